@@ -4,9 +4,42 @@
 #include <GLM/gtc/matrix_transform.hpp> // glm::translate, glm::rotate, glm::scale, glm::perspective
 #include <GLM/gtc/type_ptr.hpp> // glm::value_ptr
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <iostream>
-#define reportError(s) _ReportError(__LINE__, (s))
+#include <vector>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define SW_SIMD 1
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define MK_DISPATCH 1
+#endif
+#endif
+#if defined(__GNUC__)
+#define MK_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MK_TARGET(isa)
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#define HOT_RELOAD 1
+#endif
 
 using namespace std;
 using namespace glm;
@@ -19,11 +52,457 @@ void _ReportError(int ln, const string str)
 	printf("******************************************\n%d: %s: GLError %d: %s\n", ln, str.c_str(), err, glerr);
 }
 
+//--------------------------------ARENAS--------------------------------
+// Linear allocators for short-lived memory. An arena hands out memory from
+// big blocks by bumping an offset and never frees single allocations:
+// arenaRewind() goes back to an earlier arenaMark(), arenaReset() to the
+// start, and both keep the blocks for reuse. importArena is scratch for
+// scene import (released once the scene is built) and frameArena, one per
+// rendering thread, is reset at the start of every frame by drawScene().
+// scratchVector takes its memory from the arena of the innermost
+// structArenaScope on this thread, which rewinds it on exit, and from the
+// heap outside any scope; so the scratch must not outlive its scope.
+struct structArenaBlock { char *data; size_t size; };
+struct structArenaMark { int block; size_t used, bytes; };
+
+struct structArena
+{
+	vector<structArenaBlock> blocks;
+	size_t blockSize, used, bytes; // used: offset into blocks[block]; bytes: live bytes
+	int block;
+	long long allocs, peak;        // since the last reset
+};
+structArena importArena = { vector<structArenaBlock>(), 1 << 20, 0, 0, 0, 0, 0 };
+thread_local structArena frameArena = { vector<structArenaBlock>(), 256 << 10, 0, 0, 0, 0, 0 };
+thread_local structArena *scratchArena = NULL;
+
+void *arenaAlloc(structArena &a, size_t size, size_t align)
+{
+	uintptr_t l_base = a.blocks.empty() ? 0 : (uintptr_t)a.blocks[a.block].data;
+	size_t l_offset = ((l_base + a.used + align - 1) & ~(uintptr_t)(align - 1)) - l_base;
+	if (a.blocks.empty() || l_offset + size > a.blocks[a.block].size)
+	{
+		// On to the next block, inserting a new one if that is too small.
+		int l_next = a.blocks.empty() ? 0 : a.block + 1;
+		if (l_next == (int)a.blocks.size() || a.blocks[l_next].size < size + align)
+		{
+			structArenaBlock b = { NULL, std::max(a.blockSize, size + align) };
+			b.data = new char[b.size];
+			a.blocks.insert(a.blocks.begin() + l_next, b);
+		}
+		a.block = l_next;
+		l_base = (uintptr_t)a.blocks[l_next].data;
+		l_offset = ((l_base + align - 1) & ~(uintptr_t)(align - 1)) - l_base;
+	}
+	a.used = l_offset + size;
+	a.bytes += size;
+	a.allocs++;
+	a.peak = std::max(a.peak, (long long)a.bytes);
+	return a.blocks[a.block].data + l_offset;
+}
+
+structArenaMark arenaMark(const structArena &a)
+{
+	structArenaMark m = { a.block, a.used, a.bytes };
+	return m;
+}
+
+void arenaRewind(structArena &a, const structArenaMark &m)
+{
+	a.block = m.block;
+	a.used = m.used;
+	a.bytes = m.bytes;
+}
+
+void arenaReset(structArena &a)
+{
+	a.block = 0;
+	a.used = a.bytes = 0;
+	a.allocs = a.peak = 0;
+}
+
+// Gives the blocks back to the heap.
+void arenaRelease(structArena &a)
+{
+	for (size_t i = 0; i < a.blocks.size(); i++) { delete[] a.blocks[i].data; }
+	a.blocks.clear();
+	arenaReset(a);
+}
+
+struct structArenaScope
+{
+	structArena &arena;
+	structArena *previous;
+	structArenaMark mark;
+	structArenaScope(structArena &a) : arena(a), previous(scratchArena), mark(arenaMark(a)) { scratchArena = &a; }
+	~structArenaScope() { arenaRewind(arena, mark); scratchArena = previous; }
+};
+
+template <class T> struct structScratchAllocator
+{
+	typedef T value_type;
+	structArena *arena;
+	structScratchAllocator() : arena(scratchArena) {}
+	template <class U> structScratchAllocator(const structScratchAllocator<U> &other) : arena(other.arena) {}
+	T *allocate(size_t n) { return arena ? (T *)arenaAlloc(*arena, n * sizeof(T), alignof(T)) : (T *)::operator new(n * sizeof(T)); }
+	void deallocate(T *p, size_t) { if (!arena) ::operator delete(p); }
+};
+template <class T, class U> bool operator==(const structScratchAllocator<T> &a, const structScratchAllocator<U> &b) { return a.arena == b.arena; }
+template <class T, class U> bool operator!=(const structScratchAllocator<T> &a, const structScratchAllocator<U> &b) { return a.arena != b.arena; }
+template <class T> using scratchVector = vector<T, structScratchAllocator<T> >;
+
+#if !defined(NDEBUG) || defined(GL_TRACE)
+// Whenever GL_TRACE (defined below for debug builds) is on, every operator
+// new is counted, in total and per thread since the last gltEndFrame(). Plain
+// counters, since glTrace itself allocates when it is first touched. Memory
+// the C libraries and the GL driver get from malloc is not seen.
+struct structAllocStats { long long calls, bytes; };
+atomic<long long> heapAllocCalls(0), heapAllocBytes(0);
+thread_local structAllocStats frameAllocs = { 0, 0 };
+
+void *operator new(size_t size)
+{
+	heapAllocCalls++;
+	heapAllocBytes += size;
+	frameAllocs.calls++;
+	frameAllocs.bytes += size;
+	void *l_p = malloc(size ? size : 1);
+	if (!l_p) throw bad_alloc();
+	return l_p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+// Once inlined, GCC pairs these free() calls with the new above and warns.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+#endif
+
+//-------------------------------GL-TRACE-------------------------------
+// Instrumentation for debug builds (compiled out with NDEBUG). The GL entry
+// points the frame path uses are redefined below to wrappers that, with
+// --gl-trace, count calls per frame and keep a shadow of the bound program,
+// VAO, buffers, enabled caps and uniform values so that calls which change
+// nothing are counted as redundant. Nothing is ever skipped: the real call
+// always goes through. GL errors come from a KHR_debug callback rather than
+// glGetError polling; reportError() only records where we are.
+#ifndef NDEBUG
+#define GL_TRACE 1
+#endif
+
+#ifdef GL_TRACE
+enum { gltProgram = 0, gltVertexArray = 1, gltBind = 2, gltUniform = 3, gltUpload = 4, gltDraw = 5, gltDispatch = 6, gltCap = 7, numGltCounters = 8 };
+const char *gltCounterNames[numGltCounters] = { "program", "vao", "bind", "uniform", "upload", "draw", "dispatch", "enable" };
+const int gltNumTargets = 5;
+const GLuint gltUnknown = 0xFFFFFFFF;
+
+struct structGlTraceConfig { bool enabled; int every; string path; FILE *file; bool debugOutput; };
+structGlTraceConfig glTraceConfig = { false, 0, "", NULL, false };
+
+// Per thread, since each thread owns its own context.
+struct structGlTrace
+{
+	long long calls[numGltCounters], redundant[numGltCounters];
+	long long bufferBytes, uniformBytes;
+	int frame, debugMessages, checkpointLine;
+	const char *checkpoint;
+	GLuint program, vertexArray, buffers[gltNumTargets];
+	unordered_map<GLenum, bool> caps;
+	unordered_map<unsigned long long, vector<unsigned char> > uniforms;
+};
+thread_local structGlTrace glTrace = { {0}, {0}, 0, 0, 0, 0, 0, "start", gltUnknown, gltUnknown, { gltUnknown, gltUnknown, gltUnknown, gltUnknown, gltUnknown } };
+
+int gltTarget(GLenum target)
+{
+	switch (target)
+	{
+		case GL_ARRAY_BUFFER:          return 0;
+		case GL_ELEMENT_ARRAY_BUFFER:  return 1;
+		case GL_SHADER_STORAGE_BUFFER: return 2;
+		case GL_PIXEL_PACK_BUFFER:     return 3;
+		case GL_DRAW_INDIRECT_BUFFER:  return 4;
+	}
+	return -1;
+}
+
+void gltCount(int counter, bool redundant)
+{
+	glTrace.calls[counter]++;
+	if (redundant) glTrace.redundant[counter]++;
+}
+
+void gltUniformValue(GLint location, const void *value, size_t size)
+{
+	if (!glTraceConfig.enabled) return;
+	glTrace.uniformBytes += size;
+	if (location < 0 || glTrace.program == gltUnknown) { gltCount(gltUniform, false); return; }
+	vector<unsigned char> &l_shadow = glTrace.uniforms[((unsigned long long)glTrace.program << 32) | (unsigned int)location];
+	bool l_same = l_shadow.size() == size && !memcmp(&l_shadow[0], value, size);
+	gltCount(gltUniform, l_same);
+	if (!l_same) l_shadow.assign((const unsigned char *)value, (const unsigned char *)value + size);
+}
+
+inline void gltUseProgram(GLuint program)
+{
+	if (glTraceConfig.enabled) { gltCount(gltProgram, program == glTrace.program); glTrace.program = program; }
+	glUseProgram(program);
+}
+
+inline void gltBindVertexArray(GLuint array)
+{
+	if (glTraceConfig.enabled)
+	{
+		gltCount(gltVertexArray, array == glTrace.vertexArray);
+		if (array != glTrace.vertexArray) glTrace.buffers[1] = gltUnknown; // the element buffer is VAO state
+		glTrace.vertexArray = array;
+	}
+	glBindVertexArray(array);
+}
+
+inline void gltBindBuffer(GLenum target, GLuint buffer)
+{
+	if (glTraceConfig.enabled)
+	{
+		int t = gltTarget(target);
+		gltCount(gltBind, t >= 0 && glTrace.buffers[t] == buffer);
+		if (t >= 0) glTrace.buffers[t] = buffer;
+	}
+	glBindBuffer(target, buffer);
+}
+
+inline void gltBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	if (glTraceConfig.enabled)
+	{
+		int t = gltTarget(target);
+		gltCount(gltBind, false);
+		if (t >= 0) glTrace.buffers[t] = buffer;
+	}
+	glBindBufferBase(target, index, buffer);
+}
+
+inline void gltBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+	if (glTraceConfig.enabled) { gltCount(gltUpload, false); if (data) glTrace.bufferBytes += size; }
+	glBufferData(target, size, data, usage);
+}
+
+inline void gltBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+	if (glTraceConfig.enabled) { gltCount(gltUpload, false); glTrace.bufferBytes += size; }
+	glBufferSubData(target, offset, size, data);
+}
+
+inline void gltTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels)
+{
+	if (glTraceConfig.enabled)
+	{
+		gltCount(gltUpload, false);
+		glTrace.bufferBytes += (long long)width * height * ((format == GL_RGBA) ? 4 : (format == GL_RGB) ? 3 : 1) * ((type == GL_FLOAT) ? 4 : 1);
+	}
+	glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+}
+
+inline void gltUniform1i(GLint location, GLint v0)                { gltUniformValue(location, &v0, sizeof(v0));  glUniform1i(location, v0); }
+inline void gltUniform1ui(GLint location, GLuint v0)              { gltUniformValue(location, &v0, sizeof(v0));  glUniform1ui(location, v0); }
+inline void gltUniform2f(GLint location, GLfloat v0, GLfloat v1) { GLfloat v[2] = { v0, v1 }; gltUniformValue(location, v, sizeof(v)); glUniform2f(location, v0, v1); }
+inline void gltUniform3fv(GLint location, GLsizei count, const GLfloat *value) { gltUniformValue(location, value, sizeof(GLfloat) * 3 * count);  glUniform3fv(location, count, value); }
+inline void gltUniform4fv(GLint location, GLsizei count, const GLfloat *value) { gltUniformValue(location, value, sizeof(GLfloat) * 4 * count);  glUniform4fv(location, count, value); }
+inline void gltUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) { gltUniformValue(location, value, sizeof(GLfloat) * 16 * count);  glUniformMatrix4fv(location, count, transpose, value); }
+
+inline void gltDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+	if (glTraceConfig.enabled) gltCount(gltDraw, false);
+	glDrawElements(mode, count, type, indices);
+}
+
+inline void gltDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances)
+{
+	if (glTraceConfig.enabled) gltCount(gltDraw, false);
+	glDrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+inline void gltDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	if (glTraceConfig.enabled) gltCount(gltDraw, false);
+	glDrawArrays(mode, first, count);
+}
+
+inline void gltMultiDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride)
+{
+	if (glTraceConfig.enabled) gltCount(gltDraw, false);
+	glMultiDrawElementsIndirect(mode, type, indirect, drawcount, stride);
+}
+
+inline void gltMultiDrawElementsIndirectCountARB(GLenum mode, GLenum type, const void *indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride)
+{
+	if (glTraceConfig.enabled) gltCount(gltDraw, false);
+	glMultiDrawElementsIndirectCountARB(mode, type, indirect, drawcount, maxdrawcount, stride);
+}
+
+inline void gltDispatchCompute(GLuint x, GLuint y, GLuint z)
+{
+	if (glTraceConfig.enabled) gltCount(gltDispatch, false);
+	glDispatchCompute(x, y, z);
+}
+
+inline void gltEnable(GLenum cap)
+{
+	if (glTraceConfig.enabled)
+	{
+		unordered_map<GLenum, bool>::iterator l_it = glTrace.caps.find(cap);
+		gltCount(gltCap, l_it != glTrace.caps.end() && l_it->second);
+		glTrace.caps[cap] = true;
+	}
+	glEnable(cap);
+}
+
+inline void gltDisable(GLenum cap)
+{
+	if (glTraceConfig.enabled)
+	{
+		unordered_map<GLenum, bool>::iterator l_it = glTrace.caps.find(cap);
+		gltCount(gltCap, l_it != glTrace.caps.end() && !l_it->second);
+		glTrace.caps[cap] = false;
+	}
+	glDisable(cap);
+}
+
+void APIENTRY gltDebugCB(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *user)
+{
+	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) return;
+	glTrace.debugMessages++;
+	printf("******************************************\n%s:%d: GL %s: %s\n", glTrace.checkpoint, glTrace.checkpointLine,
+		(type == GL_DEBUG_TYPE_ERROR) ? "error" : (type == GL_DEBUG_TYPE_PERFORMANCE) ? "performance" : "message", message);
+}
+
+// Call once the context is current. Falls back to glGetError polling in
+// reportError() when KHR_debug is missing.
+void gltInit()
+{
+	glTraceConfig.debugOutput = (GLEW_VERSION_4_3 || GLEW_KHR_debug) != 0;
+	if (glTraceConfig.debugOutput)
+	{
+		glEnable(GL_DEBUG_OUTPUT);
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		glDebugMessageCallback(gltDebugCB, NULL);
+	}
+	if (glTraceConfig.enabled && !glTraceConfig.path.empty())
+	{
+		glTraceConfig.file = fopen(glTraceConfig.path.c_str(), "w");
+		if (!glTraceConfig.file) { fprintf(stderr, "could not write %s\n", glTraceConfig.path.c_str()); return; }
+		fprintf(glTraceConfig.file, "frame");
+		for (int i = 0; i < numGltCounters; i++) { fprintf(glTraceConfig.file, ",%s,%s_redundant", gltCounterNames[i], gltCounterNames[i]); }
+		fprintf(glTraceConfig.file, ",buffer_bytes,uniform_bytes,debug_messages,props,heap_allocs,heap_bytes,arena_allocs,arena_bytes\n");
+	}
+}
+
+void gltCheckpoint(int line, const char *label)
+{
+	glTrace.checkpoint = label;
+	glTrace.checkpointLine = line;
+	if (!glTraceConfig.debugOutput) _ReportError(line, label);
+}
+
+// One CSV line per frame to --gl-trace-file, and a console line every
+// --gl-trace frames; props is how many props were drawn that frame.
+void gltEndFrame(int props)
+{
+	if (!glTraceConfig.enabled) return;
+	if (glTraceConfig.file)
+	{
+		fprintf(glTraceConfig.file, "%d", glTrace.frame);
+		for (int i = 0; i < numGltCounters; i++) { fprintf(glTraceConfig.file, ",%lld,%lld", glTrace.calls[i], glTrace.redundant[i]); }
+		fprintf(glTraceConfig.file, ",%lld,%lld,%d,%d,%lld,%lld,%lld,%lld\n", glTrace.bufferBytes, glTrace.uniformBytes, glTrace.debugMessages, props,
+			frameAllocs.calls, frameAllocs.bytes, frameArena.allocs, frameArena.peak);
+	}
+	if (glTraceConfig.every > 0 && glTrace.frame % glTraceConfig.every == 0)
+	{
+		printf("GL frame %d, %d props:", glTrace.frame, props);
+		for (int i = 0; i < numGltCounters; i++)
+		{
+			if (glTrace.calls[i]) printf(" %s %lld (%lld redundant)", gltCounterNames[i], glTrace.calls[i], glTrace.redundant[i]);
+		}
+		printf(", %lld buffer bytes, %lld uniform bytes, %lld heap allocations (%lld bytes), %lld frame arena allocations (%lld bytes)\n",
+			glTrace.bufferBytes, glTrace.uniformBytes, frameAllocs.calls, frameAllocs.bytes, frameArena.allocs, frameArena.peak);
+	}
+	frameAllocs.calls = frameAllocs.bytes = 0;
+	for (int i = 0; i < numGltCounters; i++) { glTrace.calls[i] = glTrace.redundant[i] = 0; }
+	glTrace.bufferBytes = glTrace.uniformBytes = 0;
+	glTrace.debugMessages = 0;
+	glTrace.frame++;
+}
+
+void gltFinish()
+{
+	if (glTraceConfig.file) fclose(glTraceConfig.file);
+	glTraceConfig.file = NULL;
+}
+
+#undef glUseProgram
+#undef glBindVertexArray
+#undef glBindBuffer
+#undef glBindBufferBase
+#undef glBufferData
+#undef glBufferSubData
+#undef glTexSubImage2D
+#undef glUniform1i
+#undef glUniform1ui
+#undef glUniform2f
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix4fv
+#undef glDrawElements
+#undef glDrawElementsInstanced
+#undef glDrawArrays
+#undef glMultiDrawElementsIndirect
+#undef glMultiDrawElementsIndirectCountARB
+#undef glDispatchCompute
+#undef glEnable
+#undef glDisable
+#define glUseProgram                        gltUseProgram
+#define glBindVertexArray                   gltBindVertexArray
+#define glBindBuffer                        gltBindBuffer
+#define glBindBufferBase                    gltBindBufferBase
+#define glBufferData                        gltBufferData
+#define glBufferSubData                     gltBufferSubData
+#define glTexSubImage2D                     gltTexSubImage2D
+#define glUniform1i                         gltUniform1i
+#define glUniform1ui                        gltUniform1ui
+#define glUniform2f                         gltUniform2f
+#define glUniform3fv                        gltUniform3fv
+#define glUniform4fv                        gltUniform4fv
+#define glUniformMatrix4fv                  gltUniformMatrix4fv
+#define glDrawElements                      gltDrawElements
+#define glDrawElementsInstanced             gltDrawElementsInstanced
+#define glDrawArrays                        gltDrawArrays
+#define glMultiDrawElementsIndirect         gltMultiDrawElementsIndirect
+#define glMultiDrawElementsIndirectCountARB gltMultiDrawElementsIndirectCountARB
+#define glDispatchCompute                   gltDispatchCompute
+#define glEnable                            gltEnable
+#define glDisable                           gltDisable
+
+#define reportError(s) gltCheckpoint(__LINE__, (s))
+#else
+#define reportError(s) ((void)0)
+#define gltInit()
+#define gltEndFrame(props)
+#define gltFinish()
+#endif
+
 void glfwErrorCB(int error, const char* description)
 {
 	fputs(description, stderr);
 }
 
+double elapsedMs(chrono::steady_clock::time_point since)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
 GLuint initShader(const char* source, GLenum type)
 {
 	GLuint shader = glCreateShader(type);
@@ -45,7 +524,7 @@ GLuint initShader(const char* source, GLenum type)
 
 		std::cout << infoLog << std::endl;
 
-		free(infoLog);
+		delete[] infoLog;
 
 		exit(EXIT_FAILURE);
 	}
@@ -53,11 +532,16 @@ GLuint initShader(const char* source, GLenum type)
 
 }
 
-GLuint initShaders(const char* vertShaderSrc, const char *fragShaderSrc)
+GLuint initShaders(const char* vertShaderSrc, const char *fragShaderSrc, const char *geomShaderSrc = NULL, const char *tessControlSrc = NULL, const char *tessEvalSrc = NULL)
 {
 	GLuint program = glCreateProgram();
 	glAttachShader(program, initShader(vertShaderSrc, GL_VERTEX_SHADER));
 	glAttachShader(program, initShader(fragShaderSrc, GL_FRAGMENT_SHADER));
+	if (geomShaderSrc) glAttachShader(program, initShader(geomShaderSrc, GL_GEOMETRY_SHADER));
+	if (tessControlSrc) glAttachShader(program, initShader(tessControlSrc, GL_TESS_CONTROL_SHADER));
+	if (tessEvalSrc) glAttachShader(program, initShader(tessEvalSrc, GL_TESS_EVALUATION_SHADER));
+	glBindAttribLocation(program, 0, "vertexPos");
+	glBindAttribLocation(program, 1, "normalPos");
 	glLinkProgram(program);
 
 	/* link and error check */
@@ -72,7 +556,7 @@ GLuint initShaders(const char* vertShaderSrc, const char *fragShaderSrc)
 		char *infoLog = new char[logSize];
 		glGetProgramInfoLog(program, logSize, NULL, infoLog);
 		cout << infoLog << endl;
-		free(infoLog);
+		delete[] infoLog;
 		exit(EXIT_FAILURE);
 	}
 	else
@@ -83,595 +567,4564 @@ GLuint initShaders(const char* vertShaderSrc, const char *fragShaderSrc)
 	return program;
 }
 
+GLuint initComputeShader(const char* source)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, initShader(source, GL_COMPUTE_SHADER));
+	glLinkProgram(program);
+
+	GLint  linked;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		cerr << "Compute shader failed to link!\n";
+		GLint  logSize = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logSize);
+
+		char *infoLog = new char[logSize];
+		glGetProgramInfoLog(program, logSize, NULL, infoLog);
+		cout << infoLog << endl;
+		delete[] infoLog;
+		exit(EXIT_FAILURE);
+	}
+	return program;
+}
+
 struct structLight { vec4 pos; vec3 color; GLfloat intensity; };
 struct structMaterial { vec3 ambient, diffuse, specular; GLfloat shininess; };
 
+const int windowWidth = 1024, windowHeight = 1024;
 const float speed = 0.0002;
 float Cx = 0, Cy = 0, Cz = 0, ang = 0;
 int dir[] = { 0, 0,  0, 0,  0, 0,      0, 0,  0, 0,  0, 0 };
 bool phong = true;
-int camPresetMode = 0, changeCamPos = 0, numLights;
-const int maxVertices = 400, maxIndices = maxVertices*3;
+enum { backendGL = 0, backendSoftware = 1 };
+int renderBackend = backendGL;
+int camPresetMode = 0, changeCamPos = 0, numLights = 2;
+const int maxLights = 8; // lightPos[8] / lightColor[8] in the shaders
 vec3 pointOfInterest, cameraLocation, cameraUp, camPresetPos[4], POIPresetPos[4];
 mat4 Projection, View, PV;
-structLight light[2];
+structLight light[maxLights];
+vec4 lightPos[maxLights];
+vec3 lightColor[maxLights];
 structMaterial copper, silver, gold;
 
-class prop
+const char* vertexShader =
+	"#version 400\n"
+
+	"in vec3 vertexPos;"
+	"in vec3 normalPos;"
+
+	"uniform vec3 ambiComp;"
+	"uniform vec3 diffComp;"
+	"uniform vec3 specComp;"
+	"uniform vec3 constants;"
+
+	"uniform int  numLights;"
+	"uniform vec4 lightPos[8];"
+	"uniform vec3 lightColor[8];"
+
+	"uniform mat4 Model;"
+	"uniform mat4 PV;"
+
+	"uniform vec3 propColor;"
+	"out vec3 color;"
+
+	"void main ()"
+	"{"
+	"    float shinComp = constants.z;"
+	"    vec4 vertex    = Model * vec4(vertexPos, 1.0f);"
+	"    gl_Position    = PV * vertex;"
+	"    vec3 N         = normalize( vec3( Model * vec4(normalPos, 0.0f) ) );"
+	"    vec3 V         = normalize( vec3(-vertex) );"
+
+	"    vec3 ambiProd  = vec3(0.0f);"
+	"    vec3 lightProd = vec3(0.0f);"
+	"    for(int i = 0; i < numLights; i++)"
+	"    {"
+	"        vec3 L    = normalize( vec3(lightPos[i]) - vec3(vertex) * lightPos[i].w );"
+	"        ambiProd += lightColor[i];"
+	"        if(dot(N,L) > 0)"
+	"        {"
+	"            vec3 R     = normalize( reflect(-L, N) );"
+	"            lightProd += lightColor[i] * ( diffComp * max( dot(N, L), 0.0f ) + specComp * pow( max( dot(R, V), 0.0f ), shinComp ) );"
+	"        }"
+	"    }"
+
+	"    color = clamp( propColor * ( (ambiProd * ambiComp) + lightProd ), 0.0f, 1.0f );"
+	"}";
+
+const char* vertexShader0 =
+	"#version 400\n"
+	"in vec3 vertexPos;"
+	"uniform mat4 Model;"
+	"uniform mat4 PV;"
+	"uniform vec3 propColor;"
+	"out vec3 color;"
+	"void main ()"
+	"{"
+	"    gl_Position = PV * Model * vec4(vertexPos, 1.0f);"
+	"	 color = propColor; "
+	"}";
+
+const char* vertexShader1 =
+	"#version 400\n"
+
+	"in vec3 vertexPos;"
+	"in vec3 normalPos;"
+
+	"uniform mat4 Model;"
+	"uniform mat4 PV;"
+
+	"out vec3 fN;"
+	"out vec3 fP;"
+
+	"void main ()"
+	"{"
+	"    vec4 vertex = Model * vec4(vertexPos, 1.0f);"
+	"    gl_Position = PV * vertex;"
+	"    fN          = vec3( Model * vec4(normalPos, 0.0f) );"
+	"    fP          = vec3(vertex);"
+	"}";
+
+const char* fragmentShader =
+	"#version 400\n"
+	"in vec3 color;"
+	"out vec4 frag_color;"
+	"void main ()"
+	"{"
+	"    frag_color = vec4(color, 1.0);"
+	"}";
+
+const char* fragmentShader1 =
+	"#version 400\n"
+
+	"in vec3 fN;"
+	"in vec3 fP;"
+
+	"uniform vec3 ambiComp;"
+	"uniform vec3 diffComp;"
+	"uniform vec3 specComp;"
+	"uniform vec3 constants;"
+	"uniform int  numLights;"
+	"uniform vec4 lightPos[8];"
+	"uniform vec3 lightColor[8];"
+	"uniform vec3 propColor;"
+
+	"uniform bool  shadows;"
+	"uniform int   cascadeMask;"
+	"uniform mat4  cascadePV[4];"
+	"uniform vec4  cascadeSplits;"
+	"uniform vec4  cascadeTexel;"
+	"uniform vec3  shadowEye;"
+	"uniform vec3  shadowForward;"
+	"uniform sampler2DArrayShadow cascadeMap;"
+	"uniform bool  pointShadows;"
+	"uniform vec3  pointShadowPos;"
+	"uniform vec2  pointShadowRange;"
+	"uniform samplerCubeShadow pointMap;"
+
+	"out vec4 frag_color;"
+
+	// light[0] (a point light) looks up the cube map, light[1] (directional)
+	// the cascade its view depth falls in; anything outside is lit.
+	"float shadow(int i, vec3 P, vec3 N)"
+	"{"
+	"    if(i == 0 && pointShadows)"
+	"    {"
+	"        vec3  v   = P + N * 0.004f * distance(P, pointShadowPos) - pointShadowPos;"
+	"        float z   = max(max(abs(v.x), abs(v.y)), abs(v.z));"
+	"        float n   = pointShadowRange.x, f = pointShadowRange.y;"
+	"        float ref = ((f + n) / (f - n) - 2.0f * f * n / ((f - n) * z)) * 0.5f + 0.5f;"
+	"        return texture(pointMap, vec4(v, ref));"
+	"    }"
+	"    if(i != 1) return 1.0f;"
+	"    float d = dot(P - shadowEye, shadowForward);"
+	"    for(int c = 0; c < 4; c++)"
+	"    {"
+	"        if(d >= cascadeSplits[c]) continue;"
+	"        if((cascadeMask & (1 << c)) == 0) return 1.0f;"
+	"        vec4 s = cascadePV[c] * vec4(P + N * cascadeTexel[c] * 1.5f, 1.0f);"
+	"        s.xyz  = s.xyz * 0.5f + 0.5f;"
+	"        return texture(cascadeMap, vec4(s.xy, c, s.z));"
+	"    }"
+	"    return 1.0f;"
+	"}"
+
+	"void main ()"
+	"{"
+	"    float shinComp = constants.z;"
+	"    vec3 N         = normalize(fN);"
+	"    vec3 V         = normalize(-fP);"
+
+	"    vec3 ambiProd  = vec3(0.0f);"
+	"    vec3 lightProd = vec3(0.0f);"
+	"    for(int i = 0; i < numLights; i++)"
+	"    {"
+	"        vec3 L    = normalize( vec3(lightPos[i]) - fP * lightPos[i].w );"
+	"        ambiProd += lightColor[i];"
+	"        if(dot(N,L) > 0)"
+	"        {"
+	"            vec3 R     = normalize( reflect(-L, N) );"
+	"            vec3 term  = lightColor[i] * ( diffComp * max( dot(N, L), 0.0f ) + specComp * pow( max( dot(R, V), 0.0f ), shinComp ) );"
+	"            if(shadows) term *= shadow(i, fP, N);"
+	"            lightProd += term;"
+	"        }"
+	"    }"
+
+	"    frag_color = vec4(clamp( propColor * ( (ambiProd * ambiComp) + lightProd ), 0.0f, 1.0f ), 1.0f);"
+	"}";
+
+// Every prop draws with one of these programs. Programs hold their uniform
+// values, so each GL context that renders the scene gets its own set
+// (renderContext picks which); VAOs are not shared between contexts either
+// and are created per prop on first use.
+const int maxContexts = 8;
+const GLuint vertexPosAttrib = 0, normalPosAttrib = 1;
+enum { shaderOutline = 0, shaderGouraud = 1, shaderPhong = 2, numShaders = 3 };
+
+// Texture units of the shadow maps in the Phong programs.
+const int shadowCascadeUnit = 1, shadowCubeUnit = 2;
+
+struct structShader
 {
-	public:
-		int numIndices, index[maxIndices], outline;
-		vec3 vertex[maxVertices], normal[maxVertices], propColor, center;
-		GLuint vertexPos[2], normalPos[2], VAO, VBO, IBO, shaderProg[2], MUniformLoc[2], PVUniformLoc[2];
-		GLuint propColorLoc[2], ConstsLoc[2], L0PosLoc[2], L0ColorLoc[2], L1PosLoc[2], L1ColorLoc[2], ambiCompLoc[2], diffCompLoc[2], specCompLoc[2];
-		mat4 Model;
-		structMaterial material;
-		void init(int, int, vec3, vec3, mat4, structMaterial, bool);
-		void render();
+	GLuint prog;
+	GLint MUniformLoc, PVUniformLoc, propColorLoc, ConstsLoc, numLightsLoc, lightPosLoc, lightColorLoc, ambiCompLoc, diffCompLoc, specCompLoc;
+	GLint shadowsLoc, cascadeMaskLoc, cascadePVLoc, cascadeSplitsLoc, cascadeTexelLoc, shadowEyeLoc, shadowForwardLoc, pointShadowsLoc, pointShadowPosLoc, pointShadowRangeLoc;
 };
 
-void prop::init(int l_numVertices, int l_numIndices, vec3 l_color, vec3 l_center, mat4 l_Model, structMaterial l_material, bool l_outline)
+structShader shaders[maxContexts][numShaders];
+thread_local int renderContext = 0;
+
+// hasPV is false for the split-view programs, which take PV from a buffer.
+void initShaderLocations(structShader &s, bool outline, bool hasPV)
 {
-	int l_triIndex, l_triVertexIndex, l_Bindex, l_Cindex, j;
-	int l_sizeOfVertices = sizeof(vec3)*l_numVertices;
-	int l_sizeOfM_Shin = sizeof(GLfloat)*l_numVertices;
-	vec3 l_AB, l_AC;
-	numIndices = l_numIndices;
-	propColor = l_color;
-	center = l_center;
-	outline = l_outline;
-	Model = l_Model;
-	material = l_material;
+	s.MUniformLoc = glGetUniformLocation(s.prog, "Model");
+	if (s.MUniformLoc < 0) cerr << "couldn't find Model in shader\n";
+
+	s.PVUniformLoc = glGetUniformLocation(s.prog, "PV");
+	if (s.PVUniformLoc < 0 && hasPV) cerr << "couldn't find PV in shader\n";
+
+	s.propColorLoc = glGetUniformLocation(s.prog, "propColor");
+	if (s.propColorLoc < 0) cerr << "couldn't find propColor in shader\n";
+
+	if (outline) return;
+
+	s.ambiCompLoc = glGetUniformLocation(s.prog, "ambiComp");
+	if (s.ambiCompLoc < 0) cerr << "couldn't find ambiComp in shader\n";
+
+	s.diffCompLoc = glGetUniformLocation(s.prog, "diffComp");
+	if (s.diffCompLoc < 0) cerr << "couldn't find diffComp in shader\n";
+
+	s.specCompLoc = glGetUniformLocation(s.prog, "specComp");
+	if (s.specCompLoc < 0) cerr << "couldn't find specComp in shader\n";
+
+	s.ConstsLoc = glGetUniformLocation(s.prog, "constants");
+	if (s.ConstsLoc < 0) cerr << "couldn't find constants in shader\n";
+
+	s.numLightsLoc = glGetUniformLocation(s.prog, "numLights");
+	if (s.numLightsLoc < 0) cerr << "couldn't find numLights in shader\n";
+
+	s.lightPosLoc = glGetUniformLocation(s.prog, "lightPos");
+	if (s.lightPosLoc < 0) cerr << "couldn't find lightPos in shader\n";
+
+	s.lightColorLoc = glGetUniformLocation(s.prog, "lightColor");
+	if (s.lightColorLoc < 0) cerr << "couldn't find lightColor in shader\n";
+
+	// Only the Phong programs take shadows. Their two samplers always get
+	// units of their own, since samplers of different types may not share
+	// one even when the shader never reads them.
+	s.shadowsLoc          = glGetUniformLocation(s.prog, "shadows");
+	s.cascadeMaskLoc      = glGetUniformLocation(s.prog, "cascadeMask");
+	s.cascadePVLoc        = glGetUniformLocation(s.prog, "cascadePV");
+	s.cascadeSplitsLoc    = glGetUniformLocation(s.prog, "cascadeSplits");
+	s.cascadeTexelLoc     = glGetUniformLocation(s.prog, "cascadeTexel");
+	s.shadowEyeLoc        = glGetUniformLocation(s.prog, "shadowEye");
+	s.shadowForwardLoc    = glGetUniformLocation(s.prog, "shadowForward");
+	s.pointShadowsLoc     = glGetUniformLocation(s.prog, "pointShadows");
+	s.pointShadowPosLoc   = glGetUniformLocation(s.prog, "pointShadowPos");
+	s.pointShadowRangeLoc = glGetUniformLocation(s.prog, "pointShadowRange");
+	GLint l_cascadeMap = glGetUniformLocation(s.prog, "cascadeMap"), l_pointMap = glGetUniformLocation(s.prog, "pointMap");
+	if (l_cascadeMap >= 0) glProgramUniform1i(s.prog, l_cascadeMap, shadowCascadeUnit);
+	if (l_pointMap >= 0)   glProgramUniform1i(s.prog, l_pointMap, shadowCubeUnit);
+}
+
+void initContextShaders()
+{
+	const char *l_vert[numShaders] = { vertexShader0,  vertexShader,   vertexShader1   };
+	const char *l_frag[numShaders] = { fragmentShader, fragmentShader, fragmentShader1 };
 
-	// Calculating NORMALS
-	if (l_outline == false)
+	for (int i = 0; i < numShaders; i++)
 	{
-		//cout << "===========================================================================" << endl;
-		for (int i = 0; i < l_numVertices; i++)
-		{
-			normal[i] = vec3(0.0f);
-			//cout << "------------------------------------\nVertex = " << i << endl;
-			for (int j = 0; j < l_numIndices; j++)
-			{
-				if (index[j] == i)
-				{
-					l_triIndex = j / 3;
-					l_triVertexIndex = j % 3;
-					//cout << "Found Vertex in triangle = " << l_triIndex << endl;
-					//cout << "Place = " << l_triVertexIndex << endl;
-					if (l_triVertexIndex == 0) { l_Bindex = index[j + 1]; l_Cindex = index[j + 2]; j = j + 2; }
-					else if (l_triVertexIndex == 1) { l_Bindex = index[j + 1]; l_Cindex = index[j - 1]; j++; }
-					else                            { l_Bindex = index[j - 2]; l_Cindex = index[j - 1]; }
-					//cout << "The other two vertices in the triangle are = " << l_Bindex << ", " << l_Cindex << endl;
-					l_AB = vertex[l_Bindex] - vertex[i];
-					l_AC = vertex[l_Cindex] - vertex[i];
-					//cout << "Normal before calculation = " << normal[i].x << ", " << normal[i].y << ", " << normal[i].z << endl;
-					normal[i] = normalize(normal[i] + normalize(cross(l_AB, l_AC)));
-					//cout << "Normal after calculation = " << normal[i].x << ", " << normal[i].y << ", " << normal[i].z << "\n- - - - - - - - - - - - - - - - - - " << endl;
-				}
-			}
-		}
+		structShader &s = shaders[renderContext][i];
+		s.prog = initShaders(l_vert[i], l_frag[i]);
+		glUseProgram(s.prog);
+		initShaderLocations(s, i == shaderOutline, true);
 	}
+}
 
-	// VAO VBO IBO
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
+// Material and light uniforms of the Gouraud and Phong programs.
+void setLightingUniforms(const structShader &s, const structMaterial &m)
+{
+	glUniform3fv(s.ambiCompLoc, 1, value_ptr(m.ambient));
+	glUniform3fv(s.diffCompLoc, 1, value_ptr(m.diffuse));
+	glUniform3fv(s.specCompLoc, 1, value_ptr(m.specular));
+	glUniform1i(s.numLightsLoc, numLights);
+	glUniform4fv(s.lightPosLoc, numLights, value_ptr(lightPos[0]));
+	glUniform3fv(s.lightColorLoc, numLights, value_ptr(lightColor[0]));
+	glUniform3fv(s.ConstsLoc, 1, value_ptr(vec3(0.0f, 0.0f, m.shininess)));
+}
 
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, l_sizeOfVertices * 2, NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, l_sizeOfVertices, vertex);
-	if (l_outline == false)  { glBufferSubData(GL_ARRAY_BUFFER, l_sizeOfVertices, l_sizeOfVertices, normal); }
+//------------------------------MULTI-VIEW------------------------------
+// Split view: numViews cameras (the presets) rendered side by side into one
+// framebuffer in a single pass. Each view gets a viewport from the viewport
+// array and a PV matrix in the Views uniform buffer; every prop is drawn
+// once, instanced per view, and the vertex shader sends instance i to
+// viewport i (ARB_shader_viewport_layer_array). Without that extension, or
+// with --split-view-gs, a geometry shader with one invocation per view does
+// the routing instead. The programs are the regular ones with PV and main()
+// redirected by macros, so the shading is the same as N separate passes.
+const int maxViews = 16; // viewPV[16] in the shaders
+
+struct structMultiView
+{
+	bool enabled, active, supported, instanced, forceGeometry;
+	int numViews, builtViews;
+	mat4 PV[maxViews];
+	GLuint UBO;
+	structShader shaders[numShaders];
+};
+structMultiView multiView = { false, false, false, true, false, 4, 0 };
 
-	glGenBuffers(1, &IBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*l_numIndices, index, GL_STATIC_DRAW);
-
-	const char* vertexShader =
-		"#version 400\n"
-
-		"in vec3 vertexPos;"
-		"in vec3 normalPos;"
-
-		"uniform vec3 ambiComp;"
-		"uniform vec3 diffComp;"
-		"uniform vec3 specComp;"
-		"uniform vec3 constants;"
-
-		"uniform vec4 light0pos;"
-		"uniform vec3 light0color;"
-		"uniform vec4 light1pos;"
-		"uniform vec3 light1color;"
-
-		"uniform mat4 Model;"
-		"uniform mat4 PV;"
-
-		"uniform vec3 propColor;"
-		"out vec3 color;"
-
-		"void main ()"
-		"{"
-		"    float shinComp = constants.z;"
-		"    vec4 vertex    = Model * vec4(vertexPos, 1.0f);"
-		"    gl_Position    = PV * vertex;"
-		"    vec3 L0        = normalize( vec3(light0pos - vertex) );"
-		"    vec3 L1        = normalize( vec3(light1pos) );"
-		"    vec3 N         = normalize( vec3( Model * vec4(normalPos, 0.0f) ) );"
-
-		"    vec3 diffProd0 = vec3(0.0f);"
-		"    vec3 specProd0 = vec3(0.0f);"
-		"    if(dot(N,L0) > 0)"
-		"    {"
-		"        diffProd0 = diffComp * max( dot(N, L0), 0.0f );"
-		"        vec3 R0   = normalize( reflect(-L0, N) );"
-		"        vec3 V    = normalize( vec3(-vertex) );"
-		"        specProd0 = specComp * pow( max( dot(R0, V), 0.0f ), shinComp );"
-		"    }"
-
-		"    vec3 diffProd1 = vec3(0.0f);"
-		"    vec3 specProd1 = vec3(0.0f);"
-		"    if(dot(N,L1) > 0)"
-		"    {"
-		"        diffProd1 = diffComp * max( dot(N, L1), 0.0f );"
-		"        vec3 R1   = normalize( reflect(-L1, N) );"
-		"        vec3 V    = normalize( vec3(-vertex) );"
-		"        specProd1 = specComp * pow( max( dot(R1, V), 0.0f ), shinComp );"
-		"    }"
-
-		"    color = clamp( (   propColor * ( ((light0color + light1color) * ambiComp) + (light0color * (diffProd0 + specProd0)) + (light1color * (diffProd1 + specProd1)) )   ), 0.0f, 1.0f );"
-		"}";
-
-	const char* vertexShader0 =
-		"#version 400\n"
-		"in vec3 vertexPos;"
-		"uniform mat4 Model;"
-		"uniform mat4 PV;"
-		"uniform vec3 propColor;"
-		"out vec3 color;"
-		"void main ()"
-		"{"
-		"    gl_Position = PV * Model * vec4(vertexPos, 1.0f);"
-		"	 color = propColor; "
-		"}";
-
-	const char* vertexShader1 =
-		"#version 400\n"
-
-		"in vec3 vertexPos;"
-		"in vec3 normalPos;"
-
-		"uniform vec4 light0pos;"
-		"uniform vec4 light1pos;"
-		"uniform mat4 Model;"
-		"uniform mat4 PV;"
-
-		"out vec3 fN;"
-		"out vec3 fL0;"
-		"out vec3 fL1;"
-		"out vec3 fV;"
-
-		"void main ()"
-		"{"
-		"    vec4 vertex = Model * vec4(vertexPos, 1.0f);"
-		"    gl_Position = PV * vertex;"
-		"    fL0         = vec3(light0pos - vertex);"
-		"    fL1         = vec3(light1pos);"
-		"    fN          = vec3( Model * vec4(normalPos, 0.0f) );"
-		"    fV          = vec3(-vertex);"
-		"}";
+void drawProps(const mat4 &l_PV);
 
-	/*mat4 l_View = lookAt(vec3(0.0f, 0.0f, 1.0f), vec3(0.0f), vec3(1.0f, 0.0f, 0.0f));
-	cout << "vertex[16] = " << vertex[16].x << ", " << vertex[16].y << ", " << vertex[16].z << endl;
-	vec3 ver = vec3(l_View * l_Model * vec4(vertex[16], 1.0f));
-	cout << "ver        = " << ver.x << ", " << ver.y << ", " << ver.z << endl;
-	cout << "normal[16] = " << normal[16].x << ", " << normal[16].y << ", " << normal[16].z << endl;
-	vec3 N = normalize(vec3(l_View * l_Model * vec4(normal[16], 0.0f)));
-	cout << "N          = " << N.x << ", " << N.y << ", " << N.z << endl;
-	vec3 lightPos = vec3(1.0f, 1.0f, 1.0f);
-	cout << "lightPos   = " << lightPos.x << ", " << lightPos.y << ", " << lightPos.z << endl;
-	vec3 L = vec3(l_View * vec4(lightPos, 1.0f));
-	cout << "L          = " << L.x << ", " << L.y << ", " << L.z << endl;
-	L = normalize(L - ver);
-	cout << "L-ver      = " << L.x << ", " << L.y << ", " << L.z << endl;
-	cout << "ambiComp   = " << material.ambient.x << ", " << material.ambient.y << ", " << material.ambient.z << endl;
-	vec3 ambiProd       = l_Ka * material.ambient;
-	cout << "ambiProd   = " << ambiProd.x << ", " << ambiProd.y << ", " << ambiProd.z << endl;
-	cout << "diffComp   = " << material.diffuse.x << ", " << material.diffuse.y << ", " << material.diffuse.z << endl;
-	vec3 lightColor     = vec3(1.0f);
-	vec3 diffProd       = l_Ka * material.diffuse * lightColor;
-	cout << "diffProd   = " << diffProd.x << ", " << diffProd.y << ", " << diffProd.z << endl;
-	float dotProd       = max(dot(N, L), 0.0f);
-	cout << "dot(N, L)  = " << dotProd << endl;
-	diffProd            = diffProd * dotProd;
-	cout << "diffProd   = " << diffProd.x << ", " << diffProd.y << ", " << diffProd.z << endl;
-	/*cout << "specComp   = " << material.specular.x << ", " << material.specular.y << ", " << material.specular.z << endl;
-	vec3 specProd       = l_Ks * material.specular * lightColor;
-	cout << "specProd   = " << specProd.x << ", " << specProd.y << ", " << specProd.z << endl;
-	cout << "shininess  = " << material.shininess << endl;
-	dotProd             = dot(-L, N);
-	cout << "dot(-L, N) = " << dotProd << endl;*/
-	/*vec3 finalColor = clamp(propColor * (ambiProd + diffProd), 0.0f, 1.0f);
-	cout << "color      = " << finalColor.x << ", " << finalColor.y << ", " << finalColor.z << endl;*/
+// Source with its #version line and PV uniform stripped, behind header.
+string multiViewSource(const char *source, const char *header)
+{
+	string l_src = source;
+	l_src.erase(0, l_src.find('\n') + 1);
+	size_t l_pv = l_src.find("uniform mat4 PV;");
+	if (l_pv != string::npos) l_src.erase(l_pv, strlen("uniform mat4 PV;"));
+	return header + l_src;
+}
 
-	const char* fragmentShader =
-		"#version 400\n"
-		"in vec3 color;"
-		"out vec4 frag_color;"
-		"void main ()"
-		"{"
-		"    frag_color = vec4(color, 1.0);"
-		"}";
-
-	const char* fragmentShader1 =
-		"#version 400\n"
-
-		"in vec3 fN;"
-		"in vec3 fL0;"
-		"in vec3 fL1;"
-		"in vec3 fV;"
-
-		"uniform vec3 ambiComp;"
-		"uniform vec3 diffComp;"
-		"uniform vec3 specComp;"
-		"uniform vec3 constants;"
-		"uniform vec3 light0color;"
-		"uniform vec3 light1color;"
-		"uniform vec3 propColor;"
-
-		"out vec4 frag_color;"
-
-		"void main ()"
-		"{"
-		"    float shinComp = constants.z;"
-		"    vec3 N         = normalize(fN);"
-		"    vec3 L0        = normalize(fL0);"
-		"    vec3 L1        = normalize(fL1);"
-
-		"    vec3 diffProd0 = vec3(0.0f);"
-		"    vec3 specProd0 = vec3(0.0f);"
-		"    if(dot(N,L0) > 0)"
-		"    {"
-		"        vec3 V    = normalize(fV);"
-		"        vec3 R0   = normalize( reflect(-L0, N) );"
-		"        diffProd0 = diffComp * max( dot(N, L0), 0.0f );"
-		"        specProd0 = specComp * pow( max( dot(R0, V), 0.0f ), shinComp );"
-		"    }"
-
-		"    vec3 diffProd1 = vec3(0.0f);"
-		"    vec3 specProd1 = vec3(0.0f);"
-		"    if(dot(N,L1) > 0)"
-		"    {"
-		"        vec3 V    = normalize(fV);"
-		"        vec3 R1   = normalize( reflect(-L1, N) );"
-		"        diffProd1 = diffComp * max( dot(N, L1), 0.0f );"
-		"        specProd1 = specComp * pow( max( dot(R1, V), 0.0f ), shinComp );"
-		"    }"
-
-		"    frag_color = vec4(clamp( (   propColor * ( ((light0color + light1color) * ambiComp) + (light0color * (diffProd0 + specProd0)) + (light1color * (diffProd1 + specProd1)) )   ), 0.0f, 1.0f ), 1.0f);"
-		"}";
-
-	if (l_outline == true)
-	{
-		shaderProg[0] = initShaders(vertexShader0, fragmentShader);
-		j = 1;
+string multiViewGeometry(bool lines, bool phong, int views)
+{
+	char l_head[256];
+	snprintf(l_head, sizeof(l_head), "#version 430\nlayout(%s, invocations = %d) in;\nlayout(%s, max_vertices = %d) out;\n",
+		lines ? "lines" : "triangles", views, lines ? "line_strip" : "triangle_strip", lines ? 2 : 3);
+	string l_src = l_head;
+	l_src += "layout(std140, binding = 1) uniform Views { mat4 viewPV[16]; };";
+	l_src += phong ? "in vec3 vs_fN[]; in vec3 vs_fP[]; out vec3 fN; out vec3 fP;" : "in vec3 vs_color[]; out vec3 color;";
+	l_src += "void main ()"
+	         "{"
+	         "    for (int i = 0; i < gl_in.length(); i++)"
+	         "    {"
+	         "        gl_Position = viewPV[gl_InvocationID] * gl_in[i].gl_Position;"
+	         "        gl_ViewportIndex = gl_InvocationID;";
+	l_src += phong ? "        fN = vs_fN[i]; fP = vs_fP[i];" : "        color = vs_color[i];";
+	l_src += "        EmitVertex();"
+	         "    }"
+	         "    EndPrimitive();"
+	         "}";
+	return l_src;
+}
+
+bool initMultiView()
+{
+	multiView.supported = (GLEW_VERSION_4_3 || GLEW_ARB_viewport_array) != 0;
+	if (!multiView.supported)
+	{
+		fprintf(stderr, "split view needs viewport arrays; drawing the views one at a time\n");
+		return false;
 	}
-	else
+	multiView.numViews = glm::clamp(multiView.numViews, 1, maxViews);
+	multiView.instanced = GLEW_ARB_shader_viewport_layer_array && !multiView.forceGeometry;
+
+	const char *l_instancedHeader =
+		"#version 430\n"
+		"#extension GL_ARB_shader_viewport_layer_array : require\n"
+		"layout(std140, binding = 1) uniform Views { mat4 viewPV[16]; };\n"
+		"#define PV viewPV[gl_InstanceID]\n"
+		"#define main viewMain\n";
+	const char *l_geometryHeader =
+		"#version 430\n"
+		"#define PV mat4(1.0)\n"
+		"#define color vs_color\n"
+		"#define fN vs_fN\n"
+		"#define fP vs_fP\n";
+	const char *l_vert[numShaders] = { vertexShader0,  vertexShader,   vertexShader1   };
+	const char *l_frag[numShaders] = { fragmentShader, fragmentShader, fragmentShader1 };
+
+	for (int i = 0; i < numShaders; i++)
 	{
-		shaderProg[0] = initShaders(vertexShader,  fragmentShader);
-		shaderProg[1] = initShaders(vertexShader1, fragmentShader1);
-		j = 2;
+		structShader &s = multiView.shaders[i];
+		if (s.prog) glDeleteProgram(s.prog);
+		if (multiView.instanced)
+		{
+			string l_vs = multiViewSource(l_vert[i], l_instancedHeader) + "\n#undef main\nvoid main () { viewMain(); gl_ViewportIndex = gl_InstanceID; }";
+			s.prog = initShaders(l_vs.c_str(), l_frag[i]);
+		}
+		else
+		{
+			string l_vs = multiViewSource(l_vert[i], l_geometryHeader);
+			string l_gs = multiViewGeometry(i == shaderOutline, i == shaderPhong, multiView.numViews);
+			s.prog = initShaders(l_vs.c_str(), l_frag[i], l_gs.c_str());
+		}
+		initShaderLocations(s, i == shaderOutline, false);
 	}
 
-	for (int i = 0; i < j; i++)
+	if (multiView.UBO == 0)
 	{
-		glUseProgram(shaderProg[i]);
+		glGenBuffers(1, &multiView.UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, multiView.UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(mat4) * maxViews, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	multiView.builtViews = multiView.numViews;
+	return true;
+}
 
-		vertexPos[i] = glGetAttribLocation(shaderProg[i], "vertexPos");
-		if (vertexPos[i] < 0) cerr << "couldn't find vertexPos in shader\n";
-		glEnableVertexAttribArray(vertexPos[i]);
-		glVertexAttribPointer(vertexPos[i], 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+// prop::render()'s draw: once per view when instancing does the routing.
+void drawPropElements(GLenum mode, GLsizei count)
+{
+	if (multiView.active && multiView.instanced) glDrawElementsInstanced(mode, count, GL_UNSIGNED_INT, 0, multiView.numViews);
+	else glDrawElements(mode, count, GL_UNSIGNED_INT, 0);
+}
 
-		MUniformLoc[i] = glGetUniformLocation(shaderProg[i], "Model");
-		if (MUniformLoc[i] < 0) cerr << "couldn't find Model in shader\n";
+// Tiles the current viewport into a grid and points view i at preset i % 4,
+// turned about its point of interest for views past the fourth. Each view's
+// projection is Projection with the aspect ratio of its tile.
+void splitViewLayout(const GLint *viewport, vec4 *rects)
+{
+	int n = multiView.numViews;
+	int l_cols = (int)ceil(sqrt((float)n)), l_rows = (n + l_cols - 1) / l_cols;
+	int l_w = viewport[2] / l_cols, l_h = viewport[3] / l_rows;
+	for (int i = 0; i < n; i++)
+	{
+		rects[i] = vec4((float)(viewport[0] + (i % l_cols) * l_w), (float)(viewport[1] + (l_rows - 1 - i / l_cols) * l_h), (float)l_w, (float)l_h);
 
-		PVUniformLoc[i] = glGetUniformLocation(shaderProg[i], "PV");
-		if (PVUniformLoc[i] < 0) cerr << "couldn't find PV in shader\n";
+		mat4 l_projection = Projection;
+		l_projection[0][0] = Projection[1][1] * l_h / l_w;
+		float l_turn = (float)(i / 4) * 6.2831853f / ((n + 3) / 4);
+		vec3 l_eye = POIPresetPos[i % 4] + vec3(rotate(mat4(1.0f), l_turn, vec3(0.0f, 0.0f, 1.0f)) * vec4(camPresetPos[i % 4] - POIPresetPos[i % 4], 0.0f));
+		multiView.PV[i] = l_projection * lookAt(l_eye, POIPresetPos[i % 4], cameraUp);
+	}
+}
 
-		propColorLoc[i] = glGetUniformLocation(shaderProg[i], "propColor");
-		if (propColorLoc[i] < 0) cerr << "couldn't find propColor in shader\n";
+// All views in one drawProps() call, or one call per view (singlePass false,
+// or no viewport arrays); the split-view bench compares the two.
+void drawSplitView(bool singlePass)
+{
+	GLint l_viewport[4];
+	vec4 l_rects[maxViews];
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	splitViewLayout(l_viewport, l_rects);
 
-		if (l_outline == false)
+	if (singlePass && (multiView.builtViews == multiView.numViews || initMultiView()) && multiView.supported)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, multiView.UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(mat4) * multiView.numViews, &multiView.PV[0]);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 1, multiView.UBO);
+		for (int i = 0; i < multiView.numViews; i++) { glViewportIndexedf(i, l_rects[i].x, l_rects[i].y, l_rects[i].z, l_rects[i].w); }
+
+		multiView.active = true;
+		drawProps(multiView.PV[0]);
+		multiView.active = false;
+	}
+	else
+	{
+		for (int i = 0; i < multiView.numViews; i++)
 		{
-			normalPos[i] = glGetAttribLocation(shaderProg[i], "normalPos");
-			if (normalPos[i] < 0) cerr << "couldn't find normalPos in shader\n";
-			glEnableVertexAttribArray(normalPos[i]);
-			glVertexAttribPointer(normalPos[i], 3, GL_FLOAT, GL_FALSE, 0, (void *)l_sizeOfVertices);
-
-			ambiCompLoc[i] = glGetUniformLocation(shaderProg[i], "ambiComp");
-			if (ambiCompLoc[i] < 0) cerr << "couldn't find ambiComp in shader\n";
-
-			diffCompLoc[i] = glGetUniformLocation(shaderProg[i], "diffComp");
-			if (diffCompLoc[i] < 0) cerr << "couldn't find diffComp in shader\n";
-
-			specCompLoc[i] = glGetUniformLocation(shaderProg[i], "specComp");
-			if (specCompLoc[i] < 0) cerr << "couldn't find specComp in shader\n";
-
-			ConstsLoc[i] = glGetUniformLocation(shaderProg[i], "constants");
-			if (ConstsLoc[i] < 0) cerr << "couldn't find constants in shader\n";
-
-			L0PosLoc[i] = glGetUniformLocation(shaderProg[i], "light0pos");
-			if (L0PosLoc[i] < 0) cerr << "couldn't find light0pos in shader\n";
-
-			L0ColorLoc[i] = glGetUniformLocation(shaderProg[i], "light0color");
-			if (L0ColorLoc[i] < 0) cerr << "couldn't find light0color in shader\n";
-
-			L1PosLoc[i] = glGetUniformLocation(shaderProg[i], "light1pos");
-			if (L1PosLoc[i] < 0) cerr << "couldn't find light1pos in shader\n";
-
-			L1ColorLoc[i] = glGetUniformLocation(shaderProg[i], "light1color");
-			if (L1ColorLoc[i] < 0) cerr << "couldn't find light1color in shader\n";
+			glViewport((GLint)l_rects[i].x, (GLint)l_rects[i].y, (GLsizei)l_rects[i].z, (GLsizei)l_rects[i].w);
+			drawProps(multiView.PV[i]);
 		}
 	}
+	glViewport(l_viewport[0], l_viewport[1], l_viewport[2], l_viewport[3]);
 }
 
-void prop::render()
+//-----------------------------MESH-KERNELS-----------------------------
+// Bake-time vertex processing on SoA float streams (separate x, y, z
+// arrays): affine transform, bounds, face normals, normalization and 16-bit
+// quantization. Each kernel exists for scalar, SSE2, AVX2+FMA and AVX-512;
+// initMeshKernels() picks the widest the CPU supports and meshKernels
+// points at that set. Affine matrices are 3x4 row-major (mkMatrix()).
+// The SIMD versions do the bulk and hand the remainder to the scalar ones.
+struct structMeshKernels
 {
-	int i;
-	glBindVertexArray(VAO);
-	if (outline == true || phong == false)
-		i = 0;
-	else
-		i = 1;
-	glUseProgram(shaderProg[i]);
+	const char *name;
+	void (*affine)(const float *m, const float *x, const float *y, const float *z, float *ox, float *oy, float *oz, int n);
+	void (*bounds)(const float *x, const float *y, const float *z, int n, float *mn, float *mx);
+	void (*faceNormals)(const float *x, const float *y, const float *z, const int *index, int numTris, float *nx, float *ny, float *nz);
+	void (*normalize)(float *x, float *y, float *z, int n);
+	void (*quantize)(const float *x, const float *y, const float *z, int n, const float *mn, const float *mx, unsigned short *qx, unsigned short *qy, unsigned short *qz);
+};
 
-	glUniformMatrix4fv(MUniformLoc[i], 1, GL_FALSE, value_ptr(Model));
-	glUniformMatrix4fv(PVUniformLoc[i], 1, GL_FALSE, value_ptr(PV));
-	glUniform3fv(propColorLoc[i], 1, value_ptr(propColor));
+struct structSoA { scratchVector<float> x, y, z; };
 
-	if (outline == true)
-		glDrawElements(GL_LINE_LOOP, numIndices, GL_UNSIGNED_INT, 0);
-	else
+void mkMatrix(const mat4 &M, float w, float *m)
+{
+	for (int r = 0; r < 3; r++)
 	{
-		glUniform3fv(ambiCompLoc[i], 1, value_ptr(material.ambient));
-		glUniform3fv(diffCompLoc[i], 1, value_ptr(material.diffuse));
-		glUniform3fv(specCompLoc[i], 1, value_ptr(material.specular));
-		glUniform4fv(L0PosLoc[i], 1, value_ptr(light[0].pos));
-		glUniform3fv(L0ColorLoc[i], 1, value_ptr(light[0].intensity * light[0].color));
-		glUniform4fv(L1PosLoc[i], 1, value_ptr(light[1].pos));
-		glUniform3fv(L1ColorLoc[i], 1, value_ptr(light[1].intensity * light[1].color));
-		glUniform3fv(ConstsLoc[i], 1, value_ptr(vec3(0.0f, 0.0f, material.shininess)));
-
-		glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
+		m[r * 4 + 0] = M[0][r];  m[r * 4 + 1] = M[1][r];  m[r * 4 + 2] = M[2][r];  m[r * 4 + 3] = M[3][r] * w;
 	}
 }
 
-prop island, ground, cube, ecdcA, ecdcB, bayhall;
-
-void initialize()
+void mkToSoA(const vec3 *v, int n, structSoA &s)
 {
-	//-----------------------------MATERIALS-------------------------------
+	s.x.resize(n);  s.y.resize(n);  s.z.resize(n);
+	for (int i = 0; i < n; i++) { s.x[i] = v[i].x;  s.y[i] = v[i].y;  s.z[i] = v[i].z; }
+}
 
-	// COPPER
-	copper.ambient   = vec3(0.191250f, 0.073500f, 0.022500f);
-	copper.diffuse   = vec3(0.703800f, 0.270480f, 0.082800f);
-	copper.specular  = vec3(0.256777f, 0.137622f, 0.086014f);
-	copper.shininess = 12.8;
+float mkQuantScale(float mn, float mx) { return (mx > mn) ? 65535.0f / (mx - mn) : 0.0f; }
 
-	// SILVER
-	silver.ambient   = vec3(0.192250f, 0.192250f, 0.192250f);
-	silver.diffuse   = vec3(0.507540f, 0.507540f, 0.507540f);
-	silver.specular  = vec3(0.508273f, 0.508273f, 0.508273f);
-	silver.shininess = 51.2;
+void mkAffineScalar(const float *m, const float *x, const float *y, const float *z, float *ox, float *oy, float *oz, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float l_x = x[i], l_y = y[i], l_z = z[i];
+		ox[i] = m[0] * l_x + m[1] * l_y + m[2]  * l_z + m[3];
+		oy[i] = m[4] * l_x + m[5] * l_y + m[6]  * l_z + m[7];
+		oz[i] = m[8] * l_x + m[9] * l_y + m[10] * l_z + m[11];
+	}
+}
 
-	// GOLD
-	gold.ambient   = vec3(0.247250f, 0.199500f, 0.074500f);
-	gold.diffuse   = vec3(0.751640f, 0.606480f, 0.226480f);
-	gold.specular  = vec3(0.628281f, 0.555802f, 0.366065f);
-	gold.shininess = 51.2;
-	
-	//------------------------------ISLAND---------------------------------
-	vec3 islandVertex[] =
+void mkBoundsScalar(const float *x, const float *y, const float *z, int n, float *mn, float *mx)
+{
+	for (int i = 0; i < n; i++)
 	{
-		vec3(1.03208f, 0.86614f, 0.0f), /*1811376580*/		vec3(1.39635f, 1.87327f, 0.0f), /*242358198	*/
-		vec3(1.40699f, 1.89816f, 0.0f), /*242358207 */	    vec3(1.42827f, 1.94451f, 0.0f), /*242358204	*/
-		vec3(1.50805f, 1.93163f, 0.0f), /*242358189 */	    vec3(1.50945f, 1.94805f, 0.0f), /*1837961149*/
-		vec3(1.47155f, 1.95470f, 0.0f), /*948505916 */	    vec3(1.47585f, 1.97181f, 0.0f), /*948505923	*/
-		vec3(1.48250f, 1.99112f, 0.0f), /*948505927 */	    vec3(1.49959f, 2.01151f, 0.0f), /*948505931	*/
-		vec3(1.49200f, 2.04477f, 0.0f), /*948505934 */	    vec3(1.49959f, 2.07159f, 0.0f), /*948505937	*/
-		vec3(1.52429f, 2.11879f, 0.0f), /*948505941 */	    vec3(1.53474f, 2.15098f, 0.0f), /*948505946	*/
-		vec3(1.54993f, 2.19282f, 0.0f), /*948505952 */	    vec3(1.57463f, 2.21857f, 0.0f), /*948505960	*/
-		vec3(1.60787f, 2.22286f, 0.0f), /*948505968 */	    vec3(1.60312f, 2.24969f, 0.0f), /*948505977	*/
-		vec3(1.61737f, 2.28080f, 0.0f), /*948505998 */	    vec3(1.62912f, 2.25918f, 0.0f), /*1837961148*/
-		vec3(1.63570f, 2.27410f, 0.0f), /*242358176 */	    vec3(1.58099f, 2.32817f, 0.0f), /*242358173	*/
-		vec3(1.73904f, 2.76162f, 0.0f), /*493789690 */	    vec3(1.85439f, 3.12160f, 0.0f), /*242358182	*/
-		vec3(1.82015f, 3.12898f, 0.0f), /*1837826363*/		vec3(1.81125f, 3.11369f, 0.0f), /*1837912651*/
-		vec3(1.74289f, 3.06602f, 0.0f), /*1837826372*/		vec3(1.58731f, 3.07455f, 0.0f), /*1837826366*/
-		vec3(1.52083f, 3.05846f, 0.0f), /*1837826371*/		vec3(1.38387f, 3.05851f, 0.0f), /*1837826367*/
-		vec3(1.31264f, 3.08636f, 0.0f), /*1837826365*/		vec3(1.23457f, 3.06234f, 0.0f), /*1811376935*/
-		vec3(1.17475f, 2.99287f, 0.0f), /*1811376889*/		vec3(1.13590f, 2.81956f, 0.0f), /*1811376874*/
-		vec3(1.13203f, 2.81353f, 0.0f), /*1811376870*/		vec3(1.12600f, 2.80412f, 0.0f), /*1811376867*/
-		vec3(1.07980f, 2.77630f, 0.0f), /*1811376694*/		vec3(1.01499f, 2.76485f, 0.0f), /*1811376552*/
-		vec3(0.93654f, 2.71044f, 0.0f), /*1811376414*/		vec3(0.85766f, 2.59042f, 0.0f), /*1811376403*/
-		vec3(0.85769f, 2.55099f, 0.0f), /*1837912634*/		vec3(0.83339f, 2.50518f, 0.0f), /*1837912676*/
-		vec3(0.79312f, 2.47736f, 0.0f), /*1837912660*/		vec3(0.82043f, 2.56613f, 0.0f), /*1837912678*/
-		vec3(0.79637f, 2.57966f, 0.0f), /*1837912641*/		vec3(0.84638f, 2.65047f, 0.0f), /*1837912646*/
-		vec3(0.80675f, 2.65496f, 0.0f), /*1811376326*/		vec3(0.75282f, 2.61910f, 0.0f), /*1811376286*/
-		vec3(0.74458f, 2.60303f, 0.0f), /*1811376280*/		vec3(0.72917f, 2.57274f, 0.0f), /*1811376268*/
-		vec3(0.72973f, 2.56101f, 0.0f), /*1811376270*/		vec3(0.73193f, 2.54802f, 0.0f), /*1811376274*/
-		vec3(0.73248f, 2.52267f, 0.0f), /*1811376276*/		vec3(0.72807f, 2.49980f, 0.0f), /*1811376266*/
-		vec3(0.72258f, 2.47879f, 0.0f), /*1811376264*/		vec3(0.72203f, 2.46024f, 0.0f), /*1811376261*/
-		vec3(0.72092f, 2.43922f, 0.0f), /*1811376256*/		vec3(0.71817f, 2.43427f, 0.0f), /*1811376219*/
-		vec3(0.71818f, 2.43181f, 0.0f), /*1811376221*/		vec3(0.72038f, 2.42624f, 0.0f), /*1811376254*/
-		vec3(0.71928f, 2.41882f, 0.0f), /*1811376229*/		vec3(0.72094f, 2.40275f, 0.0f), /*1811376259*/
-		vec3(0.72038f, 2.39657f, 0.0f), /*1811376252*/		vec3(0.71872f, 2.39100f, 0.0f), /*1811376226*/
-		vec3(0.71323f, 2.38112f, 0.0f), /*1811376215*/		vec3(0.71212f, 2.37802f, 0.0f), /*1811376207*/
-		vec3(0.71213f, 2.37370f, 0.0f), /*1811376211*/		vec3(0.71983f, 2.36567f, 0.0f), /*1811376250*/
-		vec3(0.73084f, 2.34155f, 0.0f), /*1811376272*/		vec3(0.74569f, 2.31622f, 0.0f), /*1811376283*/
-		vec3(0.75944f, 2.28098f, 0.0f), /*1811376292*/		vec3(0.78310f, 2.23895f, 0.0f), /*1811376300*/
-		vec3(0.83702f, 2.16292f, 0.0f), /*1811376332*/		vec3(0.85847f, 2.13016f, 0.0f), /*1811376343*/
-		vec3(0.86014f, 2.12645f, 0.0f), /*1811376347*/		vec3(0.86014f, 2.11841f, 0.0f), /*1811376345*/
-		vec3(0.85737f, 2.11224f, 0.0f), /*1811376339*/		vec3(0.85682f, 2.10421f, 0.0f), /*1811376337*/
-		vec3(0.85847f, 2.09741f, 0.0f), /*1811376341*/		vec3(0.86179f, 2.08874f, 0.0f), /*1811376349*/
-		vec3(0.87608f, 2.06217f, 0.0f), /*1811376354*/		vec3(0.88323f, 2.04177f, 0.0f), /*1811376356*/
-		vec3(0.88929f, 2.03002f, 0.0f), /*1811376362*/		vec3(0.91404f, 1.99974f, 0.0f), /*1811376406*/
-		vec3(0.92009f, 1.99479f, 0.0f), /*1811376411*/		vec3(0.93825f, 1.98923f, 0.0f), /*1811376417*/
-		vec3(0.95420f, 1.98861f, 0.0f), /*1811376423*/		vec3(0.96686f, 1.99170f, 0.0f), /*1811376429*/
-		vec3(0.97016f, 1.99046f, 0.0f), /*1811376431*/		vec3(0.98061f, 1.97934f, 0.0f), /*1811376453*/
-		vec3(0.99436f, 1.96760f, 0.0f), /*1811376527*/		vec3(1.00041f, 1.96017f, 0.0f), /*1811376530*/
-		vec3(1.01472f, 1.93916f, 0.0f), /*1811376550*/		vec3(1.02847f, 1.91505f, 0.0f), /*1811376572*/
-		vec3(1.04498f, 1.90269f, 0.0f), /*1811376615*/		vec3(1.06808f, 1.87240f, 0.0f), /*1811376653*/
-		vec3(1.08899f, 1.83964f, 0.0f), /*1811376735*/		vec3(1.11760f, 1.78092f, 0.0f), /*1811376846*/
-		vec3(1.14291f, 1.71787f, 0.0f), /*1811376878*/		vec3(1.16161f, 1.67768f, 0.0f), /*1811376886*/
-		vec3(1.17756f, 1.64678f, 0.0f), /*1811376893*/		vec3(1.19131f, 1.61587f, 0.0f), /*1811376906*/
-		vec3(1.19077f, 1.61030f, 0.0f), /*1811376903*/		vec3(1.18802f, 1.60907f, 0.0f), /*1811376899*/
-		vec3(1.17590f, 1.59547f, 0.0f), /*1811376891*/		vec3(1.14071f, 1.57940f, 0.0f), /*1811376877*/
-		vec3(1.13520f, 1.57198f, 0.0f), /*1811376873*/		vec3(1.14070f, 1.56147f, 0.0f), /*1811376875*/
-		vec3(1.14841f, 1.55529f, 0.0f), /*1811376881*/		vec3(1.16161f, 1.54787f, 0.0f), /*1811376885*/
-		vec3(1.17371f, 1.54170f, 0.0f), /*1811376888*/		vec3(1.19076f, 1.53365f, 0.0f), /*1811376902*/
-		vec3(1.20012f, 1.53180f, 0.0f), /*1811376911*/		vec3(1.20177f, 1.52438f, 0.0f), /*1811376916*/
-		vec3(1.19627f, 1.52315f, 0.0f), /*1811376909*/		vec3(1.17866f, 1.52500f, 0.0f), /*1811376894*/
-		vec3(1.15776f, 1.53242f, 0.0f), /*1811376883*/		vec3(1.13355f, 1.54231f, 0.0f), /*1811376871*/
-		vec3(1.12035f, 1.55282f, 0.0f), /*1811376856*/		vec3(1.10824f, 1.55282f, 0.0f), /*1811376816*/
-		vec3(1.08404f, 1.55962f, 0.0f), /*1811376708*/		vec3(1.07469f, 1.57137f, 0.0f), /*1811376681*/
-		vec3(1.07359f, 1.58806f, 0.0f), /*1811376678*/		vec3(1.08349f, 1.61340f, 0.0f), /*1811376701*/
-		vec3(1.07964f, 1.61650f, 0.0f), /*1811376691*/		vec3(1.05543f, 1.61092f, 0.0f), /*1811376627*/
-		vec3(1.04333f, 1.59609f, 0.0f), /*1811376611*/		vec3(1.03728f, 1.56765f, 0.0f), /*1811376594*/
-		vec3(1.03727f, 1.53922f, 0.0f), /*1811376591*/		vec3(1.04223f, 1.50274f, 0.0f), /*1811376598*/
-		vec3(1.04278f, 1.47988f, 0.0f), /*1811376601*/		vec3(1.05213f, 1.44217f, 0.0f), /*1811376621*/
-		vec3(1.05708f, 1.42734f, 0.0f), /*1811376634*/		vec3(1.05818f, 1.39890f, 0.0f), /*1811376638*/
-		vec3(1.06478f, 1.37727f, 0.0f), /*1811376645*/		vec3(1.06588f, 1.35810f, 0.0f), /*1811376648*/
-		vec3(1.06918f, 1.33400f, 0.0f), /*1811376666*/		vec3(1.07028f, 1.30803f, 0.0f), /*1811376673*/
-		vec3(1.07578f, 1.28825f, 0.0f), /*1811376686*/		vec3(1.08459f, 1.28084f, 0.0f), /*1811376714*/
-		vec3(1.08515f, 1.29258f, 0.0f), /*1811376728*/		vec3(1.08018f, 1.32163f, 0.0f), /*1811376695*/
-		vec3(1.07523f, 1.35625f, 0.0f), /*1811376684*/		vec3(1.07248f, 1.38220f, 0.0f), /*1811376676*/
-		vec3(1.07154f, 1.38510f, 0.0f), /*1811376674*/		vec3(1.06865f, 1.39395f, 0.0f), /*1811376659*/
-		vec3(1.06836f, 1.40368f, 0.0f), /*1811376656*/		vec3(1.06808f, 1.41313f, 0.0f), /*1811376651*/
-		vec3(1.08074f, 1.42116f, 0.0f), /*1811376698*/		vec3(1.08404f, 1.42116f, 0.0f), /*1811376705*/
-		vec3(1.08679f, 1.41930f, 0.0f), /*1811376730*/		vec3(1.11595f, 1.37541f, 0.0f), /*1811376842*/
-		vec3(1.12034f, 1.36738f, 0.0f), /*1811376855*/		vec3(1.12199f, 1.36058f, 0.0f), /*1811376862*/
-		vec3(1.12199f, 1.35254f, 0.0f), /*1811376861*/		vec3(1.12034f, 1.34450f, 0.0f), /*1811376854*/
-		vec3(1.11814f, 1.33709f, 0.0f), /*1811376848*/		vec3(1.12364f, 1.31422f, 0.0f), /*1811376864*/
-		vec3(1.12310f, 1.30000f, 0.0f), /*1811376863*/		vec3(1.12089f, 1.29381f, 0.0f), /*1811376860*/
-		vec3(1.11429f, 1.28701f, 0.0f), /*1811376838*/		vec3(1.10714f, 1.28145f, 0.0f), /*1811376795*/
-		vec3(1.10329f, 1.28145f, 0.0f), /*1811376792*/		vec3(1.10109f, 1.28393f, 0.0f), /*1811376787*/
-		vec3(1.09724f, 1.29753f, 0.0f), /*1811376765*/		vec3(1.09613f, 1.29814f, 0.0f), /*1811376762*/
-		vec3(1.09338f, 1.29691f, 0.0f), /*1811376749*/		vec3(1.09173f, 1.27712f, 0.0f), /*1811376744*/
-		vec3(1.09119f, 1.22706f, 0.0f), /*1811376740*/		vec3(1.08458f, 1.19305f, 0.0f), /*1811376711*/
-		vec3(1.07742f, 1.17823f, 0.0f), /*1811376688*/		vec3(1.06918f, 1.16586f, 0.0f), /*1811376663*/
-		vec3(1.05707f, 1.13929f, 0.0f), /*1811376630*/		vec3(1.05102f, 1.11888f, 0.0f), /*1811376619*/
-		vec3(1.04497f, 1.10219f, 0.0f), /*1811376613*/		vec3(1.03616f, 1.06757f, 0.0f), /*1811376584*/
-		vec3(1.01691f, 1.00700f, 0.0f), /*1811376556*/		vec3(1.00865f, 0.99216f, 0.0f), /*1811376544*/
-		vec3(0.98444f, 0.95323f, 0.0f), /*1811376503*/		vec3(0.98334f, 0.94767f, 0.0f), /*1811376499*/
-		vec3(0.98554f, 0.92355f, 0.0f), /*1811376511*/		vec3(0.98499f, 0.91737f, 0.0f), /*1811376508*/
-		vec3(0.98169f, 0.90996f, 0.0f), /*1811376495*/		vec3(0.97619f, 0.90439f, 0.0f), /*1811376435*/
-		vec3(0.97398f, 0.89512f, 0.0f), /*1811376433*/		vec3(0.97784f, 0.88338f, 0.0f), /*1811376437*/
-		vec3(0.98169f, 0.87781f, 0.0f), /*1811376491*/		vec3(0.98884f, 0.86977f, 0.0f), /*1811376517*/
-		vec3(1.00094f, 0.86297f, 0.0f), /*1811376538*/		vec3(1.02021f, 0.85864f, 0.0f), /*1811376560*/
-		vec3(1.02459f, 0.85926f, 0.0f), /*1811376568*/		vec3(1.03208f, 0.86614f, 0.0f)  /*181137658	*/
-	};
+		mn[0] = fminf(mn[0], x[i]);  mn[1] = fminf(mn[1], y[i]);  mn[2] = fminf(mn[2], z[i]);
+		mx[0] = fmaxf(mx[0], x[i]);  mx[1] = fmaxf(mx[1], y[i]);  mx[2] = fmaxf(mx[2], z[i]);
+	}
+}
 
-	const int islandNumVertices = sizeof(islandVertex) / sizeof(vec3);
-	for (int i = 0; i < islandNumVertices; i++) { island.vertex[i] = islandVertex[i] + vec3(-1.25f, -2.4f, 0.0f); }
-	for (int i = 0; i < islandNumVertices; i++) { island.index[i]  = i; }
+void mkFaceNormalsScalar(const float *x, const float *y, const float *z, const int *index, int numTris, float *nx, float *ny, float *nz)
+{
+	for (int t = 0; t < numTris; t++)
+	{
+		int a = index[3 * t], b = index[3 * t + 1], c = index[3 * t + 2];
+		float l_e1x = x[b] - x[a], l_e1y = y[b] - y[a], l_e1z = z[b] - z[a];
+		float l_e2x = x[c] - x[a], l_e2y = y[c] - y[a], l_e2z = z[c] - z[a];
+		nx[t] = l_e1y * l_e2z - l_e1z * l_e2y;
+		ny[t] = l_e1z * l_e2x - l_e1x * l_e2z;
+		nz[t] = l_e1x * l_e2y - l_e1y * l_e2x;
+	}
+}
 
-	island.init(islandNumVertices, islandNumVertices, vec3(1.0, 1.0, 1.0), vec3(0.0f), mat4(1.0f), copper, true);
+void mkNormalizeScalar(float *x, float *y, float *z, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float l_len = sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+		x[i] /= l_len;  y[i] /= l_len;  z[i] /= l_len;
+	}
+}
 
-	//------------------------------GROUND---------------------------------
-	ground.vertex[0] = vec3(0.5f,  0.5f, 0.0f);      ground.vertex[2] = vec3(-0.5f, -0.5f, 0.0f);
-	ground.vertex[1] = vec3(-0.5f, 0.5f, 0.0f);		 ground.vertex[3] = vec3(0.5f, -0.5f, 0.0f);
+void mkQuantizeScalar(const float *x, const float *y, const float *z, int n, const float *mn, const float *mx, unsigned short *qx, unsigned short *qy, unsigned short *qz)
+{
+	float l_sx = mkQuantScale(mn[0], mx[0]), l_sy = mkQuantScale(mn[1], mx[1]), l_sz = mkQuantScale(mn[2], mx[2]);
+	for (int i = 0; i < n; i++)
+	{
+		qx[i] = (unsigned short)(fminf(fmaxf((x[i] - mn[0]) * l_sx, 0.0f), 65535.0f) + 0.5f);
+		qy[i] = (unsigned short)(fminf(fmaxf((y[i] - mn[1]) * l_sy, 0.0f), 65535.0f) + 0.5f);
+		qz[i] = (unsigned short)(fminf(fmaxf((z[i] - mn[2]) * l_sz, 0.0f), 65535.0f) + 0.5f);
+	}
+}
 
-	int groundIndex[] = { 0, 1, 2,      0, 2, 3 };
+#ifdef MK_DISPATCH
+//----SSE2----
+void mkAffineSSE(const float *m, const float *x, const float *y, const float *z, float *ox, float *oy, float *oz, int n)
+{
+	__m128 l_m[12];
+	for (int k = 0; k < 12; k++) { l_m[k] = _mm_set1_ps(m[k]); }
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 l_x = _mm_loadu_ps(x + i), l_y = _mm_loadu_ps(y + i), l_z = _mm_loadu_ps(z + i);
+		_mm_storeu_ps(ox + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(l_m[0], l_x), _mm_mul_ps(l_m[1], l_y)), _mm_add_ps(_mm_mul_ps(l_m[2],  l_z), l_m[3])));
+		_mm_storeu_ps(oy + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(l_m[4], l_x), _mm_mul_ps(l_m[5], l_y)), _mm_add_ps(_mm_mul_ps(l_m[6],  l_z), l_m[7])));
+		_mm_storeu_ps(oz + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(l_m[8], l_x), _mm_mul_ps(l_m[9], l_y)), _mm_add_ps(_mm_mul_ps(l_m[10], l_z), l_m[11])));
+	}
+	mkAffineScalar(m, x + i, y + i, z + i, ox + i, oy + i, oz + i, n - i);
+}
 
-	const int groundNumIndices = sizeof(groundIndex) / sizeof(int);
-	for (int i = 0; i < groundNumIndices; i++) { ground.index[i] = groundIndex[i]; }
+void mkBoundsSSE(const float *x, const float *y, const float *z, int n, float *mn, float *mx)
+{
+	__m128 l_mn[3] = { _mm_set1_ps(mn[0]), _mm_set1_ps(mn[1]), _mm_set1_ps(mn[2]) };
+	__m128 l_mx[3] = { _mm_set1_ps(mx[0]), _mm_set1_ps(mx[1]), _mm_set1_ps(mx[2]) };
+	const float *l_in[3] = { x, y, z };
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			__m128 v = _mm_loadu_ps(l_in[c] + i);
+			l_mn[c] = _mm_min_ps(l_mn[c], v);
+			l_mx[c] = _mm_max_ps(l_mx[c], v);
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		float l_a[4], l_b[4];
+		_mm_storeu_ps(l_a, l_mn[c]);
+		_mm_storeu_ps(l_b, l_mx[c]);
+		for (int k = 0; k < 4; k++) { mn[c] = fminf(mn[c], l_a[k]);  mx[c] = fmaxf(mx[c], l_b[k]); }
+	}
+	mkBoundsScalar(x + i, y + i, z + i, n - i, mn, mx);
+}
 
-	ground.init(4, groundNumIndices, vec3(0.1f, 0.1f, 0.1f), vec3(0.0f), mat4(1.0f), silver, false);
+void mkFaceNormalsSSE(const float *x, const float *y, const float *z, const int *index, int numTris, float *nx, float *ny, float *nz)
+{
+	int t = 0;
+	for (; t + 4 <= numTris; t += 4)
+	{
+		const int *l_i = index + 3 * t;
+		__m128 l_ax = _mm_setr_ps(x[l_i[0]], x[l_i[3]], x[l_i[6]], x[l_i[9]]),  l_bx = _mm_setr_ps(x[l_i[1]], x[l_i[4]], x[l_i[7]], x[l_i[10]]),  l_cx = _mm_setr_ps(x[l_i[2]], x[l_i[5]], x[l_i[8]], x[l_i[11]]);
+		__m128 l_ay = _mm_setr_ps(y[l_i[0]], y[l_i[3]], y[l_i[6]], y[l_i[9]]),  l_by = _mm_setr_ps(y[l_i[1]], y[l_i[4]], y[l_i[7]], y[l_i[10]]),  l_cy = _mm_setr_ps(y[l_i[2]], y[l_i[5]], y[l_i[8]], y[l_i[11]]);
+		__m128 l_az = _mm_setr_ps(z[l_i[0]], z[l_i[3]], z[l_i[6]], z[l_i[9]]),  l_bz = _mm_setr_ps(z[l_i[1]], z[l_i[4]], z[l_i[7]], z[l_i[10]]),  l_cz = _mm_setr_ps(z[l_i[2]], z[l_i[5]], z[l_i[8]], z[l_i[11]]);
+		__m128 l_e1x = _mm_sub_ps(l_bx, l_ax), l_e1y = _mm_sub_ps(l_by, l_ay), l_e1z = _mm_sub_ps(l_bz, l_az);
+		__m128 l_e2x = _mm_sub_ps(l_cx, l_ax), l_e2y = _mm_sub_ps(l_cy, l_ay), l_e2z = _mm_sub_ps(l_cz, l_az);
+		_mm_storeu_ps(nx + t, _mm_sub_ps(_mm_mul_ps(l_e1y, l_e2z), _mm_mul_ps(l_e1z, l_e2y)));
+		_mm_storeu_ps(ny + t, _mm_sub_ps(_mm_mul_ps(l_e1z, l_e2x), _mm_mul_ps(l_e1x, l_e2z)));
+		_mm_storeu_ps(nz + t, _mm_sub_ps(_mm_mul_ps(l_e1x, l_e2y), _mm_mul_ps(l_e1y, l_e2x)));
+	}
+	mkFaceNormalsScalar(x, y, z, index + 3 * t, numTris - t, nx + t, ny + t, nz + t);
+}
 
-	//-------------------------------CUBE----------------------------------
-	vec3 cubeVertex[] = 
+void mkNormalizeSSE(float *x, float *y, float *z, int n)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
 	{
-		vec3( 0.025f,  0.025f, 0.0f),		vec3(-0.025f,  0.025f, 0.0f),
-		vec3(-0.025f, -0.025f, 0.0f),		vec3( 0.025f, -0.025f, 0.0f),
-		vec3( 0.025f,  0.025f, 0.05f),		vec3(-0.025f,  0.025f, 0.05f),
-		vec3(-0.025f, -0.025f, 0.05f),		vec3( 0.025f, -0.025f, 0.05f)
-	};
+		__m128 l_x = _mm_loadu_ps(x + i), l_y = _mm_loadu_ps(y + i), l_z = _mm_loadu_ps(z + i);
+		__m128 l_len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(l_x, l_x), _mm_mul_ps(l_y, l_y)), _mm_mul_ps(l_z, l_z)));
+		_mm_storeu_ps(x + i, _mm_div_ps(l_x, l_len));
+		_mm_storeu_ps(y + i, _mm_div_ps(l_y, l_len));
+		_mm_storeu_ps(z + i, _mm_div_ps(l_z, l_len));
+	}
+	mkNormalizeScalar(x + i, y + i, z + i, n - i);
+}
 
-	int cubeVIndex[] =
+void mkQuantizeSSE(const float *x, const float *y, const float *z, int n, const float *mn, const float *mx, unsigned short *qx, unsigned short *qy, unsigned short *qz)
+{
+	const float *l_in[3] = { x, y, z };
+	unsigned short *l_out[3] = { qx, qy, qz };
+	__m128 l_zero = _mm_setzero_ps(), l_top = _mm_set1_ps(65535.0f), l_half = _mm_set1_ps(0.5f);
+	__m128i l_bias = _mm_set1_epi32(32768), l_flip = _mm_set1_epi16((short)0x8000);
+	int i = 0;
+	for (int c = 0; c < 3; c++)
 	{
-		0, 1, 4, 5,      1, 2, 5, 6,
-		2, 3, 6, 7,      3, 0, 7, 4,
-		4, 5, 6, 7
-	};
+		__m128 l_mn = _mm_set1_ps(mn[c]), l_s = _mm_set1_ps(mkQuantScale(mn[c], mx[c]));
+		for (i = 0; i + 4 <= n; i += 4)
+		{
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(l_in[c] + i), l_mn), l_s), l_zero), l_top);
+			// SSE2 only packs signed: shift into int16 range, pack, flip back.
+			__m128i q = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(v, l_half)), l_bias);
+			_mm_storel_epi64((__m128i *)(l_out[c] + i), _mm_xor_si128(_mm_packs_epi32(q, q), l_flip));
+		}
+	}
+	mkQuantizeScalar(x + i, y + i, z + i, n - i, mn, mx, qx + i, qy + i, qz + i);
+}
 
-	int cubeIndex[] =
+//----AVX2----
+MK_TARGET("avx2,fma") void mkAffineAVX2(const float *m, const float *x, const float *y, const float *z, float *ox, float *oy, float *oz, int n)
+{
+	__m256 l_m[12];
+	for (int k = 0; k < 12; k++) { l_m[k] = _mm256_set1_ps(m[k]); }
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
 	{
-		 0,  1,  2,       3,  2,  1,       4,  5,  6,       7,  6,  5,
-		 8,  9, 10,      11, 10,  9,      12, 13, 14,      15, 14, 13,
-		16, 17, 18,      16, 18, 19
-	};
+		__m256 l_x = _mm256_loadu_ps(x + i), l_y = _mm256_loadu_ps(y + i), l_z = _mm256_loadu_ps(z + i);
+		_mm256_storeu_ps(ox + i, _mm256_fmadd_ps(l_m[0], l_x, _mm256_fmadd_ps(l_m[1], l_y, _mm256_fmadd_ps(l_m[2],  l_z, l_m[3]))));
+		_mm256_storeu_ps(oy + i, _mm256_fmadd_ps(l_m[4], l_x, _mm256_fmadd_ps(l_m[5], l_y, _mm256_fmadd_ps(l_m[6],  l_z, l_m[7]))));
+		_mm256_storeu_ps(oz + i, _mm256_fmadd_ps(l_m[8], l_x, _mm256_fmadd_ps(l_m[9], l_y, _mm256_fmadd_ps(l_m[10], l_z, l_m[11]))));
+	}
+	mkAffineScalar(m, x + i, y + i, z + i, ox + i, oy + i, oz + i, n - i);
+}
 
-	const int cubeNumVertices = sizeof(cubeVIndex) / sizeof(int);
-	for (int i = 0; i < cubeNumVertices; i++) { cube.vertex[i] = cubeVertex[cubeVIndex[i]]; }
+MK_TARGET("avx2,fma") void mkBoundsAVX2(const float *x, const float *y, const float *z, int n, float *mn, float *mx)
+{
+	__m256 l_mn[3] = { _mm256_set1_ps(mn[0]), _mm256_set1_ps(mn[1]), _mm256_set1_ps(mn[2]) };
+	__m256 l_mx[3] = { _mm256_set1_ps(mx[0]), _mm256_set1_ps(mx[1]), _mm256_set1_ps(mx[2]) };
+	const float *l_in[3] = { x, y, z };
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			__m256 v = _mm256_loadu_ps(l_in[c] + i);
+			l_mn[c] = _mm256_min_ps(l_mn[c], v);
+			l_mx[c] = _mm256_max_ps(l_mx[c], v);
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		float l_a[8], l_b[8];
+		_mm256_storeu_ps(l_a, l_mn[c]);
+		_mm256_storeu_ps(l_b, l_mx[c]);
+		for (int k = 0; k < 8; k++) { mn[c] = fminf(mn[c], l_a[k]);  mx[c] = fmaxf(mx[c], l_b[k]); }
+	}
+	mkBoundsScalar(x + i, y + i, z + i, n - i, mn, mx);
+}
 
-	const int cubeNumIndices  = sizeof(cubeIndex)  / sizeof(int);
-	for (int i = 0; i < cubeNumIndices;  i++) { cube.index[i]  = cubeIndex[i]; }
-	
-	cube.init(cubeNumVertices, cubeNumIndices, vec3(1.0f, 0.2f, 0.2f), vec3(0.0f), mat4(1.0f), copper, false);
+MK_TARGET("avx2,fma") void mkFaceNormalsAVX2(const float *x, const float *y, const float *z, const int *index, int numTris, float *nx, float *ny, float *nz)
+{
+	const __m256i l_stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	int t = 0;
+	for (; t + 8 <= numTris; t += 8)
+	{
+		const int *l_i = index + 3 * t;
+		__m256i a = _mm256_i32gather_epi32(l_i, l_stride, 4), b = _mm256_i32gather_epi32(l_i + 1, l_stride, 4), c = _mm256_i32gather_epi32(l_i + 2, l_stride, 4);
+		__m256 l_ax = _mm256_i32gather_ps(x, a, 4), l_ay = _mm256_i32gather_ps(y, a, 4), l_az = _mm256_i32gather_ps(z, a, 4);
+		__m256 l_e1x = _mm256_sub_ps(_mm256_i32gather_ps(x, b, 4), l_ax), l_e1y = _mm256_sub_ps(_mm256_i32gather_ps(y, b, 4), l_ay), l_e1z = _mm256_sub_ps(_mm256_i32gather_ps(z, b, 4), l_az);
+		__m256 l_e2x = _mm256_sub_ps(_mm256_i32gather_ps(x, c, 4), l_ax), l_e2y = _mm256_sub_ps(_mm256_i32gather_ps(y, c, 4), l_ay), l_e2z = _mm256_sub_ps(_mm256_i32gather_ps(z, c, 4), l_az);
+		_mm256_storeu_ps(nx + t, _mm256_fmsub_ps(l_e1y, l_e2z, _mm256_mul_ps(l_e1z, l_e2y)));
+		_mm256_storeu_ps(ny + t, _mm256_fmsub_ps(l_e1z, l_e2x, _mm256_mul_ps(l_e1x, l_e2z)));
+		_mm256_storeu_ps(nz + t, _mm256_fmsub_ps(l_e1x, l_e2y, _mm256_mul_ps(l_e1y, l_e2x)));
+	}
+	mkFaceNormalsScalar(x, y, z, index + 3 * t, numTris - t, nx + t, ny + t, nz + t);
+}
 
-	//------------------------------ECDC-A---------------------------------
-	vec3 ecdcAVertex[] =
+MK_TARGET("avx2,fma") void mkNormalizeAVX2(float *x, float *y, float *z, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
 	{
-		vec3(0.941f, 0.233f, 0.0f),		vec3(0.922f, 0.337f, 0.0f),
-		vec3(0.902f, 0.462f, 0.0f),		vec3(1.003f, 0.468f, 0.0f),
-		vec3(1.003f, 0.562f, 0.0f),		vec3(1.019f, 0.661f, 0.0f),
-		vec3(1.052f, 0.748f, 0.0f),		vec3(1.096f, 0.828f, 0.0f),
-		vec3(1.147f, 0.898f, 0.0f),		vec3(1.182f, 0.933f, 0.0f),
-		vec3(1.159f, 0.964f, 0.0f),		vec3(1.179f, 0.981f, 0.0f),
-		vec3(1.208f, 0.962f, 0.0f),		vec3(1.208f, 0.946f, 0.0f),
-		vec3(1.218f, 0.932f, 0.0f),		vec3(1.231f, 0.931f, 0.0f),
-		vec3(1.244f, 0.940f, 0.0f),		vec3(1.244f, 0.954f, 0.0f),
-		vec3(1.237f, 0.965f, 0.0f),		vec3(1.222f, 0.970f, 0.0f),
-		vec3(1.212f, 1.003f, 0.0f),		vec3(1.381f, 1.112f, 0.0f),
-		vec3(1.320f, 1.208f, 0.0f),		vec3(1.407f, 1.262f, 0.0f),
-		vec3(1.387f, 1.292f, 0.0f),		vec3(1.301f, 1.238f, 0.0f),
-		vec3(1.240f, 1.338f, 0.0f),		vec3(1.083f, 1.240f, 0.0f),
-		vec3(1.146f, 1.143f, 0.0f),		vec3(1.062f, 1.081f, 0.0f),
-		vec3(1.018f, 1.128f, 0.0f),		vec3(0.979f, 1.087f, 0.0f),
-		vec3(0.901f, 1.004f, 0.0f),		vec3(0.822f, 0.886f, 0.0f),
-		vec3(0.766f, 0.753f, 0.0f),		vec3(0.732f, 0.595f, 0.0f),
-		vec3(0.728f, 0.448f, 0.0f),		vec3(0.751f, 0.289f, 0.0f),
-		vec3(0.882f, 0.326f, 0.0f),		vec3(0.909f, 0.226f, 0.0f),
-		vec3(0.941f, 0.233f, 0.216f),	vec3(0.922f, 0.337f, 0.216f),
-		vec3(0.902f, 0.462f, 0.216f),	vec3(1.003f, 0.468f, 0.216f),
-		vec3(1.003f, 0.562f, 0.216f),	vec3(1.019f, 0.661f, 0.216f),
-		vec3(1.052f, 0.748f, 0.216f),	vec3(1.096f, 0.828f, 0.216f),
-		vec3(1.147f, 0.898f, 0.216f),	vec3(1.182f, 0.933f, 0.216f),
-		vec3(1.159f, 0.964f, 0.216f),	vec3(1.179f, 0.981f, 0.216f),
-		vec3(1.208f, 0.962f, 0.216f),	vec3(1.208f, 0.946f, 0.216f),
-		vec3(1.218f, 0.932f, 0.216f),	vec3(1.231f, 0.931f, 0.216f),
-		vec3(1.244f, 0.940f, 0.216f),	vec3(1.244f, 0.954f, 0.216f),
-		vec3(1.237f, 0.965f, 0.216f),	vec3(1.222f, 0.970f, 0.216f),
-		vec3(1.212f, 1.003f, 0.216f),	vec3(1.381f, 1.112f, 0.216f),
-		vec3(1.320f, 1.208f, 0.216f),	vec3(1.407f, 1.262f, 0.216f),
-		vec3(1.387f, 1.292f, 0.216f),	vec3(1.301f, 1.238f, 0.216f),
-		vec3(1.240f, 1.338f, 0.216f),	vec3(1.083f, 1.240f, 0.216f),
-		vec3(1.146f, 1.143f, 0.216f),	vec3(1.062f, 1.081f, 0.216f),
-		vec3(1.018f, 1.128f, 0.216f),	vec3(0.979f, 1.087f, 0.216f),
-		vec3(0.901f, 1.004f, 0.216f),	vec3(0.822f, 0.886f, 0.216f),
-		vec3(0.766f, 0.753f, 0.216f),	vec3(0.732f, 0.595f, 0.216f),
-		vec3(0.728f, 0.448f, 0.216f),	vec3(0.751f, 0.289f, 0.216f),
-		vec3(0.882f, 0.326f, 0.216f),	vec3(0.909f, 0.226f, 0.216f),
-	};
+		__m256 l_x = _mm256_loadu_ps(x + i), l_y = _mm256_loadu_ps(y + i), l_z = _mm256_loadu_ps(z + i);
+		__m256 l_len = _mm256_sqrt_ps(_mm256_fmadd_ps(l_x, l_x, _mm256_fmadd_ps(l_y, l_y, _mm256_mul_ps(l_z, l_z))));
+		_mm256_storeu_ps(x + i, _mm256_div_ps(l_x, l_len));
+		_mm256_storeu_ps(y + i, _mm256_div_ps(l_y, l_len));
+		_mm256_storeu_ps(z + i, _mm256_div_ps(l_z, l_len));
+	}
+	mkNormalizeScalar(x + i, y + i, z + i, n - i);
+}
 
-	int ecdcAVIndex[] =
+MK_TARGET("avx2,fma") void mkQuantizeAVX2(const float *x, const float *y, const float *z, int n, const float *mn, const float *mx, unsigned short *qx, unsigned short *qy, unsigned short *qz)
+{
+	const float *l_in[3] = { x, y, z };
+	unsigned short *l_out[3] = { qx, qy, qz };
+	__m256 l_zero = _mm256_setzero_ps(), l_top = _mm256_set1_ps(65535.0f), l_half = _mm256_set1_ps(0.5f);
+	int i = 0;
+	for (int c = 0; c < 3; c++)
 	{
-		 0,  1,  2, 40, 41, 42, // 0 - 2,3 - 5
-		 2,  3, 42, 43, // 6 - 9
-		 3,  4,  5,  6,  7,  8,  9, 43, 44, 45, 46, 47, 48, 49, // 10 - 16,17 - 23
-		 9, 10, 49, 50, // 24 - 27
-		10, 11, 50, 51, // 28 - 31
-		11, 12, 51, 52, // 32 - 35
-		12, 13, 14, 15, 16, 17, 18, 19, 52, 53, 54, 55, 56, 57, 58, 59, // 36 - 43,44 - 51
+		__m256 l_mn = _mm256_set1_ps(mn[c]), l_s = _mm256_set1_ps(mkQuantScale(mn[c], mx[c]));
+		for (i = 0; i + 8 <= n; i += 8)
+		{
+			__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(l_in[c] + i), l_mn), l_s), l_zero), l_top);
+			__m256i q = _mm256_cvttps_epi32(_mm256_add_ps(v, l_half));
+			_mm_storeu_si128((__m128i *)(l_out[c] + i), _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)));
+		}
+	}
+	mkQuantizeScalar(x + i, y + i, z + i, n - i, mn, mx, qx + i, qy + i, qz + i);
+}
+
+//----AVX-512----
+// GCC 12's AVX-512 headers start reductions, gathers and conversions from
+// an undefined __Y, which -Wall reports as (maybe) uninitialized here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+MK_TARGET("avx512f") void mkAffineAVX512(const float *m, const float *x, const float *y, const float *z, float *ox, float *oy, float *oz, int n)
+{
+	__m512 l_m[12];
+	for (int k = 0; k < 12; k++) { l_m[k] = _mm512_set1_ps(m[k]); }
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 l_x = _mm512_loadu_ps(x + i), l_y = _mm512_loadu_ps(y + i), l_z = _mm512_loadu_ps(z + i);
+		_mm512_storeu_ps(ox + i, _mm512_fmadd_ps(l_m[0], l_x, _mm512_fmadd_ps(l_m[1], l_y, _mm512_fmadd_ps(l_m[2],  l_z, l_m[3]))));
+		_mm512_storeu_ps(oy + i, _mm512_fmadd_ps(l_m[4], l_x, _mm512_fmadd_ps(l_m[5], l_y, _mm512_fmadd_ps(l_m[6],  l_z, l_m[7]))));
+		_mm512_storeu_ps(oz + i, _mm512_fmadd_ps(l_m[8], l_x, _mm512_fmadd_ps(l_m[9], l_y, _mm512_fmadd_ps(l_m[10], l_z, l_m[11]))));
+	}
+	mkAffineScalar(m, x + i, y + i, z + i, ox + i, oy + i, oz + i, n - i);
+}
+
+MK_TARGET("avx512f") void mkBoundsAVX512(const float *x, const float *y, const float *z, int n, float *mn, float *mx)
+{
+	__m512 l_mn[3] = { _mm512_set1_ps(mn[0]), _mm512_set1_ps(mn[1]), _mm512_set1_ps(mn[2]) };
+	__m512 l_mx[3] = { _mm512_set1_ps(mx[0]), _mm512_set1_ps(mx[1]), _mm512_set1_ps(mx[2]) };
+	const float *l_in[3] = { x, y, z };
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			__m512 v = _mm512_loadu_ps(l_in[c] + i);
+			l_mn[c] = _mm512_min_ps(l_mn[c], v);
+			l_mx[c] = _mm512_max_ps(l_mx[c], v);
+		}
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		mn[c] = _mm512_reduce_min_ps(l_mn[c]);
+		mx[c] = _mm512_reduce_max_ps(l_mx[c]);
+	}
+	mkBoundsScalar(x + i, y + i, z + i, n - i, mn, mx);
+}
+
+MK_TARGET("avx512f") void mkFaceNormalsAVX512(const float *x, const float *y, const float *z, const int *index, int numTris, float *nx, float *ny, float *nz)
+{
+	const __m512i l_stride = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 33, 36, 39, 42, 45);
+	int t = 0;
+	for (; t + 16 <= numTris; t += 16)
+	{
+		const int *l_i = index + 3 * t;
+		__m512i a = _mm512_i32gather_epi32(l_stride, l_i, 4), b = _mm512_i32gather_epi32(l_stride, l_i + 1, 4), c = _mm512_i32gather_epi32(l_stride, l_i + 2, 4);
+		__m512 l_ax = _mm512_i32gather_ps(a, x, 4), l_ay = _mm512_i32gather_ps(a, y, 4), l_az = _mm512_i32gather_ps(a, z, 4);
+		__m512 l_e1x = _mm512_sub_ps(_mm512_i32gather_ps(b, x, 4), l_ax), l_e1y = _mm512_sub_ps(_mm512_i32gather_ps(b, y, 4), l_ay), l_e1z = _mm512_sub_ps(_mm512_i32gather_ps(b, z, 4), l_az);
+		__m512 l_e2x = _mm512_sub_ps(_mm512_i32gather_ps(c, x, 4), l_ax), l_e2y = _mm512_sub_ps(_mm512_i32gather_ps(c, y, 4), l_ay), l_e2z = _mm512_sub_ps(_mm512_i32gather_ps(c, z, 4), l_az);
+		_mm512_storeu_ps(nx + t, _mm512_fmsub_ps(l_e1y, l_e2z, _mm512_mul_ps(l_e1z, l_e2y)));
+		_mm512_storeu_ps(ny + t, _mm512_fmsub_ps(l_e1z, l_e2x, _mm512_mul_ps(l_e1x, l_e2z)));
+		_mm512_storeu_ps(nz + t, _mm512_fmsub_ps(l_e1x, l_e2y, _mm512_mul_ps(l_e1y, l_e2x)));
+	}
+	mkFaceNormalsScalar(x, y, z, index + 3 * t, numTris - t, nx + t, ny + t, nz + t);
+}
+
+MK_TARGET("avx512f") void mkNormalizeAVX512(float *x, float *y, float *z, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 l_x = _mm512_loadu_ps(x + i), l_y = _mm512_loadu_ps(y + i), l_z = _mm512_loadu_ps(z + i);
+		__m512 l_len = _mm512_sqrt_ps(_mm512_fmadd_ps(l_x, l_x, _mm512_fmadd_ps(l_y, l_y, _mm512_mul_ps(l_z, l_z))));
+		_mm512_storeu_ps(x + i, _mm512_div_ps(l_x, l_len));
+		_mm512_storeu_ps(y + i, _mm512_div_ps(l_y, l_len));
+		_mm512_storeu_ps(z + i, _mm512_div_ps(l_z, l_len));
+	}
+	mkNormalizeScalar(x + i, y + i, z + i, n - i);
+}
+
+MK_TARGET("avx512f") void mkQuantizeAVX512(const float *x, const float *y, const float *z, int n, const float *mn, const float *mx, unsigned short *qx, unsigned short *qy, unsigned short *qz)
+{
+	const float *l_in[3] = { x, y, z };
+	unsigned short *l_out[3] = { qx, qy, qz };
+	__m512 l_zero = _mm512_setzero_ps(), l_top = _mm512_set1_ps(65535.0f), l_half = _mm512_set1_ps(0.5f);
+	int i = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		__m512 l_mn = _mm512_set1_ps(mn[c]), l_s = _mm512_set1_ps(mkQuantScale(mn[c], mx[c]));
+		for (i = 0; i + 16 <= n; i += 16)
+		{
+			__m512 v = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(l_in[c] + i), l_mn), l_s), l_zero), l_top);
+			_mm256_storeu_si256((__m256i *)(l_out[c] + i), _mm512_cvtusepi32_epi16(_mm512_cvttps_epu32(_mm512_add_ps(v, l_half))));
+		}
+	}
+	mkQuantizeScalar(x + i, y + i, z + i, n - i, mn, mx, qx + i, qy + i, qz + i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+enum { mkTierScalar = 0, mkTierSSE = 1, mkTierAVX2 = 2, mkTierAVX512 = 3, mkNumTiers = 4 };
+
+structMeshKernels mkTiers[mkNumTiers] =
+{
+	{ "scalar", mkAffineScalar, mkBoundsScalar, mkFaceNormalsScalar, mkNormalizeScalar, mkQuantizeScalar },
+#ifdef MK_DISPATCH
+	{ "sse2",    mkAffineSSE,    mkBoundsSSE,    mkFaceNormalsSSE,    mkNormalizeSSE,    mkQuantizeSSE },
+	{ "avx2",    mkAffineAVX2,   mkBoundsAVX2,   mkFaceNormalsAVX2,   mkNormalizeAVX2,   mkQuantizeAVX2 },
+	{ "avx512",  mkAffineAVX512, mkBoundsAVX512, mkFaceNormalsAVX512, mkNormalizeAVX512, mkQuantizeAVX512 },
+#else
+	{ "sse2",   mkAffineScalar, mkBoundsScalar, mkFaceNormalsScalar, mkNormalizeScalar, mkQuantizeScalar },
+	{ "avx2",   mkAffineScalar, mkBoundsScalar, mkFaceNormalsScalar, mkNormalizeScalar, mkQuantizeScalar },
+	{ "avx512", mkAffineScalar, mkBoundsScalar, mkFaceNormalsScalar, mkNormalizeScalar, mkQuantizeScalar },
+#endif
+};
+const structMeshKernels *meshKernels = &mkTiers[mkTierScalar];
+
+bool mkSupported(int tier)
+{
+	if (tier == mkTierScalar) return true;
+#if defined(MK_DISPATCH) && defined(_MSC_VER)
+	int l_regs[4];
+	__cpuidex(l_regs, 7, 0);
+	unsigned long long l_xcr0 = ((l_regs[1] & (1 << 5)) || (l_regs[1] & (1 << 16))) ? _xgetbv(0) : 0;
+	if (tier == mkTierSSE)    return true;
+	if (tier == mkTierAVX2)   return (l_regs[1] & (1 << 5))  && (l_xcr0 & 0x06) == 0x06;
+	if (tier == mkTierAVX512) return (l_regs[1] & (1 << 16)) && (l_xcr0 & 0xe6) == 0xe6;
+#elif defined(MK_DISPATCH)
+	__builtin_cpu_init();
+	if (tier == mkTierSSE)    return __builtin_cpu_supports("sse2");
+	if (tier == mkTierAVX2)   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if (tier == mkTierAVX512) return __builtin_cpu_supports("avx512f");
+#endif
+	return false;
+}
+
+// name picks a tier by name (for comparisons); NULL picks the widest one.
+bool initMeshKernels(const char *name)
+{
+	for (int t = mkNumTiers - 1; t >= 0; t--)
+	{
+		if (!mkSupported(t) || (name && strcmp(name, mkTiers[t].name))) continue;
+		meshKernels = &mkTiers[t];
+		return true;
+	}
+	fprintf(stderr, "mesh kernels '%s' not available on this CPU\n", name);
+	return false;
+}
+
+// Bake path for imported geometry: transforms the source points once and
+// expands them through vindex (NULL for a 1:1 copy) into out.
+void bakeVertices(vector<vec3> &out, const vec3 *src, int numSrc, const int *vindex, int n, const mat4 &M)
+{
+	structSoA l_s;
+	float l_m[12];
+	mkToSoA(src, numSrc, l_s);
+	mkMatrix(M, 1.0f, l_m);
+	meshKernels->affine(l_m, l_s.x.data(), l_s.y.data(), l_s.z.data(), l_s.x.data(), l_s.y.data(), l_s.z.data(), numSrc);
+	out.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		int k = vindex ? vindex[i] : i;
+		out[i] = vec3(l_s.x[k], l_s.y[k], l_s.z[k]);
+	}
+}
+
+class prop
+{
+	public:
+		int numVertices, numIndices, outline;
+		vector<int> index;
+		vector<vec3> vertex, normal;
+		vec3 propColor, center, boundsMin, boundsMax;
+		GLuint VAO[maxContexts], VBO, IBO, occQuery;
+		int occPhase, impostor;
+		bool occVisible, occPending;
+		mat4 Model;
+		structMaterial material;
+		void init(int, int, vec3, vec3, mat4, structMaterial, bool);
+		void computeNormals();
+		void computeBounds();
+		void upload();
+		GLuint createVAO();
+		void render(const mat4 &l_PV = PV);
+		void renderSoftware(const mat4 &l_PV = PV);
+};
+
+void prop::init(int l_numVertices, int l_numIndices, vec3 l_color, vec3 l_center, mat4 l_Model, structMaterial l_material, bool l_outline)
+{
+	numVertices = l_numVertices;
+	numIndices = l_numIndices;
+	propColor = l_color;
+	center = l_center;
+	outline = l_outline;
+	Model = l_Model;
+	material = l_material;
+
+	if (l_outline == false) computeNormals();
+	upload();
+}
+
+// A vertex normal is the running normalize(n + face normal) over the
+// triangles that use it, in index order; face normals come from the mesh
+// kernels.
+void prop::computeNormals()
+{
+	structSoA l_v, l_n;
+	int l_numTris = numIndices / 3;
+	mkToSoA(vertex.data(), numVertices, l_v);
+	l_n.x.resize(l_numTris);  l_n.y.resize(l_numTris);  l_n.z.resize(l_numTris);
+	meshKernels->faceNormals(l_v.x.data(), l_v.y.data(), l_v.z.data(), index.data(), l_numTris, l_n.x.data(), l_n.y.data(), l_n.z.data());
+	meshKernels->normalize(l_n.x.data(), l_n.y.data(), l_n.z.data(), l_numTris);
+
+	normal.assign(numVertices, vec3(0.0f));
+	for (int t = 0; t < l_numTris; t++)
+	{
+		vec3 l_face = vec3(l_n.x[t], l_n.y[t], l_n.z[t]);
+		for (int k = 0; k < 3; k++)
+		{
+			vec3 &l_normal = normal[index[3 * t + k]];
+			l_normal = normalize(l_normal + l_face);
+		}
+	}
+}
+
+// World-space bounding box, used for frustum culling.
+void prop::computeBounds()
+{
+	structSoA l_s;
+	float l_m[12], l_min[3] = { 1e30f, 1e30f, 1e30f }, l_max[3] = { -1e30f, -1e30f, -1e30f };
+	mkToSoA(vertex.data(), numVertices, l_s);
+	mkMatrix(Model, 1.0f, l_m);
+	meshKernels->affine(l_m, l_s.x.data(), l_s.y.data(), l_s.z.data(), l_s.x.data(), l_s.y.data(), l_s.z.data(), numVertices);
+	meshKernels->bounds(l_s.x.data(), l_s.y.data(), l_s.z.data(), numVertices, l_min, l_max);
+	boundsMin = vec3(l_min[0], l_min[1], l_min[2]);
+	boundsMax = vec3(l_max[0], l_max[1], l_max[2]);
+}
+
+// Bounds and GL buffers; vertex, normal and index must be filled in first.
+void prop::upload()
+{
+	int l_sizeOfVertices = sizeof(vec3)*numVertices;
+	computeBounds();
+
+	// VAO VBO IBO
+	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &IBO);
+	VAO[renderContext] = createVAO();
+
+	glBufferData(GL_ARRAY_BUFFER, l_sizeOfVertices * 2, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, l_sizeOfVertices, &vertex[0]);
+	if (outline == false)  { glBufferSubData(GL_ARRAY_BUFFER, l_sizeOfVertices, l_sizeOfVertices, &normal[0]); }
+
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int)*numIndices, &index[0], GL_STATIC_DRAW);
+
+	/*mat4 l_View = lookAt(vec3(0.0f, 0.0f, 1.0f), vec3(0.0f), vec3(1.0f, 0.0f, 0.0f));
+	cout << "vertex[16] = " << vertex[16].x << ", " << vertex[16].y << ", " << vertex[16].z << endl;
+	vec3 ver = vec3(l_View * l_Model * vec4(vertex[16], 1.0f));
+	cout << "ver        = " << ver.x << ", " << ver.y << ", " << ver.z << endl;
+	cout << "normal[16] = " << normal[16].x << ", " << normal[16].y << ", " << normal[16].z << endl;
+	vec3 N = normalize(vec3(l_View * l_Model * vec4(normal[16], 0.0f)));
+	cout << "N          = " << N.x << ", " << N.y << ", " << N.z << endl;
+	vec3 lightPos = vec3(1.0f, 1.0f, 1.0f);
+	cout << "lightPos   = " << lightPos.x << ", " << lightPos.y << ", " << lightPos.z << endl;
+	vec3 L = vec3(l_View * vec4(lightPos, 1.0f));
+	cout << "L          = " << L.x << ", " << L.y << ", " << L.z << endl;
+	L = normalize(L - ver);
+	cout << "L-ver      = " << L.x << ", " << L.y << ", " << L.z << endl;
+	cout << "ambiComp   = " << material.ambient.x << ", " << material.ambient.y << ", " << material.ambient.z << endl;
+	vec3 ambiProd       = l_Ka * material.ambient;
+	cout << "ambiProd   = " << ambiProd.x << ", " << ambiProd.y << ", " << ambiProd.z << endl;
+	cout << "diffComp   = " << material.diffuse.x << ", " << material.diffuse.y << ", " << material.diffuse.z << endl;
+	vec3 lightColor     = vec3(1.0f);
+	vec3 diffProd       = l_Ka * material.diffuse * lightColor;
+	cout << "diffProd   = " << diffProd.x << ", " << diffProd.y << ", " << diffProd.z << endl;
+	float dotProd       = max(dot(N, L), 0.0f);
+	cout << "dot(N, L)  = " << dotProd << endl;
+	diffProd            = diffProd * dotProd;
+	cout << "diffProd   = " << diffProd.x << ", " << diffProd.y << ", " << diffProd.z << endl;
+	/*cout << "specComp   = " << material.specular.x << ", " << material.specular.y << ", " << material.specular.z << endl;
+	vec3 specProd       = l_Ks * material.specular * lightColor;
+	cout << "specProd   = " << specProd.x << ", " << specProd.y << ", " << specProd.z << endl;
+	cout << "shininess  = " << material.shininess << endl;
+	dotProd             = dot(-L, N);
+	cout << "dot(-L, N) = " << dotProd << endl;*/
+	/*vec3 finalColor = clamp(propColor * (ambiProd + diffProd), 0.0f, 1.0f);
+	cout << "color      = " << finalColor.x << ", " << finalColor.y << ", " << finalColor.z << endl;*/
+}
+
+GLuint prop::createVAO()
+{
+	GLuint l_VAO;
+	glGenVertexArrays(1, &l_VAO);
+	glBindVertexArray(l_VAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+
+	glEnableVertexAttribArray(vertexPosAttrib);
+	glVertexAttribPointer(vertexPosAttrib, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+	if (outline == false)
+	{
+		glEnableVertexAttribArray(normalPosAttrib);
+		glVertexAttribPointer(normalPosAttrib, 3, GL_FLOAT, GL_FALSE, 0, (void *)(sizeof(vec3) * numVertices));
+	}
+	return l_VAO;
+}
+
+int shadingLevel(const prop &p, const mat4 &l_PV, int level, vec3 &color);
+
+void prop::render(const mat4 &l_PV)
+{
+	if (renderBackend == backendSoftware)
+	{
+		renderSoftware(l_PV);
+		return;
+	}
+
+	if (VAO[renderContext] == 0) VAO[renderContext] = createVAO();
+	glBindVertexArray(VAO[renderContext]);
+
+	vec3 l_color = propColor;
+	int l_level = shadingLevel(*this, l_PV, (outline == true) ? shaderOutline : (phong == false) ? shaderGouraud : shaderPhong, l_color);
+	structShader &l_shader = (multiView.active ? multiView.shaders : shaders[renderContext])[l_level];
+	glUseProgram(l_shader.prog);
+
+	glUniformMatrix4fv(l_shader.MUniformLoc, 1, GL_FALSE, value_ptr(Model));
+	glUniformMatrix4fv(l_shader.PVUniformLoc, 1, GL_FALSE, value_ptr(l_PV));
+	glUniform3fv(l_shader.propColorLoc, 1, value_ptr(l_color));
+
+	if (outline == true)
+		drawPropElements(GL_LINE_LOOP, numIndices);
+	else
+	{
+		if (l_level != shaderOutline) setLightingUniforms(l_shader, material);
+		drawPropElements(GL_TRIANGLES, numIndices);
+	}
+}
+
+prop island, ground, cube, ecdcA, ecdcB, bayhall;
+
+// shaded[] counts filled props by the program shadingLevel() chose;
+// impostors are counted in propsDrawn as well.
+struct structSceneStats { int propsDrawn, propsCulled, propsOccluded, impostors, shaded[numShaders]; long long triangles; };
+thread_local structSceneStats sceneStats;
+
+//-----------------------------SHADING-LOD------------------------------
+// With shadingLod.enabled (L, --shading-lod) each filled prop picks its
+// program from the screen area of its bounds: phongPixels or more keeps
+// per-fragment Phong, under flatPixels it is drawn with one flat colour
+// through the outline program, and Gouraud in between. It never shades
+// better than TAB asks for. The flat colour is the Gouraud colour of the
+// prop's faces averaged by how much of each faces the camera, so a prop a
+// few pixels wide keeps its tone. The area is that of the screen rect
+// around the projected bounds; bounds reaching behind the camera count as
+// the whole screen. Split view ignores it.
+struct structShadingLod { bool enabled; float phongPixels, flatPixels; };
+structShadingLod shadingLod = { false, 4096.0f, 64.0f };
+
+// Set by drawProps() for the frame being drawn on this thread.
+thread_local vec2 shadingViewport;
+thread_local vec3 shadingEye;
+
+vec3 swShade(const prop &p, vec3 N, vec3 P);
+
+void shadingLodBeginFrame(const mat4 &l_PV)
+{
+	GLint l_viewport[4];
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	shadingViewport = vec2((float)l_viewport[2], (float)l_viewport[3]);
+	// The eye is the point PV sends to infinity.
+	vec4 l_eye = inverse(l_PV) * vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	shadingEye = vec3(l_eye) / l_eye.w;
+}
+
+float screenArea(const prop &p, const mat4 &l_PV)
+{
+	vec2 l_min(1e30f), l_max(-1e30f);
+	for (int i = 0; i < 8; i++)
+	{
+		vec4 l_clip = l_PV * vec4((i & 1) ? p.boundsMax.x : p.boundsMin.x, (i & 2) ? p.boundsMax.y : p.boundsMin.y, (i & 4) ? p.boundsMax.z : p.boundsMin.z, 1.0f);
+		if (l_clip.w <= 1e-6f) return shadingViewport.x * shadingViewport.y;
+		vec2 l_ndc = vec2(l_clip.x, l_clip.y) / l_clip.w;
+		l_min = glm::min(l_min, l_ndc);
+		l_max = glm::max(l_max, l_ndc);
+	}
+	vec2 l_size = (glm::clamp(l_max, vec2(-1.0f), vec2(1.0f)) - glm::clamp(l_min, vec2(-1.0f), vec2(1.0f))) * 0.5f * shadingViewport;
+	return l_size.x * l_size.y;
+}
+
+vec3 flatShade(const prop &p)
+{
+	vec3 l_sum(0.0f);
+	float l_weight = 0.0f;
+	for (int t = 0; t + 2 < p.numIndices; t += 3)
+	{
+		vec3 l_P[3], l_N[3];
+		for (int k = 0; k < 3; k++)
+		{
+			l_P[k] = vec3(p.Model * vec4(p.vertex[p.index[t + k]], 1.0f));
+			l_N[k] = normalize(vec3(p.Model * vec4(p.normal[p.index[t + k]], 0.0f)));
+		}
+		// Face normal, turned to agree with the vertex normals.
+		vec3 l_face = cross(l_P[1] - l_P[0], l_P[2] - l_P[0]);
+		if (dot(l_face, l_N[0] + l_N[1] + l_N[2]) < 0.0f) l_face = -l_face;
+		vec3 l_center = (l_P[0] + l_P[1] + l_P[2]) / 3.0f;
+		float w = std::max(dot(l_face, normalize(shadingEye - l_center)), 0.0f);
+		if (w <= 0.0f) continue;
+		l_sum += w * (swShade(p, l_N[0], l_P[0]) + swShade(p, l_N[1], l_P[1]) + swShade(p, l_N[2], l_P[2])) / 3.0f;
+		l_weight += w;
+	}
+	return (l_weight > 0.0f) ? l_sum / l_weight : p.propColor;
+}
+
+// The program prop::render() should use instead of level; sets color for
+// the flat level.
+int shadingLevel(const prop &p, const mat4 &l_PV, int level, vec3 &color)
+{
+	if (!shadingLod.enabled || level == shaderOutline || multiView.active) return level;
+	float l_area = screenArea(p, l_PV);
+	int l_level = std::min(level, (l_area >= shadingLod.phongPixels) ? (int)shaderPhong : (l_area >= shadingLod.flatPixels) ? (int)shaderGouraud : (int)shaderOutline);
+	if (l_level == shaderOutline) color = flatShade(p);
+	sceneStats.shaded[l_level]++;
+	return l_level;
+}
+
+//------------------------------SCENE-LIST------------------------------
+// Everything drawn in a frame is in sceneProps (the campus, or a generated
+// city). With cullProps each prop's bounds are tested against the view
+// frustum first; with drawBatched the filled props are drawn from merged
+// buffers instead, one per grid cell and material/colour (buildBatches()),
+// with cells sized to hold about batchPropsPerCell props.
+const int batchPropsPerCell = 256;
+vector<prop*> sceneProps, batchedProps, gpuSkippedProps;
+vector<prop> batches;
+bool cullProps = false, drawBatched = false, gpuCullProps = false, occlusionCull = false, drawImpostors = false;
+
+
+int gpuCullDraw(const mat4 &l_PV, const vec4 *planes);
+void occlusionBeginFrame();
+bool occlusionDraw(prop &p, const mat4 &l_PV);
+void occlusionFlush(const mat4 &l_PV);
+bool drawPolylines(const mat4 &l_PV);
+long long drawTerrain(const mat4 &l_PV);
+void impostorBeginFrame();
+bool impostorDraw(const prop &p, const mat4 &l_PV);
+void impostorFlush(const mat4 &l_PV);
+
+// Flatten light[] into the arrays the shaders take.
+void packLights()
+{
+	for (int i = 0; i < numLights; i++)
+	{
+		lightPos[i]   = light[i].pos;
+		lightColor[i] = light[i].intensity * light[i].color;
+	}
+}
+
+// Gribb/Hartmann: the frustum planes are sums/differences of the rows of PV.
+void frustumPlanes(const mat4 &l_PV, vec4 *planes)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		vec4 l_row   = vec4(l_PV[0][i], l_PV[1][i], l_PV[2][i], l_PV[3][i]);
+		vec4 l_row3  = vec4(l_PV[0][3], l_PV[1][3], l_PV[2][3], l_PV[3][3]);
+		planes[2 * i]     = l_row3 + l_row;
+		planes[2 * i + 1] = l_row3 - l_row;
+	}
+}
+
+bool inFrustum(const vec4 *planes, const prop &p)
+{
+	vec3 l_center = (p.boundsMin + p.boundsMax) * 0.5f, l_extent = (p.boundsMax - p.boundsMin) * 0.5f;
+	for (int i = 0; i < 6; i++)
+	{
+		vec3 l_n = vec3(planes[i]);
+		if (dot(l_n, l_center) + dot(glm::abs(l_n), l_extent) + planes[i].w < 0.0f) return false;
+	}
+	return true;
+}
+
+void buildBatches()
+{
+	vec3 l_min(1e30f), l_max(-1e30f);
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		l_min = glm::min(l_min, sceneProps[i]->boundsMin);
+		l_max = glm::max(l_max, sceneProps[i]->boundsMax);
+	}
+	int l_cells = std::max(1, (int)sqrt((float)sceneProps.size() / batchPropsPerCell));
+	vec2 l_cellSize = glm::max(vec2(l_max - l_min) / (float)l_cells, vec2(1e-6f));
+
+	// First pass assigns each prop to a batch so the batch vector is not
+	// reallocated once props point into it.
+	vector<int> l_batchOf(sceneProps.size(), -1);
+	vector<const prop*> l_first;
+	vector<int> l_cellOf;
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		const prop &p = *sceneProps[i];
+		if (p.outline) continue;
+		vec2 l_c = (vec2(p.boundsMin + p.boundsMax) * 0.5f - vec2(l_min)) / l_cellSize;
+		int l_cell = glm::clamp((int)l_c.y, 0, l_cells - 1) * l_cells + glm::clamp((int)l_c.x, 0, l_cells - 1);
+		for (size_t b = 0; b < l_first.size() && l_batchOf[i] < 0; b++)
+		{
+			if (l_cellOf[b] == l_cell && l_first[b]->propColor == p.propColor && !memcmp(&l_first[b]->material, &p.material, sizeof(structMaterial)))
+				l_batchOf[i] = (int)b;
+		}
+		if (l_batchOf[i] < 0)
+		{
+			l_batchOf[i] = (int)l_first.size();
+			l_first.push_back(&p);
+			l_cellOf.push_back(l_cell);
+		}
+	}
+
+	batches.assign(l_first.size(), prop());
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		const prop &p = *sceneProps[i];
+		if (l_batchOf[i] < 0) continue;
+		prop &b = batches[l_batchOf[i]];
+		mat3 l_normalMatrix = transpose(inverse(mat3(p.Model)));
+		int l_base = (int)b.vertex.size();
+		for (int v = 0; v < p.numVertices; v++)
+		{
+			b.vertex.push_back(vec3(p.Model * vec4(p.vertex[v], 1.0f)));
+			b.normal.push_back(normalize(l_normalMatrix * p.normal[v]));
+		}
+		for (int k = 0; k < p.numIndices; k++) { b.index.push_back(l_base + p.index[k]); }
+	}
+
+	batchedProps.clear();
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		if (sceneProps[i]->outline) batchedProps.push_back(sceneProps[i]);
+	}
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		batches[b].numVertices = (int)batches[b].vertex.size();
+		batches[b].numIndices  = (int)batches[b].index.size();
+		batches[b].propColor   = l_first[b]->propColor;
+		batches[b].material    = l_first[b]->material;
+		batches[b].center      = l_first[b]->center;
+		batches[b].outline     = false;
+		batches[b].Model       = mat4(1.0f);
+		batches[b].upload();
+		batchedProps.push_back(&batches[b]);
+	}
+	printf("Batched %d props into %d draws\n", (int)sceneProps.size(), (int)batchedProps.size());
+}
+
+void drawProps(const mat4 &l_PV)
+{
+	if (drawBatched && batchedProps.empty()) buildBatches();
+	const vector<prop*> *l_props = drawBatched ? &batchedProps : &sceneProps;
+
+	// In split view a prop is culled only when it is outside every view.
+	int l_numViews = multiView.active ? multiView.numViews : 1;
+	vec4 l_planes[maxViews][6];
+	for (int v = 0; v < l_numViews; v++) { frustumPlanes(multiView.active ? multiView.PV[v] : l_PV, l_planes[v]); }
+
+	// The GPU path only runs on the main context and draws the filled props;
+	// whatever it skips (outlines) still goes through render().
+	bool l_mainContext = renderBackend == backendGL && renderContext == 0 && !multiView.active;
+	int l_gpuDrawn = (gpuCullProps && l_mainContext) ? gpuCullDraw(l_PV, l_planes[0]) : -1;
+	if (l_gpuDrawn >= 0)
+	{
+		l_props = &gpuSkippedProps;
+		sceneStats.propsDrawn += l_gpuDrawn;
+	}
+
+	bool l_occlusion = occlusionCull && l_mainContext;
+	if (l_occlusion) occlusionBeginFrame();
+	bool l_polylines = renderBackend == backendGL && !multiView.active && drawPolylines(l_PV);
+	bool l_terrain = renderBackend == backendGL && !multiView.active;
+	bool l_impostors = drawImpostors && l_mainContext;
+	if ((shadingLod.enabled || l_impostors) && renderBackend == backendGL) shadingLodBeginFrame(l_PV);
+	if (l_impostors) impostorBeginFrame();
+
+	for (size_t i = 0; i < l_props->size(); i++)
+	{
+		prop &p = *(*l_props)[i];
+		if (p.outline && l_polylines) continue;
+		if (cullProps)
+		{
+			int v = 0;
+			while (v < l_numViews && !inFrustum(l_planes[v], p)) { v++; }
+			if (v == l_numViews) { sceneStats.propsCulled++; continue; }
+		}
+		long long l_terrainTris = (&p == &ground && l_terrain) ? drawTerrain(l_PV) : -1;
+		if (l_terrainTris >= 0)
+		{
+			sceneStats.propsDrawn++;
+			sceneStats.triangles += l_terrainTris;
+			continue;
+		}
+		if (l_impostors && impostorDraw(p, l_PV))
+		{
+			sceneStats.propsDrawn++;
+			sceneStats.triangles += 2;
+			continue;
+		}
+		if (!l_occlusion) p.render(l_PV);
+		else if (!occlusionDraw(p, l_PV)) continue;
+		sceneStats.propsDrawn++;
+		sceneStats.triangles += p.outline ? 0 : p.numIndices / 3;
+	}
+	if (l_impostors) impostorFlush(l_PV);
+	if (l_occlusion) occlusionFlush(l_PV);
+}
+
+//----------------------------SPATIAL-INDEX-----------------------------
+// 2D R-tree over xy bounds (the scene is z-up, so footprints are what the
+// queries care about). Nodes live in one pool, indexed, with up to
+// rtreeMaxEntries children; level 0 nodes hold entry ids, whose rects are
+// kept in structRTree::rects. rtreeBuild() bulk-loads with STR (sort by x,
+// cut into vertical slices, sort each slice by y, pack); rtreeInsert()
+// picks the child needing the least enlargement and splits quadratically,
+// rtreeRemove() dissolves nodes that drop under rtreeMinEntries and
+// reinserts their entries. Queries take the lock shared, edits exclusive,
+// so any number of readers run together.
+//
+// sceneIndex holds the filled props of sceneProps (id = position there)
+// and is rebuilt with indexScene() whenever sceneProps changes. It backs
+// picking (mouseCB), the city camera presets and sceneFootprintAt().
+struct structRect { vec2 min, max; };
+
+const int rtreeMaxEntries = 16, rtreeMinEntries = 6;
+
+struct structRTreeNode { structRect rect; int level, count; int child[rtreeMaxEntries]; };
+
+struct structRTree
+{
+	vector<structRTreeNode> nodes;
+	vector<int> freeNodes;
+	vector<structRect> rects; // by entry id
+	int root, size;
+	mutable shared_mutex lock;
+};
+structRTree sceneIndex;
+
+structRect rectUnion(const structRect &a, const structRect &b)
+{
+	structRect r = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+	return r;
+}
+
+float rectArea(const structRect &r)
+{
+	return (r.max.x - r.min.x) * (r.max.y - r.min.y);
+}
+
+bool rectOverlaps(const structRect &a, const structRect &b)
+{
+	return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+
+float rectDistance2(const structRect &r, vec2 p)
+{
+	vec2 d = glm::max(glm::max(r.min - p, p - r.max), vec2(0.0f));
+	return dot(d, d);
+}
+
+// Whether the segment a-b touches r (slab test).
+bool rectSegment(const structRect &r, vec2 a, vec2 b)
+{
+	float t0 = 0.0f, t1 = 1.0f;
+	vec2 d = b - a;
+	for (int k = 0; k < 2; k++)
+	{
+		if (fabsf(d[k]) < 1e-12f)
+		{
+			if (a[k] < r.min[k] || a[k] > r.max[k]) return false;
+			continue;
+		}
+		float l_near = (r.min[k] - a[k]) / d[k], l_far = (r.max[k] - a[k]) / d[k];
+		if (l_near > l_far) std::swap(l_near, l_far);
+		t0 = std::max(t0, l_near);
+		t1 = std::min(t1, l_far);
+		if (t0 > t1) return false;
+	}
+	return true;
+}
+
+structRect rtreeChildRect(const structRTree &t, int n, int i)
+{
+	int c = t.nodes[n].child[i];
+	return (t.nodes[n].level == 0) ? t.rects[c] : t.nodes[c].rect;
+}
+
+int rtreeNewNode(structRTree &t, int level)
+{
+	int n;
+	if (!t.freeNodes.empty()) { n = t.freeNodes.back(); t.freeNodes.pop_back(); }
+	else { n = (int)t.nodes.size(); t.nodes.push_back(structRTreeNode()); }
+	t.nodes[n].level = level;
+	t.nodes[n].count = 0;
+	return n;
+}
+
+void rtreeRefit(structRTree &t, int n)
+{
+	structRect r = { vec2(1e30f), vec2(-1e30f) };
+	for (int i = 0; i < t.nodes[n].count; i++) { r = rectUnion(r, rtreeChildRect(t, n, i)); }
+	t.nodes[n].rect = r;
+}
+
+void rtreeClear(structRTree &t)
+{
+	t.nodes.clear();
+	t.freeNodes.clear();
+	t.rects.clear();
+	t.size = 0;
+	t.root = rtreeNewNode(t, 0);
+	rtreeRefit(t, t.root);
+}
+
+// STR bulk load of entries 0..rects.size()-1.
+void rtreeBuild(structRTree &t, const vector<structRect> &rects)
+{
+	unique_lock<shared_mutex> l_lock(t.lock);
+	rtreeClear(t);
+	if (rects.empty()) return;
+	t.rects = rects;
+	t.size = (int)rects.size();
+	t.nodes.reserve(rects.size() / (rtreeMaxEntries - 2) + 16);
+
+	vector<int> l_items(rects.size());
+	vector<vec2> l_centers(rects.size());
+	for (size_t i = 0; i < rects.size(); i++) { l_items[i] = (int)i; l_centers[i] = 0.5f * (rects[i].min + rects[i].max); }
+	t.nodes.clear();
+
+	int l_level = 0;
+	while (true)
+	{
+		int n = (int)l_items.size();
+		int l_leaves = (n + rtreeMaxEntries - 1) / rtreeMaxEntries;
+		int l_sliceSize = (int)ceil(sqrt((double)l_leaves)) * rtreeMaxEntries;
+		sort(l_items.begin(), l_items.end(), [&](int a, int b) { return l_centers[a].x < l_centers[b].x; });
+		for (int s = 0; s < n; s += l_sliceSize)
+		{
+			sort(l_items.begin() + s, l_items.begin() + std::min(s + l_sliceSize, n), [&](int a, int b) { return l_centers[a].y < l_centers[b].y; });
+		}
+
+		vector<int> l_parents;
+		vector<vec2> l_parentCenters;
+		for (int i = 0; i < n; i += rtreeMaxEntries)
+		{
+			int p = rtreeNewNode(t, l_level);
+			for (int k = i; k < std::min(i + rtreeMaxEntries, n); k++) { t.nodes[p].child[t.nodes[p].count++] = l_items[k]; }
+			rtreeRefit(t, p);
+			l_parents.push_back(p);
+		}
+		l_centers.resize(t.nodes.size());
+		for (size_t i = 0; i < l_parents.size(); i++) { l_centers[l_parents[i]] = 0.5f * (t.nodes[l_parents[i]].rect.min + t.nodes[l_parents[i]].rect.max); }
+		l_items.swap(l_parents);
+		l_level++;
+		if (l_items.size() == 1) break;
+	}
+	t.root = l_items[0];
+}
+
+// Splits node n, full, plus child c (quadratic split); returns the new sibling.
+int rtreeSplit(structRTree &t, int n, int c, const structRect &r)
+{
+	int l_children[rtreeMaxEntries + 1];
+	structRect l_rects[rtreeMaxEntries + 1];
+	for (int i = 0; i < rtreeMaxEntries; i++) { l_children[i] = t.nodes[n].child[i]; l_rects[i] = rtreeChildRect(t, n, i); }
+	l_children[rtreeMaxEntries] = c;
+	l_rects[rtreeMaxEntries] = r;
+	const int l_total = rtreeMaxEntries + 1;
+
+	// Seeds: the pair wasting the most area together.
+	int l_seedA = 0, l_seedB = 1;
+	float l_worst = -1e30f;
+	for (int i = 0; i < l_total; i++)
+	{
+		for (int j = i + 1; j < l_total; j++)
+		{
+			float l_waste = rectArea(rectUnion(l_rects[i], l_rects[j])) - rectArea(l_rects[i]) - rectArea(l_rects[j]);
+			if (l_waste > l_worst) { l_worst = l_waste; l_seedA = i; l_seedB = j; }
+		}
+	}
+
+	int s = rtreeNewNode(t, t.nodes[n].level);
+	structRTreeNode &A = t.nodes[n], &B = t.nodes[s];
+	A.count = B.count = 0;
+	A.child[A.count++] = l_children[l_seedA];  A.rect = l_rects[l_seedA];
+	B.child[B.count++] = l_children[l_seedB];  B.rect = l_rects[l_seedB];
+
+	bool l_assigned[rtreeMaxEntries + 1] = { false };
+	l_assigned[l_seedA] = l_assigned[l_seedB] = true;
+	for (int l_left = l_total - 2; l_left > 0; l_left--)
+	{
+		// A group that needs all the rest to reach the minimum takes them.
+		structRTreeNode *l_forced = (A.count + l_left == rtreeMinEntries) ? &A : (B.count + l_left == rtreeMinEntries) ? &B : NULL;
+		int l_pick = -1;
+		float l_best = -1.0f, l_growA = 0.0f, l_growB = 0.0f;
+		for (int i = 0; i < l_total; i++)
+		{
+			if (l_assigned[i]) continue;
+			float a = rectArea(rectUnion(A.rect, l_rects[i])) - rectArea(A.rect);
+			float b = rectArea(rectUnion(B.rect, l_rects[i])) - rectArea(B.rect);
+			if (fabsf(a - b) > l_best) { l_best = fabsf(a - b); l_pick = i; l_growA = a; l_growB = b; }
+		}
+		structRTreeNode &G = l_forced ? *l_forced : (l_growA < l_growB || (l_growA == l_growB && A.count <= B.count)) ? A : B;
+		G.child[G.count++] = l_children[l_pick];
+		G.rect = rectUnion(G.rect, l_rects[l_pick]);
+		l_assigned[l_pick] = true;
+	}
+	return s;
+}
+
+// Adds child c (an entry id at level 0, a node above) under node n at the
+// given level; returns the sibling when n had to split, else -1.
+int rtreeInsertAt(structRTree &t, int n, int c, const structRect &r, int level)
+{
+	if (t.nodes[n].level == level)
+	{
+		if (t.nodes[n].count == rtreeMaxEntries) return rtreeSplit(t, n, c, r);
+		t.nodes[n].child[t.nodes[n].count++] = c;
+		t.nodes[n].rect = (t.nodes[n].count == 1) ? r : rectUnion(t.nodes[n].rect, r);
+		return -1;
+	}
+
+	int l_best = 0;
+	float l_bestGrow = 1e30f, l_bestArea = 1e30f;
+	for (int i = 0; i < t.nodes[n].count; i++)
+	{
+		const structRect &cr = t.nodes[t.nodes[n].child[i]].rect;
+		float l_area = rectArea(cr), l_grow = rectArea(rectUnion(cr, r)) - l_area;
+		if (l_grow < l_bestGrow || (l_grow == l_bestGrow && l_area < l_bestArea)) { l_best = i; l_bestGrow = l_grow; l_bestArea = l_area; }
+	}
+	int l_child = t.nodes[n].child[l_best];
+	int s = rtreeInsertAt(t, l_child, c, r, level);
+	if (s < 0)
+	{
+		t.nodes[n].rect = rectUnion(t.nodes[n].rect, r);
+		return -1;
+	}
+	rtreeRefit(t, l_child);
+	structRect l_siblingRect = t.nodes[s].rect;
+	int l_split = rtreeInsertAt(t, n, s, l_siblingRect, t.nodes[n].level);
+	if (l_split < 0) rtreeRefit(t, n);
+	return l_split;
+}
+
+void rtreeInsertChild(structRTree &t, int c, const structRect &r, int level)
+{
+	int s = rtreeInsertAt(t, t.root, c, r, level);
+	if (s < 0) return;
+	int l_root = rtreeNewNode(t, t.nodes[t.root].level + 1);
+	t.nodes[l_root].child[0] = t.root;
+	t.nodes[l_root].child[1] = s;
+	t.nodes[l_root].count = 2;
+	rtreeRefit(t, l_root);
+	t.root = l_root;
+}
+
+void rtreeInsert(structRTree &t, int id, const structRect &r)
+{
+	unique_lock<shared_mutex> l_lock(t.lock);
+	if (id >= (int)t.rects.size()) t.rects.resize(id + 1);
+	t.rects[id] = r;
+	rtreeInsertChild(t, id, r, 0);
+	t.size++;
+}
+
+// Frees the subtree under n, collecting its entry ids.
+void rtreeDissolve(structRTree &t, int n, vector<int> &entries)
+{
+	for (int i = 0; i < t.nodes[n].count; i++)
+	{
+		if (t.nodes[n].level == 0) entries.push_back(t.nodes[n].child[i]);
+		else rtreeDissolve(t, t.nodes[n].child[i], entries);
+	}
+	t.freeNodes.push_back(n);
+}
+
+bool rtreeRemoveAt(structRTree &t, int n, int id, const structRect &r, vector<int> &orphans)
+{
+	structRTreeNode &l_node = t.nodes[n];
+	if (l_node.level == 0)
+	{
+		for (int i = 0; i < l_node.count; i++)
+		{
+			if (l_node.child[i] != id) continue;
+			l_node.child[i] = l_node.child[--l_node.count];
+			rtreeRefit(t, n);
+			return true;
+		}
+		return false;
+	}
+	for (int i = 0; i < t.nodes[n].count; i++)
+	{
+		int c = t.nodes[n].child[i];
+		if (!rectOverlaps(t.nodes[c].rect, r) || !rtreeRemoveAt(t, c, id, r, orphans)) continue;
+		if (t.nodes[c].count < rtreeMinEntries)
+		{
+			rtreeDissolve(t, c, orphans);
+			t.nodes[n].child[i] = t.nodes[n].child[--t.nodes[n].count];
+		}
+		rtreeRefit(t, n);
+		return true;
+	}
+	return false;
+}
+
+bool rtreeRemove(structRTree &t, int id)
+{
+	unique_lock<shared_mutex> l_lock(t.lock);
+	if (id < 0 || id >= (int)t.rects.size()) return false;
+	vector<int> l_orphans;
+	if (!rtreeRemoveAt(t, t.root, id, t.rects[id], l_orphans)) return false;
+	t.size--;
+	while (t.nodes[t.root].level > 0 && t.nodes[t.root].count == 1)
+	{
+		t.freeNodes.push_back(t.root);
+		t.root = t.nodes[t.root].child[0];
+	}
+	if (t.nodes[t.root].count == 0) t.nodes[t.root].level = 0;
+	for (size_t i = 0; i < l_orphans.size(); i++) { rtreeInsertChild(t, l_orphans[i], t.rects[l_orphans[i]], 0); }
+	return true;
+}
+
+// Entries whose rect overlaps r.
+void rtreeRange(const structRTree &t, const structRect &r, vector<int> &out)
+{
+	shared_lock<shared_mutex> l_lock(t.lock);
+	out.clear();
+	if (t.size == 0) return;
+	int l_stack[512], l_top = 0;
+	l_stack[l_top++] = t.root;
+	while (l_top > 0)
+	{
+		const structRTreeNode &l_node = t.nodes[l_stack[--l_top]];
+		for (int i = 0; i < l_node.count; i++)
+		{
+			int c = l_node.child[i];
+			if (l_node.level == 0) { if (rectOverlaps(t.rects[c], r)) out.push_back(c); }
+			else if (rectOverlaps(t.nodes[c].rect, r)) l_stack[l_top++] = c;
+		}
+	}
+}
+
+// Entries whose rect the segment a-b crosses.
+void rtreeSegment(const structRTree &t, vec2 a, vec2 b, vector<int> &out)
+{
+	shared_lock<shared_mutex> l_lock(t.lock);
+	out.clear();
+	if (t.size == 0) return;
+	int l_stack[512], l_top = 0;
+	l_stack[l_top++] = t.root;
+	while (l_top > 0)
+	{
+		const structRTreeNode &l_node = t.nodes[l_stack[--l_top]];
+		for (int i = 0; i < l_node.count; i++)
+		{
+			int c = l_node.child[i];
+			if (l_node.level == 0) { if (rectSegment(t.rects[c], a, b)) out.push_back(c); }
+			else if (rectSegment(t.nodes[c].rect, a, b)) l_stack[l_top++] = c;
+		}
+	}
+}
+
+// The k entries with the nearest rects to p, nearest first (best-first
+// search; a node's distance never exceeds any of its entries').
+void rtreeNearest(const structRTree &t, vec2 p, int k, vector<int> &out)
+{
+	shared_lock<shared_mutex> l_lock(t.lock);
+	out.clear();
+	if (t.size == 0 || k <= 0) return;
+	typedef pair<float, int> structQueued; // distance^2, node (>= 0) or ~entry id
+	priority_queue<structQueued, scratchVector<structQueued>, greater<structQueued> > l_queue;
+	l_queue.push(structQueued(rectDistance2(t.nodes[t.root].rect, p), t.root));
+	while (!l_queue.empty() && (int)out.size() < k)
+	{
+		structQueued q = l_queue.top();
+		l_queue.pop();
+		if (q.second < 0) { out.push_back(~q.second); continue; }
+		const structRTreeNode &l_node = t.nodes[q.second];
+		for (int i = 0; i < l_node.count; i++)
+		{
+			int c = l_node.child[i];
+			if (l_node.level == 0) l_queue.push(structQueued(rectDistance2(t.rects[c], p), ~c));
+			else l_queue.push(structQueued(rectDistance2(t.nodes[c].rect, p), c));
+		}
+	}
+}
+
+structRect propRect(const prop &p)
+{
+	structRect r = { vec2(p.boundsMin), vec2(p.boundsMax) };
+	return r;
+}
+
+void indexScene()
+{
+	vector<structRect> l_rects(sceneProps.size());
+	for (size_t i = 0; i < sceneProps.size(); i++) { l_rects[i] = propRect(*sceneProps[i]); }
+	rtreeBuild(sceneIndex, l_rects);
+	// The ground covers everything and outlines are not solid.
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		if (sceneProps[i] == &ground || sceneProps[i]->outline) rtreeRemove(sceneIndex, (int)i);
+	}
+}
+
+// Whether xy lies under the prop: inside the xy projection of any of its
+// triangles, which for an extruded building is its footprint.
+bool propFootprintContains(const prop &p, vec2 xy)
+{
+	for (int t = 0; t + 2 < p.numIndices; t += 3)
+	{
+		vec2 a = vec2(vec3(p.Model * vec4(p.vertex[p.index[t]], 1.0f)));
+		vec2 b = vec2(vec3(p.Model * vec4(p.vertex[p.index[t + 1]], 1.0f)));
+		vec2 c = vec2(vec3(p.Model * vec4(p.vertex[p.index[t + 2]], 1.0f)));
+		float d0 = (b.x - a.x) * (xy.y - a.y) - (b.y - a.y) * (xy.x - a.x);
+		float d1 = (c.x - b.x) * (xy.y - b.y) - (c.y - b.y) * (xy.x - b.x);
+		float d2 = (a.x - c.x) * (xy.y - c.y) - (a.y - c.y) * (xy.x - c.x);
+		if ((d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0)) return true;
+	}
+	return false;
+}
+
+// The tallest prop standing on xy, or -1.
+int sceneFootprintAt(vec2 xy)
+{
+	vector<int> l_hits;
+	structRect r = { xy, xy };
+	rtreeRange(sceneIndex, r, l_hits);
+	int l_best = -1;
+	for (size_t i = 0; i < l_hits.size(); i++)
+	{
+		const prop &p = *sceneProps[l_hits[i]];
+		if (!propFootprintContains(p, xy)) continue;
+		if (l_best < 0 || p.boundsMax.z > sceneProps[l_best]->boundsMax.z) l_best = l_hits[i];
+	}
+	return l_best;
+}
+
+// Nearest prop hit by the ray through window pixel (x, y), or -1. The ray
+// is clipped to the scene's height range and the index gives the props
+// whose footprint bounds it passes over; those get exact triangle tests.
+int pickProp(double x, double y, int width, int height)
+{
+	mat4 l_inverse = inverse(PV);
+	vec2 l_ndc = vec2(2.0f * (float)x / width - 1.0f, 1.0f - 2.0f * (float)y / height);
+	vec4 l_near = l_inverse * vec4(l_ndc.x, l_ndc.y, -1.0f, 1.0f), l_far = l_inverse * vec4(l_ndc.x, l_ndc.y, 1.0f, 1.0f);
+	vec3 l_origin = vec3(l_near) / l_near.w, l_dir = normalize(vec3(l_far) / l_far.w - l_origin);
+
+	float l_top = 0.0f, t0 = 0.0f, t1 = 1e3f;
+	for (size_t i = 0; i < sceneProps.size(); i++) { l_top = std::max(l_top, sceneProps[i]->boundsMax.z); }
+	if (fabsf(l_dir.z) > 1e-6f)
+	{
+		float a = (l_top - l_origin.z) / l_dir.z, b = -l_origin.z / l_dir.z;
+		t0 = std::max(0.0f, std::min(a, b));
+		t1 = std::max(a, b);
+		if (t1 < 0.0f) return -1;
+	}
+
+	vector<int> l_candidates;
+	rtreeSegment(sceneIndex, vec2(l_origin + t0 * l_dir), vec2(l_origin + t1 * l_dir), l_candidates);
+	int l_best = -1;
+	float l_bestT = 1e30f;
+	for (size_t i = 0; i < l_candidates.size(); i++)
+	{
+		const prop &p = *sceneProps[l_candidates[i]];
+		for (int t = 0; t + 2 < p.numIndices; t += 3)
+		{
+			vec3 a = vec3(p.Model * vec4(p.vertex[p.index[t]], 1.0f));
+			vec3 e1 = vec3(p.Model * vec4(p.vertex[p.index[t + 1]], 1.0f)) - a;
+			vec3 e2 = vec3(p.Model * vec4(p.vertex[p.index[t + 2]], 1.0f)) - a;
+			vec3 h = cross(l_dir, e2);
+			float l_det = dot(e1, h);
+			if (fabsf(l_det) < 1e-12f) continue;
+			vec3 s = l_origin - a;
+			float u = dot(s, h) / l_det;
+			vec3 q = cross(s, e1);
+			float v = dot(l_dir, q) / l_det, l_t = dot(e2, q) / l_det;
+			if (u < 0.0f || v < 0.0f || u + v > 1.0f || l_t <= 0.0f || l_t >= l_bestT) continue;
+			l_bestT = l_t;
+			l_best = l_candidates[i];
+		}
+	}
+	return l_best;
+}
+
+//--------------------------OCCLUSION-CULLING---------------------------
+// Hardware occlusion culling with temporal coherence (main context only).
+// Props that were visible last frame are drawn first as occluders; every
+// visibleInterval frames (staggered per prop) their real draw is wrapped in
+// an ANY_SAMPLES_PASSED query to see whether they are still visible. Props
+// that were hidden last frame are collected and, once the occluders are in
+// the depth buffer, tested with their bounding box (colour and depth writes
+// off) and drawn under glBeginConditionalRender, so the GPU skips them if
+// the box produced no samples. Results are picked up a frame later only
+// when already available, so the CPU never waits on a query.
+struct structOcclusion
+{
+	int visibleInterval, frame, nextPhase, queries;
+	GLuint boxProg, boxVAO, boxVBO, boxIBO;
+	GLint PVLoc, boxMinLoc, boxMaxLoc;
+	vector<prop*> hidden;
+};
+structOcclusion occlusion = { 4, 0, 0, 0 };
+
+const char* boxVertexShader =
+	"#version 400\n"
+	"in vec3 vertexPos;"
+	"uniform mat4 PV;"
+	"uniform vec3 boxMin;"
+	"uniform vec3 boxMax;"
+	"void main ()"
+	"{"
+	"    gl_Position = PV * vec4(mix(boxMin, boxMax, vertexPos), 1.0f);"
+	"}";
+
+void initOcclusion()
+{
+	vec3 l_corner[8];
+	for (int i = 0; i < 8; i++) { l_corner[i] = vec3((float)(i & 1), (float)((i >> 1) & 1), (float)((i >> 2) & 1)); }
+	GLuint l_index[36] =
+	{
+		0, 2, 1,   1, 2, 3,      4, 5, 6,   5, 7, 6,
+		0, 1, 4,   1, 5, 4,      2, 6, 3,   3, 6, 7,
+		0, 4, 2,   2, 4, 6,      1, 3, 5,   3, 7, 5
+	};
+
+	occlusion.boxProg   = initShaders(boxVertexShader, fragmentShader);
+	occlusion.PVLoc     = glGetUniformLocation(occlusion.boxProg, "PV");
+	occlusion.boxMinLoc = glGetUniformLocation(occlusion.boxProg, "boxMin");
+	occlusion.boxMaxLoc = glGetUniformLocation(occlusion.boxProg, "boxMax");
+
+	glGenVertexArrays(1, &occlusion.boxVAO);
+	glBindVertexArray(occlusion.boxVAO);
+	glGenBuffers(1, &occlusion.boxVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, occlusion.boxVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(l_corner), l_corner, GL_STATIC_DRAW);
+	glGenBuffers(1, &occlusion.boxIBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, occlusion.boxIBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(l_index), l_index, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(vertexPosAttrib);
+	glVertexAttribPointer(vertexPosAttrib, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+	glBindVertexArray(0);
+}
+
+// A box that reaches the near plane would be clipped and could report no
+// samples while the prop is in view, so such props always count as visible.
+bool occlusionNearCamera(const prop &p, const mat4 &l_PV)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		vec4 l_clip = l_PV * vec4((i & 1) ? p.boundsMax.x : p.boundsMin.x, (i & 2) ? p.boundsMax.y : p.boundsMin.y, (i & 4) ? p.boundsMax.z : p.boundsMin.z, 1.0f);
+		if (l_clip.z < -l_clip.w || l_clip.w <= 0.0f) return true;
+	}
+	return false;
+}
+
+void occlusionBeginFrame()
+{
+	if (occlusion.boxProg == 0) initOcclusion();
+	occlusion.frame++;
+	occlusion.queries = 0;
+	occlusion.hidden.clear();
+}
+
+// Draws p now if it was visible last frame and returns true; otherwise
+// queues it for occlusionFlush() and returns false.
+bool occlusionDraw(prop &p, const mat4 &l_PV)
+{
+	if (p.outline) { p.render(l_PV); return true; }
+	if (p.occQuery == 0)
+	{
+		glGenQueries(1, &p.occQuery);
+		p.occPhase = occlusion.nextPhase++;
+	}
+	if (p.occPending)
+	{
+		GLuint l_ready = 0, l_samples = 0;
+		glGetQueryObjectuiv(p.occQuery, GL_QUERY_RESULT_AVAILABLE, &l_ready);
+		if (l_ready)
+		{
+			glGetQueryObjectuiv(p.occQuery, GL_QUERY_RESULT, &l_samples);
+			p.occVisible = (l_samples != 0);
+			p.occPending = false;
+		}
+	}
+	if (!p.occVisible && occlusionNearCamera(p, l_PV)) p.occVisible = true;
+
+	if (!p.occVisible)
+	{
+		occlusion.hidden.push_back(&p);
+		return false;
+	}
+	if (!p.occPending && (occlusion.frame + p.occPhase) % occlusion.visibleInterval == 0)
+	{
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, p.occQuery);
+		p.render(l_PV);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		p.occPending = true;
+		occlusion.queries++;
+	}
+	else p.render(l_PV);
+	return true;
+}
+
+// Box-tests the props hidden last frame against what has been drawn so far
+// and draws them conditionally on the result.
+void occlusionFlush(const mat4 &l_PV)
+{
+	if (occlusion.hidden.empty()) return;
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glUseProgram(occlusion.boxProg);
+	glUniformMatrix4fv(occlusion.PVLoc, 1, GL_FALSE, value_ptr(l_PV));
+	glBindVertexArray(occlusion.boxVAO);
+	for (size_t i = 0; i < occlusion.hidden.size(); i++)
+	{
+		prop &p = *occlusion.hidden[i];
+		if (p.occPending) continue; // still waiting; the draw below reuses that query
+		vec3 l_pad = (p.boundsMax - p.boundsMin) * 0.001f + vec3(1e-5f);
+		glUniform3fv(occlusion.boxMinLoc, 1, value_ptr(p.boundsMin - l_pad));
+		glUniform3fv(occlusion.boxMaxLoc, 1, value_ptr(p.boundsMax + l_pad));
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, p.occQuery);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		p.occPending = true;
+		occlusion.queries++;
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+
+	for (size_t i = 0; i < occlusion.hidden.size(); i++)
+	{
+		prop &p = *occlusion.hidden[i];
+		glBeginConditionalRender(p.occQuery, GL_QUERY_WAIT);
+		p.render(l_PV);
+		glEndConditionalRender();
+	}
+	sceneStats.propsOccluded += (int)occlusion.hidden.size();
+}
+
+//-----------------------------GPU-CULLING------------------------------
+// GPU-driven path for large scenes. All filled props are baked once, in
+// world space, into one vertex/index megabuffer with a per-prop record
+// (bounds, colour, material) in an SSBO. Each frame a compute shader tests
+// every record against the frustum and appends the indirect draw command of
+// each visible prop, and one glMultiDrawElementsIndirectCountARB draws them
+// all, so the CPU cost no longer grows with the number of props. Without
+// ARB_indirect_parameters the shader writes every command in place with
+// instanceCount 0 for culled props and glMultiDrawElementsIndirect draws the
+// whole list. baseInstance carries the prop index to the draw shaders via a
+// per-instance attribute.
+struct structGpuProp { vec4 boundsMin, boundsMax, color, ambient, diffuse, specular; }; // specular.w = shininess
+struct structDrawCmd { GLuint count, instanceCount, firstIndex; GLint baseVertex; GLuint baseInstance; };
+
+struct structGpuCull
+{
+	bool dirty, supported, useCount;
+	int numProps;
+	GLuint VAO, VBO, IBO, idBuffer, propBuffer, sourceBuffer, drawBuffer, countBuffer;
+	GLuint cullProg, drawProg;
+	GLint planesLoc, numPropsLoc, compactLoc, PVLoc, gouraudLoc, numLightsLoc, lightPosLoc, lightColorLoc;
+};
+structGpuCull gpuCull = { true, false, false, 0 };
+
+const char* gpuShaderCommon =
+	"#version 430\n"
+
+	"struct Prop { vec4 boundsMin, boundsMax, color, ambient, diffuse, specular; };"
+	"layout(std430, binding = 0) readonly buffer Props { Prop props[]; };"
+
+	"uniform int  numLights;"
+	"uniform vec4 lightPos[8];"
+	"uniform vec3 lightColor[8];"
+	"uniform bool gouraud;"
+
+	"vec3 shade(uint id, vec3 N, vec3 P)"
+	"{"
+	"    Prop p         = props[id];"
+	"    vec3 V         = normalize(-P);"
+	"    vec3 ambiProd  = vec3(0.0f);"
+	"    vec3 lightProd = vec3(0.0f);"
+	"    for(int i = 0; i < numLights; i++)"
+	"    {"
+	"        vec3 L    = normalize( vec3(lightPos[i]) - P * lightPos[i].w );"
+	"        ambiProd += lightColor[i];"
+	"        if(dot(N,L) > 0)"
+	"        {"
+	"            vec3 R     = normalize( reflect(-L, N) );"
+	"            lightProd += lightColor[i] * ( p.diffuse.rgb * max( dot(N, L), 0.0f ) + p.specular.rgb * pow( max( dot(R, V), 0.0f ), p.specular.w ) );"
+	"        }"
+	"    }"
+	"    return clamp( p.color.rgb * ( (ambiProd * p.ambient.rgb) + lightProd ), 0.0f, 1.0f );"
+	"}\n";
+
+const char* gpuVertexShader =
+	"in vec3 vertexPos;"
+	"in vec3 normalPos;"
+	"layout(location = 2) in uint propId;"
+
+	"uniform mat4 PV;"
+
+	"out vec3 fN;"
+	"out vec3 fP;"
+	"out vec3 color;"
+	"flat out uint fProp;"
+
+	"void main ()"
+	"{"
+	"    gl_Position = PV * vec4(vertexPos, 1.0f);"
+	"    fN          = normalPos;"
+	"    fP          = vertexPos;"
+	"    fProp       = propId;"
+	"    if(gouraud) color = shade(propId, normalize(normalPos), vertexPos);"
+	"}";
+
+const char* gpuFragmentShader =
+	"in vec3 fN;"
+	"in vec3 fP;"
+	"in vec3 color;"
+	"flat in uint fProp;"
+
+	"out vec4 frag_color;"
+
+	"void main ()"
+	"{"
+	"    frag_color = vec4(gouraud ? color : shade(fProp, normalize(fN), fP), 1.0f);"
+	"}";
+
+const char* gpuCullShader =
+	"#version 430\n"
+	"layout(local_size_x = 64) in;"
+
+	"struct Prop { vec4 boundsMin, boundsMax, color, ambient, diffuse, specular; };"
+	"struct Cmd  { uint count, instanceCount, firstIndex; int baseVertex; uint baseInstance; };"
+	"layout(std430, binding = 0) readonly  buffer Props  { Prop props[]; };"
+	"layout(std430, binding = 1) readonly  buffer Source { Cmd source[]; };"
+	"layout(std430, binding = 2) writeonly buffer Draws  { Cmd draws[]; };"
+	"layout(std430, binding = 3)           buffer Count  { uint drawCount; };"
+
+	"uniform vec4 planes[6];"
+	"uniform uint numProps;"
+	"uniform bool compact;"
+
+	"void main ()"
+	"{"
+	"    uint i = gl_GlobalInvocationID.x;"
+	"    if(i >= numProps) return;"
+	"    vec3 center = (props[i].boundsMin.xyz + props[i].boundsMax.xyz) * 0.5f;"
+	"    vec3 extent = (props[i].boundsMax.xyz - props[i].boundsMin.xyz) * 0.5f;"
+	"    bool visible = true;"
+	"    for(int p = 0; p < 6; p++)"
+	"        if(dot(planes[p].xyz, center) + dot(abs(planes[p].xyz), extent) + planes[p].w < 0.0f) visible = false;"
+	"    if(compact)"
+	"    {"
+	"        if(visible) draws[atomicAdd(drawCount, 1u)] = source[i];"
+	"    }"
+	"    else"
+	"    {"
+	"        Cmd cmd = source[i];"
+	"        cmd.instanceCount = visible ? 1u : 0u;"
+	"        draws[i] = cmd;"
+	"    }"
+	"}";
+
+bool initGpuCull()
+{
+	gpuCull.dirty = false;
+	gpuCull.supported = (GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_multi_draw_indirect)) != 0;
+	if (!gpuCull.supported)
+	{
+		fprintf(stderr, "GPU culling needs compute shaders, SSBOs and multi-draw-indirect; using CPU culling\n");
+		return false;
+	}
+	gpuCull.useCount = GLEW_ARB_indirect_parameters != 0;
+
+	if (gpuCull.cullProg == 0)
+	{
+		gpuCull.cullProg = initComputeShader(gpuCullShader);
+		gpuCull.planesLoc   = glGetUniformLocation(gpuCull.cullProg, "planes");
+		gpuCull.numPropsLoc = glGetUniformLocation(gpuCull.cullProg, "numProps");
+		gpuCull.compactLoc  = glGetUniformLocation(gpuCull.cullProg, "compact");
+
+		gpuCull.drawProg = initShaders((string(gpuShaderCommon) + gpuVertexShader).c_str(), (string(gpuShaderCommon) + gpuFragmentShader).c_str());
+		gpuCull.PVLoc         = glGetUniformLocation(gpuCull.drawProg, "PV");
+		gpuCull.gouraudLoc    = glGetUniformLocation(gpuCull.drawProg, "gouraud");
+		gpuCull.numLightsLoc  = glGetUniformLocation(gpuCull.drawProg, "numLights");
+		gpuCull.lightPosLoc   = glGetUniformLocation(gpuCull.drawProg, "lightPos");
+		gpuCull.lightColorLoc = glGetUniformLocation(gpuCull.drawProg, "lightColor");
+
+		glGenVertexArrays(1, &gpuCull.VAO);
+		glGenBuffers(1, &gpuCull.VBO);
+		glGenBuffers(1, &gpuCull.IBO);
+		glGenBuffers(1, &gpuCull.idBuffer);
+		glGenBuffers(1, &gpuCull.propBuffer);
+		glGenBuffers(1, &gpuCull.sourceBuffer);
+		glGenBuffers(1, &gpuCull.drawBuffer);
+		glGenBuffers(1, &gpuCull.countBuffer);
+	}
+
+	vector<vec3> l_vertex, l_normal;
+	vector<GLuint> l_index, l_ids;
+	vector<structGpuProp> l_props;
+	vector<structDrawCmd> l_cmds;
+	gpuSkippedProps.clear();
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		const prop &p = *sceneProps[i];
+		if (p.outline) { gpuSkippedProps.push_back(sceneProps[i]); continue; }
+		mat3 l_normalMatrix = transpose(inverse(mat3(p.Model)));
+		structDrawCmd l_cmd = { (GLuint)p.numIndices, 1, (GLuint)l_index.size(), (GLint)l_vertex.size(), (GLuint)l_props.size() };
+		for (int v = 0; v < p.numVertices; v++)
+		{
+			l_vertex.push_back(vec3(p.Model * vec4(p.vertex[v], 1.0f)));
+			l_normal.push_back(normalize(l_normalMatrix * p.normal[v]));
+		}
+		l_index.insert(l_index.end(), p.index.begin(), p.index.begin() + p.numIndices);
+		structGpuProp l_prop = { vec4(p.boundsMin, 1.0f), vec4(p.boundsMax, 1.0f), vec4(p.propColor, 1.0f),
+		                         vec4(p.material.ambient, 0.0f), vec4(p.material.diffuse, 0.0f), vec4(p.material.specular, p.material.shininess) };
+		l_ids.push_back((GLuint)l_props.size());
+		l_props.push_back(l_prop);
+		l_cmds.push_back(l_cmd);
+	}
+	gpuCull.numProps = (int)l_props.size();
+	if (gpuCull.numProps == 0) return false;
+
+	size_t l_sizeOfVertices = sizeof(vec3) * l_vertex.size();
+	glBindVertexArray(gpuCull.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, gpuCull.VBO);
+	glBufferData(GL_ARRAY_BUFFER, l_sizeOfVertices * 2, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, l_sizeOfVertices, &l_vertex[0]);
+	glBufferSubData(GL_ARRAY_BUFFER, l_sizeOfVertices, l_sizeOfVertices, &l_normal[0]);
+	glEnableVertexAttribArray(vertexPosAttrib);
+	glVertexAttribPointer(vertexPosAttrib, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+	glEnableVertexAttribArray(normalPosAttrib);
+	glVertexAttribPointer(normalPosAttrib, 3, GL_FLOAT, GL_FALSE, 0, (void *)l_sizeOfVertices);
+
+	glBindBuffer(GL_ARRAY_BUFFER, gpuCull.idBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * l_ids.size(), &l_ids[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(2);
+	glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, (void *)0);
+	glVertexAttribDivisor(2, 1);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuCull.IBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * l_index.size(), &l_index[0], GL_STATIC_DRAW);
+	glBindVertexArray(0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.propBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(structGpuProp) * l_props.size(), &l_props[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.sourceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(structDrawCmd) * l_cmds.size(), &l_cmds[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(structDrawCmd) * l_cmds.size(), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.countBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	printf("GPU culling: %d props, %d vertices, %d triangles in one megabuffer (%s)\n", gpuCull.numProps, (int)l_vertex.size(), (int)l_index.size() / 3,
+		gpuCull.useCount ? "MultiDrawElementsIndirectCount" : "MultiDrawElementsIndirect");
+	return true;
+}
+
+// Culls and draws every filled prop. Returns how many were submitted to the
+// cull pass, or -1 when the path is unavailable and the caller should draw
+// them itself.
+int gpuCullDraw(const mat4 &l_PV, const vec4 *planes)
+{
+	if (gpuCull.dirty && !initGpuCull()) gpuCull.supported = false;
+	if (!gpuCull.supported) return -1;
+
+	GLuint l_zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.countBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &l_zero);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuCull.propBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpuCull.sourceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpuCull.drawBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, gpuCull.countBuffer);
+
+	glUseProgram(gpuCull.cullProg);
+	glUniform4fv(gpuCull.planesLoc, 6, value_ptr(planes[0]));
+	glUniform1ui(gpuCull.numPropsLoc, (GLuint)gpuCull.numProps);
+	glUniform1i(gpuCull.compactLoc, gpuCull.useCount ? 1 : 0);
+	glDispatchCompute((gpuCull.numProps + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(gpuCull.drawProg);
+	glUniformMatrix4fv(gpuCull.PVLoc, 1, GL_FALSE, value_ptr(l_PV));
+	glUniform1i(gpuCull.gouraudLoc, phong ? 0 : 1);
+	glUniform1i(gpuCull.numLightsLoc, numLights);
+	glUniform4fv(gpuCull.lightPosLoc, numLights, value_ptr(lightPos[0]));
+	glUniform3fv(gpuCull.lightColorLoc, numLights, value_ptr(lightColor[0]));
+
+	glBindVertexArray(gpuCull.VAO);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCull.drawBuffer);
+	if (gpuCull.useCount)
+	{
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, gpuCull.countBuffer);
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, gpuCull.numProps, 0);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	}
+	else
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, gpuCull.numProps, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	return gpuCull.numProps;
+}
+
+// How many props and triangles the last cull pass kept. Reads the draw
+// commands back, so this is for stats after glFinish(), not per-frame use.
+int gpuCullCount(long long &triangles)
+{
+	GLuint l_count = (GLuint)gpuCull.numProps;
+	if (gpuCull.useCount)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.countBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &l_count);
+	}
+	vector<structDrawCmd> l_cmds(l_count);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuCull.drawBuffer);
+	if (l_count) glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(structDrawCmd) * l_count, &l_cmds[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	int l_drawn = 0;
+	triangles = 0;
+	for (GLuint i = 0; i < l_count; i++)
+	{
+		if (l_cmds[i].instanceCount == 0) continue;
+		l_drawn++;
+		triangles += l_cmds[i].count / 3;
+	}
+	return l_drawn;
+}
+
+//------------------------------IMPOSTORS-------------------------------
+// With drawImpostors (I, --impostors) a filled prop whose bounds cover
+// fewer than maxPixels on screen is drawn as one quad instead of its mesh.
+// bakeImpostors() renders every prop once from impostorViews directions
+// (eight around at 20 and at 55 degrees up, and one from straight above)
+// into tileSize x tileSize tiles of an array texture. A texel holds the
+// world normal in rgb and the depth through the prop's bounding sphere in
+// a, with a = 0 where the prop is not. The quad is the sphere's cross
+// section seen from the baked direction nearest the eye, so it faces the
+// camera to within the spacing of the views and the tile maps onto it
+// without shearing. Its fragments rebuild the surface position from the
+// depth, light it like fragmentShader1 with the prop's colour and material
+// and write their real depth, so impostors take the current lights and
+// sort against meshes. All the impostors of a frame go out in one
+// instanced draw. Only the main context and the plain GL path use them;
+// the ground is never one.
+const int impostorViews = 17; // viewRight[17] etc. in the shaders
+
+struct structImpostorInstance { vec4 sphere, color, ambient, diffuse, specular; GLuint tile; }; // specular.w = shininess
+
+struct structImpostors
+{
+	bool dirty;
+	float maxPixels;
+	int tileSize, layerSize, tilesPerRow, layers, baked;
+	vec3 viewRight[impostorViews], viewUp[impostorViews], viewDir[impostorViews];
+	GLuint atlas, FBO, depthRB, bakeProg, drawProg, VAO, instanceBuffer;
+	GLint bakeModelLoc, bakeSphereLoc, bakeFirstTileLoc, bakeTilesPerRowLoc, bakeTileScaleLoc;
+	GLint PVLoc, eyeLoc, tilesPerRowLoc, tilesPerLayerLoc, tileScaleLoc, numLightsLoc, lightPosLoc, lightColorLoc;
+	vector<structImpostorInstance> records, queue; // records[prop.impostor - 1]
+	double bakeMs;
+};
+structImpostors impostors = { true, 256.0f, 16 };
+
+const char* impostorShaderCommon =
+	"#version 400\n"
+	"uniform vec3 viewRight[17];"
+	"uniform vec3 viewUp[17];"
+	"uniform vec3 viewDir[17];"
+	"uniform int  tilesPerRow;"
+	"uniform float tileScale;\n";
+
+// Sphere space of view v: x right, y up, z towards the eye, all in [-1, 1].
+const char* impostorBakeVertexShader =
+	"in vec3 vertexPos;"
+	"in vec3 normalPos;"
+
+	"uniform mat4 Model;"
+	"uniform vec4 sphere;"
+	"uniform int  firstTile;"
+
+	"out vec3 fN;"
+
+	"void main ()"
+	"{"
+	"    int  v     = gl_InstanceID;"
+	"    int  tile  = firstTile + v;"
+	"    vec3 P     = vec3(Model * vec4(vertexPos, 1.0f)) - sphere.xyz;"
+	"    vec3 q     = vec3(dot(P, viewRight[v]), dot(P, viewUp[v]), dot(P, viewDir[v])) / sphere.w;"
+	"    vec2 cell  = vec2(tile % tilesPerRow, tile / tilesPerRow);"
+	"    gl_Position = vec4((cell + q.xy * 0.5f + 0.5f) * tileScale * 2.0f - 1.0f, -q.z, 1.0f);"
+	"    fN          = vec3(Model * vec4(normalPos, 0.0f));"
+	"}";
+
+const char* impostorBakeFragmentShader =
+	"in vec3 fN;"
+	"out vec4 frag_color;"
+	"void main ()"
+	"{"
+	"    frag_color = vec4(normalize(fN) * 0.5f + 0.5f, 1.0f - gl_FragCoord.z * (254.0f / 255.0f));"
+	"}";
+
+const char* impostorVertexShader =
+	"layout(location = 0) in vec4 sphere;"
+	"layout(location = 1) in vec4 color;"
+	"layout(location = 2) in vec4 ambient;"
+	"layout(location = 3) in vec4 diffuse;"
+	"layout(location = 4) in vec4 specular;"
+	"layout(location = 5) in uint tile;"
+
+	"uniform mat4 PV;"
+	"uniform vec3 eye;"
+	"uniform int  tilesPerLayer;"
+
+	"out vec2 uv;"
+	"flat out vec3 fCell;"
+	"flat out int  fView;"
+	"flat out vec4 fSphere, fColor, fAmbient, fDiffuse, fSpecular;"
+
+	"void main ()"
+	"{"
+	"    vec3 toEye = normalize(eye - sphere.xyz);"
+	"    int  view  = 0;"
+	"    for(int v = 1; v < 17; v++)"
+	"        if(dot(toEye, viewDir[v]) > dot(toEye, viewDir[view])) view = v;"
+	"    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0f - 1.0f;"
+	"    gl_Position = PV * vec4(sphere.xyz + (corner.x * viewRight[view] + corner.y * viewUp[view]) * sphere.w, 1.0f);"
+	"    uv          = corner * 0.5f + 0.5f;"
+	"    int t       = int(tile) + view;"
+	"    int inLayer = t % tilesPerLayer;"
+	"    fCell       = vec3(inLayer % tilesPerRow, inLayer / tilesPerRow, t / tilesPerLayer);"
+	"    fView       = view;"
+	"    fSphere = sphere;  fColor = color;  fAmbient = ambient;  fDiffuse = diffuse;  fSpecular = specular;"
+	"}";
+
+const char* impostorFragmentShader =
+	"in vec2 uv;"
+	"flat in vec3 fCell;"
+	"flat in int  fView;"
+	"flat in vec4 fSphere, fColor, fAmbient, fDiffuse, fSpecular;"
+
+	"uniform sampler2DArray atlas;"
+	"uniform mat4 PV;"
+	"uniform int  numLights;"
+	"uniform vec4 lightPos[8];"
+	"uniform vec3 lightColor[8];"
+
+	"out vec4 frag_color;"
+
+	"void main ()"
+	"{"
+	"    vec4 texel = texture(atlas, vec3((fCell.xy + uv) * tileScale, fCell.z));"
+	"    if(texel.a < 0.5f / 255.0f) discard;"
+	"    float depth = (1.0f - texel.a) * (255.0f / 254.0f);"
+	"    vec3 P      = fSphere.xyz + fSphere.w * ((uv.x * 2.0f - 1.0f) * viewRight[fView] + (uv.y * 2.0f - 1.0f) * viewUp[fView] + (1.0f - 2.0f * depth) * viewDir[fView]);"
+	"    vec4 clip   = PV * vec4(P, 1.0f);"
+	"    gl_FragDepth = clip.z / clip.w * 0.5f + 0.5f;"
+
+	"    vec3 N         = normalize(texel.rgb * 2.0f - 1.0f);"
+	"    vec3 V         = normalize(-P);"
+	"    vec3 ambiProd  = vec3(0.0f);"
+	"    vec3 lightProd = vec3(0.0f);"
+	"    for(int i = 0; i < numLights; i++)"
+	"    {"
+	"        vec3 L    = normalize( vec3(lightPos[i]) - P * lightPos[i].w );"
+	"        ambiProd += lightColor[i];"
+	"        if(dot(N,L) > 0)"
+	"        {"
+	"            vec3 R     = normalize( reflect(-L, N) );"
+	"            lightProd += lightColor[i] * ( fDiffuse.rgb * max( dot(N, L), 0.0f ) + fSpecular.rgb * pow( max( dot(R, V), 0.0f ), fSpecular.w ) );"
+	"        }"
+	"    }"
+	"    frag_color = vec4(clamp( fColor.rgb * ( (ambiProd * fAmbient.rgb) + lightProd ), 0.0f, 1.0f ), 1.0f);"
+	"}";
+
+void setImpostorViews(GLuint program)
+{
+	glUseProgram(program);
+	glUniform3fv(glGetUniformLocation(program, "viewRight"), impostorViews, value_ptr(impostors.viewRight[0]));
+	glUniform3fv(glGetUniformLocation(program, "viewUp"),    impostorViews, value_ptr(impostors.viewUp[0]));
+	glUniform3fv(glGetUniformLocation(program, "viewDir"),   impostorViews, value_ptr(impostors.viewDir[0]));
+}
+
+void initImpostors()
+{
+	const float l_pi = 3.14159265f;
+	for (int v = 0; v < impostorViews; v++)
+	{
+		float l_azimuth = (v % 8) * l_pi / 4.0f, l_elevation = (v == 16) ? 0.5f * l_pi : (v < 8) ? l_pi / 9.0f : l_pi * 11.0f / 36.0f;
+		vec3 l_dir = vec3(cos(l_azimuth) * cos(l_elevation), sin(l_azimuth) * cos(l_elevation), sin(l_elevation));
+		mat4 l_view = lookAt(l_dir, vec3(0.0f), (v == 16) ? vec3(0.0f, 1.0f, 0.0f) : vec3(0.0f, 0.0f, 1.0f));
+		impostors.viewRight[v] = vec3(l_view[0][0], l_view[1][0], l_view[2][0]);
+		impostors.viewUp[v]    = vec3(l_view[0][1], l_view[1][1], l_view[2][1]);
+		impostors.viewDir[v]   = l_dir;
+	}
+
+	GLint l_maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &l_maxSize);
+	impostors.tileSize    = glm::clamp(impostors.tileSize, 4, 256);
+	impostors.layerSize   = std::min(2048, (int)l_maxSize) / impostors.tileSize * impostors.tileSize;
+	impostors.tilesPerRow = impostors.layerSize / impostors.tileSize;
+
+	impostors.bakeProg = initShaders((string(impostorShaderCommon) + impostorBakeVertexShader).c_str(), (string(impostorShaderCommon) + impostorBakeFragmentShader).c_str());
+	impostors.bakeModelLoc       = glGetUniformLocation(impostors.bakeProg, "Model");
+	impostors.bakeSphereLoc      = glGetUniformLocation(impostors.bakeProg, "sphere");
+	impostors.bakeFirstTileLoc   = glGetUniformLocation(impostors.bakeProg, "firstTile");
+	impostors.bakeTilesPerRowLoc = glGetUniformLocation(impostors.bakeProg, "tilesPerRow");
+	impostors.bakeTileScaleLoc   = glGetUniformLocation(impostors.bakeProg, "tileScale");
+	setImpostorViews(impostors.bakeProg);
+
+	impostors.drawProg = initShaders((string(impostorShaderCommon) + impostorVertexShader).c_str(), (string(impostorShaderCommon) + impostorFragmentShader).c_str());
+	impostors.PVLoc            = glGetUniformLocation(impostors.drawProg, "PV");
+	impostors.eyeLoc           = glGetUniformLocation(impostors.drawProg, "eye");
+	impostors.tilesPerRowLoc   = glGetUniformLocation(impostors.drawProg, "tilesPerRow");
+	impostors.tilesPerLayerLoc = glGetUniformLocation(impostors.drawProg, "tilesPerLayer");
+	impostors.tileScaleLoc     = glGetUniformLocation(impostors.drawProg, "tileScale");
+	impostors.numLightsLoc     = glGetUniformLocation(impostors.drawProg, "numLights");
+	impostors.lightPosLoc      = glGetUniformLocation(impostors.drawProg, "lightPos");
+	impostors.lightColorLoc    = glGetUniformLocation(impostors.drawProg, "lightColor");
+	setImpostorViews(impostors.drawProg);
+	glUniform1i(glGetUniformLocation(impostors.drawProg, "atlas"), 0);
+
+	glGenFramebuffers(1, &impostors.FBO);
+	glGenRenderbuffers(1, &impostors.depthRB);
+	glBindRenderbuffer(GL_RENDERBUFFER, impostors.depthRB);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, impostors.layerSize, impostors.layerSize);
+
+	glGenVertexArrays(1, &impostors.VAO);
+	glGenBuffers(1, &impostors.instanceBuffer);
+	glBindVertexArray(impostors.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, impostors.instanceBuffer);
+	for (int a = 0; a < 5; a++)
+	{
+		glEnableVertexAttribArray(a);
+		glVertexAttribPointer(a, 4, GL_FLOAT, GL_FALSE, sizeof(structImpostorInstance), (void *)(sizeof(vec4) * a));
+		glVertexAttribDivisor(a, 1);
+	}
+	glEnableVertexAttribArray(5);
+	glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, sizeof(structImpostorInstance), (void *)(sizeof(vec4) * 5));
+	glVertexAttribDivisor(5, 1);
+	glBindVertexArray(0);
+}
+
+// Bakes every filled prop of sceneProps but the ground, impostorViews tiles
+// each, never splitting a prop across layers.
+void bakeImpostors()
+{
+	chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+	if (impostors.bakeProg == 0) initImpostors();
+	impostors.dirty = false;
+	impostors.records.clear();
+	for (size_t i = 0; i < sceneProps.size(); i++) { sceneProps[i]->impostor = 0; }
+
+	vector<prop*> l_props;
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		if (!sceneProps[i]->outline && sceneProps[i] != &ground) l_props.push_back(sceneProps[i]);
+	}
+	int l_propsPerLayer = impostors.tilesPerRow * impostors.tilesPerRow / impostorViews;
+	GLint l_maxLayers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &l_maxLayers);
+	impostors.layers = std::min((int)l_maxLayers, std::max(1, ((int)l_props.size() + l_propsPerLayer - 1) / l_propsPerLayer));
+	if ((int)l_props.size() > impostors.layers * l_propsPerLayer)
+	{
+		fprintf(stderr, "impostor atlas holds %d of %d props; the rest keep their meshes\n", impostors.layers * l_propsPerLayer, (int)l_props.size());
+		l_props.resize(impostors.layers * l_propsPerLayer);
+	}
+
+	if (impostors.atlas) glDeleteTextures(1, &impostors.atlas);
+	glGenTextures(1, &impostors.atlas);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, impostors.atlas);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, impostors.layerSize, impostors.layerSize, impostors.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// The bake may run in the middle of a frame, possibly into an offscreen
+	// target, so everything it changes is put back.
+	GLint l_framebuffer, l_viewport[4];
+	GLfloat l_clear[4];
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &l_framebuffer);
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, l_clear);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, impostors.FBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, impostors.depthRB);
+	glViewport(0, 0, impostors.layerSize, impostors.layerSize);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glUseProgram(impostors.bakeProg);
+	glUniform1i(impostors.bakeTilesPerRowLoc, impostors.tilesPerRow);
+	glUniform1f(impostors.bakeTileScaleLoc, (float)impostors.tileSize / impostors.layerSize);
+
+	for (size_t i = 0; i < l_props.size(); i++)
+	{
+		prop &p = *l_props[i];
+		int l_layer = (int)i / l_propsPerLayer, l_tile = l_layer * impostors.tilesPerRow * impostors.tilesPerRow + ((int)i % l_propsPerLayer) * impostorViews;
+		if ((int)i % l_propsPerLayer == 0)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, impostors.atlas, 0, l_layer);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+		vec3 l_center = (p.boundsMin + p.boundsMax) * 0.5f;
+		float l_radius = std::max(length(p.boundsMax - p.boundsMin) * 0.5f, 1e-6f);
+		structImpostorInstance l_record = { vec4(l_center, l_radius), vec4(p.propColor, 1.0f), vec4(p.material.ambient, 0.0f),
+		                                    vec4(p.material.diffuse, 0.0f), vec4(p.material.specular, p.material.shininess), (GLuint)l_tile };
+		impostors.records.push_back(l_record);
+		p.impostor = (int)impostors.records.size();
+
+		if (p.VAO[renderContext] == 0) p.VAO[renderContext] = p.createVAO();
+		glBindVertexArray(p.VAO[renderContext]);
+		glUniformMatrix4fv(impostors.bakeModelLoc, 1, GL_FALSE, value_ptr(p.Model));
+		glUniform4fv(impostors.bakeSphereLoc, 1, value_ptr(l_record.sphere));
+		glUniform1i(impostors.bakeFirstTileLoc, l_tile % (impostors.tilesPerRow * impostors.tilesPerRow));
+		glDrawElementsInstanced(GL_TRIANGLES, p.numIndices, GL_UNSIGNED_INT, 0, impostorViews);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, l_framebuffer);
+	glViewport(l_viewport[0], l_viewport[1], l_viewport[2], l_viewport[3]);
+	glClearColor(l_clear[0], l_clear[1], l_clear[2], l_clear[3]);
+	glFinish();
+
+	impostors.baked = (int)l_props.size();
+	impostors.bakeMs = elapsedMs(l_start);
+	printf("Baked %d impostors: %d views of %d x %d, %d layer(s) of %d x %d (%.1f MB) in %.0f ms\n", impostors.baked, impostorViews, impostors.tileSize, impostors.tileSize,
+		impostors.layers, impostors.layerSize, impostors.layerSize, 4.0 * impostors.layerSize * impostors.layerSize * impostors.layers / 1048576.0, impostors.bakeMs);
+}
+
+void impostorBeginFrame()
+{
+	if (impostors.dirty) bakeImpostors();
+	impostors.queue.clear();
+}
+
+// Queues p as an impostor when it is baked and small enough on screen.
+bool impostorDraw(const prop &p, const mat4 &l_PV)
+{
+	if (p.impostor == 0 || screenArea(p, l_PV) >= impostors.maxPixels) return false;
+	impostors.queue.push_back(impostors.records[p.impostor - 1]);
+	sceneStats.impostors++;
+	return true;
+}
+
+void impostorFlush(const mat4 &l_PV)
+{
+	if (impostors.queue.empty()) return;
+	glBindBuffer(GL_ARRAY_BUFFER, impostors.instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(structImpostorInstance) * impostors.queue.size(), &impostors.queue[0], GL_STREAM_DRAW);
+
+	glUseProgram(impostors.drawProg);
+	glUniformMatrix4fv(impostors.PVLoc, 1, GL_FALSE, value_ptr(l_PV));
+	glUniform3fv(impostors.eyeLoc, 1, value_ptr(shadingEye));
+	glUniform1i(impostors.tilesPerRowLoc, impostors.tilesPerRow);
+	glUniform1i(impostors.tilesPerLayerLoc, impostors.tilesPerRow * impostors.tilesPerRow);
+	glUniform1f(impostors.tileScaleLoc, (float)impostors.tileSize / impostors.layerSize);
+	glUniform1i(impostors.numLightsLoc, numLights);
+	glUniform4fv(impostors.lightPosLoc, numLights, value_ptr(lightPos[0]));
+	glUniform3fv(impostors.lightColorLoc, numLights, value_ptr(lightColor[0]));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, impostors.atlas);
+
+	glBindVertexArray(impostors.VAO);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)impostors.queue.size());
+	glBindVertexArray(0);
+}
+
+//-------------------------------SHADOWS--------------------------------
+// With shadows.enabled (H, --shadows) the Phong programs shadow light[1],
+// the directional light, from numCascades cascades of one depth array
+// texture, and light[0], the orbiting point light, from a depth cube map.
+// Both are cached. A cascade covers the bounding sphere of its slice of the
+// view frustum, grown by guard and snapped to its texels, and is drawn
+// again only when the slice leaves it or shrinks to half of it, when the
+// light turns by more than lightTurn degrees or when the scene changes. The
+// cube map is drawn again once the light has moved lightMove from where it
+// was drawn; the new one is built into a second cube a face at a time and
+// swapped in when complete, so a frame never mixes two positions. Each
+// cascade and cube face is a job with a running estimate of its GPU time
+// from timer queries; a frame runs the jobs due, nearest cascade first,
+// then the cube, then the farther cascades, while they fit in budgetMs,
+// and always at least one. With cache off every job runs every frame on a
+// tight fit, as a naive shadow pass would. Gouraud, flat, impostor, GPU
+// culled, terrain and software shading stay unshadowed.
+const int maxCascades = 4; // cascadePV[4] in the shaders
+const int shadowJobs = maxCascades + 6;
+
+struct structShadows
+{
+	bool enabled, cache, dirty, timing;
+	int size, cubeSize, numCascades;
+	float budgetMs, lightMove, lightTurn, guard;
+	GLuint cascadeMap, cubeMap[2], FBO, prog, queries[shadowJobs][2]; // timestamps before and after
+	GLint PVLoc, ModelLoc;
+	bool queryPending[shadowJobs];
+	float jobMs[shadowJobs];
+	// Cascades as last drawn: light-space centre (xy) and half size (z), the
+	// light direction and the matrix.
+	vec3 cascadeRegion[maxCascades], cascadeDir[maxCascades];
+	mat4 cascadePV[maxCascades];
+	float cascadeSplit[maxCascades];
+	int cascadeMask;
+	// cubeMap[cubeFront] is complete and drawn from cubePos[cubeFront].
+	vec3 cubePos[2];
+	float cubeFar[2];
+	int cubeFront, cubeFaces;
+	bool cubeValid;
+	long long frames, cascadeUpdates, faceUpdates, cubeUpdates, casters;
+	double passMs;
+};
+structShadows shadows = { false, true, true, false, 1024, 512, 4, 2.0f, 0.02f, 1.0f, 1.3f };
+
+const char* shadowVertexShader =
+	"#version 400\n"
+	"in vec3 vertexPos;"
+	"uniform mat4 Model;"
+	"uniform mat4 PV;"
+	"void main ()"
+	"{"
+	"    gl_Position = PV * Model * vec4(vertexPos, 1.0f);"
+	"}";
+
+const char* shadowFragmentShader =
+	"#version 400\n"
+	"void main ()"
+	"{"
+	"}";
+
+const float shadowCubeNear = 0.01f;
+const vec3 shadowCubeDir[6] = { vec3(1.0f, 0.0f, 0.0f), vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f) };
+const vec3 shadowCubeUp[6]  = { vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f) };
+
+void sceneBounds(vec3 &l_min, vec3 &l_max);
+
+GLuint shadowTexture(GLenum target)
+{
+	GLuint l_texture;
+	glGenTextures(1, &l_texture);
+	glBindTexture(target, l_texture);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	return l_texture;
+}
+
+void initShadows()
+{
+	shadows.numCascades = glm::clamp(shadows.numCascades, 1, maxCascades);
+	shadows.size = glm::clamp(shadows.size, 64, 8192);
+	shadows.cubeSize = glm::clamp(shadows.cubeSize, 64, 4096);
+
+	shadows.prog = initShaders(shadowVertexShader, shadowFragmentShader);
+	shadows.PVLoc    = glGetUniformLocation(shadows.prog, "PV");
+	shadows.ModelLoc = glGetUniformLocation(shadows.prog, "Model");
+
+	shadows.cascadeMap = shadowTexture(GL_TEXTURE_2D_ARRAY);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, shadows.size, shadows.size, maxCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	for (int c = 0; c < 2; c++)
+	{
+		shadows.cubeMap[c] = shadowTexture(GL_TEXTURE_CUBE_MAP);
+		for (int f = 0; f < 6; f++)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_DEPTH_COMPONENT24, shadows.cubeSize, shadows.cubeSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		}
+	}
+	GLint l_framebuffer;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &l_framebuffer);
+	glGenFramebuffers(1, &shadows.FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadows.FBO);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, l_framebuffer);
+	glGenQueries(2 * shadowJobs, &shadows.queries[0][0]);
+	shadows.cubeFaces = 6;
+	reportError("initShadows");
+}
+
+// Draws every filled prop but the ground that touches the light's frustum
+// into whatever depth target is bound.
+void drawShadowCasters(const mat4 &l_lightPV)
+{
+	vec4 l_planes[6];
+	frustumPlanes(l_lightPV, l_planes);
+	glUniformMatrix4fv(shadows.PVLoc, 1, GL_FALSE, value_ptr(l_lightPV));
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		prop &p = *sceneProps[i];
+		if (p.outline || &p == &ground || !inFrustum(l_planes, p)) continue;
+		if (p.VAO[renderContext] == 0) p.VAO[renderContext] = p.createVAO();
+		glBindVertexArray(p.VAO[renderContext]);
+		glUniformMatrix4fv(shadows.ModelLoc, 1, GL_FALSE, value_ptr(p.Model));
+		glDrawElements(GL_TRIANGLES, p.numIndices, GL_UNSIGNED_INT, 0);
+		shadows.casters++;
+	}
+}
+
+// Light space of the directional light: x, y across the light, z towards it.
+mat4 shadowLightView(vec3 towardsLight)
+{
+	vec3 l_up = (fabs(towardsLight.z) > 0.99f) ? vec3(0.0f, 1.0f, 0.0f) : vec3(0.0f, 0.0f, 1.0f);
+	return lookAt(vec3(0.0f), -towardsLight, l_up);
+}
+
+// The sphere (light-space centre, radius) around each slice of the view
+// frustum between the camera's near plane and the far side of the scene.
+void shadowSlices(const mat4 &l_PV, const mat4 &l_lightView, vec3 &eye, vec3 &forward, vec4 *spheres)
+{
+	mat4 l_inverse = inverse(l_PV);
+	vec3 l_near[4], l_far[4];
+	for (int k = 0; k < 4; k++)
+	{
+		vec4 l_n = l_inverse * vec4((k & 1) ? 1.0f : -1.0f, (k & 2) ? 1.0f : -1.0f, -1.0f, 1.0f);
+		vec4 l_f = l_inverse * vec4((k & 1) ? 1.0f : -1.0f, (k & 2) ? 1.0f : -1.0f,  1.0f, 1.0f);
+		l_near[k] = vec3(l_n) / l_n.w;
+		l_far[k]  = vec3(l_f) / l_f.w;
+	}
+	vec4 l_eye = l_inverse * vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	eye = vec3(l_eye) / l_eye.w;
+	forward = normalize((l_far[0] + l_far[3]) * 0.5f - (l_near[0] + l_near[3]) * 0.5f);
+	float l_nearDepth = dot((l_near[0] + l_near[3]) * 0.5f - eye, forward), l_farDepth = dot((l_far[0] + l_far[3]) * 0.5f - eye, forward);
+
+	vec3 l_min, l_max;
+	sceneBounds(l_min, l_max);
+	float l_sceneDepth = l_nearDepth;
+	for (int k = 0; k < 8; k++)
+	{
+		vec3 l_corner = vec3((k & 1) ? l_max.x : l_min.x, (k & 2) ? l_max.y : l_min.y, (k & 4) ? l_max.z : l_min.z);
+		l_sceneDepth = std::max(l_sceneDepth, dot(l_corner - eye, forward));
+	}
+	l_farDepth = glm::clamp(l_sceneDepth, l_nearDepth * 2.0f, l_farDepth);
+	float l_startDepth = std::max(l_nearDepth, l_farDepth * 0.001f);
+
+	// Practical split: mostly logarithmic, a quarter uniform.
+	float l_from = l_nearDepth;
+	for (int c = 0; c < shadows.numCascades; c++)
+	{
+		float l_t = (float)(c + 1) / shadows.numCascades;
+		float l_to = 0.75f * l_startDepth * pow(l_farDepth / l_startDepth, l_t) + 0.25f * (l_startDepth + (l_farDepth - l_startDepth) * l_t);
+		shadows.cascadeSplit[c] = l_to;
+		vec3 l_corners[8];
+		for (int k = 0; k < 4; k++)
+		{
+			l_corners[k]     = mix(l_near[k], l_far[k], (l_from - l_nearDepth) / (l_farDepth - l_nearDepth));
+			l_corners[k + 4] = mix(l_near[k], l_far[k], (l_to - l_nearDepth) / (l_farDepth - l_nearDepth));
+		}
+		vec3 l_center(0.0f);
+		for (int k = 0; k < 8; k++) { l_center += l_corners[k] / 8.0f; }
+		float l_radius = 0.0f;
+		for (int k = 0; k < 8; k++) { l_radius = std::max(l_radius, length(l_corners[k] - l_center)); }
+		spheres[c] = vec4(vec3(l_lightView * vec4(l_center, 1.0f)), l_radius);
+		l_from = l_to;
+	}
+	for (int c = shadows.numCascades; c < maxCascades; c++) { shadows.cascadeSplit[c] = -1e30f; }
+}
+
+void drawCascade(int c, const mat4 &l_lightView, vec3 towardsLight, vec4 sphere)
+{
+	float l_half = sphere.w * (shadows.cache ? shadows.guard : 1.0f);
+	float l_texel = 2.0f * l_half / shadows.size;
+	vec2 l_center = vec2(floor(sphere.x / l_texel + 0.5f) * l_texel, floor(sphere.y / l_texel + 0.5f) * l_texel);
+
+	// Depth covers the whole scene so every caster is in range.
+	vec3 l_min, l_max;
+	sceneBounds(l_min, l_max);
+	l_min = glm::min(l_min, ground.boundsMin);
+	l_max = glm::max(l_max, ground.boundsMax);
+	float l_zMin = 1e30f, l_zMax = -1e30f;
+	for (int k = 0; k < 8; k++)
+	{
+		float z = (l_lightView * vec4((k & 1) ? l_max.x : l_min.x, (k & 2) ? l_max.y : l_min.y, (k & 4) ? l_max.z : l_min.z, 1.0f)).z;
+		l_zMin = std::min(l_zMin, z);
+		l_zMax = std::max(l_zMax, z);
+	}
+	mat4 l_lightPV = ortho(l_center.x - l_half, l_center.x + l_half, l_center.y - l_half, l_center.y + l_half, -l_zMax - 0.01f, -l_zMin + 0.01f) * l_lightView;
+
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows.cascadeMap, 0, c);
+	glViewport(0, 0, shadows.size, shadows.size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	drawShadowCasters(l_lightPV);
+
+	shadows.cascadeRegion[c] = vec3(l_center, l_half);
+	shadows.cascadeDir[c] = towardsLight;
+	shadows.cascadePV[c] = l_lightPV;
+	shadows.cascadeMask |= 1 << c;
+	shadows.cascadeUpdates++;
+}
+
+void drawCubeFace(int face)
+{
+	int l_back = 1 - shadows.cubeFront;
+	float n = shadowCubeNear, f = shadows.cubeFar[l_back];
+	// 90 degree frustum; written out so it does not depend on the units
+	// perspective() takes.
+	mat4 l_projection(0.0f);
+	l_projection[0][0] = 1.0f;
+	l_projection[1][1] = 1.0f;
+	l_projection[2][2] = -(f + n) / (f - n);
+	l_projection[2][3] = -1.0f;
+	l_projection[3][2] = -2.0f * f * n / (f - n);
+	vec3 l_pos = shadows.cubePos[l_back];
+	mat4 l_lightPV = l_projection * lookAt(l_pos, l_pos + shadowCubeDir[face], shadowCubeUp[face]);
+
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, shadows.cubeMap[l_back], 0);
+	glViewport(0, 0, shadows.cubeSize, shadows.cubeSize);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	drawShadowCasters(l_lightPV);
+	shadows.faceUpdates++;
+
+	if (++shadows.cubeFaces < 6) return;
+	shadows.cubeFront = l_back;
+	shadows.cubeValid = true;
+	shadows.cubeUpdates++;
+}
+
+// Phong program uniforms for this frame, set once rather than per draw.
+void setShadowUniforms(bool on, vec3 eye, vec3 forward)
+{
+	const structShader &s = shaders[renderContext][shaderPhong];
+	glProgramUniform1i(s.prog, s.shadowsLoc, on ? 1 : 0);
+	if (!on) return;
+	float l_texel[maxCascades];
+	for (int c = 0; c < maxCascades; c++) { l_texel[c] = 2.0f * shadows.cascadeRegion[c].z / shadows.size; }
+	glProgramUniform1i(s.prog, s.cascadeMaskLoc, shadows.cascadeMask);
+	glProgramUniformMatrix4fv(s.prog, s.cascadePVLoc, maxCascades, GL_FALSE, value_ptr(shadows.cascadePV[0]));
+	glProgramUniform4fv(s.prog, s.cascadeSplitsLoc, 1, shadows.cascadeSplit);
+	glProgramUniform4fv(s.prog, s.cascadeTexelLoc, 1, l_texel);
+	glProgramUniform3fv(s.prog, s.shadowEyeLoc, 1, value_ptr(eye));
+	glProgramUniform3fv(s.prog, s.shadowForwardLoc, 1, value_ptr(forward));
+	glProgramUniform1i(s.prog, s.pointShadowsLoc, shadows.cubeValid ? 1 : 0);
+	glProgramUniform3fv(s.prog, s.pointShadowPosLoc, 1, value_ptr(shadows.cubePos[shadows.cubeFront]));
+	glProgramUniform2f(s.prog, s.pointShadowRangeLoc, shadowCubeNear, shadows.cubeFar[shadows.cubeFront]);
+
+	glActiveTexture(GL_TEXTURE0 + shadowCascadeUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadows.cascadeMap);
+	glActiveTexture(GL_TEXTURE0 + shadowCubeUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, shadows.cubeMap[shadows.cubeFront]);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// Runs before the scene is drawn: brings the maps up to date within the
+// budget and hands them to the Phong program.
+void shadowPass(const mat4 &l_PV)
+{
+	bool l_on = shadows.enabled && renderContext == 0 && renderBackend == backendGL && !multiView.enabled;
+	if (!l_on)
+	{
+		if (shadows.prog) setShadowUniforms(false, vec3(0.0f), vec3(0.0f));
+		return;
+	}
+	chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+	if (shadows.prog == 0) initShadows();
+	shadows.frames++;
+
+	for (int j = 0; j < shadowJobs; j++)
+	{
+		GLint l_ready = 0;
+		if (shadows.queryPending[j]) glGetQueryObjectiv(shadows.queries[j][1], GL_QUERY_RESULT_AVAILABLE, &l_ready);
+		if (!l_ready) continue;
+		GLuint64 l_begin, l_end;
+		glGetQueryObjectui64v(shadows.queries[j][0], GL_QUERY_RESULT, &l_begin);
+		glGetQueryObjectui64v(shadows.queries[j][1], GL_QUERY_RESULT, &l_end);
+		float l_ms = (l_end - l_begin) / 1e6f;
+		shadows.jobMs[j] = (shadows.jobMs[j] == 0.0f) ? l_ms : 0.75f * shadows.jobMs[j] + 0.25f * l_ms;
+		shadows.queryPending[j] = false;
+	}
+
+	if (shadows.dirty || !shadows.cache)
+	{
+		shadows.cascadeMask = 0;
+		shadows.cubeValid = false;
+		shadows.cubeFaces = 6;
+		shadows.dirty = false;
+	}
+
+	// Which jobs are due.
+	bool l_due[shadowJobs] = { false }, l_outside[maxCascades] = { false };
+	bool l_sun = numLights > 1 && light[1].pos.w == 0.0f, l_point = light[0].pos.w != 0.0f;
+	vec3 l_towards = l_sun ? normalize(vec3(light[1].pos)) : vec3(0.0f, 0.0f, 1.0f), l_eye, l_forward;
+	mat4 l_lightView = shadowLightView(l_towards);
+	vec4 l_spheres[maxCascades];
+	shadowSlices(l_PV, l_lightView, l_eye, l_forward, l_spheres);
+	for (int c = 0; l_sun && c < shadows.numCascades; c++)
+	{
+		vec3 r = shadows.cascadeRegion[c];
+		bool l_inside = length(vec2(l_spheres[c].x, l_spheres[c].y) - vec2(r)) + l_spheres[c].w <= r.z && l_spheres[c].w * shadows.guard >= 0.5f * r.z;
+		bool l_turned = dot(shadows.cascadeDir[c], l_towards) < cos(radians(shadows.lightTurn));
+		l_outside[c] = !l_inside;
+		l_due[c] = !(shadows.cascadeMask & (1 << c)) || !l_inside || l_turned;
+	}
+	if (!l_sun) shadows.cascadeMask = 0;
+	if (l_point && shadows.cubeFaces == 6 && (!shadows.cubeValid || distance(vec3(light[0].pos), shadows.cubePos[shadows.cubeFront]) > shadows.lightMove))
+	{
+		vec3 l_min, l_max, l_pos = vec3(light[0].pos);
+		sceneBounds(l_min, l_max);
+		float l_far = 0.0f;
+		for (int k = 0; k < 8; k++) { l_far = std::max(l_far, distance(l_pos, vec3((k & 1) ? l_max.x : l_min.x, (k & 2) ? l_max.y : l_min.y, (k & 4) ? l_max.z : l_min.z))); }
+		shadows.cubePos[1 - shadows.cubeFront] = l_pos;
+		shadows.cubeFar[1 - shadows.cubeFront] = std::max(l_far * 1.01f, shadowCubeNear * 2.0f);
+		shadows.cubeFaces = 0;
+	}
+	if (!l_point) shadows.cubeValid = false;
+	for (int f = shadows.cubeFaces; l_point && f < 6; f++) { l_due[maxCascades + f] = true; }
+
+	GLint l_framebuffer, l_viewport[4];
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &l_framebuffer);
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadows.FBO);
+	glUseProgram(shadows.prog);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	// Nearest cascade, then the cube faces in order, then the other cascades.
+	int l_order[shadowJobs], l_jobs = 0;
+	l_order[l_jobs++] = 0;
+	for (int f = 0; f < 6; f++) { l_order[l_jobs++] = maxCascades + f; }
+	for (int c = 1; c < maxCascades; c++) { l_order[l_jobs++] = c; }
+	// Timestamps rather than GL_TIME_ELAPSED, which dynamic resolution may
+	// already have open around the whole frame.
+	float l_spent = 0.0f;
+	int l_ran = 0;
+	for (int k = 0; k < l_jobs; k++)
+	{
+		int j = l_order[k];
+		if (!l_due[j]) continue;
+		if (shadows.cache && l_ran > 0 && l_spent + shadows.jobMs[j] > shadows.budgetMs) break;
+		bool l_query = !shadows.queryPending[j];
+		if (l_query) glQueryCounter(shadows.queries[j][0], GL_TIMESTAMP);
+		if (j < maxCascades) drawCascade(j, l_lightView, l_towards, l_spheres[j]);
+		else drawCubeFace(j - maxCascades);
+		if (l_query) glQueryCounter(shadows.queries[j][1], GL_TIMESTAMP);
+		shadows.queryPending[j] = shadows.queryPending[j] || l_query;
+		l_due[j] = false;
+		l_spent += shadows.jobMs[j];
+		l_ran++;
+	}
+	// A cascade left for a later frame that no longer covers its slice would
+	// be sampled outside its map; until it is drawn its slice goes unshadowed.
+	for (int c = 0; c < maxCascades; c++)
+	{
+		if (l_due[c] && l_outside[c]) shadows.cascadeMask &= ~(1 << c);
+	}
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, l_framebuffer);
+	glViewport(l_viewport[0], l_viewport[1], l_viewport[2], l_viewport[3]);
+	setShadowUniforms(true, l_eye, l_forward);
+	if (shadows.timing) glFinish();
+	shadows.passMs = elapsedMs(l_start);
+}
+
+void shadowReport()
+{
+	if (shadows.frames == 0) return;
+	printf("Shadows: %lld frames, %lld cascade and %lld cube map updates, %.1f casters drawn per frame\n",
+		shadows.frames, shadows.cascadeUpdates, shadows.cubeUpdates, (double)shadows.casters / shadows.frames);
+}
+
+//------------------------------POLYLINES-------------------------------
+// Every polyline (the outline props, or anything added with addPolyline())
+// lives in one point buffer and one index buffer, each polyline's strip
+// ended by the primitive restart index, so all of them draw in a single
+// call. The vertex shader pulls its point and both neighbours from the
+// SSBOs (two vertices per point, one either side) and pushes them apart in
+// screen space by the line width, joining segments with a miter (limited
+// to 4x the width) or, for bevel, a flat offset along the bisector.
+enum { joinMiter = 0, joinBevel = 1 };
+
+struct structPolylineGpu { vec4 color; int first, count, closed, join; }; // color.w = width in pixels
+struct structPolylineProgram { GLuint prog, VAO; GLint PVLoc, viewportLoc; };
+
+struct structPolylines
+{
+	bool supported, enabled;
+	float outlineWidth;
+	int outlineJoin, numIndices;
+	vector<vec4> points; // w = polyline number
+	vector<structPolylineGpu> lines;
+	vector<GLuint> index;
+	GLuint pointBuffer, lineBuffer, IBO;
+	structPolylineProgram program[maxContexts];
+};
+structPolylines polylines = { false, true, 2.0f, joinMiter, 0 };
+
+const char* polylineVertexShader =
+	"#version 430\n"
+	"struct Line { vec4 color; int first; int count; int closed; int join; };"
+	"layout(std430, binding = 4) readonly buffer Points { vec4 points[]; };"
+	"layout(std430, binding = 5) readonly buffer Lines  { Line lines[]; };"
+	"uniform mat4 PV;"
+	"uniform vec2 viewport;"
+	"out vec3 fColor;"
+	"vec2 toScreen(vec4 c) { return c.xy / max(abs(c.w), 1e-6) * 0.5 * viewport; }"
+	"vec2 direction(vec2 a, vec2 b) { vec2 d = b - a; float l = length(d); return (l > 1e-6) ? d / l : vec2(0.0); }"
+	"void main ()"
+	"{"
+	"    int p = gl_VertexID >> 1;"
+	"    Line l = lines[int(points[p].w)];"
+	"    int last = l.first + l.count - 1;"
+	"    int prev = (p > l.first) ? p - 1 : ((l.closed != 0) ? last : p);"
+	"    int next = (p < last) ? p + 1 : ((l.closed != 0) ? l.first : p);"
+	"    vec4 c = PV * vec4(points[p].xyz, 1.0);"
+	"    vec2 s = toScreen(c);"
+	"    vec2 d0 = direction(toScreen(PV * vec4(points[prev].xyz, 1.0)), s);"
+	"    vec2 d1 = direction(s, toScreen(PV * vec4(points[next].xyz, 1.0)));"
+	"    vec2 segment = (dot(d1, d1) > 0.0) ? d1 : d0;"
+	"    vec2 tangent = d0 + d1;"
+	"    tangent = (dot(tangent, tangent) > 1e-6) ? normalize(tangent) : segment;"
+	"    vec2 normal = vec2(-tangent.y, tangent.x);"
+	"    float halfWidth = 0.5 * l.color.w;"
+	"    if (l.join == 0) halfWidth /= max(dot(normal, vec2(-segment.y, segment.x)), 0.25);"
+	"    vec2 offset = normal * halfWidth * (((gl_VertexID & 1) == 0) ? 1.0 : -1.0);"
+	"    gl_Position = c + vec4(offset / (0.5 * viewport) * c.w, 0.0, 0.0);"
+	"    fColor = l.color.rgb;"
+	"}";
+
+const char* polylineFragmentShader =
+	"#version 400\n"
+	"in vec3 fColor;"
+	"out vec4 frag_color;"
+	"void main ()"
+	"{"
+	"    frag_color = vec4(fColor, 1.0f);"
+	"}";
+
+void clearPolylines()
+{
+	polylines.points.clear();
+	polylines.lines.clear();
+	polylines.index.clear();
+}
+
+void addPolyline(const vec3 *points, int numPoints, vec3 color, float width, bool closed, int join)
+{
+	if (numPoints < 2) return;
+	structPolylineGpu l_line = { vec4(color, width), (int)polylines.points.size(), numPoints, closed ? 1 : 0, join };
+	float l_id = (float)polylines.lines.size();
+	for (int i = 0; i < numPoints; i++)
+	{
+		polylines.index.push_back(2 * (l_line.first + i));
+		polylines.index.push_back(2 * (l_line.first + i) + 1);
+		polylines.points.push_back(vec4(points[i], l_id));
+	}
+	if (closed)
+	{
+		polylines.index.push_back(2 * l_line.first);
+		polylines.index.push_back(2 * l_line.first + 1);
+	}
+	polylines.index.push_back(0xFFFFFFFF);
+	polylines.lines.push_back(l_line);
+}
+
+void uploadPolylines()
+{
+	if (polylines.pointBuffer == 0)
+	{
+		glGenBuffers(1, &polylines.pointBuffer);
+		glGenBuffers(1, &polylines.lineBuffer);
+		glGenBuffers(1, &polylines.IBO);
+	}
+	polylines.numIndices = (int)polylines.index.size();
+	if (polylines.numIndices == 0) return;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, polylines.pointBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vec4) * polylines.points.size(), &polylines.points[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, polylines.lineBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(structPolylineGpu) * polylines.lines.size(), &polylines.lines[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindVertexArray(0); // the element buffer binding belongs to whatever VAO is bound
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, polylines.IBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * polylines.index.size(), &polylines.index[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Rebuilds the polylines from the outline props in sceneProps (the island).
+void polylinesFromScene()
+{
+	polylines.supported = (GLEW_VERSION_4_3 || GLEW_ARB_shader_storage_buffer_object) != 0;
+	if (!polylines.supported) return;
+
+	clearPolylines();
+	vector<vec3> l_points;
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		const prop &p = *sceneProps[i];
+		if (!p.outline) continue;
+		l_points.resize(p.numIndices);
+		for (int j = 0; j < p.numIndices; j++) { l_points[j] = vec3(p.Model * vec4(p.vertex[p.index[j]], 1.0f)); }
+		addPolyline(&l_points[0], p.numIndices, p.propColor, polylines.outlineWidth, true, polylines.outlineJoin);
+	}
+	uploadPolylines();
+}
+
+// False when the outline props have to be drawn by prop::render() instead.
+bool drawPolylines(const mat4 &l_PV)
+{
+	if (!polylines.supported || !polylines.enabled) return false;
+	if (polylines.numIndices == 0) return true;
+
+	structPolylineProgram &l_program = polylines.program[renderContext];
+	if (l_program.prog == 0)
+	{
+		l_program.prog = initShaders(polylineVertexShader, polylineFragmentShader);
+		l_program.PVLoc       = glGetUniformLocation(l_program.prog, "PV");
+		l_program.viewportLoc = glGetUniformLocation(l_program.prog, "viewport");
+		glGenVertexArrays(1, &l_program.VAO);
+	}
+
+	GLint l_viewport[4];
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	glUseProgram(l_program.prog);
+	glUniformMatrix4fv(l_program.PVLoc, 1, GL_FALSE, value_ptr(l_PV));
+	glUniform2f(l_program.viewportLoc, (float)l_viewport[2], (float)l_viewport[3]);
+
+	glBindVertexArray(l_program.VAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, polylines.IBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, polylines.pointBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, polylines.lineBuffer);
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(0xFFFFFFFF);
+	glDrawElements(GL_TRIANGLE_STRIP, polylines.numIndices, GL_UNSIGNED_INT, 0);
+	glDisable(GL_PRIMITIVE_RESTART);
+	glBindVertexArray(0);
+	return true;
+}
+
+//-------------------------------TERRAIN--------------------------------
+// --terrain loads a heightmap (16- or 8-bit binary PGM, or headerless
+// little-endian 16-bit .raw, square) and draws it in place of the ground
+// quad: the ground's unit square gets the elevations, from -terrain.height
+// at the lowest sample up to 0 at the highest, so the campus stands on the
+// high ground.
+//
+// The map is cut into patches of terrain.patchCells cells. Each patch is
+// one GL_PATCHES quad; the control shader picks its tessellation from the
+// screen-space error of the coarse patch: roughness (how far the samples
+// stray from the bilinear patch, per edge and for the interior) times
+// pixels per world unit at the patch, divided down by level^2 until it is
+// under terrain.maxError pixels, and never past one vertex per sample.
+// Edge levels only use data on that edge, so neighbouring patches agree
+// and there are no cracks. Patches outside the view get level 0.
+// Heights come from a texture in the evaluation shader, which does the
+// Gouraud lighting itself; for Phong the fragment shader takes its normal
+// from the heightmap, so only the silhouette depends on the level.
+//
+// The ground prop gets a coarse resample of the map for everything that
+// cannot tessellate: the software backend, split view, and the batched and
+// GPU-culled paths, which draw it merged with the other props.
+struct structTerrainProgram { structShader s; GLint gridLoc, pixelScaleLoc, maxErrorLoc, fullResLoc; };
+
+struct structTerrain
+{
+	string path;
+	bool loaded, fullRes;
+	int width, height, patchCells, coarseSamples;
+	float verticalScale, maxError;
+	vector<unsigned short> samples;
+	int numPatches;
+	GLuint heightTex, VBO, query[2];
+	GLuint VAO[maxContexts];
+	structTerrainProgram programs[maxContexts][2]; // Gouraud, Phong
+	int queryFrame;
+	long long frames, triSum, triMin, triMax, lastTris;
+};
+structTerrain terrain = { "", false, false, 0, 0, 32, 65, 0.05f, 1.0f };
+
+const char* terrainVertexShader =
+	"#version 400\n"
+	"layout(location = 0) in vec3 vertexPos;"
+	"layout(location = 1) in vec4 patchInfo;"
+	"out vec3 tcPos;"
+	"out vec4 tcInfo;"
+	"void main ()"
+	"{"
+	"    tcPos  = vertexPos;"
+	"    tcInfo = patchInfo;"
+	"}";
+
+// patchInfo: x = roughness of the edge from this corner to the next,
+// y = interior roughness, z/w = lowest/highest sample (all 0..1).
+const char* terrainControlShader =
+	"#version 400\n"
+	"layout(vertices = 4) out;"
+	"in vec3 tcPos[];"
+	"in vec4 tcInfo[];"
+	"out vec3 tePos[];"
+	"uniform mat4 Model;"
+	"uniform mat4 PV;"
+	"uniform vec2 grid;"
+	"uniform float pixelScale;"
+	"uniform float maxError;"
+	"uniform int fullRes;"
+	"float level(float rough, float w, float cells)"
+	"{"
+	"    if (fullRes != 0 || w <= 1e-4) return cells;"
+	"    float errorPx = rough * length(Model[2].xyz) * pixelScale / w;"
+	"    return clamp(ceil(sqrt(errorPx / maxError)), 1.0, cells);"
+	"}"
+	"void main ()"
+	"{"
+	"    tePos[gl_InvocationID] = tcPos[gl_InvocationID];"
+	"    if (gl_InvocationID != 0) return;"
+
+	"    float zmin = tcInfo[0].z, zmax = tcInfo[0].w;"
+	"    vec4 c[8];"
+	"    for (int i = 0; i < 8; i++) c[i] = PV * Model * vec4(tcPos[i & 3].xy, (i < 4) ? zmin : zmax, 1.0);"
+	"    bool outside = false;"
+	"    for (int p = 0; p < 6; p++)"
+	"    {"
+	"        int n = 0;"
+	"        for (int i = 0; i < 8; i++) { float d = (p < 3) ? c[i].w - c[i][p] : c[i].w + c[i][p - 3]; if (d < 0.0) n++; }"
+	"        outside = outside || n == 8;"
+	"    }"
+	"    if (outside)"
+	"    {"
+	"        gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = gl_TessLevelOuter[3] = 0.0;"
+	"        gl_TessLevelInner[0] = gl_TessLevelInner[1] = 0.0;"
+	"        return;"
+	"    }"
+
+	"    float w[4];"
+	"    for (int i = 0; i < 4; i++) w[i] = (PV * Model * vec4(tcPos[i], 1.0)).w;"
+	"    vec2 cells = floor((tcPos[2].xy - tcPos[0].xy) * grid + 0.5);"
+	"    float e0 = level(tcInfo[0].x, min(w[0], w[1]), cells.x);"
+	"    float e1 = level(tcInfo[1].x, min(w[1], w[2]), cells.y);"
+	"    float e2 = level(tcInfo[2].x, min(w[2], w[3]), cells.x);"
+	"    float e3 = level(tcInfo[3].x, min(w[3], w[0]), cells.y);"
+	"    float wmin = min(min(w[0], w[1]), min(w[2], w[3]));"
+	"    gl_TessLevelOuter[0] = e3;"
+	"    gl_TessLevelOuter[1] = e0;"
+	"    gl_TessLevelOuter[2] = e1;"
+	"    gl_TessLevelOuter[3] = e2;"
+	"    gl_TessLevelInner[0] = max(level(tcInfo[0].y, wmin, cells.x), max(e0, e2));"
+	"    gl_TessLevelInner[1] = max(level(tcInfo[0].y, wmin, cells.y), max(e1, e3));"
+	"}";
+
+// Height and normal lookups, shared by the evaluation and fragment shaders.
+#define TERRAIN_SHADER_HEIGHTS \
+	"uniform sampler2D heights;" \
+	"uniform mat4 Model;" \
+	"uniform vec2 grid;" \
+	"float h(vec2 p) { return texture(heights, (p * grid + 0.5) / (grid + 1.0)).r; }" \
+	"vec3 terrainNormal(vec2 p)" \
+	"{" \
+	"    vec2 d  = 1.0 / grid;" \
+	"    vec3 Tu = mat3(Model) * vec3(2.0 * d.x, 0.0, h(p + vec2(d.x, 0.0)) - h(p - vec2(d.x, 0.0)));" \
+	"    vec3 Tv = mat3(Model) * vec3(0.0, 2.0 * d.y, h(p + vec2(0.0, d.y)) - h(p - vec2(0.0, d.y)));" \
+	"    return normalize(cross(Tu, Tv));" \
+	"}"
+
+// Up to the displaced vertex; the two lighting models add their tail.
+#define TERRAIN_EVALUATION_SHADER_HEAD \
+	"#version 400\n" \
+	"layout(quads, equal_spacing, ccw) in;" \
+	"in vec3 tePos[];" \
+	"uniform mat4 PV;" \
+	TERRAIN_SHADER_HEIGHTS \
+	"vec4 terrainVertex(out vec2 p)" \
+	"{" \
+	"    p = mix(mix(tePos[0].xy, tePos[1].xy, gl_TessCoord.x), mix(tePos[3].xy, tePos[2].xy, gl_TessCoord.x), gl_TessCoord.y);" \
+	"    vec4 vertex = Model * vec4(p, h(p), 1.0);" \
+	"    gl_Position = PV * vertex;" \
+	"    return vertex;" \
+	"}"
+
+const char* terrainGouraudShader =
+	TERRAIN_EVALUATION_SHADER_HEAD
+	"uniform vec3 ambiComp;"
+	"uniform vec3 diffComp;"
+	"uniform vec3 specComp;"
+	"uniform vec3 constants;"
+	"uniform int  numLights;"
+	"uniform vec4 lightPos[8];"
+	"uniform vec3 lightColor[8];"
+	"uniform vec3 propColor;"
+	"out vec3 color;"
+	"void main ()"
+	"{"
+	"    vec2 p;"
+	"    vec4 vertex    = terrainVertex(p);"
+	"    vec3 N         = terrainNormal(p);"
+	"    float shinComp = constants.z;"
+	"    vec3 V         = normalize( vec3(-vertex) );"
+	"    vec3 ambiProd  = vec3(0.0f);"
+	"    vec3 lightProd = vec3(0.0f);"
+	"    for(int i = 0; i < numLights; i++)"
+	"    {"
+	"        vec3 L    = normalize( vec3(lightPos[i]) - vec3(vertex) * lightPos[i].w );"
+	"        ambiProd += lightColor[i];"
+	"        if(dot(N,L) > 0)"
+	"        {"
+	"            vec3 R     = normalize( reflect(-L, N) );"
+	"            lightProd += lightColor[i] * ( diffComp * max( dot(N, L), 0.0f ) + specComp * pow( max( dot(R, V), 0.0f ), shinComp ) );"
+	"        }"
+	"    }"
+	"    color = clamp( propColor * ( (ambiProd * ambiComp) + lightProd ), 0.0f, 1.0f );"
+	"}";
+
+const char* terrainPhongShader =
+	TERRAIN_EVALUATION_SHADER_HEAD
+	"out vec3 fP;"
+	"out vec2 fGrid;"
+	"void main ()"
+	"{"
+	"    fP = vec3(terrainVertex(fGrid));"
+	"}";
+
+// fragmentShader1 with the normal taken from the heightmap per pixel, so the
+// shading does not change with the tessellation level.
+const char* terrainPhongFragmentShader =
+	"#version 400\n"
+	"in vec3 fP;"
+	"in vec2 fGrid;"
+	TERRAIN_SHADER_HEIGHTS
+	"uniform vec3 ambiComp;"
+	"uniform vec3 diffComp;"
+	"uniform vec3 specComp;"
+	"uniform vec3 constants;"
+	"uniform int  numLights;"
+	"uniform vec4 lightPos[8];"
+	"uniform vec3 lightColor[8];"
+	"uniform vec3 propColor;"
+	"out vec4 frag_color;"
+	"void main ()"
+	"{"
+	"    float shinComp = constants.z;"
+	"    vec3 N         = terrainNormal(fGrid);"
+	"    vec3 V         = normalize(-fP);"
+	"    vec3 ambiProd  = vec3(0.0f);"
+	"    vec3 lightProd = vec3(0.0f);"
+	"    for(int i = 0; i < numLights; i++)"
+	"    {"
+	"        vec3 L    = normalize( vec3(lightPos[i]) - fP * lightPos[i].w );"
+	"        ambiProd += lightColor[i];"
+	"        if(dot(N,L) > 0)"
+	"        {"
+	"            vec3 R     = normalize( reflect(-L, N) );"
+	"            lightProd += lightColor[i] * ( diffComp * max( dot(N, L), 0.0f ) + specComp * pow( max( dot(R, V), 0.0f ), shinComp ) );"
+	"        }"
+	"    }"
+	"    frag_color = vec4(clamp( propColor * ( (ambiProd * ambiComp) + lightProd ), 0.0f, 1.0f ), 1.0f);"
+	"}";
+
+// Samples end up bottom row first, full 16-bit range.
+bool loadHeightmap(const char *path, vector<unsigned short> &samples, int &width, int &height)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) { fprintf(stderr, "Can't open heightmap %s\n", path); return false; }
+	fseek(f, 0, SEEK_END);
+	long l_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char l_magic[3] = { 0 };
+	int l_maxval = 65535;
+	bool l_pgm = fread(l_magic, 1, 2, f) == 2 && l_magic[0] == 'P' && l_magic[1] == '5';
+	if (l_pgm)
+	{
+		int l_fields[3], l_n = 0;
+		while (l_n < 3)
+		{
+			int c = fgetc(f);
+			if (c == '#') { while (c != '\n' && c != EOF) c = fgetc(f); }
+			else if (c >= '0' && c <= '9') { ungetc(c, f); if (fscanf(f, "%d", &l_fields[l_n++]) != 1) break; }
+			else if (c == EOF) break;
+		}
+		fgetc(f); // the single whitespace before the data
+		if (l_n < 3 || l_fields[2] <= 0 || l_fields[2] > 65535) { fprintf(stderr, "Bad PGM header in %s\n", path); fclose(f); return false; }
+		width = l_fields[0];  height = l_fields[1];  l_maxval = l_fields[2];
+	}
+	else
+	{
+		fseek(f, 0, SEEK_SET);
+		width = height = (int)sqrt((double)(l_size / 2));
+		if ((long)width * width * 2 != l_size) { fprintf(stderr, "%s: .raw heightmaps must be square 16-bit\n", path); fclose(f); return false; }
+	}
+	if (width < 2 || height < 2) { fprintf(stderr, "%s: heightmap too small\n", path); fclose(f); return false; }
+
+	int l_bytes = (l_maxval > 255) ? 2 : 1;
+	vector<unsigned char> l_raw((size_t)width * height * l_bytes);
+	bool l_ok = fread(&l_raw[0], 1, l_raw.size(), f) == l_raw.size();
+	fclose(f);
+	if (!l_ok) { fprintf(stderr, "%s: heightmap is truncated\n", path); return false; }
+
+	samples.resize((size_t)width * height);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			size_t i = ((size_t)(height - 1 - y) * width + x) * l_bytes;
+			unsigned int v = (l_bytes == 1) ? l_raw[i] : l_pgm ? (l_raw[i] << 8 | l_raw[i + 1]) : (l_raw[i] | l_raw[i + 1] << 8);
+			samples[(size_t)y * width + x] = (unsigned short)(v * 65535u / l_maxval);
+		}
+	}
+	return true;
+}
+
+float terrainSample(int x, int y)
+{
+	return terrain.samples[(size_t)y * terrain.width + x] / 65535.0f;
+}
+
+// Largest distance of the samples from x0,y0 to x1,y1 (a row or a column)
+// to the straight line between its ends.
+float terrainEdgeRoughness(int x0, int y0, int x1, int y1)
+{
+	int l_n = std::max(x1 - x0, y1 - y0);
+	float l_a = terrainSample(x0, y0), l_b = terrainSample(x1, y1), l_r = 0.0f;
+	for (int i = 1; i < l_n; i++)
+	{
+		float t = (float)i / l_n;
+		float v = terrainSample(x0 + (x1 - x0) * i / l_n, y0 + (y1 - y0) * i / l_n);
+		l_r = std::max(l_r, fabsf(v - (l_a + (l_b - l_a) * t)));
+	}
+	return l_r;
+}
+
+// Ground-local transform of the unit heightmap (see the section comment).
+mat4 terrainModel()
+{
+	return translate(mat4(1.0f), vec3(-0.5f, -0.5f, -terrain.verticalScale)) * scale(mat4(1.0f), vec3(1.0f, 1.0f, terrain.verticalScale));
+}
+
+void initTerrain()
+{
+	if (terrain.path.empty()) return;
+	if (!loadHeightmap(terrain.path.c_str(), terrain.samples, terrain.width, terrain.height)) return;
+
+	int W = terrain.width, H = terrain.height, P = terrain.patchCells;
+	vec2 l_grid = vec2((float)(W - 1), (float)(H - 1));
+	vector<float> l_patches;
+	for (int y0 = 0; y0 < H - 1; y0 += P)
+	{
+		for (int x0 = 0; x0 < W - 1; x0 += P)
+		{
+			int x1 = std::min(x0 + P, W - 1), y1 = std::min(y0 + P, H - 1);
+			float l_c[4] = { terrainSample(x0, y0), terrainSample(x1, y0), terrainSample(x1, y1), terrainSample(x0, y1) };
+			float l_interior = 0.0f, l_min = 1.0f, l_max = 0.0f;
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					float u = (float)(x - x0) / (x1 - x0), v = (float)(y - y0) / (y1 - y0), s = terrainSample(x, y);
+					float l_bilinear = (l_c[0] * (1 - u) + l_c[1] * u) * (1 - v) + (l_c[3] * (1 - u) + l_c[2] * u) * v;
+					l_interior = std::max(l_interior, fabsf(s - l_bilinear));
+					l_min = std::min(l_min, s);
+					l_max = std::max(l_max, s);
+				}
+			}
+			float l_edge[4] = { terrainEdgeRoughness(x0, y0, x1, y0), terrainEdgeRoughness(x1, y0, x1, y1), terrainEdgeRoughness(x0, y1, x1, y1), terrainEdgeRoughness(x0, y0, x0, y1) };
+			int l_corner[4][2] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 } };
+			for (int k = 0; k < 4; k++)
+			{
+				float l_vertex[7] = { l_corner[k][0] / l_grid.x, l_corner[k][1] / l_grid.y, l_c[k], l_edge[k], l_interior, l_min, l_max };
+				l_patches.insert(l_patches.end(), l_vertex, l_vertex + 7);
+			}
+		}
+	}
+	terrain.numPatches = (int)l_patches.size() / 28;
+
+	glGenBuffers(1, &terrain.VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, terrain.VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * l_patches.size(), &l_patches[0], GL_STATIC_DRAW);
+
+	glGenTextures(1, &terrain.heightTex);
+	glBindTexture(GL_TEXTURE_2D, terrain.heightTex);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, W, H, 0, GL_RED, GL_UNSIGNED_SHORT, &terrain.samples[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenQueries(2, terrain.query);
+
+	// The coarse stand-in on the ground prop.
+	int n = std::max(2, std::min(terrain.coarseSamples, std::min(W, H)));
+	mat4 l_model = terrainModel();
+	ground.vertex.resize(n * n);
+	ground.index.clear();
+	for (int y = 0; y < n; y++)
+	{
+		for (int x = 0; x < n; x++)
+		{
+			int sx = x * (W - 1) / (n - 1), sy = y * (H - 1) / (n - 1);
+			ground.vertex[y * n + x] = vec3(l_model * vec4((float)x / (n - 1), (float)y / (n - 1), terrainSample(sx, sy), 1.0f));
+			if (x == n - 1 || y == n - 1) continue;
+			int i = y * n + x;
+			int l_quad[6] = { i, i + 1, i + n + 1,    i, i + n + 1, i + n };
+			ground.index.insert(ground.index.end(), l_quad, l_quad + 6);
+		}
+	}
+	glDeleteBuffers(1, &ground.VBO);
+	glDeleteBuffers(1, &ground.IBO);
+	glDeleteVertexArrays(1, &ground.VAO[renderContext]);
+	ground.VAO[renderContext] = 0;
+	ground.init(n * n, (int)ground.index.size(), ground.propColor, ground.center, ground.Model, ground.material, false);
+
+	terrain.loaded = true;
+	terrain.triMin = 1LL << 62;
+	printf("Terrain: %s, %d x %d samples, %d patches of %d cells, %lld triangles at full resolution\n",
+		terrain.path.c_str(), W, H, terrain.numPatches, P, 2LL * (W - 1) * (H - 1));
+}
+
+// In runs of terrainPatchesPerDraw: llvmpipe garbles single draws of a few
+// hundred highly tessellated patches.
+const int terrainPatchesPerDraw = 16;
+
+void drawTerrainPatches()
+{
+	for (int i = 0; i < terrain.numPatches; i += terrainPatchesPerDraw)
+	{
+		glDrawArrays(GL_PATCHES, 4 * i, 4 * std::min(terrainPatchesPerDraw, terrain.numPatches - i));
+	}
+}
+
+// Returns the triangles drawn (from the previous frame's query on the main
+// context, which is ready by now without waiting), or -1 without a terrain.
+long long drawTerrain(const mat4 &l_PV)
+{
+	if (!terrain.loaded) return -1;
+	structTerrainProgram *l_programs = terrain.programs[renderContext];
+	if (l_programs[0].s.prog == 0)
+	{
+		const char *l_eval[2] = { terrainGouraudShader, terrainPhongShader };
+		const char *l_frag[2] = { fragmentShader, terrainPhongFragmentShader };
+		for (int i = 0; i < 2; i++)
+		{
+			structTerrainProgram &t = l_programs[i];
+			t.s.prog = initShaders(terrainVertexShader, l_frag[i], NULL, terrainControlShader, l_eval[i]);
+			glUseProgram(t.s.prog);
+			initShaderLocations(t.s, false, true);
+			t.gridLoc       = glGetUniformLocation(t.s.prog, "grid");
+			t.pixelScaleLoc = glGetUniformLocation(t.s.prog, "pixelScale");
+			t.maxErrorLoc   = glGetUniformLocation(t.s.prog, "maxError");
+			t.fullResLoc    = glGetUniformLocation(t.s.prog, "fullRes");
+			glUniform1i(glGetUniformLocation(t.s.prog, "heights"), 0);
+		}
+		glGenVertexArrays(1, &terrain.VAO[renderContext]);
+		glBindVertexArray(terrain.VAO[renderContext]);
+		glBindBuffer(GL_ARRAY_BUFFER, terrain.VBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void *)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void *)(3 * sizeof(float)));
+	}
+
+	structTerrainProgram &t = l_programs[phong ? 1 : 0];
+	GLint l_viewport[4];
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	glUseProgram(t.s.prog);
+	glUniformMatrix4fv(t.s.MUniformLoc, 1, GL_FALSE, value_ptr(ground.Model * terrainModel()));
+	glUniformMatrix4fv(t.s.PVUniformLoc, 1, GL_FALSE, value_ptr(l_PV));
+	glUniform3fv(t.s.propColorLoc, 1, value_ptr(ground.propColor));
+	setLightingUniforms(t.s, ground.material);
+	glUniform2f(t.gridLoc, (float)(terrain.width - 1), (float)(terrain.height - 1));
+	glUniform1f(t.pixelScaleLoc, 0.5f * l_viewport[3] * fabsf(Projection[1][1])); // the campus fovy of 5 rad flips its sign
+	glUniform1f(t.maxErrorLoc, terrain.maxError);
+	glUniform1i(t.fullResLoc, terrain.fullRes ? 1 : 0);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, terrain.heightTex);
+	glBindVertexArray(terrain.VAO[renderContext]);
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+
+	if (renderContext != 0)
+	{
+		drawTerrainPatches();
+		return terrain.lastTris;
+	}
+
+	// Two queries in turn; last frame's is read only if it is already done.
+	if (terrain.queryFrame > 0)
+	{
+		GLuint l_previous = terrain.query[(terrain.queryFrame + 1) & 1], l_ready = 0, l_prims = 0;
+		glGetQueryObjectuiv(l_previous, GL_QUERY_RESULT_AVAILABLE, &l_ready);
+		if (l_ready)
+		{
+			glGetQueryObjectuiv(l_previous, GL_QUERY_RESULT, &l_prims);
+			terrain.lastTris = l_prims;
+			terrain.frames++;
+			terrain.triSum += l_prims;
+			terrain.triMin = std::min(terrain.triMin, (long long)l_prims);
+			terrain.triMax = std::max(terrain.triMax, (long long)l_prims);
+		}
+	}
+	glBeginQuery(GL_PRIMITIVES_GENERATED, terrain.query[terrain.queryFrame & 1]);
+	drawTerrainPatches();
+	glEndQuery(GL_PRIMITIVES_GENERATED);
+	terrain.queryFrame++;
+	glBindVertexArray(0);
+	return terrain.lastTris;
+}
+
+void terrainReport()
+{
+	if (!terrain.loaded || terrain.frames == 0) return;
+	long long l_full = 2LL * (terrain.width - 1) * (terrain.height - 1);
+	double l_mean = (double)terrain.triSum / terrain.frames;
+	printf("Terrain: %.0f triangles per frame (min %lld, max %lld) vs %lld at full resolution, %.2f%%, over %lld frames\n",
+		l_mean, terrain.triMin, terrain.triMax, l_full, 100.0 * l_mean / l_full, terrain.frames);
+}
+
+//-------------------------SOFTWARE-RASTERIZER--------------------------
+// CPU backend for machines without a usable GPU. prop::render() forwards to
+// prop::renderSoftware() when renderBackend == backendSoftware: vertices are
+// transformed with SSE (AVX2 when the CPU has it), lit exactly like the
+// Gouraud/Phong shaders, clipped against the near plane and binned into
+// screen tiles. swEndFrame() then
+// rasterizes the tiles on a pool of worker threads. Each tile keeps a max
+// depth per 8x8 block (a one-level Hi-Z), so triangles behind what has
+// already been drawn are rejected a block at a time.
+const int swTileSize = 64, swBlockSize = 8, swMaxVaryings = 6;
+enum { swModeGouraud = 0, swModePhong = 1 };
+
+struct swVertex { vec4 clip; float var[swMaxVaryings]; };
+
+struct swTriangle
+{
+	vec3 v[3];                          // window x, y and depth
+	float invW[3], var[3][swMaxVaryings]; // varyings are pre-divided by w
+	float area, zMin;
+	int minX, minY, maxX, maxY, mode;
+	const prop *owner;
+};
+
+struct swLine { vec3 a, b; unsigned int color; };
+
+struct structSwFrame
+{
+	int width, height, tilesX, tilesY, blocksX, blocksY;
+	unsigned int clearColor;
+	long long trianglesSubmitted;
+	vector<unsigned int> color;
+	vector<float> depth, blockMaxZ;
+	vector<swTriangle> tris;
+	vector<swLine> lines;
+	vector< vector<int> > tileList;     // >= 0 triangle index, < 0 ~line index, in submission order
+};
+
+struct structSwPool
+{
+	vector<thread> workers;
+	mutex lock;
+	condition_variable wake, done;
+	int generation, busy;
+	bool quit;
+	atomic<int> nextTile;
+};
+
+structSwFrame swFrame;
+structSwPool swPool;
+mutex swFrameLock; // held from swBeginFrame() to swRasterFrame() by batch render threads, which share swFrame
+int swNumThreads = 0;
+GLuint swTex = 0, swFBO = 0;
+int swTexWidth = 0, swTexHeight = 0;
+
+#ifdef MK_DISPATCH
+// Two vertices per iteration, one in each 128-bit lane; returns how many
+// were done. Same mul/add order as the SSE loop, so results are identical.
+MK_TARGET("avx2") int swTransformAVX2(const float *l_m, float w, const vec3 *in, vec4 *out, int n)
+{
+	__m128 l_c3 = _mm_mul_ps(_mm_loadu_ps(l_m + 12), _mm_set1_ps(w));
+	__m256 l_d0 = _mm256_broadcast_ps((const __m128 *)l_m), l_d1 = _mm256_broadcast_ps((const __m128 *)(l_m + 4));
+	__m256 l_d2 = _mm256_broadcast_ps((const __m128 *)(l_m + 8)), l_d3 = _mm256_broadcast_ps(&l_c3);
+	int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		__m256 l_x = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(in[i].x)), _mm_set1_ps(in[i + 1].x), 1);
+		__m256 l_y = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(in[i].y)), _mm_set1_ps(in[i + 1].y), 1);
+		__m256 l_z = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(in[i].z)), _mm_set1_ps(in[i + 1].z), 1);
+		__m256 l_r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l_d0, l_x), _mm256_mul_ps(l_d1, l_y)), _mm256_add_ps(_mm256_mul_ps(l_d2, l_z), l_d3));
+		_mm256_storeu_ps(&out[i].x, l_r);
+	}
+	return i;
+}
+#endif
+
+// out[i] = M * vec4(in[i], w). The wide loop follows the mesh kernel tier
+// picked at startup (--mesh-kernels), so it runs wherever the CPU has AVX2.
+void swTransform(const mat4 &M, const vec3 *in, vec4 *out, int n, float w)
+{
+#ifdef SW_SIMD
+	const float *l_m = value_ptr(M);
+	__m128 l_c0 = _mm_loadu_ps(l_m),     l_c1 = _mm_loadu_ps(l_m + 4);
+	__m128 l_c2 = _mm_loadu_ps(l_m + 8), l_c3 = _mm_mul_ps(_mm_loadu_ps(l_m + 12), _mm_set1_ps(w));
+	int i = 0;
+#ifdef MK_DISPATCH
+	if (meshKernels >= &mkTiers[mkTierAVX2]) i = swTransformAVX2(l_m, w, in, out, n);
+#endif
+	for (; i < n; i++)
+	{
+		__m128 l_r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l_c0, _mm_set1_ps(in[i].x)), _mm_mul_ps(l_c1, _mm_set1_ps(in[i].y))),
+		                        _mm_add_ps(_mm_mul_ps(l_c2, _mm_set1_ps(in[i].z)), l_c3));
+		_mm_storeu_ps(&out[i].x, l_r);
+	}
+#else
+	for (int i = 0; i < n; i++) { out[i] = M * vec4(in[i], w); }
+#endif
+}
+
+// Same lighting equation as vertexShader / fragmentShader1. N normalized,
+// P the world-space position.
+vec3 swShade(const prop &p, vec3 N, vec3 P)
+{
+	vec3 l_V = normalize(-P), l_ambiProd(0.0f), l_lightProd(0.0f);
+
+	for (int i = 0; i < numLights; i++)
+	{
+		vec3 l_L = normalize(vec3(lightPos[i]) - P * lightPos[i].w);
+		l_ambiProd += lightColor[i];
+		if (dot(N, l_L) > 0)
+		{
+			vec3 l_R = normalize(reflect(-l_L, N));
+			l_lightProd += lightColor[i] * (p.material.diffuse * dot(N, l_L) + p.material.specular * powf(fmaxf(dot(l_R, l_V), 0.0f), p.material.shininess));
+		}
+	}
+
+	return clamp(p.propColor * ((l_ambiProd * p.material.ambient) + l_lightProd), 0.0f, 1.0f);
+}
+
+unsigned int swPackColor(vec3 c)
+{
+	return (unsigned int)(c.x * 255.0f + 0.5f) | ((unsigned int)(c.y * 255.0f + 0.5f) << 8) | ((unsigned int)(c.z * 255.0f + 0.5f) << 16) | 0xff000000u;
+}
+
+vec3 swToWindow(vec4 clip)
+{
+	vec3 l_ndc = vec3(clip) / clip.w;
+	return vec3((l_ndc.x * 0.5f + 0.5f) * swFrame.width, (l_ndc.y * 0.5f + 0.5f) * swFrame.height, l_ndc.z * 0.5f + 0.5f);
+}
+
+float swEdge(vec3 a, vec3 b, float px, float py)
+{
+	return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+void swBin(int minX, int minY, int maxX, int maxY, int entry)
+{
+	for (int ty = minY / swTileSize; ty <= maxY / swTileSize; ty++)
+		for (int tx = minX / swTileSize; tx <= maxX / swTileSize; tx++)
+			swFrame.tileList[ty * swFrame.tilesX + tx].push_back(entry);
+}
+
+void swSetupTriangle(const swVertex &a, const swVertex &b, const swVertex &c, int mode, const prop *owner)
+{
+	const swVertex *l_v[3] = { &a, &b, &c };
+	swTriangle l_t;
+	for (int i = 0; i < 3; i++)
+	{
+		l_t.v[i]    = swToWindow(l_v[i]->clip);
+		l_t.invW[i] = 1.0f / l_v[i]->clip.w;
+		for (int k = 0; k < swMaxVaryings; k++) { l_t.var[i][k] = l_v[i]->var[k] * l_t.invW[i]; }
+	}
+
+	// No face culling in the GL path either, so accept both windings.
+	l_t.area = swEdge(l_t.v[0], l_t.v[1], l_t.v[2].x, l_t.v[2].y);
+	if (l_t.area == 0.0f) return;
+	if (l_t.area < 0.0f)
+	{
+		swap(l_t.v[1], l_t.v[2]);
+		swap(l_t.invW[1], l_t.invW[2]);
+		for (int k = 0; k < swMaxVaryings; k++) { swap(l_t.var[1][k], l_t.var[2][k]); }
+		l_t.area = -l_t.area;
+	}
+
+	float l_minX = fminf(l_t.v[0].x, fminf(l_t.v[1].x, l_t.v[2].x)), l_maxX = fmaxf(l_t.v[0].x, fmaxf(l_t.v[1].x, l_t.v[2].x));
+	float l_minY = fminf(l_t.v[0].y, fminf(l_t.v[1].y, l_t.v[2].y)), l_maxY = fmaxf(l_t.v[0].y, fmaxf(l_t.v[1].y, l_t.v[2].y));
+	if (l_maxX < 0.0f || l_maxY < 0.0f || l_minX >= swFrame.width || l_minY >= swFrame.height) return;
+
+	l_t.minX = std::max(0, (int)l_minX);   l_t.maxX = std::min(swFrame.width  - 1, (int)l_maxX);
+	l_t.minY = std::max(0, (int)l_minY);   l_t.maxY = std::min(swFrame.height - 1, (int)l_maxY);
+	l_t.zMin  = fminf(l_t.v[0].z, fminf(l_t.v[1].z, l_t.v[2].z));
+	l_t.mode  = mode;
+	l_t.owner = owner;
+
+	swFrame.tris.push_back(l_t);
+	swBin(l_t.minX, l_t.minY, l_t.maxX, l_t.maxY, (int)swFrame.tris.size() - 1);
+}
+
+swVertex swLerp(const swVertex &a, const swVertex &b, float t)
+{
+	swVertex l_r;
+	l_r.clip = mix(a.clip, b.clip, t);
+	for (int k = 0; k < swMaxVaryings; k++) { l_r.var[k] = a.var[k] + (b.var[k] - a.var[k]) * t; }
+	return l_r;
+}
+
+// Signed distances to the near plane and to a guard band around the side
+// planes; a vertex is inside where they are all >= 0. Clipping the sides too
+// keeps window coordinates small enough for float edge functions.
+const int swNumClipPlanes = 5;
+const float swGuardBand = 2.0f;
+
+float swClipDist(const swVertex &v, int plane)
+{
+	switch (plane)
+	{
+		case 0:  return v.clip.z + v.clip.w;
+		case 1:  return swGuardBand * v.clip.w + v.clip.x;
+		case 2:  return swGuardBand * v.clip.w - v.clip.x;
+		case 3:  return swGuardBand * v.clip.w + v.clip.y;
+		default: return swGuardBand * v.clip.w - v.clip.y;
+	}
+}
+
+void swSubmitTriangle(const swVertex &a, const swVertex &b, const swVertex &c, int mode, const prop *owner)
+{
+	bool l_inside = true;
+	for (int p = 0; p < swNumClipPlanes && l_inside; p++)
+		l_inside = swClipDist(a, p) >= 0 && swClipDist(b, p) >= 0 && swClipDist(c, p) >= 0;
+	if (l_inside)
+	{
+		swSetupTriangle(a, b, c, mode, owner);
+		return;
+	}
+
+	// Sutherland-Hodgman against each plane in turn, then fan out the result.
+	swVertex l_poly[2][3 + swNumClipPlanes];
+	int l_n = 3, l_src = 0;
+	l_poly[0][0] = a;  l_poly[0][1] = b;  l_poly[0][2] = c;
+	for (int p = 0; p < swNumClipPlanes && l_n > 0; p++)
+	{
+		const swVertex *l_in = l_poly[l_src];
+		swVertex *l_out = l_poly[1 - l_src];
+		int l_outN = 0;
+		for (int i = 0; i < l_n; i++)
+		{
+			const swVertex &l_a = l_in[i], &l_b = l_in[(i + 1) % l_n];
+			float l_da = swClipDist(l_a, p), l_db = swClipDist(l_b, p);
+			if (l_da >= 0) l_out[l_outN++] = l_a;
+			if ((l_da >= 0) != (l_db >= 0)) l_out[l_outN++] = swLerp(l_a, l_b, l_da / (l_da - l_db));
+		}
+		l_n = l_outN;
+		l_src = 1 - l_src;
+	}
+	for (int i = 2; i < l_n; i++) { swSetupTriangle(l_poly[l_src][0], l_poly[l_src][i - 1], l_poly[l_src][i], mode, owner); }
+}
+
+void swSubmitLine(const swVertex &a, const swVertex &b, unsigned int color)
+{
+	swVertex l_a = a, l_b = b;
+	for (int p = 0; p < swNumClipPlanes; p++)
+	{
+		float l_da = swClipDist(l_a, p), l_db = swClipDist(l_b, p);
+		if (l_da < 0 && l_db < 0) return;
+		if (l_da < 0) l_a = swLerp(l_a, l_b, l_da / (l_da - l_db));
+		else if (l_db < 0) l_b = swLerp(l_b, l_a, l_db / (l_db - l_da));
+	}
+
+	swLine l_line = { swToWindow(l_a.clip), swToWindow(l_b.clip), color };
+	int l_minX = std::max(0, (int)fminf(l_line.a.x, l_line.b.x)), l_maxX = std::min(swFrame.width  - 1, (int)fmaxf(l_line.a.x, l_line.b.x));
+	int l_minY = std::max(0, (int)fminf(l_line.a.y, l_line.b.y)), l_maxY = std::min(swFrame.height - 1, (int)fmaxf(l_line.a.y, l_line.b.y));
+	if (l_minX > l_maxX || l_minY > l_maxY) return;
+
+	swFrame.lines.push_back(l_line);
+	swBin(l_minX, l_minY, l_maxX, l_maxY, ~((int)swFrame.lines.size() - 1));
+}
+
+void prop::renderSoftware(const mat4 &l_PV)
+{
+	static vector<vec4> l_clip, l_world, l_normal;
+	static vector<swVertex> l_vert;
+	l_clip.resize(numVertices);
+	l_world.resize(numVertices);
+	l_normal.resize(numVertices);
+	l_vert.resize(numVertices);
+
+	swTransform(l_PV * Model, &vertex[0], &l_clip[0], numVertices, 1.0f);
+
+	if (outline == true)
+	{
+		for (int i = 0; i < numVertices; i++) { l_vert[i].clip = l_clip[i]; }
+		unsigned int l_color = swPackColor(clamp(propColor, 0.0f, 1.0f));
+		for (int i = 0; i < numIndices; i++) { swSubmitLine(l_vert[index[i]], l_vert[index[(i + 1) % numIndices]], l_color); }
+		return;
+	}
+
+	swTransform(Model, &vertex[0], &l_world[0], numVertices, 1.0f);
+	swTransform(Model, &normal[0], &l_normal[0], numVertices, 0.0f);
+
+	int l_mode = phong ? swModePhong : swModeGouraud;
+	for (int i = 0; i < numVertices; i++)
+	{
+		swVertex &v = l_vert[i];
+		vec3 l_vertex = vec3(l_world[i]);
+		v.clip = l_clip[i];
+		if (l_mode == swModeGouraud)
+		{
+			vec3 l_color = swShade(*this, normalize(vec3(l_normal[i])), l_vertex);
+			v.var[0] = l_color.x;  v.var[1] = l_color.y;  v.var[2] = l_color.z;
+		}
+		else
+		{
+			// fN, fP exactly as vertexShader1 writes them.
+			v.var[0] = l_normal[i].x;  v.var[1] = l_normal[i].y;  v.var[2] = l_normal[i].z;
+			v.var[3] = l_vertex.x;     v.var[4] = l_vertex.y;     v.var[5] = l_vertex.z;
+		}
+	}
+
+	for (int i = 0; i + 2 < numIndices; i += 3)
+	{
+		swSubmitTriangle(l_vert[index[i]], l_vert[index[i + 1]], l_vert[index[i + 2]], l_mode, this);
+	}
+	swFrame.trianglesSubmitted += numIndices / 3;
+}
+
+void swRasterTriangle(const swTriangle &t, int x0, int y0, int x1, int y1)
+{
+	int l_minX = std::max(t.minX, x0), l_maxX = std::min(t.maxX, x1);
+	int l_minY = std::max(t.minY, y0), l_maxY = std::min(t.maxY, y1);
+	if (l_minX > l_maxX || l_minY > l_maxY) return;
+
+	// Edge function steps per pixel in x and y.
+	float l_ax[3], l_ay[3];
+	for (int e = 0; e < 3; e++)
+	{
+		const vec3 &l_a = t.v[(e + 1) % 3], &l_b = t.v[(e + 2) % 3];
+		l_ax[e] = -(l_b.y - l_a.y);
+		l_ay[e] =   l_b.x - l_a.x;
+	}
+	float l_invArea = 1.0f / t.area;
+
+	for (int by = l_minY / swBlockSize; by <= l_maxY / swBlockSize; by++)
+	{
+		for (int bx = l_minX / swBlockSize; bx <= l_maxX / swBlockSize; bx++)
+		{
+			float &l_blockMax = swFrame.blockMaxZ[by * swFrame.blocksX + bx];
+			if (t.zMin >= l_blockMax) continue; // everything in this block is already closer
+
+			int l_px0 = std::max(l_minX, bx * swBlockSize), l_px1 = std::min(l_maxX, bx * swBlockSize + swBlockSize - 1);
+			int l_py0 = std::max(l_minY, by * swBlockSize), l_py1 = std::min(l_maxY, by * swBlockSize + swBlockSize - 1);
+			bool l_wrote = false;
+
+			float l_row[3];
+			for (int e = 0; e < 3; e++) { l_row[e] = swEdge(t.v[(e + 1) % 3], t.v[(e + 2) % 3], l_px0 + 0.5f, l_py0 + 0.5f); }
+
+			for (int y = l_py0; y <= l_py1; y++, l_row[0] += l_ay[0], l_row[1] += l_ay[1], l_row[2] += l_ay[2])
+			{
+				float l_w[3] = { l_row[0], l_row[1], l_row[2] };
+
+				for (int x = l_px0; x <= l_px1; x++, l_w[0] += l_ax[0], l_w[1] += l_ax[1], l_w[2] += l_ax[2])
+				{
+					if (l_w[0] < 0.0f || l_w[1] < 0.0f || l_w[2] < 0.0f) continue;
+
+					float l_b0 = l_w[0] * l_invArea, l_b1 = l_w[1] * l_invArea, l_b2 = l_w[2] * l_invArea;
+					float l_z = l_b0 * t.v[0].z + l_b1 * t.v[1].z + l_b2 * t.v[2].z;
+					int l_pixel = y * swFrame.width + x;
+					if (!(l_z < swFrame.depth[l_pixel]) || l_z < 0.0f) continue;
+
+					float l_invW = l_b0 * t.invW[0] + l_b1 * t.invW[1] + l_b2 * t.invW[2];
+					float l_var[swMaxVaryings];
+					int l_numVar = (t.mode == swModePhong) ? 6 : 3;
+					for (int k = 0; k < l_numVar; k++) { l_var[k] = (l_b0 * t.var[0][k] + l_b1 * t.var[1][k] + l_b2 * t.var[2][k]) / l_invW; }
+
+					vec3 l_color;
+					if (t.mode == swModePhong)
+						l_color = swShade(*t.owner, normalize(vec3(l_var[0], l_var[1], l_var[2])), vec3(l_var[3], l_var[4], l_var[5]));
+					else
+						l_color = vec3(l_var[0], l_var[1], l_var[2]);
+
+					swFrame.depth[l_pixel] = l_z;
+					swFrame.color[l_pixel] = swPackColor(clamp(l_color, 0.0f, 1.0f));
+					l_wrote = true;
+				}
+			}
+
+			if (l_wrote)
+			{
+				float l_max = 0.0f;
+				int l_bx1 = std::min(swFrame.width, (bx + 1) * swBlockSize), l_by1 = std::min(swFrame.height, (by + 1) * swBlockSize);
+				for (int y = by * swBlockSize; y < l_by1; y++)
+					for (int x = bx * swBlockSize; x < l_bx1; x++) { l_max = fmaxf(l_max, swFrame.depth[y * swFrame.width + x]); }
+				l_blockMax = l_max;
+			}
+		}
+	}
+}
+
+void swRasterLine(const swLine &l, int x0, int y0, int x1, int y1)
+{
+	float l_dx = l.b.x - l.a.x, l_dy = l.b.y - l.a.y, l_dz = l.b.z - l.a.z;
+	int l_steps = (int)fmaxf(fabs(l_dx), fabs(l_dy)) + 1;
+	for (int i = 0; i <= l_steps; i++)
+	{
+		float l_t = (float)i / l_steps;
+		int x = (int)(l.a.x + l_dx * l_t), y = (int)(l.a.y + l_dy * l_t);
+		if (x < x0 || x > x1 || y < y0 || y > y1) continue;
+		float l_z = l.a.z + l_dz * l_t;
+		int l_pixel = y * swFrame.width + x;
+		if (!(l_z < swFrame.depth[l_pixel])) continue;
+		swFrame.depth[l_pixel] = l_z;
+		swFrame.color[l_pixel] = l.color;
+		// A line can only push depth towards the camera; Hi-Z stays conservative.
+	}
+}
+
+void swRasterTiles()
+{
+	int l_numTiles = swFrame.tilesX * swFrame.tilesY;
+	for (int l_tile = swPool.nextTile++; l_tile < l_numTiles; l_tile = swPool.nextTile++)
+	{
+		int l_x0 = (l_tile % swFrame.tilesX) * swTileSize, l_x1 = std::min(swFrame.width,  l_x0 + swTileSize) - 1;
+		int l_y0 = (l_tile / swFrame.tilesX) * swTileSize, l_y1 = std::min(swFrame.height, l_y0 + swTileSize) - 1;
+
+		for (int y = l_y0; y <= l_y1; y++)
+		{
+			fill(swFrame.color.begin() + y * swFrame.width + l_x0, swFrame.color.begin() + y * swFrame.width + l_x1 + 1, swFrame.clearColor);
+			fill(swFrame.depth.begin() + y * swFrame.width + l_x0, swFrame.depth.begin() + y * swFrame.width + l_x1 + 1, 1.0f);
+		}
+		for (int by = l_y0 / swBlockSize; by <= l_y1 / swBlockSize; by++)
+			for (int bx = l_x0 / swBlockSize; bx <= l_x1 / swBlockSize; bx++) { swFrame.blockMaxZ[by * swFrame.blocksX + bx] = 1.0f; }
+
+		const vector<int> &l_list = swFrame.tileList[l_tile];
+		for (size_t i = 0; i < l_list.size(); i++)
+		{
+			if (l_list[i] >= 0) swRasterTriangle(swFrame.tris[l_list[i]], l_x0, l_y0, l_x1, l_y1);
+			else                swRasterLine(swFrame.lines[~l_list[i]], l_x0, l_y0, l_x1, l_y1);
+		}
+	}
+}
+
+void swWorker()
+{
+	int l_seen = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> l_lock(swPool.lock);
+			swPool.wake.wait(l_lock, [&] { return swPool.quit || swPool.generation != l_seen; });
+			if (swPool.quit) return;
+			l_seen = swPool.generation;
+		}
+		swRasterTiles();
+		{
+			lock_guard<mutex> l_lock(swPool.lock);
+			if (--swPool.busy == 0) swPool.done.notify_one();
+		}
+	}
+}
+
+void initSoftware()
+{
+	if (swNumThreads <= 0) swNumThreads = std::max(1, (int)thread::hardware_concurrency());
+	swPool.generation = 0;
+	swPool.busy = 0;
+	swPool.quit = false;
+	// The calling thread rasterizes too, so it only needs N-1 helpers.
+	for (int i = 1; i < swNumThreads; i++) { swPool.workers.push_back(thread(swWorker)); }
+}
+
+void shutdownSoftware()
+{
+	{
+		lock_guard<mutex> l_lock(swPool.lock);
+		swPool.quit = true;
+	}
+	swPool.wake.notify_all();
+	for (size_t i = 0; i < swPool.workers.size(); i++) { swPool.workers[i].join(); }
+	swPool.workers.clear();
+}
+
+void swBeginFrame()
+{
+	GLint l_viewport[4];
+	GLfloat l_clear[4];
+	glGetIntegerv(GL_VIEWPORT, l_viewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, l_clear);
+
+	if (swFrame.width != l_viewport[2] || swFrame.height != l_viewport[3])
+	{
+		swFrame.width   = l_viewport[2];
+		swFrame.height  = l_viewport[3];
+		swFrame.tilesX  = (swFrame.width  + swTileSize  - 1) / swTileSize;
+		swFrame.tilesY  = (swFrame.height + swTileSize  - 1) / swTileSize;
+		swFrame.blocksX = (swFrame.width  + swBlockSize - 1) / swBlockSize;
+		swFrame.blocksY = (swFrame.height + swBlockSize - 1) / swBlockSize;
+		swFrame.color.resize(swFrame.width * swFrame.height);
+		swFrame.depth.resize(swFrame.width * swFrame.height);
+		swFrame.blockMaxZ.resize(swFrame.blocksX * swFrame.blocksY);
+		swFrame.tileList.resize(swFrame.tilesX * swFrame.tilesY);
+	}
+
+	swFrame.clearColor = swPackColor(vec3(l_clear[0], l_clear[1], l_clear[2]));
+	swFrame.trianglesSubmitted = 0;
+	swFrame.tris.clear();
+	swFrame.lines.clear();
+	for (size_t i = 0; i < swFrame.tileList.size(); i++) { swFrame.tileList[i].clear(); }
+}
+
+void swRasterFrame()
+{
+	swPool.nextTile = 0;
+	{
+		lock_guard<mutex> l_lock(swPool.lock);
+		swPool.busy = (int)swPool.workers.size();
+		swPool.generation++;
+	}
+	swPool.wake.notify_all();
+	swRasterTiles();
+
+	unique_lock<mutex> l_lock(swPool.lock);
+	swPool.done.wait(l_lock, [] { return swPool.busy == 0; });
+}
+
+void swPresent()
+{
+	if (swFBO == 0)
+	{
+		glGenTextures(1, &swTex);
+		glGenFramebuffers(1, &swFBO);
+	}
+	glBindTexture(GL_TEXTURE_2D, swTex);
+	if (swTexWidth != swFrame.width || swTexHeight != swFrame.height)
+	{
+		swTexWidth  = swFrame.width;
+		swTexHeight = swFrame.height;
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, swTexWidth, swTexHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, swFrame.width, swFrame.height, GL_RGBA, GL_UNSIGNED_BYTE, &swFrame.color[0]);
+
+	// Blit into whatever is bound for drawing (the window, or the dynamic resolution FBO).
+	GLint l_drawFBO;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &l_drawFBO);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, swFBO);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, swTex, 0);
+	glBlitFramebuffer(0, 0, swFrame.width, swFrame.height, 0, 0, swFrame.width, swFrame.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, l_drawFBO);
+}
+
+void swEndFrame()
+{
+	swRasterFrame();
+	swPresent();
+}
+
+//------------------------DYNAMIC-RESOLUTION---------------------------
+// The scene is drawn into an offscreen FBO at (scale * window) pixels and
+// blitted up to the window. GPU time of the scene + blit is measured with
+// a ring of timer queries (read back a few frames late so we never stall)
+// and the scale is nudged towards the frame-time target.
+struct structDynRes
+{
+	bool enabled, supported, log; // supported: initDynRes() built a complete FBO
+	float targetMs, minScale, maxScale, hysteresis, step, scale, gpuMsAvg;
+	int settleFrames, framesSinceChange, width, height;
+};
+
+const int dynResNumQueries = 4;
+structDynRes dynRes = { false, false, true, 16.6f, 0.5f, 1.0f, 0.1f, 0.05f, 1.0f, 0.0f, 30, 0, windowWidth, windowHeight };
+GLuint dynResFBO, dynResColorRBO, dynResDepthRBO, dynResQuery[dynResNumQueries];
+int dynResQueryFrame = 0;
+
+void initDynRes()
+{
+	dynRes.scale = dynRes.maxScale;
+
+	glGenRenderbuffers(1, &dynResColorRBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, dynResColorRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, (int)(windowWidth * dynRes.maxScale), (int)(windowHeight * dynRes.maxScale));
+
+	glGenRenderbuffers(1, &dynResDepthRBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, dynResDepthRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, (int)(windowWidth * dynRes.maxScale), (int)(windowHeight * dynRes.maxScale));
+
+	glGenFramebuffers(1, &dynResFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, dynResFBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, dynResColorRBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, dynResDepthRBO);
+	dynRes.supported = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	if (!dynRes.supported)
+	{
+		cerr << "Dynamic resolution FBO incomplete, disabling\n";
+		dynRes.enabled = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenQueries(dynResNumQueries, dynResQuery);
+	reportError("initDynRes");
+}
+
+void updateDynRes(float gpuMs)
+{
+	float l_newScale = dynRes.scale;
+	dynRes.framesSinceChange++;
+
+	// Queries still in flight were rendered at the old scale.
+	if (dynRes.framesSinceChange <= dynResNumQueries) return;
+
+	// Inside the hysteresis band, or still settling after the last change: hold.
+	if (gpuMs > dynRes.targetMs * (1.0f + dynRes.hysteresis))
+		l_newScale = dynRes.scale * sqrt(dynRes.targetMs / gpuMs); // cost ~ pixel count ~ scale^2
+	else if (gpuMs < dynRes.targetMs * (1.0f - dynRes.hysteresis) && dynRes.framesSinceChange >= dynRes.settleFrames)
+		l_newScale = dynRes.scale + dynRes.step;
+	else
+		return;
+
+	l_newScale = floor(l_newScale / dynRes.step + 0.5f) * dynRes.step;
+	l_newScale = glm::clamp(l_newScale, dynRes.minScale, dynRes.maxScale);
+	if (fabs(l_newScale - dynRes.scale) < dynRes.step * 0.5f)
+		return;
+
+	if (dynRes.log)
+		printf("DynRes: gpu %.2f ms (target %.2f ms) scale %.2f -> %.2f (%dx%d)\n", gpuMs, dynRes.targetMs, dynRes.scale, l_newScale,
+			(int)(windowWidth * l_newScale), (int)(windowHeight * l_newScale));
+	dynRes.scale = l_newScale;
+	dynRes.framesSinceChange = 0;
+	dynRes.gpuMsAvg = 0.0f;
+}
+
+void dynResBegin()
+{
+	if (!dynRes.enabled) return;
+
+	// Oldest query in the ring was issued dynResNumQueries-1 frames ago. The
+	// first lap is discarded (some drivers return garbage for the very first
+	// query) and the rest are smoothed so a single hitch doesn't drop the scale.
+	GLuint l_query = dynResQuery[dynResQueryFrame % dynResNumQueries];
+	if (dynResQueryFrame >= dynResNumQueries * 2)
+	{
+		GLint l_available = 0;
+		glGetQueryObjectiv(l_query, GL_QUERY_RESULT_AVAILABLE, &l_available);
+		if (l_available)
+		{
+			GLuint64 l_ns = 0;
+			glGetQueryObjectui64v(l_query, GL_QUERY_RESULT, &l_ns);
+			float l_ms = l_ns / 1000000.0f;
+			if (l_ms > 0.0f && l_ms < 1000.0f) // anything else is not a real frame time
+			{
+				if (dynRes.gpuMsAvg == 0.0f) dynRes.gpuMsAvg = l_ms;
+				else                         dynRes.gpuMsAvg = mix(dynRes.gpuMsAvg, l_ms, 0.2f);
+				updateDynRes(dynRes.gpuMsAvg);
+			}
+		}
+	}
+	glBeginQuery(GL_TIME_ELAPSED, l_query);
+
+	dynRes.width  = (int)(windowWidth  * dynRes.scale);
+	dynRes.height = (int)(windowHeight * dynRes.scale);
+	glBindFramebuffer(GL_FRAMEBUFFER, dynResFBO);
+	glViewport(0, 0, dynRes.width, dynRes.height);
+}
+
+void dynResEnd()
+{
+	if (!dynRes.enabled) return;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, dynResFBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, dynRes.width, dynRes.height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, windowWidth, windowHeight);
+
+	glEndQuery(GL_TIME_ELAPSED);
+	dynResQueryFrame++;
+}
+
+mat4 campusModel;
+
+void initialize()
+{
+	structArenaScope l_import(importArena);
+
+	//-----------------------------MATERIALS-------------------------------
+
+	// COPPER
+	copper.ambient   = vec3(0.191250f, 0.073500f, 0.022500f);
+	copper.diffuse   = vec3(0.703800f, 0.270480f, 0.082800f);
+	copper.specular  = vec3(0.256777f, 0.137622f, 0.086014f);
+	copper.shininess = 12.8;
+
+	// SILVER
+	silver.ambient   = vec3(0.192250f, 0.192250f, 0.192250f);
+	silver.diffuse   = vec3(0.507540f, 0.507540f, 0.507540f);
+	silver.specular  = vec3(0.508273f, 0.508273f, 0.508273f);
+	silver.shininess = 51.2;
+
+	// GOLD
+	gold.ambient   = vec3(0.247250f, 0.199500f, 0.074500f);
+	gold.diffuse   = vec3(0.751640f, 0.606480f, 0.226480f);
+	gold.specular  = vec3(0.628281f, 0.555802f, 0.366065f);
+	gold.shininess = 51.2;
+	
+	initContextShaders();
+
+	//------------------------------ISLAND---------------------------------
+	static const vec3 islandVertex[] =
+	{
+		vec3(1.03208f, 0.86614f, 0.0f), /*1811376580*/		vec3(1.39635f, 1.87327f, 0.0f), /*242358198	*/
+		vec3(1.40699f, 1.89816f, 0.0f), /*242358207 */	    vec3(1.42827f, 1.94451f, 0.0f), /*242358204	*/
+		vec3(1.50805f, 1.93163f, 0.0f), /*242358189 */	    vec3(1.50945f, 1.94805f, 0.0f), /*1837961149*/
+		vec3(1.47155f, 1.95470f, 0.0f), /*948505916 */	    vec3(1.47585f, 1.97181f, 0.0f), /*948505923	*/
+		vec3(1.48250f, 1.99112f, 0.0f), /*948505927 */	    vec3(1.49959f, 2.01151f, 0.0f), /*948505931	*/
+		vec3(1.49200f, 2.04477f, 0.0f), /*948505934 */	    vec3(1.49959f, 2.07159f, 0.0f), /*948505937	*/
+		vec3(1.52429f, 2.11879f, 0.0f), /*948505941 */	    vec3(1.53474f, 2.15098f, 0.0f), /*948505946	*/
+		vec3(1.54993f, 2.19282f, 0.0f), /*948505952 */	    vec3(1.57463f, 2.21857f, 0.0f), /*948505960	*/
+		vec3(1.60787f, 2.22286f, 0.0f), /*948505968 */	    vec3(1.60312f, 2.24969f, 0.0f), /*948505977	*/
+		vec3(1.61737f, 2.28080f, 0.0f), /*948505998 */	    vec3(1.62912f, 2.25918f, 0.0f), /*1837961148*/
+		vec3(1.63570f, 2.27410f, 0.0f), /*242358176 */	    vec3(1.58099f, 2.32817f, 0.0f), /*242358173	*/
+		vec3(1.73904f, 2.76162f, 0.0f), /*493789690 */	    vec3(1.85439f, 3.12160f, 0.0f), /*242358182	*/
+		vec3(1.82015f, 3.12898f, 0.0f), /*1837826363*/		vec3(1.81125f, 3.11369f, 0.0f), /*1837912651*/
+		vec3(1.74289f, 3.06602f, 0.0f), /*1837826372*/		vec3(1.58731f, 3.07455f, 0.0f), /*1837826366*/
+		vec3(1.52083f, 3.05846f, 0.0f), /*1837826371*/		vec3(1.38387f, 3.05851f, 0.0f), /*1837826367*/
+		vec3(1.31264f, 3.08636f, 0.0f), /*1837826365*/		vec3(1.23457f, 3.06234f, 0.0f), /*1811376935*/
+		vec3(1.17475f, 2.99287f, 0.0f), /*1811376889*/		vec3(1.13590f, 2.81956f, 0.0f), /*1811376874*/
+		vec3(1.13203f, 2.81353f, 0.0f), /*1811376870*/		vec3(1.12600f, 2.80412f, 0.0f), /*1811376867*/
+		vec3(1.07980f, 2.77630f, 0.0f), /*1811376694*/		vec3(1.01499f, 2.76485f, 0.0f), /*1811376552*/
+		vec3(0.93654f, 2.71044f, 0.0f), /*1811376414*/		vec3(0.85766f, 2.59042f, 0.0f), /*1811376403*/
+		vec3(0.85769f, 2.55099f, 0.0f), /*1837912634*/		vec3(0.83339f, 2.50518f, 0.0f), /*1837912676*/
+		vec3(0.79312f, 2.47736f, 0.0f), /*1837912660*/		vec3(0.82043f, 2.56613f, 0.0f), /*1837912678*/
+		vec3(0.79637f, 2.57966f, 0.0f), /*1837912641*/		vec3(0.84638f, 2.65047f, 0.0f), /*1837912646*/
+		vec3(0.80675f, 2.65496f, 0.0f), /*1811376326*/		vec3(0.75282f, 2.61910f, 0.0f), /*1811376286*/
+		vec3(0.74458f, 2.60303f, 0.0f), /*1811376280*/		vec3(0.72917f, 2.57274f, 0.0f), /*1811376268*/
+		vec3(0.72973f, 2.56101f, 0.0f), /*1811376270*/		vec3(0.73193f, 2.54802f, 0.0f), /*1811376274*/
+		vec3(0.73248f, 2.52267f, 0.0f), /*1811376276*/		vec3(0.72807f, 2.49980f, 0.0f), /*1811376266*/
+		vec3(0.72258f, 2.47879f, 0.0f), /*1811376264*/		vec3(0.72203f, 2.46024f, 0.0f), /*1811376261*/
+		vec3(0.72092f, 2.43922f, 0.0f), /*1811376256*/		vec3(0.71817f, 2.43427f, 0.0f), /*1811376219*/
+		vec3(0.71818f, 2.43181f, 0.0f), /*1811376221*/		vec3(0.72038f, 2.42624f, 0.0f), /*1811376254*/
+		vec3(0.71928f, 2.41882f, 0.0f), /*1811376229*/		vec3(0.72094f, 2.40275f, 0.0f), /*1811376259*/
+		vec3(0.72038f, 2.39657f, 0.0f), /*1811376252*/		vec3(0.71872f, 2.39100f, 0.0f), /*1811376226*/
+		vec3(0.71323f, 2.38112f, 0.0f), /*1811376215*/		vec3(0.71212f, 2.37802f, 0.0f), /*1811376207*/
+		vec3(0.71213f, 2.37370f, 0.0f), /*1811376211*/		vec3(0.71983f, 2.36567f, 0.0f), /*1811376250*/
+		vec3(0.73084f, 2.34155f, 0.0f), /*1811376272*/		vec3(0.74569f, 2.31622f, 0.0f), /*1811376283*/
+		vec3(0.75944f, 2.28098f, 0.0f), /*1811376292*/		vec3(0.78310f, 2.23895f, 0.0f), /*1811376300*/
+		vec3(0.83702f, 2.16292f, 0.0f), /*1811376332*/		vec3(0.85847f, 2.13016f, 0.0f), /*1811376343*/
+		vec3(0.86014f, 2.12645f, 0.0f), /*1811376347*/		vec3(0.86014f, 2.11841f, 0.0f), /*1811376345*/
+		vec3(0.85737f, 2.11224f, 0.0f), /*1811376339*/		vec3(0.85682f, 2.10421f, 0.0f), /*1811376337*/
+		vec3(0.85847f, 2.09741f, 0.0f), /*1811376341*/		vec3(0.86179f, 2.08874f, 0.0f), /*1811376349*/
+		vec3(0.87608f, 2.06217f, 0.0f), /*1811376354*/		vec3(0.88323f, 2.04177f, 0.0f), /*1811376356*/
+		vec3(0.88929f, 2.03002f, 0.0f), /*1811376362*/		vec3(0.91404f, 1.99974f, 0.0f), /*1811376406*/
+		vec3(0.92009f, 1.99479f, 0.0f), /*1811376411*/		vec3(0.93825f, 1.98923f, 0.0f), /*1811376417*/
+		vec3(0.95420f, 1.98861f, 0.0f), /*1811376423*/		vec3(0.96686f, 1.99170f, 0.0f), /*1811376429*/
+		vec3(0.97016f, 1.99046f, 0.0f), /*1811376431*/		vec3(0.98061f, 1.97934f, 0.0f), /*1811376453*/
+		vec3(0.99436f, 1.96760f, 0.0f), /*1811376527*/		vec3(1.00041f, 1.96017f, 0.0f), /*1811376530*/
+		vec3(1.01472f, 1.93916f, 0.0f), /*1811376550*/		vec3(1.02847f, 1.91505f, 0.0f), /*1811376572*/
+		vec3(1.04498f, 1.90269f, 0.0f), /*1811376615*/		vec3(1.06808f, 1.87240f, 0.0f), /*1811376653*/
+		vec3(1.08899f, 1.83964f, 0.0f), /*1811376735*/		vec3(1.11760f, 1.78092f, 0.0f), /*1811376846*/
+		vec3(1.14291f, 1.71787f, 0.0f), /*1811376878*/		vec3(1.16161f, 1.67768f, 0.0f), /*1811376886*/
+		vec3(1.17756f, 1.64678f, 0.0f), /*1811376893*/		vec3(1.19131f, 1.61587f, 0.0f), /*1811376906*/
+		vec3(1.19077f, 1.61030f, 0.0f), /*1811376903*/		vec3(1.18802f, 1.60907f, 0.0f), /*1811376899*/
+		vec3(1.17590f, 1.59547f, 0.0f), /*1811376891*/		vec3(1.14071f, 1.57940f, 0.0f), /*1811376877*/
+		vec3(1.13520f, 1.57198f, 0.0f), /*1811376873*/		vec3(1.14070f, 1.56147f, 0.0f), /*1811376875*/
+		vec3(1.14841f, 1.55529f, 0.0f), /*1811376881*/		vec3(1.16161f, 1.54787f, 0.0f), /*1811376885*/
+		vec3(1.17371f, 1.54170f, 0.0f), /*1811376888*/		vec3(1.19076f, 1.53365f, 0.0f), /*1811376902*/
+		vec3(1.20012f, 1.53180f, 0.0f), /*1811376911*/		vec3(1.20177f, 1.52438f, 0.0f), /*1811376916*/
+		vec3(1.19627f, 1.52315f, 0.0f), /*1811376909*/		vec3(1.17866f, 1.52500f, 0.0f), /*1811376894*/
+		vec3(1.15776f, 1.53242f, 0.0f), /*1811376883*/		vec3(1.13355f, 1.54231f, 0.0f), /*1811376871*/
+		vec3(1.12035f, 1.55282f, 0.0f), /*1811376856*/		vec3(1.10824f, 1.55282f, 0.0f), /*1811376816*/
+		vec3(1.08404f, 1.55962f, 0.0f), /*1811376708*/		vec3(1.07469f, 1.57137f, 0.0f), /*1811376681*/
+		vec3(1.07359f, 1.58806f, 0.0f), /*1811376678*/		vec3(1.08349f, 1.61340f, 0.0f), /*1811376701*/
+		vec3(1.07964f, 1.61650f, 0.0f), /*1811376691*/		vec3(1.05543f, 1.61092f, 0.0f), /*1811376627*/
+		vec3(1.04333f, 1.59609f, 0.0f), /*1811376611*/		vec3(1.03728f, 1.56765f, 0.0f), /*1811376594*/
+		vec3(1.03727f, 1.53922f, 0.0f), /*1811376591*/		vec3(1.04223f, 1.50274f, 0.0f), /*1811376598*/
+		vec3(1.04278f, 1.47988f, 0.0f), /*1811376601*/		vec3(1.05213f, 1.44217f, 0.0f), /*1811376621*/
+		vec3(1.05708f, 1.42734f, 0.0f), /*1811376634*/		vec3(1.05818f, 1.39890f, 0.0f), /*1811376638*/
+		vec3(1.06478f, 1.37727f, 0.0f), /*1811376645*/		vec3(1.06588f, 1.35810f, 0.0f), /*1811376648*/
+		vec3(1.06918f, 1.33400f, 0.0f), /*1811376666*/		vec3(1.07028f, 1.30803f, 0.0f), /*1811376673*/
+		vec3(1.07578f, 1.28825f, 0.0f), /*1811376686*/		vec3(1.08459f, 1.28084f, 0.0f), /*1811376714*/
+		vec3(1.08515f, 1.29258f, 0.0f), /*1811376728*/		vec3(1.08018f, 1.32163f, 0.0f), /*1811376695*/
+		vec3(1.07523f, 1.35625f, 0.0f), /*1811376684*/		vec3(1.07248f, 1.38220f, 0.0f), /*1811376676*/
+		vec3(1.07154f, 1.38510f, 0.0f), /*1811376674*/		vec3(1.06865f, 1.39395f, 0.0f), /*1811376659*/
+		vec3(1.06836f, 1.40368f, 0.0f), /*1811376656*/		vec3(1.06808f, 1.41313f, 0.0f), /*1811376651*/
+		vec3(1.08074f, 1.42116f, 0.0f), /*1811376698*/		vec3(1.08404f, 1.42116f, 0.0f), /*1811376705*/
+		vec3(1.08679f, 1.41930f, 0.0f), /*1811376730*/		vec3(1.11595f, 1.37541f, 0.0f), /*1811376842*/
+		vec3(1.12034f, 1.36738f, 0.0f), /*1811376855*/		vec3(1.12199f, 1.36058f, 0.0f), /*1811376862*/
+		vec3(1.12199f, 1.35254f, 0.0f), /*1811376861*/		vec3(1.12034f, 1.34450f, 0.0f), /*1811376854*/
+		vec3(1.11814f, 1.33709f, 0.0f), /*1811376848*/		vec3(1.12364f, 1.31422f, 0.0f), /*1811376864*/
+		vec3(1.12310f, 1.30000f, 0.0f), /*1811376863*/		vec3(1.12089f, 1.29381f, 0.0f), /*1811376860*/
+		vec3(1.11429f, 1.28701f, 0.0f), /*1811376838*/		vec3(1.10714f, 1.28145f, 0.0f), /*1811376795*/
+		vec3(1.10329f, 1.28145f, 0.0f), /*1811376792*/		vec3(1.10109f, 1.28393f, 0.0f), /*1811376787*/
+		vec3(1.09724f, 1.29753f, 0.0f), /*1811376765*/		vec3(1.09613f, 1.29814f, 0.0f), /*1811376762*/
+		vec3(1.09338f, 1.29691f, 0.0f), /*1811376749*/		vec3(1.09173f, 1.27712f, 0.0f), /*1811376744*/
+		vec3(1.09119f, 1.22706f, 0.0f), /*1811376740*/		vec3(1.08458f, 1.19305f, 0.0f), /*1811376711*/
+		vec3(1.07742f, 1.17823f, 0.0f), /*1811376688*/		vec3(1.06918f, 1.16586f, 0.0f), /*1811376663*/
+		vec3(1.05707f, 1.13929f, 0.0f), /*1811376630*/		vec3(1.05102f, 1.11888f, 0.0f), /*1811376619*/
+		vec3(1.04497f, 1.10219f, 0.0f), /*1811376613*/		vec3(1.03616f, 1.06757f, 0.0f), /*1811376584*/
+		vec3(1.01691f, 1.00700f, 0.0f), /*1811376556*/		vec3(1.00865f, 0.99216f, 0.0f), /*1811376544*/
+		vec3(0.98444f, 0.95323f, 0.0f), /*1811376503*/		vec3(0.98334f, 0.94767f, 0.0f), /*1811376499*/
+		vec3(0.98554f, 0.92355f, 0.0f), /*1811376511*/		vec3(0.98499f, 0.91737f, 0.0f), /*1811376508*/
+		vec3(0.98169f, 0.90996f, 0.0f), /*1811376495*/		vec3(0.97619f, 0.90439f, 0.0f), /*1811376435*/
+		vec3(0.97398f, 0.89512f, 0.0f), /*1811376433*/		vec3(0.97784f, 0.88338f, 0.0f), /*1811376437*/
+		vec3(0.98169f, 0.87781f, 0.0f), /*1811376491*/		vec3(0.98884f, 0.86977f, 0.0f), /*1811376517*/
+		vec3(1.00094f, 0.86297f, 0.0f), /*1811376538*/		vec3(1.02021f, 0.85864f, 0.0f), /*1811376560*/
+		vec3(1.02459f, 0.85926f, 0.0f), /*1811376568*/		vec3(1.03208f, 0.86614f, 0.0f)  /*181137658	*/
+	};
+
+	const int islandNumVertices = sizeof(islandVertex) / sizeof(vec3);
+	island.index.resize(islandNumVertices);
+	bakeVertices(island.vertex, islandVertex, islandNumVertices, NULL, islandNumVertices, translate(mat4(1.0f), vec3(-1.25f, -2.4f, 0.0f)));
+	for (int i = 0; i < islandNumVertices; i++) { island.index[i]  = i; }
+
+	island.init(islandNumVertices, islandNumVertices, vec3(1.0, 1.0, 1.0), vec3(0.0f), mat4(1.0f), copper, true);
+
+	//------------------------------GROUND---------------------------------
+	ground.vertex.resize(4);
+	ground.vertex[0] = vec3(0.5f,  0.5f, 0.0f);      ground.vertex[2] = vec3(-0.5f, -0.5f, 0.0f);
+	ground.vertex[1] = vec3(-0.5f, 0.5f, 0.0f);		 ground.vertex[3] = vec3(0.5f, -0.5f, 0.0f);
+
+	static const int groundIndex[] = { 0, 1, 2,      0, 2, 3 };
+
+	const int groundNumIndices = sizeof(groundIndex) / sizeof(int);
+	ground.index.resize(groundNumIndices);
+	for (int i = 0; i < groundNumIndices; i++) { ground.index[i] = groundIndex[i]; }
+
+	ground.init(4, groundNumIndices, vec3(0.1f, 0.1f, 0.1f), vec3(0.0f), mat4(1.0f), silver, false);
+
+	//-------------------------------CUBE----------------------------------
+	static const vec3 cubeVertex[] = 
+	{
+		vec3( 0.025f,  0.025f, 0.0f),		vec3(-0.025f,  0.025f, 0.0f),
+		vec3(-0.025f, -0.025f, 0.0f),		vec3( 0.025f, -0.025f, 0.0f),
+		vec3( 0.025f,  0.025f, 0.05f),		vec3(-0.025f,  0.025f, 0.05f),
+		vec3(-0.025f, -0.025f, 0.05f),		vec3( 0.025f, -0.025f, 0.05f)
+	};
+
+	static const int cubeVIndex[] =
+	{
+		0, 1, 4, 5,      1, 2, 5, 6,
+		2, 3, 6, 7,      3, 0, 7, 4,
+		4, 5, 6, 7
+	};
+
+	static const int cubeIndex[] =
+	{
+		 0,  1,  2,       3,  2,  1,       4,  5,  6,       7,  6,  5,
+		 8,  9, 10,      11, 10,  9,      12, 13, 14,      15, 14, 13,
+		16, 17, 18,      16, 18, 19
+	};
+
+	const int cubeNumVertices = sizeof(cubeVIndex) / sizeof(int);
+	cube.vertex.resize(cubeNumVertices);
+	for (int i = 0; i < cubeNumVertices; i++) { cube.vertex[i] = cubeVertex[cubeVIndex[i]]; }
+
+	const int cubeNumIndices  = sizeof(cubeIndex)  / sizeof(int);
+	cube.index.resize(cubeNumIndices);
+	for (int i = 0; i < cubeNumIndices;  i++) { cube.index[i]  = cubeIndex[i]; }
+	
+	cube.init(cubeNumVertices, cubeNumIndices, vec3(1.0f, 0.2f, 0.2f), vec3(0.0f), mat4(1.0f), copper, false);
+
+	// ecdcA, ecdcB and bayhall are modelled at 9.25x and placed on the island.
+	campusModel = translate(mat4(1.0f), vec3(0.175f, 0.06f, 0.0f)) * scale(mat4(1.0f), vec3(1.0f / 9.25f));
+
+	//------------------------------ECDC-A---------------------------------
+	static const vec3 ecdcAVertex[] =
+	{
+		vec3(0.941f, 0.233f, 0.0f),		vec3(0.922f, 0.337f, 0.0f),
+		vec3(0.902f, 0.462f, 0.0f),		vec3(1.003f, 0.468f, 0.0f),
+		vec3(1.003f, 0.562f, 0.0f),		vec3(1.019f, 0.661f, 0.0f),
+		vec3(1.052f, 0.748f, 0.0f),		vec3(1.096f, 0.828f, 0.0f),
+		vec3(1.147f, 0.898f, 0.0f),		vec3(1.182f, 0.933f, 0.0f),
+		vec3(1.159f, 0.964f, 0.0f),		vec3(1.179f, 0.981f, 0.0f),
+		vec3(1.208f, 0.962f, 0.0f),		vec3(1.208f, 0.946f, 0.0f),
+		vec3(1.218f, 0.932f, 0.0f),		vec3(1.231f, 0.931f, 0.0f),
+		vec3(1.244f, 0.940f, 0.0f),		vec3(1.244f, 0.954f, 0.0f),
+		vec3(1.237f, 0.965f, 0.0f),		vec3(1.222f, 0.970f, 0.0f),
+		vec3(1.212f, 1.003f, 0.0f),		vec3(1.381f, 1.112f, 0.0f),
+		vec3(1.320f, 1.208f, 0.0f),		vec3(1.407f, 1.262f, 0.0f),
+		vec3(1.387f, 1.292f, 0.0f),		vec3(1.301f, 1.238f, 0.0f),
+		vec3(1.240f, 1.338f, 0.0f),		vec3(1.083f, 1.240f, 0.0f),
+		vec3(1.146f, 1.143f, 0.0f),		vec3(1.062f, 1.081f, 0.0f),
+		vec3(1.018f, 1.128f, 0.0f),		vec3(0.979f, 1.087f, 0.0f),
+		vec3(0.901f, 1.004f, 0.0f),		vec3(0.822f, 0.886f, 0.0f),
+		vec3(0.766f, 0.753f, 0.0f),		vec3(0.732f, 0.595f, 0.0f),
+		vec3(0.728f, 0.448f, 0.0f),		vec3(0.751f, 0.289f, 0.0f),
+		vec3(0.882f, 0.326f, 0.0f),		vec3(0.909f, 0.226f, 0.0f),
+		vec3(0.941f, 0.233f, 0.216f),	vec3(0.922f, 0.337f, 0.216f),
+		vec3(0.902f, 0.462f, 0.216f),	vec3(1.003f, 0.468f, 0.216f),
+		vec3(1.003f, 0.562f, 0.216f),	vec3(1.019f, 0.661f, 0.216f),
+		vec3(1.052f, 0.748f, 0.216f),	vec3(1.096f, 0.828f, 0.216f),
+		vec3(1.147f, 0.898f, 0.216f),	vec3(1.182f, 0.933f, 0.216f),
+		vec3(1.159f, 0.964f, 0.216f),	vec3(1.179f, 0.981f, 0.216f),
+		vec3(1.208f, 0.962f, 0.216f),	vec3(1.208f, 0.946f, 0.216f),
+		vec3(1.218f, 0.932f, 0.216f),	vec3(1.231f, 0.931f, 0.216f),
+		vec3(1.244f, 0.940f, 0.216f),	vec3(1.244f, 0.954f, 0.216f),
+		vec3(1.237f, 0.965f, 0.216f),	vec3(1.222f, 0.970f, 0.216f),
+		vec3(1.212f, 1.003f, 0.216f),	vec3(1.381f, 1.112f, 0.216f),
+		vec3(1.320f, 1.208f, 0.216f),	vec3(1.407f, 1.262f, 0.216f),
+		vec3(1.387f, 1.292f, 0.216f),	vec3(1.301f, 1.238f, 0.216f),
+		vec3(1.240f, 1.338f, 0.216f),	vec3(1.083f, 1.240f, 0.216f),
+		vec3(1.146f, 1.143f, 0.216f),	vec3(1.062f, 1.081f, 0.216f),
+		vec3(1.018f, 1.128f, 0.216f),	vec3(0.979f, 1.087f, 0.216f),
+		vec3(0.901f, 1.004f, 0.216f),	vec3(0.822f, 0.886f, 0.216f),
+		vec3(0.766f, 0.753f, 0.216f),	vec3(0.732f, 0.595f, 0.216f),
+		vec3(0.728f, 0.448f, 0.216f),	vec3(0.751f, 0.289f, 0.216f),
+		vec3(0.882f, 0.326f, 0.216f),	vec3(0.909f, 0.226f, 0.216f),
+	};
+
+	static const int ecdcAVIndex[] =
+	{
+		 0,  1,  2, 40, 41, 42, // 0 - 2,3 - 5
+		 2,  3, 42, 43, // 6 - 9
+		 3,  4,  5,  6,  7,  8,  9, 43, 44, 45, 46, 47, 48, 49, // 10 - 16,17 - 23
+		 9, 10, 49, 50, // 24 - 27
+		10, 11, 50, 51, // 28 - 31
+		11, 12, 51, 52, // 32 - 35
+		12, 13, 14, 15, 16, 17, 18, 19, 52, 53, 54, 55, 56, 57, 58, 59, // 36 - 43,44 - 51
 		19, 20, 59, 60, // 52 - 55
 		20, 21, 60, 61, // 56 - 59
 		21, 22, 61, 62, // 60 - 63
@@ -688,415 +5141,3103 @@ void initialize()
 		38, 39, 78, 79, // 116 - 119
 		39,  0, 79, 40, // 120 - 123
 
-		40, 41, 42, 43, 44, 45, 46, 47, 48, 49, // 124 - 133
-		50, 51, 52, 53, 54, 55, 56, 57, 58, 59, // 134 - 143
-		60, 61, 62, 63, 64, 65, 66, 67, 68, 69, // 144 - 153
-		70, 71, 72, 73, 74, 75, 76, 77, 78, 79  // 154 - 163
-	};
+		40, 41, 42, 43, 44, 45, 46, 47, 48, 49, // 124 - 133
+		50, 51, 52, 53, 54, 55, 56, 57, 58, 59, // 134 - 143
+		60, 61, 62, 63, 64, 65, 66, 67, 68, 69, // 144 - 153
+		70, 71, 72, 73, 74, 75, 76, 77, 78, 79  // 154 - 163
+	};
+
+	static const int ecdcAIndex[] =
+	{
+		  0,   1,   3,        1,   2,   4,
+		  4,   3,   1,        5,   4,   2, // 0 - 2,3 - 5
+		  6,   7,   8,        9,   8,   7, // 6 - 9
+		 10,  11,  17,       11,  12,  18,
+		 12,  13,  19,       13,  14,  20,
+		 14,  15,  21,       15,  16,  22,
+		 18,  17,  11,       19,  18,  12,
+		 20,  19,  13,       21,  20,  14,
+		 22,  21,  15,       23,  22,  16, // 10 - 16,17 - 23
+		 24,  25,  26,       27,  26,  25, // 24 - 27
+		 28,  29,  30,       31,  30,  29, // 28 - 31
+		 32,  33,  34,       35,  34,  33, // 32 - 35
+		 36,  37,  44,       37,  38,  45,
+		 38,  39,  46,       39,  40,  47,
+		 40,  41,  48,       41,  42,  49,
+		 42,  43,  50,       45,  44,  37,
+		 46,  45,  38,       47,  46,  39,
+		 48,  47,  40,       49,  48,  41,
+		 50,  49,  42,       51,  50,  43, // 36 - 43,44 - 51
+		 52,  53,  54,       55,  54,  53, // 52 - 55
+		 56,  57,  58,       59,  58,  57, // 56 - 59
+		 60,  61,  62,       63,  62,  61, // 60 - 63
+		 64,  65,  66,       67,  66,  65, // 64 - 67
+		 68,  69,  70,       71,  70,  69, // 68 - 71
+		 72,  73,  74,       75,  74,  73, // 72 - 75
+		 76,  77,  78,       79,  78,  77, // 76 - 79
+		 80,  81,  82,       83,  82,  81, // 80 - 83
+		 84,  85,  86,       87,  86,  85, // 84 - 87
+		 88,  89,  90,       91,  90,  89, // 88 - 91
+		 92,  93,  94,       95,  94,  93, // 92 - 95
+		 96,  97, 104,       97,  98, 105,
+		 98,  99, 106,       99, 100, 107,
+		100, 101, 108,      101, 102, 109,
+		102, 103, 110,      105, 104,  97,
+		106, 105,  98,      107, 106,  99,
+		108, 107, 100,      109, 108, 101,
+		110, 109, 102,      111, 110, 103, //  96 - 103,104 - 111
+		112, 113, 114,      115, 114, 113, // 112 - 115
+		116, 117, 118,      119, 118, 117, // 116 - 119
+		120, 121, 122,      123, 122, 121, // 120 - 123
+
+		124, 125, 162,      162, 163, 124,
+		125, 126, 162,      126, 160, 162,      160, 161, 162,
+		126, 127, 128,      126, 128, 159,      159, 160, 126,
+		128, 129, 158,      158, 159, 128,
+		129, 130, 157,      157, 158, 129,
+		130, 131, 156,      156, 157, 130,
+		131, 132, 155,      155, 156, 131,
+		132, 133, 134,      132, 134, 153,
+		132, 153, 155,      153, 154, 155,
+		134, 135, 153,      135, 152, 153,      135, 144, 152,
+		135, 136, 144,      136, 143, 144,
+		136, 137, 143,      142, 143, 137,
+		137, 138, 142,      141, 142, 138,
+		138, 139, 141,      140, 141, 139,
+		144, 145, 152,      145, 146, 152,      146, 149, 152,
+		146, 147, 148,      148, 149, 146,
+		149, 150, 151,      149, 151, 152
+	};
+
+	const int ecdcANumVertices = sizeof(ecdcAVIndex) / sizeof(int);
+	bakeVertices(ecdcA.vertex, ecdcAVertex, sizeof(ecdcAVertex) / sizeof(vec3), ecdcAVIndex, ecdcANumVertices, campusModel);
+
+	const int ecdcANumIndices = sizeof(ecdcAIndex) / sizeof(int);
+	ecdcA.index.resize(ecdcANumIndices);
+	for (int i = 0; i < ecdcANumIndices; i++) { ecdcA.index[i] = ecdcAIndex[i]; }
+
+	ecdcA.init(ecdcANumVertices, ecdcANumIndices, vec3(0.1, 0.1, 0.5), ((vec3(1.083f, 0.862f, 0.0f)/9.25f)+ vec3(0.175f, 0.06f, 0.0f)), mat4(1.0f), copper, false);
+
+	//------------------------------ECDC-B---------------------------------
+	static const vec3 ecdcBVertex[] =
+	{
+		vec3(0.585f, 0.551f, 0.0f),			vec3(0.624f, 0.561f, 0.0f),
+		vec3(0.660f, 0.593f, 0.0f),			vec3(0.685f, 0.639f, 0.0f),
+		vec3(0.698f, 0.638f, 0.0f),			vec3(0.714f, 0.697f, 0.0f),
+		vec3(0.693f, 0.701f, 0.0f),			vec3(0.698f, 0.726f, 0.0f),
+		vec3(0.677f, 0.730f, 0.0f),			vec3(0.647f, 0.778f, 0.0f),
+		vec3(0.596f, 0.807f, 0.0f),			vec3(0.590f, 0.794f, 0.0f),
+		vec3(0.569f, 0.807f, 0.0f),			vec3(0.507f, 0.786f, 0.0f),
+		vec3(0.462f, 0.751f, 0.0f),			vec3(0.440f, 0.697f, 0.0f),
+		vec3(0.446f, 0.638f, 0.0f),			vec3(0.478f, 0.594f, 0.0f),
+		vec3(0.528f, 0.568f, 0.0f),			vec3(0.585f, 0.570f, 0.0f),
+		vec3(0.585f, 0.551f, 0.216f),		vec3(0.624f, 0.561f, 0.216f),
+		vec3(0.660f, 0.593f, 0.216f),		vec3(0.685f, 0.639f, 0.216f),
+		vec3(0.698f, 0.638f, 0.216f),		vec3(0.714f, 0.697f, 0.216f),
+		vec3(0.693f, 0.701f, 0.216f),		vec3(0.698f, 0.726f, 0.216f),
+		vec3(0.677f, 0.730f, 0.216f),		vec3(0.647f, 0.778f, 0.216f),
+		vec3(0.596f, 0.807f, 0.216f),		vec3(0.590f, 0.794f, 0.216f),
+		vec3(0.569f, 0.807f, 0.216f),		vec3(0.507f, 0.786f, 0.216f),
+		vec3(0.462f, 0.751f, 0.216f),		vec3(0.440f, 0.697f, 0.216f),
+		vec3(0.446f, 0.638f, 0.216f),		vec3(0.478f, 0.594f, 0.216f),
+		vec3(0.528f, 0.568f, 0.216f),		vec3(0.585f, 0.570f, 0.216f)
+	};
+
+	static const int ecdcBVIndex[] = 
+	{
+		 0,  1,  2,  3, 20, 21, 22, 23, // 0 - 3,4 - 7
+		 3,  4, 23, 24, //  8 - 11
+		 4,  5, 24, 25, // 12 - 15
+		 5,  6, 25, 26, // 16 - 19
+		 6,  7, 26, 27, // 20 - 23
+		 7,  8, 27, 28, // 24 - 27
+		 8,  9, 10, 28, 29, 30, // 28 - 30,31 - 33
+		10, 11, 30, 31, // 34 - 37
+		11, 12, 31, 32, // 38 - 41
+		12, 13, 14, 15, 16, 17, 18, 19, 32, 33, 34, 35, 36, 37, 38, 39, // 42 - 49,50 - 57
+		19,  0, 39, 20, // 58 - 61
+
+		20, 21, 22, 23, 24, 25, 26, 27, 28, 29, // 62 - 71
+		30, 31, 32, 33, 34, 35, 36, 37, 38, 39  // 72 - 81
+	};
+
+	static const int ecdcBIndex[] = 
+	{
+		 0,  1,  5,       5,  4,  0,
+		 1,  2,  6,       6,  5,  1,
+		 2,  3,  7,       7,  6,  2, //  0 -  3,4 - 7
+		 8,  9, 10,      11, 10,  9, //  8 - 11
+		12, 13, 14,      15, 14, 13, // 12 - 15
+		16, 17, 18,      19, 18, 17, // 16 - 19
+		20, 21, 22,      23, 22, 21, // 20 - 23
+		24, 25, 26,      27, 26, 25, // 24 - 27
+		28, 29, 32,      32, 31, 28,
+		29, 30, 33,      33, 32, 29, // 28 - 30,31 - 33
+		34, 35, 36,      37, 36, 35, // 34 - 37
+		38, 39, 40,      41, 40, 39, // 38 - 41
+		42, 43, 51,      51, 50, 42,
+		43, 44, 52,      52, 51, 43,
+		44, 45, 53,      53, 52, 44,
+		45, 46, 54,      54, 53, 45,
+		46, 47, 55,      55, 54, 46,
+		47, 48, 56,      56, 55, 47,
+		48, 49, 57,      57, 56, 48, // 42 - 49,50 - 57
+		58, 59, 60,      61, 60, 59, // 58 - 61
+
+		62, 63, 81,      63, 64, 81,      64, 65, 81,
+		65, 79, 81,      79, 80, 81,
+		65, 77, 79,      77, 78, 79,
+		65, 66, 68,      66, 67, 68,
+		65, 70, 77,      65, 68, 70,      68, 69, 70,
+		70, 71, 73,      71, 72, 73,
+		70, 73, 75,      73, 74, 75,
+		70, 75, 77,      75, 76, 77
+	};
+
+	const int ecdcBNumVertices = sizeof(ecdcBVIndex) / sizeof(int);
+	bakeVertices(ecdcB.vertex, ecdcBVertex, sizeof(ecdcBVertex) / sizeof(vec3), ecdcBVIndex, ecdcBNumVertices, campusModel);
+
+	const int ecdcBNumIndices = sizeof(ecdcBIndex) / sizeof(int);
+	ecdcB.index.resize(ecdcBNumIndices);
+	for (int i = 0; i < ecdcBNumIndices; i++) { ecdcB.index[i] = ecdcBIndex[i]; }
+
+	ecdcB.init(ecdcBNumVertices, ecdcBNumIndices, vec3(0.1, 0.5, 0.1), ((vec3(0.595f, 0.681f, 0.0f) / 9.25f) + vec3(0.175f, 0.06f, 0.0f)), mat4(1.0f), silver, false);
+
+	//-----------------------------BAY-HALL--------------------------------
+	static const vec3 bayhallVertex[] =
+	{
+		vec3(-1.499f, -1.166f, 0.0f),		vec3(-0.888f, -1.429f, 0.0f),
+		vec3(-0.755f, -1.121f, 0.0f),		vec3(-1.356f, -0.855f, 0.0f),
+		vec3(-1.499f, -1.166f, 0.153f),		vec3(-0.888f, -1.429f, 0.153f),
+		vec3(-0.876f, -1.402f, 0.153f),		vec3(-1.485f, -1.137f, 0.153f),
+		vec3(-1.485f, -1.137f, 0.291f),		vec3(-0.876f, -1.402f, 0.291f),
+		vec3(-0.755f, -1.121f, 0.291f),		vec3(-1.356f, -0.855f, 0.291f),
+		vec3(-1.391f, -0.974f, 0.291f),		vec3(-1.350f, -0.992f, 0.291f),
+		vec3(-1.381f, -1.059f, 0.291f),		vec3(-1.216f, -1.132f, 0.291f),
+		vec3(-1.170f, -1.031f, 0.291f),		vec3(-1.286f, -0.975f, 0.291f),
+		vec3(-1.272f, -0.944f, 0.291f),		vec3(-1.360f, -0.906f, 0.291f),
+		vec3(-1.391f, -0.974f, 0.347f),		vec3(-1.350f, -0.992f, 0.347f),
+		vec3(-1.381f, -1.059f, 0.347f),		vec3(-1.216f, -1.132f, 0.347f),
+		vec3(-1.170f, -1.031f, 0.347f),		vec3(-1.286f, -0.975f, 0.347f),
+		vec3(-1.272f, -0.944f, 0.347f),		vec3(-1.360f, -0.906f, 0.347f),
+		vec3(-1.103f, -1.157f, 0.291f),		vec3(-0.905f, -1.244f, 0.291f),
+		vec3(-0.860f, -1.142f, 0.291f),		vec3(-1.058f, -1.055f, 0.291f),
+		vec3(-1.103f, -1.157f, 0.347f),		vec3(-0.905f, -1.244f, 0.347f),
+		vec3(-0.860f, -1.142f, 0.347f),		vec3(-1.058f, -1.055f, 0.347f),
+		vec3(-0.985f, -1.169f, 0.347f),		vec3(-0.919f, -1.198f, 0.347f),
+		vec3(-0.901f, -1.157f, 0.347f),		vec3(-0.967f, -1.128f, 0.347f),
+		vec3(-0.985f, -1.169f, 0.291f),		vec3(-0.919f, -1.198f, 0.291f),
+		vec3(-0.901f, -1.157f, 0.291f),		vec3(-0.967f, -1.128f, 0.291f)
+	};
+
+	static const int bayhallVIndex[] =
+	{
+		 0,  1,  4,  5, //  0 -  3
+		 4,  5,  7,  6, //  4 -  7
+		 7,  6,  8,  9, //  8 - 11
+		 2,  3, 10, 11, // 12 - 15
+		 1,  2, 10,  9, 6,  5, // 16 - 21
+		 3,  0,  4,  7, 8, 11, // 22 - 27
+		 8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 28, 29, 30, 31, // 28 - 43
+		12, 13, 20, 21, // 44 - 47
+		13, 14, 21, 22, // 48 - 51
+		14, 15, 22, 23, // 52 - 55
+		15, 16, 23, 24, // 56 - 59
+		16, 17, 24, 25, // 60 - 63
+		17, 18, 25, 26, // 64 - 67
+		18, 19, 26, 27, // 68 - 71
+		19, 12, 27, 20, // 72 - 75
+		28, 29, 32, 33, // 76 - 79
+		29, 30, 33, 34, // 80 - 83
+		30, 31, 34, 35, // 84 - 87
+		31, 28, 35, 32, // 88 - 91
+		20, 21, 22, 23, 24, 25, 26, 27, //  92 -  99
+		32, 33, 34, 35, 36, 37, 38, 39, // 100 - 107
+		41, 40, 37, 36, // 108 - 111
+		42, 41, 38, 37, // 112 - 115
+		43, 42, 39, 38, // 116 - 119
+		40, 43, 36, 39, // 120 - 123
+		40, 41, 43, 42  // 124 - 127
+	};
+
+	static const int bayhallIndex[] =
+	{
+		  0,   1,   2,     3,   2,   1, //   0 -   3
+		  4,   5,   6,     7,   6,   5, //   4 -   7
+		  8,   9,  10,    11,  10,   9, //   8 -  11
+		 12,  13,  14,    15,  14,  13, //  12 -  15
+		 16,  17,  20,    16,  20,  21,
+		 17,  18,  20,    18,  19,  20, //  16 -  21
+		 22,  23,  25,    23,  24,  25,
+		 22,  25,  27,    25,  26,  27, //  22 -  27
+		 28,  29,  35,    29,  40,  35,
+		 28,  35,  34,    29,  41,  40,
+		 28,  34,  32,    29,  30,  41,
+		 28,  32,  31,    30,  42,  41,
+		 31,  32,  39,    30,  43,  42,
+		 31,  39,  38,    30,  31,  43,
+		 31,  38,  43,    32,  34,  33,
+		 35,  40,  36,    40,  43,  36,
+		 36,  43,  38,    36,  38,  37, //  28 -  43
+		 44,  45,  46,    47,  46,  45, //  44 -  47
+		 48,  49,  50,    51,  50,  49, //  48 -  51
+		 52,  53,  54,    55,  54,  53, //  52 -  55
+		 56,  57,  58,    59,  58,  57, //  56 -  59
+		 60,  61,  62,    63,  62,  61, //  60 -  63
+		 64,  65,  66,    67,  66,  65, //  64 -  67
+		 68,  69,  70,    71,  70,  69, //  68 -  71
+		 72,  73,  74,    75,  74,  73, //  72 -  75
+		 76,  77,  78,    79,  78,  77, //  76 -  79
+		 80,  81,  82,    83,  82,  81, //  80 -  83
+		 84,  85,  86,    87,  86,  85, //  84 -  87
+		 88,  89,  90,    91,  90,  89, //  88 -  91
+		 92,  93,  99,    93,  98,  99,
+		 93,  97,  98,    93,  94,  97,
+		 94,  95,  97,    95,  96,  97, //  92 -  99
+		100, 101, 104,   101, 105, 104,
+		101, 102, 105,   102, 106, 105,
+		102, 107, 106,   102, 103, 107,
+		103, 104, 107,   100, 104, 103, // 100 - 107
+		108, 109, 110,   111, 110, 109, // 108 - 111
+		112, 113, 114,   115, 114, 113, // 112 - 115
+		116, 117, 118,   119, 118, 117, // 116 - 119
+		120, 121, 122,   123, 122, 121, // 120 - 123
+		124, 125, 126,   127, 126, 125  // 124 - 127
+	};
+
+	const int bayhallNumVertices = sizeof(bayhallVIndex) / sizeof(int);
+	bakeVertices(bayhall.vertex, bayhallVertex, sizeof(bayhallVertex) / sizeof(vec3), bayhallVIndex, bayhallNumVertices, campusModel);
+
+	const int bayhallNumIndices = sizeof(bayhallIndex) / sizeof(int);
+	bayhall.index.resize(bayhallNumIndices);
+	for (int i = 0; i < bayhallNumIndices; i++) { bayhall.index[i] = bayhallIndex[i]; }
+
+	bayhall.init(bayhallNumVertices, bayhallNumIndices, vec3(0.1, 0.1, 0.5), ((vec3(-1.134f, -1.105f, 0.0f) / 9.25f) + vec3(0.175f, 0.06f, 0.0f)), mat4(1.0f), gold, false);
+
+	//------------------------------CAMERA---------------------------------
+	camPresetPos[0] = vec3(0.5f, 0.0f, 0.5f);
+	camPresetPos[1] = vec3(0.5f, 0.15f, 0.25f);
+	camPresetPos[2] = vec3(0.15f, 0.0f, 0.25f);
+	camPresetPos[3] = vec3(0.33f, -0.1f, 0.25f);
+
+	POIPresetPos[0] = island.center;
+	POIPresetPos[1] = ecdcA.center;
+	POIPresetPos[2] = bayhall.center;
+	POIPresetPos[3] = ecdcB.center;
+	
+	Projection = perspective(5.0f, 3.0f / 3.0f, 0.00001f, 1000.0f);
+	
+	pointOfInterest = island.center;
+	cameraLocation  = island.center + vec3(0.0f, 0.0f, 0.25f);
+	cameraUp = vec3(1.0f, 0.0f, 0.0f);
+
+	//------------------------------LIGHTS---------------------------------
+	light[0].pos   = vec4(0.33f, 0.33f, 0.25f, 1.0f);
+	light[0].color = vec3(1.0f, 1.0f, 1.0f);
+	light[0].intensity = 5.0f;
+
+	light[1].pos   = vec4(0.5f, 0.5f,  0.5f, 0.0f);
+	light[1].color = vec3(1.0f, 1.0f, 1.0f);
+	light[1].intensity = 0.1f;
+	packLights();
+
+	sceneProps.clear();
+	sceneProps.push_back(&island);
+	sceneProps.push_back(&ground);
+	sceneProps.push_back(&cube);
+	sceneProps.push_back(&ecdcA);
+	sceneProps.push_back(&ecdcB);
+	sceneProps.push_back(&bayhall);
+	polylinesFromScene();
+	initTerrain();
+	indexScene();
+	
+	phong = true;
+
+	glEnable(GL_DEPTH_TEST);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glDepthFunc(GL_LESS);
+
+	initDynRes();
+}
+
+//---------------------------CITY-GENERATOR-----------------------------
+// Procedural stand-in for a large campus: buildings are extruded star-shaped
+// footprints on a jittered grid, with a few palette colours and the three
+// materials. Uses its own xorshift generator so the same seed gives the
+// same city everywhere. Replaces the campus in sceneProps.
+struct structCityConfig { int buildings, footprint, lights; unsigned int seed; float spacing; };
+structCityConfig city = { 0, 8, 2, 1, 0.12f };
+vector<prop> cityProps;
+
+unsigned int cityRand(unsigned int &state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+float cityRandf(unsigned int &state, float lo, float hi)
+{
+	return lo + (hi - lo) * (cityRand(state) & 0xffffff) / 16777216.0f;
+}
+
+void generateCity()
+{
+	const vec3 l_palette[] = { vec3(0.1f, 0.1f, 0.5f), vec3(0.5f, 0.5f, 0.5f), vec3(0.6f, 0.3f, 0.1f), vec3(0.2f, 0.4f, 0.2f) };
+	const structMaterial *l_materials[] = { &copper, &silver, &gold };
+	const float l_pi = 3.14159265f;
+	unsigned int l_state = city.seed ? city.seed : 1;
+	int l_footprint = glm::clamp(city.footprint, 3, 256);
+	int l_side = (int)ceil(sqrt((float)city.buildings));
+	float l_half = l_side * city.spacing * 0.5f;
+	chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+#ifdef GL_TRACE
+	long long l_heapCalls = heapAllocCalls, l_heapBytes = heapAllocBytes, l_arenaAllocs = importArena.allocs;
+#endif
+	structArenaScope l_import(importArena);
+
+	cityProps.assign(city.buildings, prop());
+	for (int b = 0; b < city.buildings; b++)
+	{
+		structArenaScope l_building(importArena);
+		prop &p = cityProps[b];
+		vec3 l_center = vec3((b % l_side + 0.5f) * city.spacing - l_half, (b / l_side + 0.5f) * city.spacing - l_half, 0.0f);
+		l_center += vec3(cityRandf(l_state, -0.1f, 0.1f) * city.spacing, cityRandf(l_state, -0.1f, 0.1f) * city.spacing, 0.0f);
+		float l_radius = cityRandf(l_state, 0.2f, 0.38f) * city.spacing;
+		float l_height = cityRandf(l_state, 0.02f, 0.08f) * ((cityRand(l_state) % 10 == 0) ? 3.0f : 1.0f);
+
+		scratchVector<vec3> l_ring(l_footprint);
+		for (int i = 0; i < l_footprint; i++)
+		{
+			float l_a = (i + cityRandf(l_state, -0.3f, 0.3f)) * 2.0f * l_pi / l_footprint;
+			l_ring[i] = l_center + l_radius * cityRandf(l_state, 0.75f, 1.0f) * vec3(cos(l_a), sin(l_a), 0.0f);
+		}
+
+		// Walls get their own four vertices each so they shade flat; the roof
+		// is a fan around the centre.
+		p.vertex.reserve(5 * l_footprint + 1);
+		p.normal.reserve(5 * l_footprint + 1);
+		p.index.reserve(9 * l_footprint);
+		for (int i = 0; i < l_footprint; i++)
+		{
+			vec3 l_a = l_ring[i], l_b = l_ring[(i + 1) % l_footprint], l_up = vec3(0.0f, 0.0f, l_height);
+			vec3 l_n = normalize(cross(l_b - l_a, vec3(0.0f, 0.0f, 1.0f)));
+			int l_base = (int)p.vertex.size();
+			p.vertex.push_back(l_a);  p.vertex.push_back(l_b);  p.vertex.push_back(l_b + l_up);  p.vertex.push_back(l_a + l_up);
+			for (int k = 0; k < 4; k++) { p.normal.push_back(l_n); }
+			int l_quad[] = { 0, 1, 2,    0, 2, 3 };
+			for (int k = 0; k < 6; k++) { p.index.push_back(l_base + l_quad[k]); }
+		}
+		int l_roof = (int)p.vertex.size();
+		p.vertex.push_back(l_center + vec3(0.0f, 0.0f, l_height));
+		p.normal.push_back(vec3(0.0f, 0.0f, 1.0f));
+		for (int i = 0; i < l_footprint; i++)
+		{
+			p.vertex.push_back(l_ring[i] + vec3(0.0f, 0.0f, l_height));
+			p.normal.push_back(vec3(0.0f, 0.0f, 1.0f));
+		}
+		for (int i = 0; i < l_footprint; i++)
+		{
+			p.index.push_back(l_roof);
+			p.index.push_back(l_roof + 1 + i);
+			p.index.push_back(l_roof + 1 + (i + 1) % l_footprint);
+		}
+
+		p.numVertices = (int)p.vertex.size();
+		p.numIndices  = (int)p.index.size();
+		p.propColor   = l_palette[cityRand(l_state) % 4];
+		p.material    = *l_materials[cityRand(l_state) % 3];
+		p.center      = l_center + vec3(0.0f, 0.0f, l_height * 0.5f);
+		p.outline     = false;
+		p.Model       = mat4(1.0f);
+		p.upload();
+	}
+
+	ground.Model = scale(mat4(1.0f), vec3(2.0f * l_half + city.spacing, 2.0f * l_half + city.spacing, 1.0f));
+	ground.computeBounds();
+
+	sceneProps.clear();
+	sceneProps.push_back(&ground);
+	for (int b = 0; b < city.buildings; b++) { sceneProps.push_back(&cityProps[b]); }
+	batches.clear();
+	batchedProps.clear();
+	gpuCull.dirty = true;
+	impostors.dirty = true;
+	shadows.dirty = true;
+	polylinesFromScene();
+	indexScene();
+
+	// light[0] keeps orbiting and light[1] stays the sun; the rest are street
+	// lights scattered over the city.
+	numLights = glm::clamp(city.lights, 1, maxLights);
+	for (int i = 2; i < numLights; i++)
+	{
+		light[i].pos = vec4(cityRandf(l_state, -l_half, l_half), cityRandf(l_state, -l_half, l_half), 0.3f, 1.0f);
+		light[i].color = vec3(1.0f, cityRandf(l_state, 0.7f, 1.0f), cityRandf(l_state, 0.4f, 0.8f));
+		light[i].intensity = 0.5f;
+	}
+	packLights();
+
+	// Each preset looks at the building nearest a point a quarter of the way
+	// out towards it, rather than at the empty middle of the grid.
+	for (int i = 0; i < 4; i++)
+	{
+		float l_a = i * 0.5f * l_pi + 0.6f;
+		camPresetPos[i] = vec3(cos(l_a) * l_half * 1.2f, sin(l_a) * l_half * 1.2f, l_half * (i == 0 ? 1.5f : 0.5f));
+		vector<int> l_nearest;
+		rtreeNearest(sceneIndex, vec2(cos(l_a), sin(l_a)) * l_half * 0.25f, 1, l_nearest);
+		POIPresetPos[i] = l_nearest.empty() ? vec3(0.0f) : sceneProps[l_nearest[0]]->center;
+	}
+	cameraLocation  = camPresetPos[0];
+	pointOfInterest = POIPresetPos[0];
+	cameraUp = vec3(0.0f, 0.0f, 1.0f);
+	Projection = perspective(5.0f, 3.0f / 3.0f, 0.001f, 1000.0f);
+
+	long long l_tris = 0;
+	for (int b = 0; b < city.buildings; b++) { l_tris += cityProps[b].numIndices / 3; }
+	printf("Generated city: %d buildings, %d-vertex footprints, %d lights, %lld triangles, %.1f x %.1f in %.0f ms\n",
+		city.buildings, l_footprint, numLights, l_tris, 2.0f * l_half, 2.0f * l_half, elapsedMs(l_start));
+#ifdef GL_TRACE
+	printf("  %lld heap allocations (%.1f MB), %lld import arena allocations (peak %.1f KB)\n", heapAllocCalls - l_heapCalls,
+		(heapAllocBytes - l_heapBytes) / 1048576.0, importArena.allocs - l_arenaAllocs, importArena.peak / 1024.0);
+#endif
+}
+
+//-------------------------RECORD-AND-REPLAY----------------------------
+// Camera and light only change through keyboardCB and the per-frame
+// integration in renderWorld(), so logging key events against the frame
+// they arrived in is enough to reproduce a session exactly. mouseCB's
+// random clear colour is not logged, so it is off while recording or
+// replaying (picking only prints). The resulting camera/light state of
+// every frame is logged too, so a replay can verify that it really did
+// follow the same path.
+struct structInputEvent { int frame, key, action; float timeMs; };
+struct structFrameState { vec3 cameraLocation, pointOfInterest; vec4 light0pos; float ang; int flags; };
+
+enum { inputLive = 0, inputRecord = 1, inputReplay = 2 };
+
+struct structInputLog
+{
+	int mode, frame, nextEvent, mismatches;
+	bool fast, injecting;
+	float stepMs;
+	string path, csvPath;
+	vector<structInputEvent> events;
+	vector<structFrameState> states;
+	vector<float> frameMs;
+	chrono::steady_clock::time_point start, frameStart;
+};
+
+structInputLog inputLog = { inputLive, 0, 0, 0, false, false, 1000.0f / 60.0f };
+const char inputLogMagic[8] = { 'L', '5', 'R', 'E', 'C', 0, 0, 1 };
+
+void keyboardCB(GLFWwindow *window, int key, int scancode, int action, int mods);
+void drawScene();
+
+float percentile(vector<float> values, float p)
+{
+	if (values.empty()) return 0.0f;
+	size_t l_n = (size_t)(p / 100.0f * (values.size() - 1) + 0.5f);
+	nth_element(values.begin(), values.begin() + l_n, values.end());
+	return values[l_n];
+}
+
+structFrameState currentFrameState()
+{
+	structFrameState l_state = { cameraLocation, pointOfInterest, light[0].pos, ang, (phong ? 1 : 0) | (camPresetMode << 1) };
+	return l_state;
+}
+
+bool saveInputLog()
+{
+	FILE *f = fopen(inputLog.path.c_str(), "wb");
+	if (!f) { fprintf(stderr, "could not write %s\n", inputLog.path.c_str()); return false; }
+	int l_counts[2] = { (int)inputLog.events.size(), (int)inputLog.states.size() };
+	fwrite(inputLogMagic, 1, sizeof(inputLogMagic), f);
+	fwrite(l_counts, sizeof(int), 2, f);
+	if (l_counts[0]) fwrite(&inputLog.events[0], sizeof(structInputEvent), l_counts[0], f);
+	if (l_counts[1]) fwrite(&inputLog.states[0], sizeof(structFrameState), l_counts[1], f);
+	fclose(f);
+	printf("Recorded %d events over %d frames to %s\n", l_counts[0], l_counts[1], inputLog.path.c_str());
+	return true;
+}
+
+bool loadInputLog()
+{
+	FILE *f = fopen(inputLog.path.c_str(), "rb");
+	char l_magic[8];
+	int l_counts[2];
+	if (!f || fread(l_magic, 1, 8, f) != 8 || memcmp(l_magic, inputLogMagic, 8) || fread(l_counts, sizeof(int), 2, f) != 2)
+	{
+		fprintf(stderr, "%s is not an input recording\n", inputLog.path.c_str());
+		if (f) fclose(f);
+		return false;
+	}
+	inputLog.events.resize(l_counts[0]);
+	inputLog.states.resize(l_counts[1]);
+	bool l_ok = (!l_counts[0] || fread(&inputLog.events[0], sizeof(structInputEvent), l_counts[0], f) == (size_t)l_counts[0]) &&
+	            (!l_counts[1] || fread(&inputLog.states[0], sizeof(structFrameState), l_counts[1], f) == (size_t)l_counts[1]);
+	fclose(f);
+	if (!l_ok) fprintf(stderr, "%s is truncated\n", inputLog.path.c_str());
+	return l_ok;
+}
+
+// Called by keyboardCB; returns false if the event should be dropped.
+bool inputLogKey(int key, int action)
+{
+	if (inputLog.mode == inputRecord)
+	{
+		structInputEvent l_event = { inputLog.frame, key, action, (float)elapsedMs(inputLog.start) };
+		inputLog.events.push_back(l_event);
+	}
+	// During replay only the recording drives the camera; Escape still quits.
+	return inputLog.mode != inputReplay || inputLog.injecting || key == GLFW_KEY_ESCAPE;
+}
+
+void inputLogBeginFrame(GLFWwindow *window)
+{
+	chrono::steady_clock::time_point l_now = chrono::steady_clock::now();
+	if (inputLog.mode == inputLive) return;
+	if (inputLog.frame == 0) inputLog.start = l_now;
+	else inputLog.frameMs.push_back((float)chrono::duration<double, milli>(l_now - inputLog.frameStart).count());
+
+	if (inputLog.mode == inputReplay)
+	{
+		if (inputLog.frame >= (int)inputLog.states.size())
+		{
+			glfwSetWindowShouldClose(window, GL_TRUE);
+			return;
+		}
+		if (!inputLog.fast)
+		{
+			// Fixed timestep: hold every frame to stepMs regardless of how fast it rendered.
+			chrono::steady_clock::time_point l_due = inputLog.frameStart + chrono::microseconds((long long)(inputLog.stepMs * 1000.0f));
+			if (inputLog.frame > 0 && l_now < l_due) this_thread::sleep_until(l_due);
+		}
+		inputLog.injecting = true;
+		for (; inputLog.nextEvent < (int)inputLog.events.size() && inputLog.events[inputLog.nextEvent].frame <= inputLog.frame; inputLog.nextEvent++)
+		{
+			const structInputEvent &l_event = inputLog.events[inputLog.nextEvent];
+			keyboardCB(window, l_event.key, 0, l_event.action, 0);
+		}
+		inputLog.injecting = false;
+	}
+	inputLog.frameStart = chrono::steady_clock::now();
+}
+
+void inputLogEndFrame()
+{
+	if (inputLog.mode == inputRecord) inputLog.states.push_back(currentFrameState());
+	else if (inputLog.mode == inputReplay && inputLog.frame < (int)inputLog.states.size())
+	{
+		structFrameState l_state = currentFrameState();
+		if (memcmp(&l_state, &inputLog.states[inputLog.frame], sizeof(l_state)))
+		{
+			if (inputLog.mismatches++ == 0) fprintf(stderr, "Replay diverged from the recording at frame %d\n", inputLog.frame);
+		}
+	}
+	inputLog.frame++;
+}
+
+void inputLogFinish()
+{
+	if (inputLog.mode == inputLive) return;
+	if (inputLog.mode == inputRecord) saveInputLog();
+
+	vector<float> &l_ms = inputLog.frameMs;
+	double l_total = 0.0;
+	for (size_t i = 0; i < l_ms.size(); i++) { l_total += l_ms[i]; }
+	if (!l_ms.empty())
+	{
+		printf("%s: %d frames, %.1f ms total, avg %.3f ms (%.1f fps), p50 %.3f, p95 %.3f, p99 %.3f, max %.3f ms\n",
+			inputLog.mode == inputRecord ? "Record" : (inputLog.fast ? "Replay (fast)" : "Replay (fixed step)"),
+			(int)l_ms.size(), l_total, l_total / l_ms.size(), 1000.0 * l_ms.size() / l_total,
+			percentile(l_ms, 50), percentile(l_ms, 95), percentile(l_ms, 99), percentile(l_ms, 100));
+	}
+	if (inputLog.mode == inputReplay)
+		printf("Replay %s the recording (%d of %d frames differ)\n", inputLog.mismatches ? "did NOT match" : "matched", inputLog.mismatches, (int)inputLog.states.size());
+
+	if (!inputLog.csvPath.empty())
+	{
+		FILE *f = fopen(inputLog.csvPath.c_str(), "w");
+		if (!f) { fprintf(stderr, "could not write %s\n", inputLog.csvPath.c_str()); return; }
+		fprintf(f, "frame,ms\n");
+		for (size_t i = 0; i < l_ms.size(); i++) { fprintf(f, "%d,%.4f\n", (int)i, l_ms[i]); }
+		fclose(f);
+	}
+}
+
+//-------------------------SIMULATION-THREAD----------------------------
+// With --sim-thread the camera and light are integrated on their own thread
+// at a fixed rate (sim.hz) instead of once per rendered frame. The main
+// thread only publishes the held keys and preset presses (atomics) after
+// polling events; every tick the simulation writes an immutable snapshot
+// into a lock-free triple buffer, and the renderer takes the newest one
+// without waiting and draws between the last two, one tick behind, so
+// motion stays smooth when ticks and frames do not line up. Not used with
+// --record/--replay, which are frame-based.
+//
+// Either way, input-to-present latency (key event until the first frame
+// reflecting it has been swapped), frame-time jitter and the variation of the
+// on-screen camera speed while moving are reported on exit (--sim-report).
+struct structSimState { vec3 cameraLocation, pointOfInterest; vec4 light0pos; float ang; int camPresetMode; };
+struct structSnapshot { structSimState state; double timeMs, inputMs; long long tick; };
+
+const int simFresh = 4; // flag next to the slot index in structTripleBuffer::middle
+
+struct structTripleBuffer
+{
+	structSnapshot slot[3];
+	atomic<int> middle;
+	int back, front; // owned by the writer and the reader
+};
+
+struct structSim
+{
+	bool enabled, report;
+	float hz;
+	atomic<bool> running;
+	atomic<unsigned int> keys;
+	atomic<int> presetPresses;
+	atomic<long long> inputUs;
+	thread worker;
+	structTripleBuffer buffer;
+	structSnapshot previous, current;
+	double pendingInputMs, frameInputMs, lastInputMs, postedInputMs;
+	vec3 lastCamera;
+	int lastPreset;
+	bool wasMoving;
+	chrono::steady_clock::time_point epoch, lastSwap;
+	vector<float> frameMs, latencyMs, cameraSpeed;
+};
+structSim sim = { false, false, 60.0f }; // 60 Hz keeps the per-step speed of the vsynced loop
+
+double simNowMs()
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - sim.epoch).count();
+}
+
+void tripleBufferInit(structTripleBuffer &b, const structSnapshot &s)
+{
+	for (int i = 0; i < 3; i++) { b.slot[i] = s; }
+	b.back = 0;
+	b.middle = 1;
+	b.front = 2;
+}
+
+void tripleBufferPublish(structTripleBuffer &b, const structSnapshot &s)
+{
+	b.slot[b.back] = s;
+	b.back = b.middle.exchange(b.back | simFresh, memory_order_acq_rel) & 3;
+}
+
+// False (and s untouched) when nothing new was published since last time.
+bool tripleBufferConsume(structTripleBuffer &b, structSnapshot &s)
+{
+	if (!(b.middle.load(memory_order_acquire) & simFresh)) return false;
+	b.front = b.middle.exchange(b.front, memory_order_acq_rel) & 3;
+	s = b.slot[b.front];
+	return true;
+}
+
+// One step of camera/light integration; renderWorld() runs it once per frame
+// and the simulation thread once per tick.
+void simulateStep(structSimState &s, const int *keys, bool nextPreset)
+{
+	if (keys[ 0] == 1) { s.cameraLocation.x  -= speed; }
+	if (keys[ 1] == 1) { s.cameraLocation.x  += speed; }
+	if (keys[ 2] == 1) { s.cameraLocation.y  -= speed; }
+	if (keys[ 3] == 1) { s.cameraLocation.y  += speed; }
+	if (keys[ 4] == 1) { s.cameraLocation.z  -= speed; }
+	if (keys[ 5] == 1) { s.cameraLocation.z  += speed; }
+
+	if (keys[ 6] == 1) { s.pointOfInterest.x -= speed; }
+	if (keys[ 7] == 1) { s.pointOfInterest.x += speed; }
+	if (keys[ 8] == 1) { s.pointOfInterest.y -= speed; }
+	if (keys[ 9] == 1) { s.pointOfInterest.y += speed; }
+	if (keys[10] == 1) { s.pointOfInterest.z -= speed; }
+	if (keys[11] == 1) { s.pointOfInterest.z += speed; }
+
+	if (nextPreset)
+	{
+		s.camPresetMode++;
+		if (s.camPresetMode >= 4) { s.camPresetMode = 0; }
+		s.cameraLocation = camPresetPos[s.camPresetMode];
+		s.pointOfInterest = POIPresetPos[s.camPresetMode];
+	}
+
+	s.light0pos.x = sin(s.ang)/3;
+	s.light0pos.y = cos(s.ang)/3;
+
+	s.ang += 0.0005;
+	if (s.ang > 360) s.ang = 0;
+}
+
+void simThread()
+{
+	double l_stepMs = 1000.0 / sim.hz;
+	structSnapshot l_snap = sim.current;
+	int l_presets = 0;
+	chrono::steady_clock::time_point l_next = chrono::steady_clock::now();
+	while (sim.running.load())
+	{
+		unsigned int l_bits = sim.keys.load();
+		int l_keys[12];
+		for (int i = 0; i < 12; i++) { l_keys[i] = (l_bits >> i) & 1; }
+		int l_presses = sim.presetPresses.load();
+
+		// Snapshots carry the time of the newest input they include, so the
+		// renderer still sees it when intermediate ticks are overwritten.
+		long long l_inputUs = sim.inputUs.exchange(0);
+		if (l_inputUs) l_snap.inputMs = l_inputUs / 1000.0;
+		simulateStep(l_snap.state, l_keys, l_presses != l_presets);
+		if (l_presses != l_presets) l_presets++;
+		l_snap.tick++;
+		// Stamped with the nominal tick time: a late tick still describes
+		// the moment it was due, which keeps interpolation even.
+		l_snap.timeMs = chrono::duration<double, milli>(l_next - sim.epoch).count();
+		tripleBufferPublish(sim.buffer, l_snap);
+
+		l_next += chrono::microseconds((long long)(l_stepMs * 1000.0));
+		this_thread::sleep_until(l_next);
+	}
+}
+
+// Called from keyboardCB for every event. Only the first event since the
+// last tick is timed; that is the one the latency is measured from.
+void simNoteInput()
+{
+	double l_now = simNowMs();
+	if (sim.enabled)
+	{
+		long long l_zero = 0, l_us = (long long)(l_now * 1000.0) + 1;
+		if (sim.inputUs.compare_exchange_strong(l_zero, l_us)) sim.postedInputMs = l_us / 1000.0;
+	}
+	else if (sim.pendingInputMs == 0.0) sim.pendingInputMs = l_now;
+}
+
+void simStart()
+{
+	sim.epoch = sim.lastSwap = chrono::steady_clock::now();
+	sim.lastCamera = cameraLocation;
+	sim.lastPreset = camPresetMode;
+	if (sim.enabled && inputLog.mode != inputLive)
+	{
+		fprintf(stderr, "--sim-thread is ignored with --record/--replay\n");
+		sim.enabled = false;
+	}
+	if (!sim.enabled) return;
+
+	structSimState l_state = { cameraLocation, pointOfInterest, light[0].pos, ang, camPresetMode };
+	structSnapshot l_snap = { l_state, 0.0, 0.0, 0 };
+	sim.previous = sim.current = l_snap;
+	tripleBufferInit(sim.buffer, l_snap);
+	sim.running = true;
+	sim.worker = thread(simThread);
+}
+
+// After glfwPollEvents(): hand the held keys and preset presses over.
+void simPublishInput()
+{
+	if (!sim.enabled) return;
+	unsigned int l_bits = 0;
+	for (int i = 0; i < 12; i++) { l_bits |= (dir[i] == 1 ? 1u : 0u) << i; }
+	sim.keys.store(l_bits);
+	if (changeCamPos == 1) { sim.presetPresses++; changeCamPos = 0; }
+}
+
+// The render thread's half of renderWorld(): newest snapshot in, camera and
+// light interpolated one tick behind, scene drawn.
+void renderSnapshot()
+{
+	// Input that arrived since the last frame has not been simulated yet;
+	// give the simulation at most one tick to fold it in rather than showing
+	// it a whole frame later.
+	double l_deadline = simNowMs() + 1000.0 / sim.hz;
+	structSnapshot l_snap;
+	while (true)
+	{
+		while (tripleBufferConsume(sim.buffer, l_snap))
+		{
+			sim.previous = sim.current;
+			sim.current = l_snap;
+			if (l_snap.inputMs > sim.lastInputMs) { sim.frameInputMs = l_snap.inputMs; sim.lastInputMs = l_snap.inputMs; }
+		}
+		if (sim.lastInputMs >= sim.postedInputMs || simNowMs() > l_deadline) break;
+		this_thread::yield();
+	}
+
+	const structSimState &a = sim.previous.state, &b = sim.current.state;
+	double l_span = sim.current.timeMs - sim.previous.timeMs;
+	float t = (l_span > 0.0) ? glm::clamp((float)((simNowMs() - 1000.0 / sim.hz - sim.previous.timeMs) / l_span), 0.0f, 1.0f) : 1.0f;
+	bool l_jump = a.camPresetMode != b.camPresetMode; // preset changes snap, not glide
+	cameraLocation  = l_jump ? b.cameraLocation  : mix(a.cameraLocation,  b.cameraLocation,  t);
+	pointOfInterest = l_jump ? b.pointOfInterest : mix(a.pointOfInterest, b.pointOfInterest, t);
+	light[0].pos    = mix(a.light0pos, b.light0pos, t);
+	ang             = b.ang;
+	camPresetMode   = b.camPresetMode;
+	packLights();
+
+	View = lookAt(cameraLocation, pointOfInterest, cameraUp);
+	PV = Projection * View;
+
+	dynResBegin();
+	drawScene();
+	dynResEnd();
+}
+
+// After glfwSwapBuffers().
+void simEndFrame()
+{
+	if (!sim.report) return;
+	glFinish();
+	chrono::steady_clock::time_point l_now = chrono::steady_clock::now();
+	sim.frameMs.push_back((float)chrono::duration<double, milli>(l_now - sim.lastSwap).count());
+	sim.lastSwap = l_now;
+	if (sim.frameInputMs > 0.0) sim.latencyMs.push_back((float)(simNowMs() - sim.frameInputMs));
+	sim.frameInputMs = 0.0;
+
+	bool l_moving = false;
+	for (int i = 0; i < 6; i++) { l_moving |= dir[i] == 1; }
+	// Skips the frames where a key went down or up mid-interval.
+	if (l_moving && sim.wasMoving && camPresetMode == sim.lastPreset && sim.frameMs.back() > 0.0f)
+		sim.cameraSpeed.push_back(length(cameraLocation - sim.lastCamera) * 1000.0f / sim.frameMs.back());
+	sim.lastCamera = cameraLocation;
+	sim.lastPreset = camPresetMode;
+	sim.wasMoving = l_moving;
+}
+
+void simFinish()
+{
+	if (sim.enabled)
+	{
+		sim.running = false;
+		sim.worker.join();
+	}
+	if (!sim.report || sim.frameMs.size() < 2) return;
+
+	vector<float> &l_ms = sim.frameMs;
+	l_ms.erase(l_ms.begin()); // the first interval includes startup
+	double l_sum = 0.0, l_sq = 0.0;
+	for (size_t i = 0; i < l_ms.size(); i++) { l_sum += l_ms[i]; l_sq += l_ms[i] * l_ms[i]; }
+	double l_mean = l_sum / l_ms.size();
+	printf("%s: %d frames, frame %.3f ms mean, p50 %.3f, p99 %.3f, jitter (stddev) %.3f ms\n", sim.enabled ? "Sim thread" : "Single loop",
+		(int)l_ms.size(), l_mean, percentile(l_ms, 50), percentile(l_ms, 99), sqrt(fmax(l_sq / l_ms.size() - l_mean * l_mean, 0.0)));
+	if (!sim.latencyMs.empty())
+		printf("  input-to-present: %d events, p50 %.3f ms, p95 %.3f ms, max %.3f ms\n", (int)sim.latencyMs.size(),
+			percentile(sim.latencyMs, 50), percentile(sim.latencyMs, 95), percentile(sim.latencyMs, 100));
+	// Perceived motion: distance per frame over the time that frame was on screen.
+	if (sim.cameraSpeed.size() > 1)
+	{
+		vector<float> &l_v = sim.cameraSpeed;
+		double l_s = 0.0, l_s2 = 0.0;
+		for (size_t i = 0; i < l_v.size(); i++) { l_s += l_v[i]; l_s2 += l_v[i] * l_v[i]; }
+		double l_m = l_s / l_v.size();
+		printf("  camera speed while moving: %.5f units/s mean, %.1f%% variation over %d frames\n", l_m,
+			l_m > 0.0 ? 100.0 * sqrt(fmax(l_s2 / l_v.size() - l_m * l_m, 0.0)) / l_m : 0.0, (int)l_v.size());
+	}
+}
+
+void keyboardCB(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	//cout << "key = " << key << "\n";
+	if (!inputLogKey(key, action)) return;
+	simNoteInput();
+
+	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
+		glfwSetWindowShouldClose(window, GL_TRUE);
+
+	else if (key == GLFW_KEY_W             && action == GLFW_PRESS)   { dir[ 0] = 1; }
+	else if (key == GLFW_KEY_S             && action == GLFW_PRESS)   { dir[ 1] = 1; }
+	else if (key == GLFW_KEY_A             && action == GLFW_PRESS)   { dir[ 2] = 1; }
+	else if (key == GLFW_KEY_D             && action == GLFW_PRESS)   { dir[ 3] = 1; }
+	else if (key == GLFW_KEY_LEFT_SHIFT    && action == GLFW_PRESS)   { dir[ 4] = 1; }
+	else if (key == GLFW_KEY_LEFT_CONTROL  && action == GLFW_PRESS)   { dir[ 5] = 1; }
+																			 
+	else if (key == GLFW_KEY_W             && action == GLFW_RELEASE) { dir[ 0] = 0; }
+	else if (key == GLFW_KEY_S             && action == GLFW_RELEASE) { dir[ 1] = 0; }
+	else if (key == GLFW_KEY_A             && action == GLFW_RELEASE) { dir[ 2] = 0; }
+	else if (key == GLFW_KEY_D             && action == GLFW_RELEASE) { dir[ 3] = 0; }
+	else if (key == GLFW_KEY_LEFT_SHIFT    && action == GLFW_RELEASE) { dir[ 4] = 0; }
+	else if (key == GLFW_KEY_LEFT_CONTROL  && action == GLFW_RELEASE) { dir[ 5] = 0; }
+																			 
+	else if (key == GLFW_KEY_UP            && action == GLFW_PRESS)   { dir[ 6] = 1; }
+	else if (key == GLFW_KEY_DOWN          && action == GLFW_PRESS)   { dir[ 7] = 1; }
+	else if (key == GLFW_KEY_LEFT          && action == GLFW_PRESS)   { dir[ 8] = 1; }
+	else if (key == GLFW_KEY_RIGHT         && action == GLFW_PRESS)   { dir[ 9] = 1; }
+	else if (key == GLFW_KEY_RIGHT_SHIFT   && action == GLFW_PRESS)   { dir[10] = 1; }
+	else if (key == GLFW_KEY_RIGHT_CONTROL && action == GLFW_PRESS)   { dir[11] = 1; }
+
+	else if (key == GLFW_KEY_UP		       && action == GLFW_RELEASE) { dir[ 6] = 0; }
+	else if (key == GLFW_KEY_DOWN		   && action == GLFW_RELEASE) { dir[ 7] = 0; }
+	else if (key == GLFW_KEY_LEFT		   && action == GLFW_RELEASE) { dir[ 8] = 0; }
+	else if (key == GLFW_KEY_RIGHT		   && action == GLFW_RELEASE) { dir[ 9] = 0; }
+	else if (key == GLFW_KEY_RIGHT_SHIFT   && action == GLFW_RELEASE) { dir[10] = 0; }
+	else if (key == GLFW_KEY_RIGHT_CONTROL && action == GLFW_RELEASE) { dir[11] = 0; }
+
+	else if (key == GLFW_KEY_SPACE         && action == GLFW_RELEASE) { changeCamPos = 1; }
+
+	else if (key == GLFW_KEY_TAB           && action == GLFW_RELEASE) { phong = !phong; }
+
+	else if (key == GLFW_KEY_L             && action == GLFW_RELEASE) { shadingLod.enabled = !shadingLod.enabled; }
+
+	else if (key == GLFW_KEY_I             && action == GLFW_RELEASE) { drawImpostors = !drawImpostors; }
+
+	else if (key == GLFW_KEY_H             && action == GLFW_RELEASE) { shadows.enabled = !shadows.enabled; }
+
+	else if (key == GLFW_KEY_R             && action == GLFW_RELEASE && dynRes.supported) { dynRes.enabled = !dynRes.enabled; dynResQueryFrame = 0; dynRes.gpuMsAvg = 0.0f; }
+
+	else if (key == GLFW_KEY_B             && action == GLFW_RELEASE) { renderBackend = (renderBackend == backendGL) ? backendSoftware : backendGL; }
+
+	else if (key == GLFW_KEY_C             && action == GLFW_RELEASE) { cullProps = !cullProps; }
+
+	else if (key == GLFW_KEY_V             && action == GLFW_RELEASE) { drawBatched = !drawBatched; }
+
+	else if (key == GLFW_KEY_G             && action == GLFW_RELEASE) { gpuCullProps = !gpuCullProps; }
+
+	else if (key == GLFW_KEY_O             && action == GLFW_RELEASE) { occlusionCull = !occlusionCull; }
+
+	else if (key == GLFW_KEY_M             && action == GLFW_RELEASE) { multiView.enabled = !multiView.enabled; }
+}
+
+void mouseCB(GLFWwindow *window, int button, int action, int mods)
+{
+	float r = 0.0f, g = 0.0f, b = 0.0f;
+	if (button == GLFW_MOUSE_BUTTON_1 && action == GLFW_PRESS)
+	{
+		double x, y;
+		int l_width, l_height;
+		glfwGetCursorPos(window, &x, &y);
+		glfwGetWindowSize(window, &l_width, &l_height);
+		int l_pick = pickProp(x, y, l_width, l_height);
+		if (l_pick < 0) printf("Picked nothing\n");
+		else
+		{
+			const prop &p = *sceneProps[l_pick];
+			vec3 l_center = (p.boundsMin + p.boundsMax) * 0.5f;
+			printf("Picked prop %d: centre (%.4f, %.4f, %.4f), %d triangles\n", l_pick, l_center.x, l_center.y, l_center.z, p.numIndices / 3);
+		}
+	}
+	else if (button == GLFW_MOUSE_BUTTON_2 && action == GLFW_PRESS && inputLog.mode == inputLive)
+	{
+		r = (double)rand() / (double)RAND_MAX;
+		g = (double)rand() / (double)RAND_MAX;
+		b = (double)rand() / (double)RAND_MAX;
+		glClearColor(r, g, b, 1.0);
+	}
+}
+
+void drawScene()
+{
+	shadowPass(PV);
+	if (renderBackend == backendSoftware) swBeginFrame();
+	else glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	sceneStats.propsDrawn = sceneStats.propsCulled = sceneStats.propsOccluded = sceneStats.impostors = 0;
+	sceneStats.shaded[shaderOutline] = sceneStats.shaded[shaderGouraud] = sceneStats.shaded[shaderPhong] = 0;
+	sceneStats.triangles = 0;
+	arenaReset(frameArena);
+	structArenaScope l_frame(frameArena);
+	if (multiView.enabled && renderBackend == backendGL) drawSplitView(true);
+	else drawProps(PV);
+
+	if (renderBackend == backendSoftware) swEndFrame();
+}
+
+void renderWorld()
+{
+	//---------------------------CHANGE-CAMERA-DIRECTION---------------------------
+	structSimState l_state = { cameraLocation, pointOfInterest, light[0].pos, ang, camPresetMode };
+	simulateStep(l_state, dir, changeCamPos == 1);
+	changeCamPos    = 0;
+	cameraLocation  = l_state.cameraLocation;
+	pointOfInterest = l_state.pointOfInterest;
+	light[0].pos    = l_state.light0pos;
+	ang             = l_state.ang;
+	camPresetMode   = l_state.camPresetMode;
+	packLights();
+
+	sim.frameInputMs = sim.pendingInputMs;
+	sim.pendingInputMs = 0.0;
+
+	View = lookAt(cameraLocation, pointOfInterest, cameraUp);
+	PV = Projection * View;
+
+	dynResBegin();
+	drawScene();
+	dynResEnd();
+}
+
+//------------------------------HOT-RELOAD------------------------------
+// --watch DIR: an inotify watch on DIR rebuilds what a saved file affects,
+// without a restart. Geometry files are the campus vertex lists
+// (bayhallVertices.txt, ecdcAvertices.txt, ecdcBvertices.txt: vec3(...)
+// lines, then triangles as index triples) and buildingN.txt, the same
+// format in world space, for building N of --city. Shader files are
+// <name>.glsl for the five sources the prop programs are built from; the
+// embedded ones are written to DIR first when missing, to have something
+// to edit. A worker thread with its own shared context parses the file,
+// builds the prop's buffers or links the programs and fences them; at the
+// start of a frame the main thread takes whatever has finished and swaps
+// it in whole, so a frame never sees half a change and never waits on
+// one. Programs for split view and the terrain are not reloaded.
+enum { reloadGeometry = 0, reloadShader = 1 };
+
+struct structReload
+{
+	int kind, target;                  // prop or shader source
+	string file;
+	prop mesh;                         // geometry: new vertices and buffers
+	GLuint programs[numShaders];       // shader: new programs, 0 = unchanged
+	GLsync fence;
+	chrono::steady_clock::time_point saved;
+	double buildMs, swapMs;
+};
+
+struct structHotReload
+{
+	string dir;
+	GLFWwindow *context;
+	thread worker;
+	atomic<bool> quit;
+	int fd;
+	mutex lock;
+	deque<structReload*> ready;
+	vector<structReload*> shown;       // swapped in this frame
+	string sources[5];
+	int count;
+	double latencySum, latencyMax;
+};
+structHotReload hotReload;
+
+const char *hotReloadSourceNames[5] = { "vertexShader", "vertexShader0", "vertexShader1", "fragmentShader", "fragmentShader1" };
+const int hotReloadVert[numShaders] = { 1, 0, 2 }, hotReloadFrag[numShaders] = { 3, 3, 4 }; // as in initContextShaders()
+
+// The prop a geometry file maps to (a city building, or -1..-3 for the
+// campus), and the transform its file is in; -4 when it is not geometry.
+int hotReloadTarget(const string &name, mat4 &model)
+{
+	model = mat4(1.0f);
+	int l_building;
+	if (sscanf(name.c_str(), "building%d.txt", &l_building) == 1)
+		return (l_building >= 0 && l_building < (int)cityProps.size()) ? l_building : -4;
+	model = campusModel;
+	if (name == "bayhallVertices.txt") return -1;
+	if (name == "ecdcAvertices.txt")   return -2;
+	if (name == "ecdcBvertices.txt")   return -3;
+	return -4;
+}
+
+prop &hotReloadProp(int target)
+{
+	return (target >= 0) ? cityProps[target] : (target == -1) ? bayhall : (target == -2) ? ecdcA : ecdcB;
+}
+
+// Every triangle gets its own corners, so each face shades flat like the
+// hand-built campus meshes.
+bool loadReloadMesh(const string &path, const mat4 &model, prop &p)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if (!f) return false;
+	vector<vec3> l_points;
+	vector<int> l_triangles;
+	char l_line[512];
+	while (fgets(l_line, sizeof(l_line), f))
+	{
+		char *c = strstr(l_line, "vec3(");
+		if (c)
+		{
+			c += 5;
+			float v[3];
+			for (int k = 0; k < 3; k++)
+			{
+				while (*c && !strchr("-+.0123456789", *c)) { c++; }
+				v[k] = strtof(c, &c);
+			}
+			l_points.push_back(vec3(v[0], v[1], v[2]));
+			continue;
+		}
+		for (c = l_line; *c; )
+		{
+			if (!strchr("0123456789", *c)) { c++; continue; }
+			l_triangles.push_back((int)strtol(c, &c, 10));
+		}
+	}
+	fclose(f);
+
+	if (l_points.empty() || l_triangles.empty() || l_triangles.size() % 3) return false;
+	for (size_t i = 0; i < l_triangles.size(); i++)
+	{
+		if (l_triangles[i] >= (int)l_points.size()) return false;
+	}
+	bakeVertices(p.vertex, &l_points[0], (int)l_points.size(), &l_triangles[0], (int)l_triangles.size(), model);
+	p.numVertices = p.numIndices = (int)l_triangles.size();
+	p.index.resize(p.numIndices);
+	for (int i = 0; i < p.numIndices; i++) { p.index[i] = i; }
+	p.outline = false;
+	p.Model = mat4(1.0f);
+	p.computeNormals();
+	return true;
+}
 
-	int ecdcAIndex[] =
+// Like initShaders(), but a bad source leaves the old program in place
+// instead of ending the program.
+GLuint hotReloadProgram(const string &vert, const string &frag)
+{
+	const string *l_sources[2] = { &vert, &frag };
+	GLenum l_types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	GLuint l_program = glCreateProgram();
+	char l_log[2048];
+	for (int i = 0; i < 2; i++)
 	{
-		  0,   1,   3,        1,   2,   4,
-		  4,   3,   1,        5,   4,   2, // 0 - 2,3 - 5
-		  6,   7,   8,        9,   8,   7, // 6 - 9
-		 10,  11,  17,       11,  12,  18,
-		 12,  13,  19,       13,  14,  20,
-		 14,  15,  21,       15,  16,  22,
-		 18,  17,  11,       19,  18,  12,
-		 20,  19,  13,       21,  20,  14,
-		 22,  21,  15,       23,  22,  16, // 10 - 16,17 - 23
-		 24,  25,  26,       27,  26,  25, // 24 - 27
-		 28,  29,  30,       31,  30,  29, // 28 - 31
-		 32,  33,  34,       35,  34,  33, // 32 - 35
-		 36,  37,  44,       37,  38,  45,
-		 38,  39,  46,       39,  40,  47,
-		 40,  41,  48,       41,  42,  49,
-		 42,  43,  50,       45,  44,  37,
-		 46,  45,  38,       47,  46,  39,
-		 48,  47,  40,       49,  48,  41,
-		 50,  49,  42,       51,  50,  43, // 36 - 43,44 - 51
-		 52,  53,  54,       55,  54,  53, // 52 - 55
-		 56,  57,  58,       59,  58,  57, // 56 - 59
-		 60,  61,  62,       63,  62,  61, // 60 - 63
-		 64,  65,  66,       67,  66,  65, // 64 - 67
-		 68,  69,  70,       71,  70,  69, // 68 - 71
-		 72,  73,  74,       75,  74,  73, // 72 - 75
-		 76,  77,  78,       79,  78,  77, // 76 - 79
-		 80,  81,  82,       83,  82,  81, // 80 - 83
-		 84,  85,  86,       87,  86,  85, // 84 - 87
-		 88,  89,  90,       91,  90,  89, // 88 - 91
-		 92,  93,  94,       95,  94,  93, // 92 - 95
-		 96,  97, 104,       97,  98, 105,
-		 98,  99, 106,       99, 100, 107,
-		100, 101, 108,      101, 102, 109,
-		102, 103, 110,      105, 104,  97,
-		106, 105,  98,      107, 106,  99,
-		108, 107, 100,      109, 108, 101,
-		110, 109, 102,      111, 110, 103, //  96 - 103,104 - 111
-		112, 113, 114,      115, 114, 113, // 112 - 115
-		116, 117, 118,      119, 118, 117, // 116 - 119
-		120, 121, 122,      123, 122, 121, // 120 - 123
+		GLuint l_shader = glCreateShader(l_types[i]);
+		const GLchar *l_text = l_sources[i]->c_str();
+		glShaderSource(l_shader, 1, &l_text, NULL);
+		glCompileShader(l_shader);
+		GLint l_compiled;
+		glGetShaderiv(l_shader, GL_COMPILE_STATUS, &l_compiled);
+		if (!l_compiled)
+		{
+			glGetShaderInfoLog(l_shader, sizeof(l_log), NULL, l_log);
+			printf("Hot reload: shader failed to compile, keeping the old one:\n%s\n", l_log);
+			glDeleteShader(l_shader);
+			glDeleteProgram(l_program);
+			return 0;
+		}
+		glAttachShader(l_program, l_shader);
+		glDeleteShader(l_shader);
+	}
+	glBindAttribLocation(l_program, vertexPosAttrib, "vertexPos");
+	glBindAttribLocation(l_program, normalPosAttrib, "normalPos");
+	glLinkProgram(l_program);
+	GLint l_linked;
+	glGetProgramiv(l_program, GL_LINK_STATUS, &l_linked);
+	if (!l_linked)
+	{
+		glGetProgramInfoLog(l_program, sizeof(l_log), NULL, l_log);
+		printf("Hot reload: shaders failed to link, keeping the old program:\n%s\n", l_log);
+		glDeleteProgram(l_program);
+		return 0;
+	}
+	return l_program;
+}
+
+// Worker side: everything but the swap. Returns NULL when the file is not
+// one we know or did not load.
+structReload *hotReloadBuild(const string &name, chrono::steady_clock::time_point saved)
+{
+	string l_path = hotReload.dir + "/" + name;
+	structReload *r = new structReload();
+	r->file = name;
+	r->saved = saved;
+	r->fence = 0;
+	for (int i = 0; i < numShaders; i++) { r->programs[i] = 0; }
+
+	mat4 l_model;
+	int l_target = hotReloadTarget(name, l_model);
+	int l_source = -1;
+	for (int i = 0; i < 5; i++) { if (name == string(hotReloadSourceNames[i]) + ".glsl") l_source = i; }
+
+	if (l_target > -4)
+	{
+		r->kind = reloadGeometry;
+		r->target = l_target;
+		if (!loadReloadMesh(l_path, l_model, r->mesh))
+		{
+			printf("Hot reload: could not read %s, keeping the old mesh\n", name.c_str());
+			delete r;
+			return NULL;
+		}
+		r->mesh.upload();
+		glDeleteVertexArrays(1, &r->mesh.VAO[renderContext]);
+		r->mesh.VAO[renderContext] = 0;
+	}
+	else if (l_source >= 0)
+	{
+		FILE *f = fopen(l_path.c_str(), "rb");
+		if (!f) { delete r; return NULL; }
+		string l_text;
+		char l_buffer[4096];
+		size_t n;
+		while ((n = fread(l_buffer, 1, sizeof(l_buffer), f)) > 0) { l_text.append(l_buffer, n); }
+		fclose(f);
+		if (l_text == hotReload.sources[l_source]) { delete r; return NULL; }
+		hotReload.sources[l_source] = l_text;
+
+		r->kind = reloadShader;
+		r->target = l_source;
+		for (int i = 0; i < numShaders; i++)
+		{
+			if (hotReloadVert[i] != l_source && hotReloadFrag[i] != l_source) continue;
+			r->programs[i] = hotReloadProgram(hotReload.sources[hotReloadVert[i]], hotReload.sources[hotReloadFrag[i]]);
+			if (r->programs[i] == 0)
+			{
+				for (int k = 0; k < numShaders; k++) { if (r->programs[k]) glDeleteProgram(r->programs[k]); }
+				delete r;
+				return NULL;
+			}
+		}
+	}
+	else
+	{
+		delete r;
+		return NULL;
+	}
+
+	r->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	r->buildMs = elapsedMs(saved);
+	return r;
+}
+
+void hotReloadWorker()
+{
+#ifdef HOT_RELOAD
+	glfwMakeContextCurrent(hotReload.context);
+	renderContext = maxContexts - 1;
+	char l_events[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (!hotReload.quit)
+	{
+		struct pollfd l_poll = { hotReload.fd, POLLIN, 0 };
+		if (poll(&l_poll, 1, 100) <= 0) continue;
+		ssize_t l_length = read(hotReload.fd, l_events, sizeof(l_events));
+		chrono::steady_clock::time_point l_saved = chrono::steady_clock::now();
+
+		// An editor may write a file more than once in one save; build it once.
+		vector<string> l_names;
+		for (char *c = l_events; c < l_events + l_length; )
+		{
+			const struct inotify_event *e = (const struct inotify_event *)c;
+			c += sizeof(struct inotify_event) + e->len;
+			if (e->len == 0) continue;
+			if (find(l_names.begin(), l_names.end(), string(e->name)) == l_names.end()) l_names.push_back(e->name);
+		}
+		for (size_t i = 0; i < l_names.size(); i++)
+		{
+			structReload *r = hotReloadBuild(l_names[i], l_saved);
+			if (!r) continue;
+			lock_guard<mutex> l_lock(hotReload.lock);
+			hotReload.ready.push_back(r);
+		}
+	}
+	glfwMakeContextCurrent(NULL);
+#endif
+}
+
+void hotReloadStart(GLFWwindow *window)
+{
+	if (hotReload.dir.empty()) return;
+#ifdef HOT_RELOAD
+	const char *l_embedded[5] = { vertexShader, vertexShader0, vertexShader1, fragmentShader, fragmentShader1 };
+	for (int i = 0; i < 5; i++)
+	{
+		hotReload.sources[i] = l_embedded[i];
+		string l_path = hotReload.dir + "/" + hotReloadSourceNames[i] + ".glsl";
+		FILE *f = fopen(l_path.c_str(), "rb");
+		if (f) { fclose(f); continue; }
+		f = fopen(l_path.c_str(), "wb");
+		if (f) { fputs(l_embedded[i], f); fclose(f); }
+	}
+
+	hotReload.fd = inotify_init1(IN_CLOEXEC);
+	if (hotReload.fd < 0 || inotify_add_watch(hotReload.fd, hotReload.dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		fprintf(stderr, "could not watch %s\n", hotReload.dir.c_str());
+		return;
+	}
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	hotReload.context = glfwCreateWindow(1, 1, "reload", NULL, window);
+	if (!hotReload.context)
+	{
+		fprintf(stderr, "could not create a context for hot reload\n");
+		return;
+	}
+	hotReload.quit = false;
+	hotReload.worker = thread(hotReloadWorker);
+	printf("Hot reload: watching %s\n", hotReload.dir.c_str());
+#else
+	fprintf(stderr, "--watch needs inotify (Linux)\n");
+#endif
+}
+
+// Main thread, before drawing: swaps in every reload whose GPU work is done.
+void hotReloadBeginFrame()
+{
+	if (!hotReload.worker.joinable()) return;
+	deque<structReload*> l_pending;
+	{
+		lock_guard<mutex> l_lock(hotReload.lock);
+		l_pending.swap(hotReload.ready);
+	}
+	while (!l_pending.empty())
+	{
+		structReload *r = l_pending.front();
+		if (glClientWaitSync(r->fence, 0, 0) == GL_TIMEOUT_EXPIRED) break;
+		l_pending.pop_front();
+		glDeleteSync(r->fence);
+
+		if (r->kind == reloadGeometry)
+		{
+			prop &p = hotReloadProp(r->target);
+			glDeleteBuffers(1, &p.VBO);
+			glDeleteBuffers(1, &p.IBO);
+			if (p.VAO[renderContext]) glDeleteVertexArrays(1, &p.VAO[renderContext]);
+			for (int c = 0; c < maxContexts; c++) { p.VAO[c] = 0; }
+			p.vertex.swap(r->mesh.vertex);
+			p.normal.swap(r->mesh.normal);
+			p.index.swap(r->mesh.index);
+			p.numVertices = r->mesh.numVertices;
+			p.numIndices = r->mesh.numIndices;
+			p.VBO = r->mesh.VBO;
+			p.IBO = r->mesh.IBO;
+			p.Model = mat4(1.0f);
+			p.impostor = 0;
+			p.computeBounds();
+
+			for (size_t i = 0; i < sceneProps.size(); i++)
+			{
+				if (sceneProps[i] != &p) continue;
+				rtreeRemove(sceneIndex, (int)i);
+				rtreeInsert(sceneIndex, (int)i, propRect(p));
+			}
+			batches.clear();
+			batchedProps.clear();
+			gpuCull.dirty = true;
+			shadows.dirty = true;
+		}
+		else
+		{
+			for (int i = 0; i < numShaders; i++)
+			{
+				if (r->programs[i] == 0) continue;
+				structShader &l_shader = shaders[renderContext][i];
+				glDeleteProgram(l_shader.prog);
+				l_shader.prog = r->programs[i];
+				initShaderLocations(l_shader, i == shaderOutline, true);
+			}
+		}
+		r->swapMs = elapsedMs(r->saved);
+		hotReload.shown.push_back(r);
+	}
+	if (l_pending.empty()) return;
+	lock_guard<mutex> l_lock(hotReload.lock);
+	hotReload.ready.insert(hotReload.ready.begin(), l_pending.begin(), l_pending.end());
+}
+
+// After the swap that first showed them.
+void hotReloadEndFrame()
+{
+	for (size_t i = 0; i < hotReload.shown.size(); i++)
+	{
+		structReload *r = hotReload.shown[i];
+		double l_visibleMs = elapsedMs(r->saved);
+		printf("Hot reload %s: visible %.1f ms after save (built %.1f ms, swapped in at %.1f ms)\n", r->file.c_str(), l_visibleMs, r->buildMs, r->swapMs);
+		hotReload.count++;
+		hotReload.latencySum += l_visibleMs;
+		hotReload.latencyMax = std::max(hotReload.latencyMax, l_visibleMs);
+		delete r;
+	}
+	hotReload.shown.clear();
+}
+
+void hotReloadFinish()
+{
+	if (!hotReload.worker.joinable()) return;
+	hotReload.quit = true;
+	hotReload.worker.join();
+#ifdef HOT_RELOAD
+	close(hotReload.fd);
+#endif
+	for (size_t i = 0; i < hotReload.ready.size(); i++) { delete hotReload.ready[i]; }
+	hotReload.ready.clear();
+	if (hotReload.count) printf("Hot reload: %d changes, save to visible %.1f ms mean, %.1f ms max\n", hotReload.count, hotReload.latencySum / hotReload.count, hotReload.latencyMax);
+}
+
+//----------------------------SOFTWARE-BENCH----------------------------
+// Renders every camera preset with the GL path (llvmpipe when run with
+// LIBGL_ALWAYS_SOFTWARE=1) and with the software backend, and reports
+// throughput and how far the two images are apart.
+void writePPM(const char *path, int width, int height, const unsigned int *rgba)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) { fprintf(stderr, "could not write %s\n", path); return; }
+	fprintf(f, "P6\n%d %d\n255\n", width, height);
+	for (int y = height - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			unsigned int c = rgba[y * width + x];
+			unsigned char l_rgb[3] = { (unsigned char)(c & 0xff), (unsigned char)((c >> 8) & 0xff), (unsigned char)((c >> 16) & 0xff) };
+			fwrite(l_rgb, 1, 3, f);
+		}
+	}
+	fclose(f);
+}
+
+void benchSoftware(int frames, bool writeImages)
+{
+	vector<unsigned int> l_glImage(windowWidth * windowHeight), l_diffImage(windowWidth * windowHeight);
+	printf("Software backend: %d threads, %dx%d tiles\nGL backend: %s\n", swNumThreads, swTileSize, swTileSize, glGetString(GL_RENDERER));
+	printf("preset |   tris | GL fps | GL Mtri/s | SW fps | SW Mtri/s | mean diff | pixels > 8/255\n");
+
+	for (int l_preset = 0; l_preset < 4; l_preset++)
+	{
+		cameraLocation  = camPresetPos[l_preset];
+		pointOfInterest = POIPresetPos[l_preset];
+		View = lookAt(cameraLocation, pointOfInterest, cameraUp);
+		PV = Projection * View;
+
+		renderBackend = backendGL;
+		drawScene();
+		glFinish();
+		chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++) { drawScene(); glFinish(); }
+		double l_glMs = elapsedMs(l_start) / frames;
+		glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, &l_glImage[0]);
+
+		renderBackend = backendSoftware;
+		drawScene();
+		glFinish();
+		l_start = chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++) { drawScene(); glFinish(); }
+		double l_swMs = elapsedMs(l_start) / frames;
+		double l_tris = (double)swFrame.trianglesSubmitted;
+
+		double l_diffSum = 0.0;
+		int l_diffPixels = 0;
+		for (int i = 0; i < windowWidth * windowHeight; i++)
+		{
+			int l_maxDiff = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int d = abs((int)((l_glImage[i] >> (8 * c)) & 0xff) - (int)((swFrame.color[i] >> (8 * c)) & 0xff));
+				l_diffSum += d;
+				l_maxDiff = std::max(l_maxDiff, d);
+			}
+			if (l_maxDiff > 8) l_diffPixels++;
+			l_diffImage[i] = (l_maxDiff > 8) ? 0xff0000ffu : 0xff000000u | (l_maxDiff * 0x1f) * 0x010101u;
+		}
+
+		printf("%6d | %6.0f | %6.1f | %9.2f | %6.1f | %9.2f | %9.3f | %6d (%.2f%%)\n", l_preset, l_tris,
+			1000.0 / l_glMs, l_tris / (l_glMs * 1000.0), 1000.0 / l_swMs, l_tris / (l_swMs * 1000.0),
+			l_diffSum / (windowWidth * windowHeight * 3.0), l_diffPixels, 100.0 * l_diffPixels / (windowWidth * windowHeight));
+
+		if (writeImages)
+		{
+			char l_path[64];
+			sprintf(l_path, "swbench_%d_gl.ppm",   l_preset);  writePPM(l_path, windowWidth, windowHeight, &l_glImage[0]);
+			sprintf(l_path, "swbench_%d_sw.ppm",   l_preset);  writePPM(l_path, windowWidth, windowHeight, &swFrame.color[0]);
+			sprintf(l_path, "swbench_%d_diff.ppm", l_preset);  writePPM(l_path, windowWidth, windowHeight, &l_diffImage[0]);
+		}
+	}
+	renderBackend = backendGL;
+}
+
+//-----------------------------BATCH-RENDER-----------------------------
+// Headless rendering of a list of camera poses to PNG files. Each render
+// thread owns a GL context and an offscreen FBO; frames are read back into
+// a pair of PBOs so the copy of pose i overlaps rendering of pose i+1, and
+// PNG encoding happens on separate writer threads. With --software the
+// render threads take turns on the shared software frame and queue it
+// straight from memory.
+struct structPose { vec3 location, pointOfInterest, up; float fov; };
+
+struct structBatchJob { int index; vector<unsigned char> rgba; };
+
+// Past this many images waiting for a writer, render threads block.
+const int batchMaxQueued = 8;
+
+struct structBatchQueue
+{
+	deque<structBatchJob> jobs;
+	mutex lock;
+	condition_variable ready, drained;
+	bool finished;
+};
+
+structBatchQueue batchQueue;
+string batchOutDir = ".";
+int batchWidth = windowWidth, batchHeight = windowHeight;
+
+unsigned int crc32Table[256];
+
+unsigned int updateCRC32(unsigned int crc, const unsigned char *data, size_t len)
+{
+	if (crc32Table[1] == 0)
+	{
+		for (unsigned int n = 0; n < 256; n++)
+		{
+			unsigned int c = n;
+			for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1; }
+			crc32Table[n] = c;
+		}
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) { crc = crc32Table[(crc ^ data[i]) & 0xff] ^ (crc >> 8); }
+	return ~crc;
+}
+
+void writePNGChunk(FILE *f, const char *type, const unsigned char *data, size_t len)
+{
+	unsigned char l_header[8] = { (unsigned char)(len >> 24), (unsigned char)(len >> 16), (unsigned char)(len >> 8), (unsigned char)len,
+	                              (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3] };
+	unsigned int l_crc = updateCRC32(updateCRC32(0, l_header + 4, 4), data, len);
+	unsigned char l_footer[4] = { (unsigned char)(l_crc >> 24), (unsigned char)(l_crc >> 16), (unsigned char)(l_crc >> 8), (unsigned char)l_crc };
+	fwrite(l_header, 1, 8, f);
+	if (len) fwrite(data, 1, len, f);
+	fwrite(l_footer, 1, 4, f);
+}
+
+// RGB PNG from a bottom-up RGBA buffer (what glReadPixels returns). The zlib
+// stream uses stored blocks only: no compression, but no dependency either
+// and the encoder is never the bottleneck.
+bool writePNG(const char *path, int width, int height, const unsigned char *rgba)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) { fprintf(stderr, "could not write %s\n", path); return false; }
+
+	vector<unsigned char> l_raw((width * 3 + 1) * height);
+	for (int y = 0; y < height; y++)
+	{
+		unsigned char *l_row = &l_raw[y * (width * 3 + 1)];
+		const unsigned char *l_src = rgba + (height - 1 - y) * width * 4;
+		l_row[0] = 0; // filter: none
+		for (int x = 0; x < width; x++) { l_row[1 + x * 3] = l_src[x * 4]; l_row[2 + x * 3] = l_src[x * 4 + 1]; l_row[3 + x * 3] = l_src[x * 4 + 2]; }
+	}
+
+	vector<unsigned char> l_zlib;
+	l_zlib.reserve(l_raw.size() + l_raw.size() / 65535 * 5 + 16);
+	l_zlib.push_back(0x78);
+	l_zlib.push_back(0x01);
+	unsigned int l_a = 1, l_b = 0;
+	for (size_t l_pos = 0; l_pos < l_raw.size() || l_pos == 0; )
+	{
+		size_t l_len = std::min((size_t)65535, l_raw.size() - l_pos);
+		bool l_last = l_pos + l_len == l_raw.size();
+		l_zlib.push_back(l_last ? 1 : 0);
+		l_zlib.push_back(l_len & 0xff);          l_zlib.push_back(l_len >> 8);
+		l_zlib.push_back(~l_len & 0xff);         l_zlib.push_back((~l_len >> 8) & 0xff);
+		l_zlib.insert(l_zlib.end(), l_raw.begin() + l_pos, l_raw.begin() + l_pos + l_len);
+		for (size_t i = l_pos; i < l_pos + l_len; i++) { l_a = (l_a + l_raw[i]) % 65521; l_b = (l_b + l_a) % 65521; }
+		l_pos += l_len;
+		if (l_last) break;
+	}
+	unsigned int l_adler = (l_b << 16) | l_a;
+	l_zlib.push_back(l_adler >> 24);  l_zlib.push_back(l_adler >> 16);  l_zlib.push_back(l_adler >> 8);  l_zlib.push_back(l_adler);
+
+	unsigned char l_ihdr[13] = { (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+	                             (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+	                             8, 2, 0, 0, 0 };
+	const unsigned char l_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	fwrite(l_signature, 1, 8, f);
+	writePNGChunk(f, "IHDR", l_ihdr, 13);
+	writePNGChunk(f, "IDAT", &l_zlib[0], l_zlib.size());
+	writePNGChunk(f, "IEND", NULL, 0);
+	fclose(f);
+	return true;
+}
+
+bool loadPoses(const char *path, vector<structPose> &poses)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) { fprintf(stderr, "could not open pose file %s\n", path); return false; }
+
+	// One pose per line: location(3) pointOfInterest(3) up(3) [fov]. '#' starts a comment.
+	char l_line[512];
+	int l_lineNum = 0;
+	while (fgets(l_line, sizeof(l_line), f))
+	{
+		l_lineNum++;
+		char *l_hash = strchr(l_line, '#');
+		if (l_hash) *l_hash = 0;
+
+		structPose l_pose;
+		l_pose.fov = 5.0f; // same as Projection in initialize()
+		int n = sscanf(l_line, "%f %f %f %f %f %f %f %f %f %f",
+			&l_pose.location.x, &l_pose.location.y, &l_pose.location.z,
+			&l_pose.pointOfInterest.x, &l_pose.pointOfInterest.y, &l_pose.pointOfInterest.z,
+			&l_pose.up.x, &l_pose.up.y, &l_pose.up.z, &l_pose.fov);
+		if (n <= 0) continue;
+		if (n < 9)
+		{
+			fprintf(stderr, "%s:%d: expected 9 or 10 numbers\n", path, l_lineNum);
+			fclose(f);
+			return false;
+		}
+		poses.push_back(l_pose);
+	}
+	fclose(f);
+	return true;
+}
+
+void batchWriter()
+{
+	while (true)
+	{
+		structBatchJob l_job;
+		{
+			unique_lock<mutex> l_lock(batchQueue.lock);
+			batchQueue.ready.wait(l_lock, [] { return batchQueue.finished || !batchQueue.jobs.empty(); });
+			if (batchQueue.jobs.empty()) return;
+			l_job = move(batchQueue.jobs.front());
+			batchQueue.jobs.pop_front();
+			batchQueue.drained.notify_one();
+		}
+		char l_path[1024];
+		snprintf(l_path, sizeof(l_path), "%s/view_%05d.png", batchOutDir.c_str(), l_job.index);
+		writePNG(l_path, batchWidth, batchHeight, &l_job.rgba[0]);
+	}
+}
+
+void batchQueueImage(int index, const void *rgba)
+{
+	structBatchJob l_job;
+	l_job.index = index;
+	l_job.rgba.assign((const unsigned char *)rgba, (const unsigned char *)rgba + batchWidth * batchHeight * 4);
+
+	unique_lock<mutex> l_lock(batchQueue.lock);
+	batchQueue.drained.wait(l_lock, [] { return (int)batchQueue.jobs.size() < batchMaxQueued; });
+	batchQueue.jobs.push_back(move(l_job));
+	batchQueue.ready.notify_one();
+}
+
+void batchRenderThread(GLFWwindow *context, int ctx, const vector<structPose> *poses, int first, int stride)
+{
+	glfwMakeContextCurrent(context);
+	renderContext = ctx;
+	if (shaders[ctx][0].prog == 0) initContextShaders();
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+
+	GLuint l_FBO, l_RBO[2], l_PBO[2];
+	GLsync l_fence[2] = { 0, 0 };
+	int l_pending[2] = { -1, -1 }, l_slot = 0;
+
+	glGenRenderbuffers(2, l_RBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, l_RBO[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, batchWidth, batchHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, l_RBO[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, batchWidth, batchHeight);
+	glGenFramebuffers(1, &l_FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, l_FBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, l_RBO[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, l_RBO[1]);
+	glViewport(0, 0, batchWidth, batchHeight);
+
+	glGenBuffers(2, l_PBO);
+	for (int i = 0; i < 2; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, l_PBO[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, batchWidth * batchHeight * 4, NULL, GL_STREAM_READ);
+	}
+
+	for (int i = first; ; i += stride)
+	{
+		if (i < (int)poses->size())
+		{
+			const structPose &l_pose = (*poses)[i];
+			mat4 l_PV = perspective(l_pose.fov, (float)batchWidth / batchHeight, 0.00001f, 1000.0f) * lookAt(l_pose.location, l_pose.pointOfInterest, l_pose.up);
+			if (renderBackend == backendSoftware)
+			{
+				// The software frame is already in memory (bottom-up RGBA, as glReadPixels
+				// returns it); no FBO or PBO round trip.
+				lock_guard<mutex> l_lock(swFrameLock);
+				swBeginFrame();
+				drawProps(l_PV);
+				swRasterFrame();
+				batchQueueImage(i, &swFrame.color[0]);
+			}
+			else
+			{
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				drawProps(l_PV);
+
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, l_PBO[l_slot]);
+				glReadPixels(0, 0, batchWidth, batchHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+				l_fence[l_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				l_pending[l_slot] = i;
+			}
+		}
+
+		// Collect the readback issued one pose ago while this one renders.
+		int l_other = 1 - l_slot;
+		if (l_pending[l_other] >= 0)
+		{
+			glClientWaitSync(l_fence[l_other], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(l_fence[l_other]);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, l_PBO[l_other]);
+			void *l_pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, batchWidth * batchHeight * 4, GL_MAP_READ_BIT);
+			if (l_pixels) batchQueueImage(l_pending[l_other], l_pixels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			l_pending[l_other] = -1;
+		}
+		else if (i >= (int)poses->size())
+			break;
+		l_slot = l_other;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteBuffers(2, l_PBO);
+	glDeleteFramebuffers(1, &l_FBO);
+	glDeleteRenderbuffers(2, l_RBO);
+	glFinish();
+	glfwMakeContextCurrent(NULL);
+}
+
+// Returns images/sec. contexts[0] is the main window's context.
+double runBatch(const vector<structPose> &poses, GLFWwindow **contexts, int numThreads)
+{
+	batchQueue.finished = false;
+	vector<thread> l_writers, l_renderers;
+	for (int i = 0; i < numThreads + 1; i++) { l_writers.push_back(thread(batchWriter)); }
+
+	glfwMakeContextCurrent(NULL);
+	chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+	for (int t = 0; t < numThreads; t++) { l_renderers.push_back(thread(batchRenderThread, contexts[t], t, &poses, t, numThreads)); }
+	for (int t = 0; t < numThreads; t++) { l_renderers[t].join(); }
+	{
+		lock_guard<mutex> l_lock(batchQueue.lock);
+		batchQueue.finished = true;
+	}
+	batchQueue.ready.notify_all();
+	for (size_t i = 0; i < l_writers.size(); i++) { l_writers[i].join(); }
+	double l_seconds = elapsedMs(l_start) / 1000.0;
+
+	glfwMakeContextCurrent(contexts[0]);
+	renderContext = 0;
+	return poses.size() / l_seconds;
+}
+
+int batchMain(GLFWwindow *window, const char *poseFile, int numThreads, bool scaling)
+{
+	vector<structPose> l_poses;
+	if (!loadPoses(poseFile, l_poses)) return 1;
+	numThreads = glm::clamp(numThreads, 1, maxContexts);
+
+	// Extra contexts share buffers and textures with the main one; programs
+	// and VAOs are created per context on first use.
+	GLFWwindow *l_contexts[maxContexts] = { window };
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	for (int t = 1; t < numThreads; t++)
+	{
+		l_contexts[t] = glfwCreateWindow(1, 1, "batch", NULL, window);
+		if (!l_contexts[t])
+		{
+			fprintf(stderr, "could only create %d render contexts\n", t);
+			numThreads = t;
+			break;
+		}
+	}
+
+	printf("Batch: %d poses, %dx%d, output to %s\n", (int)l_poses.size(), batchWidth, batchHeight, batchOutDir.c_str());
+	printf("threads | images/s | speedup\n");
+	double l_base = 0.0;
+	for (int n = scaling ? 1 : numThreads; ; n = std::min(n * 2, numThreads))
+	{
+		double l_rate = runBatch(l_poses, l_contexts, n);
+		if (l_base == 0.0) l_base = l_rate;
+		printf("%7d | %8.2f | %6.2fx\n", n, l_rate, l_rate / l_base);
+		if (n == numThreads) break;
+	}
+
+	for (int t = 1; t < numThreads; t++) { glfwDestroyWindow(l_contexts[t]); }
+	return 0;
+}
+
+//--------------------------REGRESSION-BENCH----------------------------
+// Renders each path (gouraud, phong, culled, batched, gpu, occlusion) along fixed camera
+// paths over the current scene (the campus, or --city), times every frame
+// to glFinish() and writes one JSON record per path/camera with frame time
+// percentiles. Given a baseline file from an earlier run, any p50/p95 more
+// than tolerance percent slower is flagged and the exit code is 3; so is any
+// p95 over the budget.
+enum { benchGouraud = 0, benchPhong = 1, benchCulled = 2, benchBatched = 3, benchGpuCulled = 4, benchOcclusion = 5, numBenchPaths = 6 };
+enum { benchOrbit = 0, benchFlyover = 1, benchStreet = 2, numBenchCameras = 3 };
+const char *benchPathNames[numBenchPaths] = { "gouraud", "phong", "culled", "batched", "gpu", "occlusion" };
+const char *benchCameraNames[numBenchCameras] = { "orbit", "flyover", "street" };
+
+struct structBenchResult
+{
+	string path, camera;
+	int frames;
+	float meanMs, p50Ms, p90Ms, p95Ms, p99Ms, maxMs, cpuMs, propsDrawn, propsOccluded, queries;
+	double triangles;
+};
+
+struct structBench { int frames, warmup; string outPath, baselinePath, paths; float tolerance, budgetMs; };
+structBench bench = { 0, 10, "bench.json", "", "", 10.0f, 0.0f };
+
+void benchCamera(int camera, float t, vec3 l_min, vec3 l_max, vec3 &location, vec3 &poi)
+{
+	vec3 l_center = (l_min + l_max) * 0.5f;
+	float l_size = std::max(l_max.x - l_min.x, l_max.y - l_min.y);
+	float l_a = t * 2.0f * 3.14159265f;
+
+	if (camera == benchOrbit)
+	{
+		location = l_center + vec3(cos(l_a) * l_size * 0.75f, sin(l_a) * l_size * 0.75f, l_size * 0.4f);
+		poi = l_center;
+	}
+	else if (camera == benchFlyover)
+	{
+		location = vec3(mix(l_min.x, l_max.x, t), mix(l_min.y, l_max.y, t), l_size * 0.08f);
+		poi = location + vec3(l_size * 0.1f, l_size * 0.1f, -l_size * 0.05f);
+	}
+	else
+	{
+		// Down the middle of a street, just above the rooftops' lower range.
+		float l_street = l_center.y + ((city.buildings > 0) ? city.spacing * 0.5f : 0.0f);
+		location = vec3(mix(l_min.x, l_max.x, t), l_street, 0.03f);
+		poi = location + vec3(0.5f, 0.0f, -0.005f);
+	}
+}
+
+void setBenchPath(int path)
+{
+	phong       = (path != benchGouraud);
+	cullProps   = (path == benchCulled || path == benchBatched || path == benchOcclusion);
+	drawBatched = (path == benchBatched);
+	gpuCullProps = (path == benchGpuCulled);
+	occlusionCull = (path == benchOcclusion);
+}
+
+// World bounds of everything but the ground and outlines.
+void sceneBounds(vec3 &l_min, vec3 &l_max)
+{
+	l_min = vec3(1e30f);
+	l_max = vec3(-1e30f);
+	for (size_t i = 0; i < sceneProps.size(); i++)
+	{
+		if (sceneProps[i] == &ground || sceneProps[i]->outline) continue;
+		l_min = glm::min(l_min, sceneProps[i]->boundsMin);
+		l_max = glm::max(l_max, sceneProps[i]->boundsMax);
+	}
+}
+
+// Flies each bench camera over the scene in turn: two warm-up frames and
+// then frames steps along its path, setting View and PV and calling
+// frame(f) for every step (f < 0 while warming up).
+template <class F> void benchFlyCameras(int frames, F frame)
+{
+	vec3 l_min, l_max;
+	sceneBounds(l_min, l_max);
+	for (int l_camera = 0; l_camera < numBenchCameras; l_camera++)
+	{
+		for (int f = -2; f < frames; f++)
+		{
+			benchCamera(l_camera, (float)std::max(f, 0) / frames, l_min, l_max, cameraLocation, pointOfInterest);
+			View = lookAt(cameraLocation, pointOfInterest, vec3(0.0f, 0.0f, 1.0f));
+			PV = Projection * View;
+			frame(f);
+		}
+	}
+}
 
-		124, 125, 162,      162, 163, 124,
-		125, 126, 162,      126, 160, 162,      160, 161, 162,
-		126, 127, 128,      126, 128, 159,      159, 160, 126,
-		128, 129, 158,      158, 159, 128,
-		129, 130, 157,      157, 158, 129,
-		130, 131, 156,      156, 157, 130,
-		131, 132, 155,      155, 156, 131,
-		132, 133, 134,      132, 134, 153,
-		132, 153, 155,      153, 154, 155,
-		134, 135, 153,      135, 152, 153,      135, 144, 152,
-		135, 136, 144,      136, 143, 144,
-		136, 137, 143,      142, 143, 137,
-		137, 138, 142,      141, 142, 138,
-		138, 139, 141,      140, 141, 139,
-		144, 145, 152,      145, 146, 152,      146, 149, 152,
-		146, 147, 148,      148, 149, 146,
-		149, 150, 151,      149, 151, 152
-	};
+// Error of an RGBA frame read back against a reference frame: mean absolute
+// difference per channel (/255) and the share of pixels, in percent, off by
+// more than 8/255 in any channel.
+void benchImageError(const vector<unsigned char> &image, const vector<unsigned char> &reference, double &meanError, double &offPercent)
+{
+	long long l_sum = 0, l_count = 0;
+	for (size_t i = 0; i < image.size(); i += 4)
+	{
+		int l_worst = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			int d = abs((int)image[i + k] - (int)reference[i + k]);
+			l_sum += d;
+			l_worst = std::max(l_worst, d);
+		}
+		l_count += l_worst > 8;
+	}
+	meanError = (double)l_sum / (image.size() / 4 * 3);
+	offPercent = 100.0 * l_count / (image.size() / 4);
+}
 
-	const int ecdcANumVertices = sizeof(ecdcAVIndex) / sizeof(int);
-	for (int i = 0; i < ecdcANumVertices; i++) { ecdcA.vertex[i] = (ecdcAVertex[ecdcAVIndex[i]]/9.25f) + vec3(0.175f, 0.06f, 0.0f); }
+structBenchResult benchRun(int path, int camera)
+{
+	vec3 l_min, l_max;
+	sceneBounds(l_min, l_max);
 
-	const int ecdcANumIndices = sizeof(ecdcAIndex) / sizeof(int);
-	for (int i = 0; i < ecdcANumIndices; i++) { ecdcA.index[i] = ecdcAIndex[i]; }
+	setBenchPath(path);
+	vector<float> l_ms;
+	double l_props = 0.0, l_tris = 0.0, l_cpuMs = 0.0, l_occluded = 0.0, l_queries = 0.0;
+	for (int f = -bench.warmup; f < bench.frames; f++)
+	{
+		benchCamera(camera, (float)std::max(f, 0) / bench.frames, l_min, l_max, cameraLocation, pointOfInterest);
+		View = lookAt(cameraLocation, pointOfInterest, vec3(0.0f, 0.0f, 1.0f));
+		PV = Projection * View;
+
+		chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+		drawScene();
+		double l_submitMs = elapsedMs(l_start);
+		glFinish();
+		if (f < 0) continue;
+		l_ms.push_back((float)elapsedMs(l_start));
+		l_cpuMs += l_submitMs;
+		if (path == benchGpuCulled && gpuCullProps)
+		{
+			long long l_gpuTris;
+			l_props += gpuCullCount(l_gpuTris) + sceneStats.propsDrawn - gpuCull.numProps;
+			l_tris  += (double)(l_gpuTris + sceneStats.triangles);
+			continue;
+		}
+		l_props += sceneStats.propsDrawn;
+		l_tris  += (double)sceneStats.triangles;
+		if (occlusionCull)
+		{
+			l_occluded += sceneStats.propsOccluded;
+			l_queries  += occlusion.queries;
+		}
+	}
 
-	ecdcA.init(ecdcANumVertices, ecdcANumIndices, vec3(0.1, 0.1, 0.5), ((vec3(1.083f, 0.862f, 0.0f)/9.25f)+ vec3(0.175f, 0.06f, 0.0f)), mat4(1.0f), copper, false);
+	structBenchResult r;
+	r.path = benchPathNames[path];
+	r.camera = benchCameraNames[camera];
+	r.frames = bench.frames;
+	double l_sum = 0.0;
+	for (size_t i = 0; i < l_ms.size(); i++) { l_sum += l_ms[i]; }
+	r.meanMs = (float)(l_sum / l_ms.size());
+	r.p50Ms = percentile(l_ms, 50.0f);
+	r.p90Ms = percentile(l_ms, 90.0f);
+	r.p95Ms = percentile(l_ms, 95.0f);
+	r.p99Ms = percentile(l_ms, 99.0f);
+	r.maxMs = percentile(l_ms, 100.0f);
+	r.cpuMs = (float)(l_cpuMs / bench.frames);
+	r.propsDrawn = (float)(l_props / bench.frames);
+	r.propsOccluded = (float)(l_occluded / bench.frames);
+	r.queries = (float)(l_queries / bench.frames);
+	r.triangles = l_tris / bench.frames;
+	return r;
+}
 
-	//------------------------------ECDC-B---------------------------------
-	vec3 ecdcBVertex[] =
+bool writeBenchJSON(const vector<structBenchResult> &results)
+{
+	FILE *f = fopen(bench.outPath.c_str(), "w");
+	if (!f) { fprintf(stderr, "could not write %s\n", bench.outPath.c_str()); return false; }
+	fprintf(f, "{\n  \"renderer\": \"%s\",\n", glGetString(GL_RENDERER));
+	fprintf(f, "  \"scene\": { \"buildings\": %d, \"footprint\": %d, \"lights\": %d, \"seed\": %u, \"props\": %d },\n",
+		city.buildings, city.footprint, numLights, city.seed, (int)sceneProps.size());
+	fprintf(f, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
 	{
-		vec3(0.585f, 0.551f, 0.0f),			vec3(0.624f, 0.561f, 0.0f),
-		vec3(0.660f, 0.593f, 0.0f),			vec3(0.685f, 0.639f, 0.0f),
-		vec3(0.698f, 0.638f, 0.0f),			vec3(0.714f, 0.697f, 0.0f),
-		vec3(0.693f, 0.701f, 0.0f),			vec3(0.698f, 0.726f, 0.0f),
-		vec3(0.677f, 0.730f, 0.0f),			vec3(0.647f, 0.778f, 0.0f),
-		vec3(0.596f, 0.807f, 0.0f),			vec3(0.590f, 0.794f, 0.0f),
-		vec3(0.569f, 0.807f, 0.0f),			vec3(0.507f, 0.786f, 0.0f),
-		vec3(0.462f, 0.751f, 0.0f),			vec3(0.440f, 0.697f, 0.0f),
-		vec3(0.446f, 0.638f, 0.0f),			vec3(0.478f, 0.594f, 0.0f),
-		vec3(0.528f, 0.568f, 0.0f),			vec3(0.585f, 0.570f, 0.0f),
-		vec3(0.585f, 0.551f, 0.216f),		vec3(0.624f, 0.561f, 0.216f),
-		vec3(0.660f, 0.593f, 0.216f),		vec3(0.685f, 0.639f, 0.216f),
-		vec3(0.698f, 0.638f, 0.216f),		vec3(0.714f, 0.697f, 0.216f),
-		vec3(0.693f, 0.701f, 0.216f),		vec3(0.698f, 0.726f, 0.216f),
-		vec3(0.677f, 0.730f, 0.216f),		vec3(0.647f, 0.778f, 0.216f),
-		vec3(0.596f, 0.807f, 0.216f),		vec3(0.590f, 0.794f, 0.216f),
-		vec3(0.569f, 0.807f, 0.216f),		vec3(0.507f, 0.786f, 0.216f),
-		vec3(0.462f, 0.751f, 0.216f),		vec3(0.440f, 0.697f, 0.216f),
-		vec3(0.446f, 0.638f, 0.216f),		vec3(0.478f, 0.594f, 0.216f),
-		vec3(0.528f, 0.568f, 0.216f),		vec3(0.585f, 0.570f, 0.216f)
-	};
+		const structBenchResult &r = results[i];
+		fprintf(f, "    { \"path\": \"%s\", \"camera\": \"%s\", \"frames\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"cpu_ms\": %.4f, \"props_drawn\": %.1f, \"props_occluded\": %.1f, \"queries\": %.1f, \"triangles\": %.0f }%s\n",
+			r.path.c_str(), r.camera.c_str(), r.frames, r.meanMs, r.p50Ms, r.p90Ms, r.p95Ms, r.p99Ms, r.maxMs, r.cpuMs, r.propsDrawn, r.propsOccluded, r.queries, r.triangles, (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+	return true;
+}
 
-	int ecdcBVIndex[] = 
+// Only reads back what writeBenchJSON() writes: one result object per line.
+bool benchField(const char *line, const char *key, string &value)
+{
+	string l_key = string("\"") + key + "\": \"";
+	const char *l_p = strstr(line, l_key.c_str());
+	if (!l_p) return false;
+	l_p += l_key.size();
+	const char *l_end = strchr(l_p, '"');
+	if (!l_end) return false;
+	value.assign(l_p, l_end);
+	return true;
+}
+
+bool benchField(const char *line, const char *key, float &value)
+{
+	string l_key = string("\"") + key + "\": ";
+	const char *l_p = strstr(line, l_key.c_str());
+	if (!l_p) return false;
+	value = (float)atof(l_p + l_key.size());
+	return true;
+}
+
+bool loadBenchBaseline(vector<structBenchResult> &results)
+{
+	FILE *f = fopen(bench.baselinePath.c_str(), "r");
+	if (!f) { fprintf(stderr, "could not read baseline %s\n", bench.baselinePath.c_str()); return false; }
+	char l_line[1024];
+	while (fgets(l_line, sizeof(l_line), f))
 	{
-		 0,  1,  2,  3, 20, 21, 22, 23, // 0 - 3,4 - 7
-		 3,  4, 23, 24, //  8 - 11
-		 4,  5, 24, 25, // 12 - 15
-		 5,  6, 25, 26, // 16 - 19
-		 6,  7, 26, 27, // 20 - 23
-		 7,  8, 27, 28, // 24 - 27
-		 8,  9, 10, 28, 29, 30, // 28 - 30,31 - 33
-		10, 11, 30, 31, // 34 - 37
-		11, 12, 31, 32, // 38 - 41
-		12, 13, 14, 15, 16, 17, 18, 19, 32, 33, 34, 35, 36, 37, 38, 39, // 42 - 49,50 - 57
-		19,  0, 39, 20, // 58 - 61
+		structBenchResult r;
+		if (benchField(l_line, "path", r.path) && benchField(l_line, "camera", r.camera) &&
+		    benchField(l_line, "p50_ms", r.p50Ms) && benchField(l_line, "p95_ms", r.p95Ms))
+			results.push_back(r);
+	}
+	fclose(f);
+	return true;
+}
 
-		20, 21, 22, 23, 24, 25, 26, 27, 28, 29, // 62 - 71
-		30, 31, 32, 33, 34, 35, 36, 37, 38, 39  // 72 - 81
-	};
+int benchMain()
+{
+	vector<structBenchResult> l_results, l_baseline;
+	if (!bench.baselinePath.empty() && !loadBenchBaseline(l_baseline)) return 1;
 
-	int ecdcBIndex[] = 
+	printf("Bench: %d props, %d lights, %d frames per run\n", (int)sceneProps.size(), numLights, bench.frames);
+	printf("path      | camera  |  mean ms |   p50 ms |   p95 ms |   p99 ms |   cpu ms |  props |     tris | vs baseline\n");
+	int l_regressions = 0;
+	for (int l_path = 0; l_path < numBenchPaths; l_path++)
 	{
-		 0,  1,  5,       5,  4,  0,
-		 1,  2,  6,       6,  5,  1,
-		 2,  3,  7,       7,  6,  2, //  0 -  3,4 - 7
-		 8,  9, 10,      11, 10,  9, //  8 - 11
-		12, 13, 14,      15, 14, 13, // 12 - 15
-		16, 17, 18,      19, 18, 17, // 16 - 19
-		20, 21, 22,      23, 22, 21, // 20 - 23
-		24, 25, 26,      27, 26, 25, // 24 - 27
-		28, 29, 32,      32, 31, 28,
-		29, 30, 33,      33, 32, 29, // 28 - 30,31 - 33
-		34, 35, 36,      37, 36, 35, // 34 - 37
-		38, 39, 40,      41, 40, 39, // 38 - 41
-		42, 43, 51,      51, 50, 42,
-		43, 44, 52,      52, 51, 43,
-		44, 45, 53,      53, 52, 44,
-		45, 46, 54,      54, 53, 45,
-		46, 47, 55,      55, 54, 46,
-		47, 48, 56,      56, 55, 47,
-		48, 49, 57,      57, 56, 48, // 42 - 49,50 - 57
-		58, 59, 60,      61, 60, 59, // 58 - 61
+		if (!bench.paths.empty() && ("," + bench.paths + ",").find(string(",") + benchPathNames[l_path] + ",") == string::npos) continue;
+		for (int l_camera = 0; l_camera < numBenchCameras; l_camera++)
+		{
+			structBenchResult r = benchRun(l_path, l_camera);
+			l_results.push_back(r);
 
-		62, 63, 81,      63, 64, 81,      64, 65, 81,
-		65, 79, 81,      79, 80, 81,
-		65, 77, 79,      77, 78, 79,
-		65, 66, 68,      66, 67, 68,
-		65, 70, 77,      65, 68, 70,      68, 69, 70,
-		70, 71, 73,      71, 72, 73,
-		70, 73, 75,      73, 74, 75,
-		70, 75, 77,      75, 76, 77
-	};
+			string l_verdict = "-";
+			for (size_t b = 0; b < l_baseline.size(); b++)
+			{
+				if (l_baseline[b].path != r.path || l_baseline[b].camera != r.camera) continue;
+				float l_limit = 1.0f + bench.tolerance / 100.0f;
+				char l_text[64];
+				sprintf(l_text, "p50 %+.1f%% p95 %+.1f%%", 100.0f * (r.p50Ms / l_baseline[b].p50Ms - 1.0f), 100.0f * (r.p95Ms / l_baseline[b].p95Ms - 1.0f));
+				l_verdict = l_text;
+				if (r.p50Ms > l_baseline[b].p50Ms * l_limit || r.p95Ms > l_baseline[b].p95Ms * l_limit) { l_verdict += " REGRESSION"; l_regressions++; }
+			}
+			if (bench.budgetMs > 0.0f && r.p95Ms > bench.budgetMs) { l_verdict += " OVER BUDGET"; l_regressions++; }
 
-	const int ecdcBNumVertices = sizeof(ecdcBVIndex) / sizeof(int);
-	for (int i = 0; i < ecdcBNumVertices; i++) { ecdcB.vertex[i] = (ecdcBVertex[ecdcBVIndex[i]] / 9.25f) + vec3(0.175f, 0.06f, 0.0f); }
+			printf("%-9s | %-7s | %8.3f | %8.3f | %8.3f | %8.3f | %8.3f | %6.0f | %8.0f | %s\n", r.path.c_str(), r.camera.c_str(),
+				r.meanMs, r.p50Ms, r.p95Ms, r.p99Ms, r.cpuMs, r.propsDrawn, r.triangles, l_verdict.c_str());
+		}
+	}
+	setBenchPath(benchPhong);
 
-	const int ecdcBNumIndices = sizeof(ecdcBIndex) / sizeof(int);
-	for (int i = 0; i < ecdcBNumIndices; i++) { ecdcB.index[i] = ecdcBIndex[i]; }
+	// Occlusion culling against plain frustum culling on the same camera; the
+	// occlusion frame times already include issuing the queries.
+	for (size_t i = 0; i < l_results.size(); i++)
+	{
+		if (l_results[i].path != benchPathNames[benchOcclusion]) continue;
+		for (size_t j = 0; j < l_results.size(); j++)
+		{
+			if (l_results[j].path != benchPathNames[benchCulled] || l_results[j].camera != l_results[i].camera) continue;
+			const structBenchResult &o = l_results[i], &c = l_results[j];
+			printf("occlusion %-7s: %.0f of %.0f props occluded per frame, %.0f queries, saved %.3f ms/frame (%+.1f%%)\n", o.camera.c_str(),
+				o.propsOccluded, o.propsDrawn + o.propsOccluded, o.queries, c.meanMs - o.meanMs, 100.0f * (o.meanMs / c.meanMs - 1.0f));
+		}
+	}
 
-	ecdcB.init(ecdcBNumVertices, ecdcBNumIndices, vec3(0.1, 0.5, 0.1), ((vec3(0.595f, 0.681f, 0.0f) / 9.25f) + vec3(0.175f, 0.06f, 0.0f)), mat4(1.0f), silver, false);
+	if (!writeBenchJSON(l_results)) return 1;
+	printf("Wrote %s\n", bench.outPath.c_str());
+	if (l_regressions) printf("%d regression(s)\n", l_regressions);
+	return l_regressions ? 3 : 0;
+}
 
-	//-----------------------------BAY-HALL--------------------------------
-	vec3 bayhallVertex[] =
+//-------------------------------CAPTURE--------------------------------
+// Asynchronous frame capture. Every frame is read into the next PBO of a
+// ring with a fence behind it, and a PBO is only mapped when the ring comes
+// back around to it ringSize frames later, by which time the copy has
+// normally landed, so the render thread does not wait for the GPU. Mapped
+// frames are copied into recycled buffers and handed to a writer thread
+// that writes a PNG sequence (--capture-dir) and/or a 4:2:0 Y4M stream
+// (--capture-y4m, e.g. for ffmpeg -i capture.y4m out.mp4).
+const int captureMaxRing = 8;
+
+struct structCaptureFrame { int index; vector<unsigned char> rgba; };
+
+struct structCapture
+{
+	string dir, y4mPath;
+	int ringSize, maxQueued, fps, width, height;
+	GLuint PBO[captureMaxRing];
+	GLsync fence[captureMaxRing];
+	int pending[captureMaxRing], slot, frame;
+	FILE *y4m;
+	bool active, finished;
+	int written, gpuWaits, queueWaits;
+	double renderMs, writeMs;
+	thread writer;
+	mutex lock;
+	condition_variable ready, drained;
+	deque<structCaptureFrame> queue;
+	vector<vector<unsigned char> > freeBuffers;
+};
+structCapture capture = { "", "", 3, 4, 60 };
+
+// BT.601 studio range, chroma averaged over 2x2 blocks; rgba is bottom-up.
+void rgbaToI420(const unsigned char *rgba, int width, int height, vector<unsigned char> &yuv)
+{
+	int l_cw = (width + 1) / 2, l_ch = (height + 1) / 2;
+	yuv.resize(width * height + 2 * l_cw * l_ch);
+	unsigned char *l_y = &yuv[0], *l_u = l_y + width * height, *l_v = l_u + l_cw * l_ch;
+
+	for (int y = 0; y < height; y++)
 	{
-		vec3(-1.499f, -1.166f, 0.0f),		vec3(-0.888f, -1.429f, 0.0f),
-		vec3(-0.755f, -1.121f, 0.0f),		vec3(-1.356f, -0.855f, 0.0f),
-		vec3(-1.499f, -1.166f, 0.153f),		vec3(-0.888f, -1.429f, 0.153f),
-		vec3(-0.876f, -1.402f, 0.153f),		vec3(-1.485f, -1.137f, 0.153f),
-		vec3(-1.485f, -1.137f, 0.291f),		vec3(-0.876f, -1.402f, 0.291f),
-		vec3(-0.755f, -1.121f, 0.291f),		vec3(-1.356f, -0.855f, 0.291f),
-		vec3(-1.391f, -0.974f, 0.291f),		vec3(-1.350f, -0.992f, 0.291f),
-		vec3(-1.381f, -1.059f, 0.291f),		vec3(-1.216f, -1.132f, 0.291f),
-		vec3(-1.170f, -1.031f, 0.291f),		vec3(-1.286f, -0.975f, 0.291f),
-		vec3(-1.272f, -0.944f, 0.291f),		vec3(-1.360f, -0.906f, 0.291f),
-		vec3(-1.391f, -0.974f, 0.347f),		vec3(-1.350f, -0.992f, 0.347f),
-		vec3(-1.381f, -1.059f, 0.347f),		vec3(-1.216f, -1.132f, 0.347f),
-		vec3(-1.170f, -1.031f, 0.347f),		vec3(-1.286f, -0.975f, 0.347f),
-		vec3(-1.272f, -0.944f, 0.347f),		vec3(-1.360f, -0.906f, 0.347f),
-		vec3(-1.103f, -1.157f, 0.291f),		vec3(-0.905f, -1.244f, 0.291f),
-		vec3(-0.860f, -1.142f, 0.291f),		vec3(-1.058f, -1.055f, 0.291f),
-		vec3(-1.103f, -1.157f, 0.347f),		vec3(-0.905f, -1.244f, 0.347f),
-		vec3(-0.860f, -1.142f, 0.347f),		vec3(-1.058f, -1.055f, 0.347f),
-		vec3(-0.985f, -1.169f, 0.347f),		vec3(-0.919f, -1.198f, 0.347f),
-		vec3(-0.901f, -1.157f, 0.347f),		vec3(-0.967f, -1.128f, 0.347f),
-		vec3(-0.985f, -1.169f, 0.291f),		vec3(-0.919f, -1.198f, 0.291f),
-		vec3(-0.901f, -1.157f, 0.291f),		vec3(-0.967f, -1.128f, 0.291f)
-	};
+		const unsigned char *l_src = rgba + (height - 1 - y) * width * 4;
+		for (int x = 0; x < width; x++, l_src += 4) { l_y[y * width + x] = (unsigned char)(((66 * l_src[0] + 129 * l_src[1] + 25 * l_src[2] + 128) >> 8) + 16); }
+	}
+	for (int cy = 0; cy < l_ch; cy++)
+	{
+		const unsigned char *l_row0 = rgba + (height - 1 - 2 * cy) * width * 4;
+		const unsigned char *l_row1 = rgba + (height - 1 - std::min(2 * cy + 1, height - 1)) * width * 4;
+		for (int cx = 0; cx < l_cw; cx++)
+		{
+			int l_x0 = 2 * cx * 4, l_x1 = std::min(2 * cx + 1, width - 1) * 4;
+			int l_r = (l_row0[l_x0]     + l_row0[l_x1]     + l_row1[l_x0]     + l_row1[l_x1]     + 2) >> 2;
+			int l_g = (l_row0[l_x0 + 1] + l_row0[l_x1 + 1] + l_row1[l_x0 + 1] + l_row1[l_x1 + 1] + 2) >> 2;
+			int l_b = (l_row0[l_x0 + 2] + l_row0[l_x1 + 2] + l_row1[l_x0 + 2] + l_row1[l_x1 + 2] + 2) >> 2;
+			l_u[cy * l_cw + cx] = (unsigned char)(((-38 * l_r -  74 * l_g + 112 * l_b + 128) >> 8) + 128);
+			l_v[cy * l_cw + cx] = (unsigned char)(((112 * l_r -  94 * l_g -  18 * l_b + 128) >> 8) + 128);
+		}
+	}
+}
 
-	int bayhallVIndex[] =
+void captureWriter()
+{
+	vector<unsigned char> l_yuv;
+	while (true)
 	{
-		 0,  1,  4,  5, //  0 -  3
-		 4,  5,  7,  6, //  4 -  7
-		 7,  6,  8,  9, //  8 - 11
-		 2,  3, 10, 11, // 12 - 15
-		 1,  2, 10,  9, 6,  5, // 16 - 21
-		 3,  0,  4,  7, 8, 11, // 22 - 27
-		 8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 28, 29, 30, 31, // 28 - 43
-		12, 13, 20, 21, // 44 - 47
-		13, 14, 21, 22, // 48 - 51
-		14, 15, 22, 23, // 52 - 55
-		15, 16, 23, 24, // 56 - 59
-		16, 17, 24, 25, // 60 - 63
-		17, 18, 25, 26, // 64 - 67
-		18, 19, 26, 27, // 68 - 71
-		19, 12, 27, 20, // 72 - 75
-		28, 29, 32, 33, // 76 - 79
-		29, 30, 33, 34, // 80 - 83
-		30, 31, 34, 35, // 84 - 87
-		31, 28, 35, 32, // 88 - 91
-		20, 21, 22, 23, 24, 25, 26, 27, //  92 -  99
-		32, 33, 34, 35, 36, 37, 38, 39, // 100 - 107
-		41, 40, 37, 36, // 108 - 111
-		42, 41, 38, 37, // 112 - 115
-		43, 42, 39, 38, // 116 - 119
-		40, 43, 36, 39, // 120 - 123
-		40, 41, 43, 42  // 124 - 127
-	};
+		structCaptureFrame l_frame;
+		{
+			unique_lock<mutex> l_lock(capture.lock);
+			capture.ready.wait(l_lock, [] { return capture.finished || !capture.queue.empty(); });
+			if (capture.queue.empty()) return;
+			l_frame = move(capture.queue.front());
+			capture.queue.pop_front();
+			capture.drained.notify_one();
+		}
+
+		chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+		if (!capture.dir.empty())
+		{
+			char l_path[1024];
+			snprintf(l_path, sizeof(l_path), "%s/frame_%05d.png", capture.dir.c_str(), l_frame.index);
+			writePNG(l_path, capture.width, capture.height, &l_frame.rgba[0]);
+		}
+		if (capture.y4m)
+		{
+			rgbaToI420(&l_frame.rgba[0], capture.width, capture.height, l_yuv);
+			fputs("FRAME\n", capture.y4m);
+			fwrite(&l_yuv[0], 1, l_yuv.size(), capture.y4m);
+		}
+		double l_ms = elapsedMs(l_start);
+
+		lock_guard<mutex> l_lock(capture.lock);
+		capture.freeBuffers.push_back(move(l_frame.rgba));
+		capture.written++;
+		capture.writeMs += l_ms;
+	}
+}
 
-	int bayhallIndex[] =
+bool captureBegin(int width, int height)
+{
+	if (capture.dir.empty() && capture.y4mPath.empty()) return false;
+	capture.width = width;
+	capture.height = height;
+	capture.ringSize = glm::clamp(capture.ringSize, 2, captureMaxRing);
+	capture.y4m = NULL;
+	if (!capture.y4mPath.empty())
 	{
-		  0,   1,   2,     3,   2,   1, //   0 -   3
-		  4,   5,   6,     7,   6,   5, //   4 -   7
-		  8,   9,  10,    11,  10,   9, //   8 -  11
-		 12,  13,  14,    15,  14,  13, //  12 -  15
-		 16,  17,  20,    16,  20,  21,
-		 17,  18,  20,    18,  19,  20, //  16 -  21
-		 22,  23,  25,    23,  24,  25,
-		 22,  25,  27,    25,  26,  27, //  22 -  27
-		 28,  29,  35,    29,  40,  35,
-		 28,  35,  34,    29,  41,  40,
-		 28,  34,  32,    29,  30,  41,
-		 28,  32,  31,    30,  42,  41,
-		 31,  32,  39,    30,  43,  42,
-		 31,  39,  38,    30,  31,  43,
-		 31,  38,  43,    32,  34,  33,
-		 35,  40,  36,    40,  43,  36,
-		 36,  43,  38,    36,  38,  37, //  28 -  43
-		 44,  45,  46,    47,  46,  45, //  44 -  47
-		 48,  49,  50,    51,  50,  49, //  48 -  51
-		 52,  53,  54,    55,  54,  53, //  52 -  55
-		 56,  57,  58,    59,  58,  57, //  56 -  59
-		 60,  61,  62,    63,  62,  61, //  60 -  63
-		 64,  65,  66,    67,  66,  65, //  64 -  67
-		 68,  69,  70,    71,  70,  69, //  68 -  71
-		 72,  73,  74,    75,  74,  73, //  72 -  75
-		 76,  77,  78,    79,  78,  77, //  76 -  79
-		 80,  81,  82,    83,  82,  81, //  80 -  83
-		 84,  85,  86,    87,  86,  85, //  84 -  87
-		 88,  89,  90,    91,  90,  89, //  88 -  91
-		 92,  93,  99,    93,  98,  99,
-		 93,  97,  98,    93,  94,  97,
-		 94,  95,  97,    95,  96,  97, //  92 -  99
-		100, 101, 104,   101, 105, 104,
-		101, 102, 105,   102, 106, 105,
-		102, 107, 106,   102, 103, 107,
-		103, 104, 107,   100, 104, 103, // 100 - 107
-		108, 109, 110,   111, 110, 109, // 108 - 111
-		112, 113, 114,   115, 114, 113, // 112 - 115
-		116, 117, 118,   119, 118, 117, // 116 - 119
-		120, 121, 122,   123, 122, 121, // 120 - 123
-		124, 125, 126,   127, 126, 125  // 124 - 127
-	};
+		capture.y4m = fopen(capture.y4mPath.c_str(), "wb");
+		if (!capture.y4m) { fprintf(stderr, "could not write %s\n", capture.y4mPath.c_str()); return false; }
+		fprintf(capture.y4m, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, capture.fps);
+	}
+
+	glGenBuffers(capture.ringSize, capture.PBO);
+	for (int i = 0; i < capture.ringSize; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.PBO[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+		capture.pending[i] = -1;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	capture.slot = capture.frame = 0;
+	capture.written = capture.gpuWaits = capture.queueWaits = 0;
+	capture.renderMs = capture.writeMs = 0.0;
+	capture.finished = false;
+	capture.active = true;
+	capture.writer = thread(captureWriter);
+	return true;
+}
+
+// Maps the PBO in slot s and queues its frame for the writer.
+void captureCollect(int s)
+{
+	if (capture.pending[s] < 0) return;
+	if (glClientWaitSync(capture.fence[s], 0, 0) == GL_TIMEOUT_EXPIRED)
+	{
+		capture.gpuWaits++;
+		glClientWaitSync(capture.fence[s], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+	}
+	glDeleteSync(capture.fence[s]);
 
-	const int bayhallNumVertices = sizeof(bayhallVIndex) / sizeof(int);
-	for (int i = 0; i < bayhallNumVertices; i++) { bayhall.vertex[i] = (bayhallVertex[bayhallVIndex[i]] / 9.25f) + vec3(0.175f, 0.06f, 0.0f); }
+	structCaptureFrame l_frame;
+	l_frame.index = capture.pending[s];
+	{
+		// Back-pressure: past maxQueued frames the writer sets the pace.
+		unique_lock<mutex> l_lock(capture.lock);
+		if ((int)capture.queue.size() >= capture.maxQueued) capture.queueWaits++;
+		capture.drained.wait(l_lock, [] { return (int)capture.queue.size() < capture.maxQueued; });
+		if (!capture.freeBuffers.empty())
+		{
+			l_frame.rgba = move(capture.freeBuffers.back());
+			capture.freeBuffers.pop_back();
+		}
+	}
+	size_t l_size = capture.width * capture.height * 4;
+	l_frame.rgba.resize(l_size);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.PBO[s]);
+	void *l_pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, l_size, GL_MAP_READ_BIT);
+	if (l_pixels) memcpy(&l_frame.rgba[0], l_pixels, l_size);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capture.pending[s] = -1;
+
+	lock_guard<mutex> l_lock(capture.lock);
+	capture.queue.push_back(move(l_frame));
+	capture.ready.notify_one();
+}
 
-	const int bayhallNumIndices = sizeof(bayhallIndex) / sizeof(int);
-	for (int i = 0; i < bayhallNumIndices; i++) { bayhall.index[i] = bayhallIndex[i]; }
+// Call with the finished frame in the read framebuffer, before swapping.
+void captureFrame()
+{
+	if (!capture.active) return;
+	chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+
+	int s = capture.slot;
+	captureCollect(s);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.PBO[s]);
+	glReadPixels(0, 0, capture.width, capture.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capture.fence[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	capture.pending[s] = capture.frame++;
+	capture.slot = (s + 1) % capture.ringSize;
+
+	capture.renderMs += elapsedMs(l_start);
+}
 
-	bayhall.init(bayhallNumVertices, bayhallNumIndices, vec3(0.1, 0.1, 0.5), ((vec3(-1.134f, -1.105f, 0.0f) / 9.25f) + vec3(0.175f, 0.06f, 0.0f)), mat4(1.0f), gold, false);
+void captureEnd()
+{
+	if (!capture.active) return;
+	for (int i = 0; i < capture.ringSize; i++) { captureCollect((capture.slot + i) % capture.ringSize); }
+	{
+		lock_guard<mutex> l_lock(capture.lock);
+		capture.finished = true;
+		capture.ready.notify_all();
+	}
+	capture.writer.join();
+	glDeleteBuffers(capture.ringSize, capture.PBO);
+	if (capture.y4m) fclose(capture.y4m);
+	capture.freeBuffers.clear();
+	capture.active = false;
+
+	printf("Capture: %d frames at %dx%d, render thread %.3f ms/frame, writer %.3f ms/frame, %d GPU waits, %d queue waits\n",
+		capture.written, capture.width, capture.height, capture.renderMs / std::max(capture.frame, 1), capture.writeMs / std::max(capture.written, 1),
+		capture.gpuWaits, capture.queueWaits);
+}
 
-	//------------------------------CAMERA---------------------------------
-	camPresetPos[0] = vec3(0.5f, 0.0f, 0.5f);
-	camPresetPos[1] = vec3(0.5f, 0.15f, 0.25f);
-	camPresetPos[2] = vec3(0.15f, 0.0f, 0.25f);
-	camPresetPos[3] = vec3(0.33f, -0.1f, 0.25f);
+// Orbits the scene offscreen at width x height three times: without
+// capture, with a synchronous glReadPixels each frame (the stall the ring
+// avoids), and with the capture pipeline, and reports the overhead of each.
+// Sustained fps for the capture run counts until the writer has finished.
+int captureBench(int frames, int width, int height)
+{
+	GLuint l_FBO, l_RBO[2];
+	glGenRenderbuffers(2, l_RBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, l_RBO[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, l_RBO[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glGenFramebuffers(1, &l_FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, l_FBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, l_RBO[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, l_RBO[1]);
+	glViewport(0, 0, width, height);
+
+	vec3 l_min, l_max;
+	sceneBounds(l_min, l_max);
+	Projection = perspective(5.0f, (float)width / height, 0.001f, 1000.0f);
+	if (capture.dir.empty() && capture.y4mPath.empty()) capture.y4mPath = "capture.y4m";
+
+	const char *l_names[3] = { "none", "sync", "async" };
+	double l_baseMs = 0.0;
+	vector<unsigned char> l_pixels(width * height * 4);
+	printf("Capture bench: %d frames at %dx%d, ring of %d PBOs\n", frames, width, height, capture.ringSize);
+	for (int f = 0; f < 5; f++) { drawScene(); }
+	glFinish();
+	for (int l_mode = 0; l_mode < 3; l_mode++)
+	{
+		if (l_mode == 2 && !captureBegin(width, height)) return 1;
+		chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+		for (int f = 0; f < frames; f++)
+		{
+			benchCamera(benchOrbit, (float)f / frames, l_min, l_max, cameraLocation, pointOfInterest);
+			View = lookAt(cameraLocation, pointOfInterest, vec3(0.0f, 0.0f, 1.0f));
+			PV = Projection * View;
+			drawScene();
+			if (l_mode == 1) glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &l_pixels[0]);
+			if (l_mode == 2) captureFrame();
+			glFlush();
+		}
+		glFinish();
+		double l_loopMs = elapsedMs(l_start);
+		if (l_mode == 2) captureEnd();
+		double l_totalMs = elapsedMs(l_start);
+		if (l_mode == 0) l_baseMs = l_loopMs;
+
+		printf("%-5s: %8.3f ms/frame render loop (%+.1f%%), %6.1f fps sustained\n", l_names[l_mode],
+			l_loopMs / frames, 100.0 * (l_loopMs / l_baseMs - 1.0), frames * 1000.0 / l_totalMs);
+	}
 
-	POIPresetPos[0] = island.center;
-	POIPresetPos[1] = ecdcA.center;
-	POIPresetPos[2] = bayhall.center;
-	POIPresetPos[3] = ecdcB.center;
-	
-	Projection = perspective(5.0f, 3.0f / 3.0f, 0.00001f, 1000.0f);
-	
-	pointOfInterest = island.center;
-	cameraLocation  = island.center + vec3(0.0f, 0.0f, 0.25f);
-	cameraUp = vec3(1.0f, 0.0f, 0.0f);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &l_FBO);
+	glDeleteRenderbuffers(2, l_RBO);
+	glViewport(0, 0, windowWidth, windowHeight);
+	return 0;
+}
 
-	//------------------------------LIGHTS---------------------------------
-	light[0].pos   = vec4(0.33f, 0.33f, 0.25f, 1.0f);
-	light[0].color = vec3(1.0f, 1.0f, 1.0f);
-	light[0].intensity = 5.0f;
+//----------------------------KERNEL-BENCH------------------------------
+// Throughput of each mesh kernel tier against the equivalent glm loops over
+// the AoS vec3 layout, on randomly generated vertices and triangles.
+template <class F> double mkBestMs(F f)
+{
+	double l_best = 1e30;
+	for (int r = 0; r < 3; r++)
+	{
+		chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+		f();
+		l_best = std::min(l_best, elapsedMs(l_start));
+	}
+	return l_best;
+}
 
-	light[1].pos   = vec4(0.5f, 0.5f,  0.5f, 0.0f);
-	light[1].color = vec3(1.0f, 1.0f, 1.0f);
-	light[1].intensity = 0.1f;
-	
-	phong = true;
+float mkMaxDiff(const vector<float> &a, const vector<float> &b)
+{
+	float l_diff = 0.0f;
+	for (size_t i = 0; i < a.size(); i++) { l_diff = fmaxf(l_diff, fabsf(a[i] - b[i])); }
+	return l_diff;
+}
 
-	glEnable(GL_DEPTH_TEST);
-	glClearColor(0.0, 0.0, 0.0, 1.0);
-	glDepthFunc(GL_LESS);
+void benchKernels(int millions)
+{
+	int n = millions * 1000000, l_numTris = n / 3;
+	unsigned int l_state = 12345;
+	vector<vec3> l_aos(n), l_aosOut(n), l_faceAoS(l_numTris);
+	vector<int> l_index(l_numTris * 3);
+	vector<unsigned short> l_q(3 * n);
+	for (int i = 0; i < n; i++) { l_aos[i] = vec3(cityRandf(l_state, -1.0f, 1.0f), cityRandf(l_state, -1.0f, 1.0f), cityRandf(l_state, 0.0f, 0.5f)); }
+	// Triangles reference nearby vertices, as in a mesh in vertex-cache order.
+	for (int i = 0; i < l_numTris * 3; i++) { l_index[i] = std::min(n - 1, i + (int)(cityRand(l_state) % 64)); }
+
+	structSoA l_in, l_out;
+	vector<float> l_ref[5];
+	mkToSoA(&l_aos[0], n, l_in);
+	mkToSoA(&l_aos[0], n, l_out);
+	mat4 l_M = translate(mat4(1.0f), vec3(0.175f, 0.06f, 0.0f)) * rotate(mat4(1.0f), 0.3f, vec3(0.0f, 0.0f, 1.0f)) * scale(mat4(1.0f), vec3(1.0f / 9.25f));
+	float l_m[12], l_mn[3], l_mx[3];
+	mkMatrix(l_M, 1.0f, l_m);
+
+	const char *l_names[5] = { "affine", "bounds", "face normals", "normalize", "quantize16" };
+	double l_bytes[5] = { 24.0 * n, 12.0 * n, 60.0 * l_numTris, 24.0 * n, 18.0 * n };
+	double l_glmMs[5];
+	vec3 l_bmin, l_bmax;
+
+	l_glmMs[0] = mkBestMs([&] { for (int i = 0; i < n; i++) { l_aosOut[i] = vec3(l_M * vec4(l_aos[i], 1.0f)); } });
+	l_glmMs[1] = mkBestMs([&] { l_bmin = vec3(1e30f); l_bmax = vec3(-1e30f); for (int i = 0; i < n; i++) { l_bmin = glm::min(l_bmin, l_aos[i]); l_bmax = glm::max(l_bmax, l_aos[i]); } });
+	l_glmMs[2] = mkBestMs([&] { for (int t = 0; t < l_numTris; t++) { vec3 a = l_aos[l_index[3 * t]]; l_faceAoS[t] = cross(l_aos[l_index[3 * t + 1]] - a, l_aos[l_index[3 * t + 2]] - a); } });
+	l_glmMs[3] = mkBestMs([&] { for (int i = 0; i < n; i++) { l_aosOut[i] = normalize(l_aos[i]); } });
+	l_glmMs[4] = mkBestMs([&] {
+		vec3 l_s = 65535.0f / (l_bmax - l_bmin);
+		for (int i = 0; i < n; i++)
+		{
+			vec3 q = glm::clamp((l_aos[i] - l_bmin) * l_s, 0.0f, 65535.0f) + vec3(0.5f);
+			l_q[3 * i] = (unsigned short)q.x;  l_q[3 * i + 1] = (unsigned short)q.y;  l_q[3 * i + 2] = (unsigned short)q.z;
+		}
+	});
+
+	printf("Mesh kernels: %d vertices, %d triangles; GB/s (bytes read + written)\n", n, l_numTris);
+	printf("%-12s | glm AoS", "kernel");
+	for (int t = 0; t < mkNumTiers; t++) { if (mkSupported(t)) printf(" | %7s", mkTiers[t].name); }
+	printf(" | max diff vs scalar\n");
+
+	for (int k = 0; k < 5; k++)
+	{
+		printf("%-12s | %7.2f", l_names[k], l_bytes[k] / (l_glmMs[k] * 1e6));
+		float l_diff = 0.0f;
+		for (int t = 0; t < mkNumTiers; t++)
+		{
+			if (!mkSupported(t)) continue;
+			const structMeshKernels &K = mkTiers[t];
+			vector<float> l_result;
+			double l_ms = 0.0;
+			if (k == 0)
+			{
+				l_ms = mkBestMs([&] { K.affine(l_m, &l_in.x[0], &l_in.y[0], &l_in.z[0], &l_out.x[0], &l_out.y[0], &l_out.z[0], n); });
+				l_result.assign(l_out.x.begin(), l_out.x.end());
+			}
+			else if (k == 1)
+			{
+				l_ms = mkBestMs([&] {
+					for (int c = 0; c < 3; c++) { l_mn[c] = 1e30f;  l_mx[c] = -1e30f; }
+					K.bounds(&l_in.x[0], &l_in.y[0], &l_in.z[0], n, l_mn, l_mx);
+				});
+				l_result.assign(l_mn, l_mn + 3);
+				l_result.insert(l_result.end(), l_mx, l_mx + 3);
+			}
+			else if (k == 2)
+			{
+				l_ms = mkBestMs([&] { K.faceNormals(&l_in.x[0], &l_in.y[0], &l_in.z[0], &l_index[0], l_numTris, &l_out.x[0], &l_out.y[0], &l_out.z[0]); });
+				l_result.assign(l_out.x.begin(), l_out.x.begin() + l_numTris);
+			}
+			else if (k == 3)
+			{
+				// Runs in place, so start from a fresh copy each time.
+				l_ms = mkBestMs([&] { l_out = l_in; K.normalize(&l_out.x[0], &l_out.y[0], &l_out.z[0], n); }) - mkBestMs([&] { l_out = l_in; });
+				l_result.assign(l_out.x.begin(), l_out.x.end());
+			}
+			else
+			{
+				l_ms = mkBestMs([&] { K.quantize(&l_in.x[0], &l_in.y[0], &l_in.z[0], n, l_mn, l_mx, &l_q[0], &l_q[n], &l_q[2 * n]); });
+				l_result.assign(l_q.begin(), l_q.end());
+			}
+			if (t == mkTierScalar) l_ref[k] = l_result;
+			else l_diff = fmaxf(l_diff, mkMaxDiff(l_result, l_ref[k]));
+			printf(" | %7.2f", l_bytes[k] / (std::max(l_ms, 1e-3) * 1e6));
+		}
+		printf(" | %g\n", l_diff);
+	}
 }
 
-void keyboardCB(GLFWwindow *window, int key, int scancode, int action, int mods)
+//---------------------------POLYLINE-BENCH-----------------------------
+// Draws count random polylines (2-32 points, open and closed) over the
+// island from the default camera, once batched and once as one
+// GL_LINE_STRIP/GL_LINE_LOOP draw per polyline through the outline shader
+// (what prop::render() does for an outline), and reports polylines/sec.
+void benchPolylines(int count, int frames)
 {
-	//cout << "key = " << key << "\n";
-	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
-		glfwSetWindowShouldClose(window, GL_TRUE);
+	if (!polylines.supported) { fprintf(stderr, "polylines need SSBOs (GL 4.3)\n"); return; }
+
+	srand(1);
+	vector<vec3> l_points;
+	vec3 l_size = island.boundsMax - island.boundsMin;
+	long long l_segments = 0;
+	clearPolylines();
+	for (int i = 0; i < count; i++)
+	{
+		int l_numPoints = 2 + rand() % 31;
+		bool l_closed = (rand() % 4) == 0;
+		vec3 l_p = island.boundsMin + vec3(l_size.x * rand() / RAND_MAX, l_size.y * rand() / RAND_MAX, 0.001f);
+		l_points.resize(l_numPoints);
+		for (int j = 0; j < l_numPoints; j++)
+		{
+			l_points[j] = l_p;
+			l_p += vec3((rand() / (float)RAND_MAX - 0.5f) * 0.05f, (rand() / (float)RAND_MAX - 0.5f) * 0.05f, 0.0f);
+		}
+		vec3 l_color(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+		addPolyline(&l_points[0], l_numPoints, l_color, polylines.outlineWidth, l_closed, polylines.outlineJoin);
+		l_segments += l_closed ? l_numPoints : l_numPoints - 1;
+	}
+	uploadPolylines();
+
+	GLuint l_VAO;
+	glGenVertexArrays(1, &l_VAO);
+	glBindVertexArray(l_VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, polylines.pointBuffer);
+	glEnableVertexAttribArray(vertexPosAttrib);
+	glVertexAttribPointer(vertexPosAttrib, 3, GL_FLOAT, GL_FALSE, sizeof(vec4), (void *)0);
+	glBindVertexArray(0);
+
+	printf("Polylines: %d polylines, %lld segments, %d frames\n", count, l_segments, frames);
+	for (int l_batched = 1; l_batched >= 0; l_batched--)
+	{
+		double l_ms = 0.0;
+		for (int f = -2; f < frames; f++)
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glFinish();
+			chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+			if (l_batched) drawPolylines(PV);
+			else
+			{
+				structShader &l_shader = shaders[renderContext][shaderOutline];
+				glUseProgram(l_shader.prog);
+				glUniformMatrix4fv(l_shader.MUniformLoc, 1, GL_FALSE, value_ptr(mat4(1.0f)));
+				glUniformMatrix4fv(l_shader.PVUniformLoc, 1, GL_FALSE, value_ptr(PV));
+				glBindVertexArray(l_VAO);
+				for (size_t i = 0; i < polylines.lines.size(); i++)
+				{
+					const structPolylineGpu &l = polylines.lines[i];
+					glUniform3fv(l_shader.propColorLoc, 1, value_ptr(vec3(l.color)));
+					glDrawArrays(l.closed ? GL_LINE_LOOP : GL_LINE_STRIP, l.first, l.count);
+				}
+				glBindVertexArray(0);
+			}
+			glFinish();
+			if (f >= 0) l_ms += elapsedMs(l_start);
+		}
+		double l_frameMs = l_ms / frames;
+		printf("%-8s: %8.3f ms/frame, %10.0f polylines/s, %12.0f segments/s, %d draw call(s)\n", l_batched ? "batched" : "per-line",
+			l_frameMs, count * 1000.0 / l_frameMs, l_segments * 1000.0 / l_frameMs, l_batched ? 1 : count);
+	}
+	glDeleteVertexArrays(1, &l_VAO);
+	polylinesFromScene();
+}
 
-	else if (key == GLFW_KEY_W             && action == GLFW_PRESS)   { dir[ 0] = 1; }
-	else if (key == GLFW_KEY_S             && action == GLFW_PRESS)   { dir[ 1] = 1; }
-	else if (key == GLFW_KEY_A             && action == GLFW_PRESS)   { dir[ 2] = 1; }
-	else if (key == GLFW_KEY_D             && action == GLFW_PRESS)   { dir[ 3] = 1; }
-	else if (key == GLFW_KEY_LEFT_SHIFT    && action == GLFW_PRESS)   { dir[ 4] = 1; }
-	else if (key == GLFW_KEY_LEFT_CONTROL  && action == GLFW_PRESS)   { dir[ 5] = 1; }
-																			 
-	else if (key == GLFW_KEY_W             && action == GLFW_RELEASE) { dir[ 0] = 0; }
-	else if (key == GLFW_KEY_S             && action == GLFW_RELEASE) { dir[ 1] = 0; }
-	else if (key == GLFW_KEY_A             && action == GLFW_RELEASE) { dir[ 2] = 0; }
-	else if (key == GLFW_KEY_D             && action == GLFW_RELEASE) { dir[ 3] = 0; }
-	else if (key == GLFW_KEY_LEFT_SHIFT    && action == GLFW_RELEASE) { dir[ 4] = 0; }
-	else if (key == GLFW_KEY_LEFT_CONTROL  && action == GLFW_RELEASE) { dir[ 5] = 0; }
-																			 
-	else if (key == GLFW_KEY_UP            && action == GLFW_PRESS)   { dir[ 6] = 1; }
-	else if (key == GLFW_KEY_DOWN          && action == GLFW_PRESS)   { dir[ 7] = 1; }
-	else if (key == GLFW_KEY_LEFT          && action == GLFW_PRESS)   { dir[ 8] = 1; }
-	else if (key == GLFW_KEY_RIGHT         && action == GLFW_PRESS)   { dir[ 9] = 1; }
-	else if (key == GLFW_KEY_RIGHT_SHIFT   && action == GLFW_PRESS)   { dir[10] = 1; }
-	else if (key == GLFW_KEY_RIGHT_CONTROL && action == GLFW_PRESS)   { dir[11] = 1; }
+//----------------------------SPATIAL-BENCH-----------------------------
+// --spatial-bench N: N synthetic city footprints (6-10 sided, jittered on
+// a grid one unit apart) through the R-tree. Times the STR build against N
+// single inserts, then range (3x3-unit window), k-nearest (k = 8) and
+// point-in-footprint queries on one thread, checks a sample of each
+// against brute force, deletes and reinserts 10% and checks again, and
+// finally runs the query mix on --spatial-threads readers, alone and next
+// to a thread deleting and reinserting footprints.
+struct structFootprints { vector<vec2> points; vector<int> first; vector<structRect> rects; };
+
+bool footprintContains(const structFootprints &f, int id, vec2 p)
+{
+	bool l_inside = false;
+	int l_begin = f.first[id], l_end = f.first[id + 1];
+	for (int i = l_begin, j = l_end - 1; i < l_end; j = i++)
+	{
+		vec2 a = f.points[i], b = f.points[j];
+		if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x) l_inside = !l_inside;
+	}
+	return l_inside;
+}
 
-	else if (key == GLFW_KEY_UP		       && action == GLFW_RELEASE) { dir[ 6] = 0; }
-	else if (key == GLFW_KEY_DOWN		   && action == GLFW_RELEASE) { dir[ 7] = 0; }
-	else if (key == GLFW_KEY_LEFT		   && action == GLFW_RELEASE) { dir[ 8] = 0; }
-	else if (key == GLFW_KEY_RIGHT		   && action == GLFW_RELEASE) { dir[ 9] = 0; }
-	else if (key == GLFW_KEY_RIGHT_SHIFT   && action == GLFW_RELEASE) { dir[10] = 0; }
-	else if (key == GLFW_KEY_RIGHT_CONTROL && action == GLFW_RELEASE) { dir[11] = 0; }
+int footprintsAt(const structRTree &t, const structFootprints &f, vec2 p, vector<int> &scratch)
+{
+	structRect r = { p, p };
+	rtreeRange(t, r, scratch);
+	int n = 0;
+	for (size_t i = 0; i < scratch.size(); i++) { n += footprintContains(f, scratch[i], p) ? 1 : 0; }
+	return n;
+}
 
-	else if (key == GLFW_KEY_SPACE         && action == GLFW_RELEASE) { changeCamPos = 1; }
+// Query kind q % 3 at point p: range, nearest or footprint. Returns hits.
+int spatialQuery(const structRTree &t, const structFootprints &f, int q, vec2 p, vector<int> &scratch)
+{
+	structArenaScope l_frame(frameArena);
+	if (q % 3 == 0)
+	{
+		structRect r = { p - vec2(1.5f), p + vec2(1.5f) };
+		rtreeRange(t, r, scratch);
+		return (int)scratch.size();
+	}
+	if (q % 3 == 1)
+	{
+		rtreeNearest(t, p, 8, scratch);
+		return (int)scratch.size();
+	}
+	return footprintsAt(t, f, p, scratch);
+}
 
-	else if (key == GLFW_KEY_TAB           && action == GLFW_RELEASE) { phong = !phong; }
+// Brute-force answers for the same queries; false on the first mismatch.
+bool spatialVerify(const structRTree &t, const structFootprints &f, const vector<bool> &live, const vector<vec2> &points)
+{
+	vector<int> l_got, l_want;
+	for (size_t s = 0; s < points.size(); s++)
+	{
+		vec2 p = points[s];
+		for (int q = 0; q < 3; q++)
+		{
+			l_want.clear();
+			if (q == 0)
+			{
+				structRect r = { p - vec2(1.5f), p + vec2(1.5f) };
+				rtreeRange(t, r, l_got);
+				for (size_t i = 0; i < f.rects.size(); i++) { if (live[i] && rectOverlaps(f.rects[i], r)) l_want.push_back((int)i); }
+			}
+			else if (q == 1)
+			{
+				// Compared by distance, since ties may come back in any order.
+				rtreeNearest(t, p, 8, l_got);
+				vector<float> l_all, l_mine;
+				for (size_t i = 0; i < f.rects.size(); i++) { if (live[i]) l_all.push_back(rectDistance2(f.rects[i], p)); }
+				partial_sort(l_all.begin(), l_all.begin() + std::min<size_t>(8, l_all.size()), l_all.end());
+				l_all.resize(std::min<size_t>(8, l_all.size()));
+				for (size_t i = 0; i < l_got.size(); i++) { l_mine.push_back(rectDistance2(f.rects[l_got[i]], p)); }
+				if (l_mine != l_all) return false;
+				continue;
+			}
+			else
+			{
+				structRect r = { p, p };
+				rtreeRange(t, r, l_got);
+				vector<int> l_inside;
+				for (size_t i = 0; i < l_got.size(); i++) { if (footprintContains(f, l_got[i], p)) l_inside.push_back(l_got[i]); }
+				l_got.swap(l_inside);
+				for (size_t i = 0; i < f.rects.size(); i++) { if (live[i] && rectOverlaps(f.rects[i], r) && footprintContains(f, (int)i, p)) l_want.push_back((int)i); }
+			}
+			sort(l_got.begin(), l_got.end());
+			if (l_got != l_want) return false;
+		}
+	}
+	return true;
 }
 
-void mouseCB(GLFWwindow *window, int button, int action, int mods)
+int benchSpatial(int count, int threads)
 {
-	float r = 0.0f, g = 0.0f, b = 0.0f;
-	cout << "btn = " << button << "\n";
-	if (button == GLFW_MOUSE_BUTTON_1 && action == GLFW_PRESS)
+	const float l_pi = 3.14159265f;
+	unsigned int l_state = 7;
+	int l_side = (int)ceil(sqrt((double)count));
+	structFootprints f;
+	f.first.reserve(count + 1);
+	f.rects.resize(count);
+	for (int b = 0; b < count; b++)
 	{
-		r = (double)rand() / (double)RAND_MAX;
-		g = (double)rand() / (double)RAND_MAX;
-		b = (double)rand() / (double)RAND_MAX;
-		cout << "r = " << r << " | " << "g = " << g << " | " << "b = " << b << "\n";
-		glClearColor(r, g, b, 1.0);
+		vec2 l_center = vec2(b % l_side + cityRandf(l_state, 0.4f, 0.6f), b / l_side + cityRandf(l_state, 0.4f, 0.6f));
+		int l_sides = 6 + cityRand(l_state) % 5;
+		float l_radius = cityRandf(l_state, 0.2f, 0.45f);
+		structRect r = { vec2(1e30f), vec2(-1e30f) };
+		f.first.push_back((int)f.points.size());
+		for (int i = 0; i < l_sides; i++)
+		{
+			float l_a = (i + cityRandf(l_state, -0.3f, 0.3f)) * 2.0f * l_pi / l_sides;
+			vec2 l_point = l_center + l_radius * cityRandf(l_state, 0.6f, 1.0f) * vec2(cos(l_a), sin(l_a));
+			f.points.push_back(l_point);
+			r.min = glm::min(r.min, l_point);
+			r.max = glm::max(r.max, l_point);
+		}
+		f.rects[b] = r;
+	}
+	f.first.push_back((int)f.points.size());
+
+	const int l_queries = 300000, l_samples = 100;
+	vector<vec2> l_points(l_queries);
+	for (int i = 0; i < l_queries; i++) { l_points[i] = vec2(cityRandf(l_state, 0.0f, (float)l_side), cityRandf(l_state, 0.0f, (float)l_side)); }
+	vector<vec2> l_check(l_points.begin(), l_points.begin() + l_samples);
+	vector<bool> l_live(count, true);
+	printf("Spatial index: %d footprints, %d queries per kind\n", count, l_queries / 3);
+
+	structRTree t;
+	rtreeClear(t);
+	chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) { rtreeInsert(t, i, f.rects[i]); }
+	printf("  %-24s %9.1f ms, height %d, %d nodes\n", "one-by-one insert", elapsedMs(l_start), t.nodes[t.root].level + 1, (int)(t.nodes.size() - t.freeNodes.size()));
+	bool l_ok = spatialVerify(t, f, l_live, l_check);
+
+	l_start = chrono::steady_clock::now();
+	rtreeBuild(t, f.rects);
+	printf("  %-24s %9.1f ms, height %d, %d nodes\n", "STR bulk load", elapsedMs(l_start), t.nodes[t.root].level + 1, (int)t.nodes.size());
+	l_ok = l_ok && spatialVerify(t, f, l_live, l_check);
+
+	const char *l_kinds[3] = { "range 3x3", "nearest 8", "point-in-footprint" };
+	vector<int> l_scratch;
+	for (int q = 0; q < 3; q++)
+	{
+		long long l_hits = 0;
+		l_start = chrono::steady_clock::now();
+		for (int i = q; i < l_queries; i += 3) { l_hits += spatialQuery(t, f, q, l_points[i], l_scratch); }
+		double l_ms = elapsedMs(l_start);
+		printf("  %-24s %9.0f queries/s, %.2f hits each\n", l_kinds[q], (l_queries / 3) / (l_ms / 1000.0), (double)l_hits / (l_queries / 3));
+	}
+
+	l_start = chrono::steady_clock::now();
+	vector<int> l_moved;
+	for (int i = 0; i < count / 10; i++)
+	{
+		int id = (int)(cityRand(l_state) % count);
+		if (!l_live[id]) continue;
+		rtreeRemove(t, id);
+		l_live[id] = false;
+		l_moved.push_back(id);
+	}
+	double l_removeMs = elapsedMs(l_start);
+	l_ok = l_ok && t.size == count - (int)l_moved.size() && spatialVerify(t, f, l_live, l_check);
+	l_start = chrono::steady_clock::now();
+	for (size_t i = 0; i < l_moved.size(); i++) { rtreeInsert(t, l_moved[i], f.rects[l_moved[i]]); l_live[l_moved[i]] = true; }
+	printf("  %-24s %9.1f ms remove, %.1f ms reinsert of %d\n", "delete and reinsert", l_removeMs, elapsedMs(l_start), (int)l_moved.size());
+	l_ok = l_ok && t.size == count && spatialVerify(t, f, l_live, l_check);
+	printf("  %-24s %s\n", "brute-force check", l_ok ? "ok" : "MISMATCH");
+
+	// The writer only moves footprints it owns (ids 0..count/100), so the
+	// readers' answers stay meaningful.
+	for (int l_writer = 0; l_writer < 2; l_writer++)
+	{
+		atomic<bool> l_done(false);
+		atomic<long long> l_edits(0);
+		thread l_writerThread;
+		if (l_writer)
+		{
+			l_writerThread = thread([&]()
+			{
+				unsigned int l_seed = 99;
+				while (!l_done.load())
+				{
+					int id = (int)(cityRand(l_seed) % std::max(1, count / 100));
+					rtreeRemove(t, id);
+					rtreeInsert(t, id, f.rects[id]);
+					l_edits += 2;
+				}
+			});
+		}
+		vector<thread> l_readers;
+		l_start = chrono::steady_clock::now();
+		for (int r = 0; r < threads; r++)
+		{
+			l_readers.push_back(thread([&, r]()
+			{
+				vector<int> l_local;
+				for (int i = r; i < l_queries; i += threads) { spatialQuery(t, f, i, l_points[i], l_local); }
+			}));
+		}
+		for (size_t r = 0; r < l_readers.size(); r++) { l_readers[r].join(); }
+		double l_ms = elapsedMs(l_start);
+		l_done = true;
+		if (l_writer) l_writerThread.join();
+		char l_label[64];
+		snprintf(l_label, sizeof(l_label), "%d reader%s%s", threads, threads == 1 ? "" : "s", l_writer ? " + writer" : "");
+		printf("  %-24s %9.0f queries/s", l_label, l_queries / (l_ms / 1000.0));
+		if (l_writer) printf(", %.0f edits/s", l_edits.load() / (l_ms / 1000.0));
+		printf("\n");
 	}
+	return l_ok ? 0 : 1;
 }
 
-void renderWorld()
+//--------------------------SPLIT-VIEW-BENCH----------------------------
+// Renders the split view as N sequential passes, as one instanced pass and
+// as one geometry shader pass, and reports frame time, draw calls and how
+// many pixels differ from the sequential image. Outlines are drawn as plain
+// line loops in all three, since the single pass does not batch polylines.
+int benchSplitView(int frames)
 {
-	//---------------------------CHANGE-CAMERA-DIRECTION---------------------------
-	if (dir[ 0] == 1) { cameraLocation.x  -= speed; }
-	if (dir[ 1] == 1) { cameraLocation.x  += speed; }
-	if (dir[ 2] == 1) { cameraLocation.y  -= speed; }
-	if (dir[ 3] == 1) { cameraLocation.y  += speed; }
-	if (dir[ 4] == 1) { cameraLocation.z  -= speed; }
-	if (dir[ 5] == 1) { cameraLocation.z  += speed; }
-			 
-	if (dir[ 6] == 1) { pointOfInterest.x -= speed; }
-	if (dir[ 7] == 1) { pointOfInterest.x += speed; }
-	if (dir[ 8] == 1) { pointOfInterest.y -= speed; }
-	if (dir[ 9] == 1) { pointOfInterest.y += speed; }
-	if (dir[10] == 1) { pointOfInterest.z -= speed; }
-	if (dir[11] == 1) { pointOfInterest.z += speed; }
-
-	if (changeCamPos == 1)
-	{
-		changeCamPos = 0;
-		camPresetMode++;
-		if (camPresetMode >= 4) { camPresetMode = 0; }
-		cameraLocation = camPresetPos[camPresetMode];
-		pointOfInterest = POIPresetPos[camPresetMode];
-	}
-
-	light[0].pos.x = sin(ang)/3;
-	light[0].pos.y = cos(ang)/3;
-
-	ang += 0.0005;
-	if (ang > 360) ang = 0;
+	polylines.enabled = false;
+	const char *l_names[3] = { "sequential", "instanced", "geometry" };
+	vector<unsigned char> l_reference(windowWidth * windowHeight * 4), l_image(windowWidth * windowHeight * 4);
+	double l_baseMs = 0.0;
 
-	View = lookAt(cameraLocation, pointOfInterest, cameraUp);
-	PV = Projection * View;
+	printf("Split view: %d views, %d props, %d frames\n", multiView.numViews, (int)sceneProps.size(), frames);
+	for (int l_mode = 0; l_mode < 3; l_mode++)
+	{
+		if (l_mode > 0)
+		{
+			multiView.forceGeometry = (l_mode == 2);
+			if (!initMultiView()) return 1;
+			if (l_mode == 1 && !multiView.instanced) { printf("%-10s: not supported\n", l_names[l_mode]); continue; }
+		}
+
+		double l_ms = 0.0;
+		int l_draws = 0;
+		for (int f = -3; f < frames; f++)
+		{
+			chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			sceneStats.propsDrawn = 0;
+			drawSplitView(l_mode > 0);
+			glFinish();
+			if (f < 0) continue;
+			l_ms += elapsedMs(l_start);
+			l_draws = sceneStats.propsDrawn;
+		}
+		glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, l_mode ? &l_image[0] : &l_reference[0]);
+
+		int l_diff = 0;
+		for (size_t i = 0; l_mode && i < l_image.size(); i += 4) { l_diff += memcmp(&l_image[i], &l_reference[i], 3) != 0; }
+		if (l_mode == 0) l_baseMs = l_ms;
+		printf("%-10s: %8.3f ms/frame (%.2fx), %4d prop draws, %d pixels differ\n", l_names[l_mode], l_ms / frames, l_baseMs / l_ms, l_draws, l_diff);
+	}
+	return 0;
+}
+
+//-------------------------SHADING-LOD-BENCH----------------------------
+// Renders the bench cameras (orbit, flyover, street) with all-Phong, with
+// all-Gouraud and with the shading LOD at its thresholds scaled by 1/4 to
+// 16, and reports frame time and the benchImageError() of each against the
+// all-Phong image of the same frame. The fastest setting whose mean error is
+// within maxError (/255) is the one the gain is quoted for.
+int benchShadingLod(int frames, float maxError)
+{
+	const int l_configs = 6;
+	const char *l_names[l_configs] = { "phong", "gouraud", "lod x0.25", "lod x1", "lod x4", "lod x16" };
+	const float l_scales[l_configs] = { 0.0f, 0.0f, 0.25f, 1.0f, 4.0f, 16.0f };
+	float l_phongPixels = shadingLod.phongPixels, l_flatPixels = shadingLod.flatPixels;
+	double l_ms[l_configs] = { 0.0 }, l_error[l_configs] = { 0.0 }, l_off[l_configs] = { 0.0 }, l_tiers[l_configs][numShaders] = { { 0.0 } };
+	vector<unsigned char> l_reference(windowWidth * windowHeight * 4), l_image(windowWidth * windowHeight * 4);
+	setBenchPath(benchPhong);
+
+	printf("Shading LOD: %d props, %d frames per camera, Phong from %.0f px, flat under %.0f px\n", (int)sceneProps.size(), frames, l_phongPixels, l_flatPixels);
+	benchFlyCameras(frames, [&](int f) {
+		for (int c = 0; c < l_configs; c++)
+		{
+			phong = (c != 1);
+			shadingLod.enabled = (c >= 2);
+			shadingLod.phongPixels = l_phongPixels * l_scales[c];
+			shadingLod.flatPixels = l_flatPixels * l_scales[c];
+
+			chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+			drawScene();
+			glFinish();
+			double l_frameMs = elapsedMs(l_start);
+			glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, c ? &l_image[0] : &l_reference[0]);
+			if (f < 0) continue;
+
+			l_ms[c] += l_frameMs;
+			for (int k = 0; k < numShaders; k++) { l_tiers[c][k] += sceneStats.shaded[k]; }
+			if (c == 0) continue;
+			double l_mean, l_percent;
+			benchImageError(l_image, l_reference, l_mean, l_percent);
+			l_error[c] += l_mean;
+			l_off[c] += l_percent;
+		}
+	});
+	shadingLod.enabled = false;
+	shadingLod.phongPixels = l_phongPixels;
+	shadingLod.flatPixels = l_flatPixels;
+	phong = true;
+
+	int l_frames = frames * numBenchCameras, l_best = 0;
+	printf("setting   |  ms/frame | speedup | mean err | >8 off %% | phong / gouraud / flat props\n");
+	for (int c = 0; c < l_configs; c++)
+	{
+		printf("%-9s | %9.3f | %6.2fx | %8.3f | %8.3f | %.0f / %.0f / %.0f\n", l_names[c], l_ms[c] / l_frames, l_ms[0] / l_ms[c], l_error[c] / l_frames, l_off[c] / l_frames,
+			l_tiers[c][shaderPhong] / l_frames, l_tiers[c][shaderGouraud] / l_frames, l_tiers[c][shaderOutline] / l_frames);
+		if (c >= 2 && l_error[c] / l_frames <= maxError && l_ms[c] < l_ms[l_best]) l_best = c;
+	}
+	if (l_best == 0) printf("No LOD setting beats all-Phong within a mean error of %.2f/255\n", maxError);
+	else printf("Best within a mean error of %.2f/255: %s, %.3f ms/frame saved (%.1f%%)\n", maxError, l_names[l_best], (l_ms[0] - l_ms[l_best]) / l_frames, 100.0 * (1.0 - l_ms[l_best] / l_ms[0]));
+	return 0;
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	island.render();
-	ground.render();
-	cube.render();
-	ecdcA.render();
-	ecdcB.render();
-	bayhall.render();
+//---------------------------IMPOSTOR-BENCH-----------------------------
+// Renders the bench cameras with every prop as a mesh and with impostors
+// at maxPixels scaled by 1/4 to 4, and reports frame time, triangles and
+// impostors per frame and the benchImageError() against the mesh image of
+// the same frame.
+int benchImpostors(int frames)
+{
+	const int l_configs = 4;
+	const char *l_names[l_configs] = { "meshes", "imp x0.25", "imp x1", "imp x4" };
+	const float l_scales[l_configs] = { 0.0f, 0.25f, 1.0f, 4.0f };
+	float l_maxPixels = impostors.maxPixels;
+	double l_ms[l_configs] = { 0.0 }, l_tris[l_configs] = { 0.0 }, l_impostors[l_configs] = { 0.0 }, l_error[l_configs] = { 0.0 }, l_off[l_configs] = { 0.0 };
+	vector<unsigned char> l_reference(windowWidth * windowHeight * 4), l_image(windowWidth * windowHeight * 4);
+	setBenchPath(benchPhong);
+	bakeImpostors();
+
+	printf("Impostors: %d props, %d frames per camera, impostor under %.0f px\n", (int)sceneProps.size(), frames, l_maxPixels);
+	benchFlyCameras(frames, [&](int f) {
+		for (int c = 0; c < l_configs; c++)
+		{
+			drawImpostors = (c > 0);
+			impostors.maxPixels = l_maxPixels * l_scales[c];
+
+			chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+			drawScene();
+			glFinish();
+			double l_frameMs = elapsedMs(l_start);
+			glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, c ? &l_image[0] : &l_reference[0]);
+			if (f < 0) continue;
+
+			l_ms[c] += l_frameMs;
+			l_tris[c] += (double)sceneStats.triangles;
+			l_impostors[c] += sceneStats.impostors;
+			if (c == 0) continue;
+			double l_mean, l_percent;
+			benchImageError(l_image, l_reference, l_mean, l_percent);
+			l_error[c] += l_mean;
+			l_off[c] += l_percent;
+		}
+	});
+	drawImpostors = false;
+	impostors.maxPixels = l_maxPixels;
+
+	int l_frames = frames * numBenchCameras;
+	printf("setting   |  ms/frame | speedup | triangles | impostors | mean err | >8 off %%\n");
+	for (int c = 0; c < l_configs; c++)
+	{
+		printf("%-9s | %9.3f | %6.2fx | %9.0f | %9.0f | %8.3f | %8.3f\n", l_names[c], l_ms[c] / l_frames, l_ms[0] / l_ms[c], l_tris[c] / l_frames,
+			l_impostors[c] / l_frames, l_error[c] / l_frames, l_off[c] / l_frames);
+	}
+	return 0;
+}
+
+//----------------------------SHADOW-BENCH------------------------------
+// Flies the bench cameras while light[0] orbits 20 times faster than in
+// the app (0.01 rad a frame), first without shadows, then with every map
+// drawn every frame, then cached within the budget. Each run starts with
+// empty caches. Reports frame time, the shadow pass's share of it, the
+// cost over no shadows and the map updates per frame.
+int benchShadows(int frames)
+{
+	const int l_configs = 3;
+	const char *l_names[l_configs] = { "off", "uncached", "cached" };
+	bool l_enabled = shadows.enabled, l_cache = shadows.cache;
+	float l_ang = ang;
+	vec4 l_light0 = light[0].pos;
+	double l_ms[l_configs] = { 0.0 }, l_passMs[l_configs] = { 0.0 }, l_updates[l_configs] = { 0.0 };
+	setBenchPath(benchPhong);
+	shadows.timing = true;
+
+	printf("Shadows: %d props, %d frames per camera, %d cascades of %d, cube map of %d, budget %.1f ms, redraw cube after %.3f\n", (int)sceneProps.size(),
+		frames, shadows.numCascades, shadows.size, shadows.cubeSize, shadows.budgetMs, shadows.lightMove);
+	for (int c = 0; c < l_configs; c++)
+	{
+		shadows.enabled = (c > 0);
+		shadows.cache = (c == 2);
+		shadows.dirty = true;
+		ang = l_ang;
+		benchFlyCameras(frames, [&](int f) {
+			ang += 0.01f;
+			light[0].pos.x = sin(ang) / 3;
+			light[0].pos.y = cos(ang) / 3;
+			packLights();
+			long long l_updatesBefore = shadows.cascadeUpdates + shadows.faceUpdates;
+
+			chrono::steady_clock::time_point l_start = chrono::steady_clock::now();
+			shadows.passMs = 0.0;
+			drawScene();
+			glFinish();
+			double l_frameMs = elapsedMs(l_start);
+			if (f < 0) return;
+
+			l_ms[c] += l_frameMs;
+			l_passMs[c] += shadows.passMs;
+			l_updates[c] += (double)(shadows.cascadeUpdates + shadows.faceUpdates - l_updatesBefore);
+		});
+	}
+	shadows.enabled = l_enabled;
+	shadows.cache = l_cache;
+	shadows.dirty = true;
+	shadows.timing = false;
+	ang = l_ang;
+	light[0].pos = l_light0;
+	packLights();
+
+	int l_frames = frames * numBenchCameras;
+	printf("setting  |  ms/frame | shadow ms | %% of frame | over no shadows | cascades + faces drawn/frame\n");
+	for (int c = 0; c < l_configs; c++)
+	{
+		printf("%-8s | %9.3f | %9.3f | %9.1f%% | %14.1f%% | %.2f\n", l_names[c], l_ms[c] / l_frames, l_passMs[c] / l_frames, 100.0 * l_passMs[c] / l_ms[c],
+			100.0 * (l_ms[c] - l_ms[0]) / l_ms[0], l_updates[c] / l_frames);
+	}
+	return 0;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+	int l_swBenchFrames = 0, l_batchThreads = 1, l_kernelBench = 0, l_polylineBench = 0, l_captureBench = 0, l_splitViewBench = 0;
+	int l_spatialBench = 0, l_spatialThreads = (int)std::max(1u, thread::hardware_concurrency()), l_shadingLodBench = 0, l_impostorBench = 0, l_shadowBench = 0;
+	float l_shadingLodError = 0.5f;
+	int l_captureWidth = windowWidth, l_captureHeight = windowHeight;
+	bool l_swBenchImages = false, l_hidden = false, l_batchScaling = false;
+	const char *l_batchFile = NULL, *l_meshKernels = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if      (!strcmp(argv[i], "--dynres"))                       { dynRes.enabled = true; }
+		else if (!strcmp(argv[i], "--target-ms")   && i + 1 < argc) { dynRes.targetMs   = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--min-scale")   && i + 1 < argc) { dynRes.minScale   = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--max-scale")   && i + 1 < argc) { dynRes.maxScale   = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--hysteresis")  && i + 1 < argc) { dynRes.hysteresis = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--scale-step")  && i + 1 < argc) { dynRes.step       = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--settle")      && i + 1 < argc) { dynRes.settleFrames = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--quiet-dynres"))                 { dynRes.log = false; }
+		else if (!strcmp(argv[i], "--software"))                     { renderBackend = backendSoftware; }
+		else if (!strcmp(argv[i], "--sw-threads")  && i + 1 < argc) { swNumThreads = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--sw-bench")    && i + 1 < argc) { l_swBenchFrames = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--sw-bench-images"))              { l_swBenchImages = true; }
+		else if (!strcmp(argv[i], "--hidden"))                       { l_hidden = true; }
+		else if (!strcmp(argv[i], "--batch")         && i + 1 < argc) { l_batchFile = argv[++i]; l_hidden = true; }
+		else if (!strcmp(argv[i], "--batch-out")     && i + 1 < argc) { batchOutDir = argv[++i]; }
+		else if (!strcmp(argv[i], "--batch-threads") && i + 1 < argc) { l_batchThreads = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--batch-size")    && i + 2 < argc) { batchWidth = atoi(argv[++i]); batchHeight = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--batch-scaling"))                  { l_batchScaling = true; }
+		else if (!strcmp(argv[i], "--record")        && i + 1 < argc) { inputLog.mode = inputRecord; inputLog.path = argv[++i]; }
+		else if (!strcmp(argv[i], "--replay")        && i + 1 < argc) { inputLog.mode = inputReplay; inputLog.path = argv[++i]; }
+		else if (!strcmp(argv[i], "--replay-fast"))                    { inputLog.fast = true; }
+		else if (!strcmp(argv[i], "--replay-step-ms") && i + 1 < argc) { inputLog.stepMs = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--frame-csv")     && i + 1 < argc) { inputLog.csvPath = argv[++i]; }
+		else if (!strcmp(argv[i], "--gpu-cull"))                        { gpuCullProps = true; }
+		else if (!strcmp(argv[i], "--sim-thread"))
+		{
+			sim.enabled = true;
+			if (i + 1 < argc && atof(argv[i + 1]) > 0.0) sim.hz = (float)atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--sim-report"))                      { sim.report = true; }
+		else if (!strcmp(argv[i], "--terrain")        && i + 1 < argc) { terrain.path = argv[++i]; }
+		else if (!strcmp(argv[i], "--terrain-height") && i + 1 < argc) { terrain.verticalScale = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--terrain-error")  && i + 1 < argc) { terrain.maxError = std::max(0.01f, (float)atof(argv[++i])); }
+		else if (!strcmp(argv[i], "--terrain-patch")  && i + 1 < argc) { terrain.patchCells = glm::clamp(atoi(argv[++i]), 1, 64); }
+		else if (!strcmp(argv[i], "--terrain-full"))                    { terrain.fullRes = true; }
+		else if (!strcmp(argv[i], "--watch")        && i + 1 < argc) { hotReload.dir = argv[++i]; }
+		else if (!strcmp(argv[i], "--shading-lod"))                    { shadingLod.enabled = true; }
+		else if (!strcmp(argv[i], "--shading-lod-phong") && i + 1 < argc) { shadingLod.phongPixels = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--shading-lod-flat")  && i + 1 < argc) { shadingLod.flatPixels = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--shading-lod-bench") && i + 1 < argc) { l_shadingLodBench = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--shading-lod-error") && i + 1 < argc) { l_shadingLodError = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--impostors"))                      { drawImpostors = true; }
+		else if (!strcmp(argv[i], "--impostor-pixels") && i + 1 < argc) { impostors.maxPixels = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--impostor-size")   && i + 1 < argc) { impostors.tileSize = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--impostor-bench")  && i + 1 < argc) { l_impostorBench = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--shadows"))                        { shadows.enabled = true; }
+		else if (!strcmp(argv[i], "--shadow-size")     && i + 1 < argc) { shadows.size = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--shadow-cube-size") && i + 1 < argc) { shadows.cubeSize = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--shadow-cascades") && i + 1 < argc) { shadows.numCascades = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--shadow-budget")   && i + 1 < argc) { shadows.budgetMs = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--shadow-move")     && i + 1 < argc) { shadows.lightMove = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--shadow-turn")     && i + 1 < argc) { shadows.lightTurn = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--shadow-no-cache"))                { shadows.cache = false; }
+		else if (!strcmp(argv[i], "--shadow-bench")    && i + 1 < argc) { l_shadowBench = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--spatial-bench")  && i + 1 < argc) { l_spatialBench = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--spatial-threads") && i + 1 < argc) { l_spatialThreads = std::max(1, atoi(argv[++i])); }
+		else if (!strcmp(argv[i], "--occlusion"))                       { occlusionCull = true; }
+		else if (!strcmp(argv[i], "--occlusion-interval") && i + 1 < argc) { occlusion.visibleInterval = std::max(1, atoi(argv[++i])); }
+		else if (!strcmp(argv[i], "--city")           && i + 1 < argc) { city.buildings = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--city-footprint") && i + 1 < argc) { city.footprint = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--city-lights")    && i + 1 < argc) { city.lights    = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--city-seed")      && i + 1 < argc) { city.seed      = (unsigned int)atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--bench")          && i + 1 < argc) { bench.frames = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--bench-warmup")   && i + 1 < argc) { bench.warmup = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--bench-out")      && i + 1 < argc) { bench.outPath = argv[++i]; }
+		else if (!strcmp(argv[i], "--bench-paths")    && i + 1 < argc) { bench.paths = argv[++i]; }
+		else if (!strcmp(argv[i], "--bench-baseline") && i + 1 < argc) { bench.baselinePath = argv[++i]; }
+		else if (!strcmp(argv[i], "--bench-tolerance") && i + 1 < argc) { bench.tolerance = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--bench-budget-ms") && i + 1 < argc) { bench.budgetMs = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--mesh-kernels")   && i + 1 < argc) { l_meshKernels = argv[++i]; }
+		else if (!strcmp(argv[i], "--kernel-bench")   && i + 1 < argc) { l_kernelBench = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--line-width")     && i + 1 < argc) { polylines.outlineWidth = (float)atof(argv[++i]); }
+		else if (!strcmp(argv[i], "--line-join")      && i + 1 < argc) { polylines.outlineJoin = strcmp(argv[++i], "bevel") ? joinMiter : joinBevel; }
+		else if (!strcmp(argv[i], "--legacy-lines"))                    { polylines.enabled = false; }
+		else if (!strcmp(argv[i], "--polyline-bench") && i + 1 < argc) { l_polylineBench = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--capture-dir")    && i + 1 < argc) { capture.dir = argv[++i]; }
+		else if (!strcmp(argv[i], "--capture-y4m")    && i + 1 < argc) { capture.y4mPath = argv[++i]; }
+		else if (!strcmp(argv[i], "--capture-fps")    && i + 1 < argc) { capture.fps = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--capture-ring")   && i + 1 < argc) { capture.ringSize = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--capture-bench")  && i + 1 < argc) { l_captureBench = atoi(argv[++i]); l_hidden = true; }
+		else if (!strcmp(argv[i], "--capture-size")   && i + 2 < argc) { l_captureWidth = atoi(argv[++i]); l_captureHeight = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--split-view")     && i + 1 < argc) { multiView.enabled = true; multiView.numViews = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--split-view-gs"))                   { multiView.forceGeometry = true; }
+		else if (!strcmp(argv[i], "--split-view-bench") && i + 1 < argc) { l_splitViewBench = atoi(argv[++i]); l_hidden = true; }
+#ifdef GL_TRACE
+		else if (!strcmp(argv[i], "--gl-trace")       && i + 1 < argc) { glTraceConfig.enabled = true; glTraceConfig.every = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "--gl-trace-file")  && i + 1 < argc) { glTraceConfig.enabled = true; glTraceConfig.path = argv[++i]; }
+#endif
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	dynRes.maxScale = glm::clamp(dynRes.maxScale, 0.1f, 1.0f);
+	dynRes.minScale = glm::clamp(dynRes.minScale, 0.1f, dynRes.maxScale);
+	dynRes.step     = glm::clamp(dynRes.step, 0.01f, 1.0f);
+	// Before any window or thread exists, so a bad recording just exits.
+	if (inputLog.mode == inputReplay && !loadInputLog()) return 1;
+
+	if (!initMeshKernels(l_meshKernels)) return 1;
+	printf("Mesh kernels: %s\n", meshKernels->name);
+	if (l_kernelBench > 0)
+	{
+		benchKernels(l_kernelBench);
+		return 0;
+	}
+	if (l_spatialBench > 0) return benchSpatial(l_spatialBench, l_spatialThreads);
+
 	if (!glfwInit())
 	{
 		fprintf(stderr, "ERROR: could not start GLFW3\n");
 		return 1;
 	}
 
-	GLFWwindow* window = glfwCreateWindow(1024, 1024, "COSC 4328 HW 3", NULL, NULL);
+	if (l_hidden) glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+#ifdef GL_TRACE
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+#endif
+	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "COSC 4328 HW 3", NULL, NULL);
 	if (!window)
 	{
 		fprintf(stderr, "ERROR: could not open window with GLFW3\n");
@@ -1108,6 +8249,7 @@ int main()
 	glewExperimental = GL_TRUE;
 
 	glewInit();
+	gltInit();
 
 	const GLubyte* renderer = glGetString(GL_RENDERER);
 	const GLubyte* version = glGetString(GL_VERSION);
@@ -1118,17 +8260,124 @@ int main()
 	glDepthFunc(GL_LESS);
 
 	initialize();
+	if (city.buildings > 0) generateCity();
+	arenaRelease(importArena);
+	initSoftware();
+
+	if (l_batchFile)
+	{
+		int l_result = batchMain(window, l_batchFile, l_batchThreads, l_batchScaling);
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (bench.frames > 0)
+	{
+		glfwSwapInterval(0);
+		int l_result = benchMain();
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (l_polylineBench > 0)
+	{
+		glfwSwapInterval(0);
+		benchPolylines(l_polylineBench, 20);
+		shutdownSoftware();
+		glfwTerminate();
+		return 0;
+	}
+
+	if (l_shadingLodBench > 0)
+	{
+		glfwSwapInterval(0);
+		int l_result = benchShadingLod(l_shadingLodBench, l_shadingLodError);
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (l_shadowBench > 0)
+	{
+		glfwSwapInterval(0);
+		int l_result = benchShadows(l_shadowBench);
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (l_impostorBench > 0)
+	{
+		glfwSwapInterval(0);
+		int l_result = benchImpostors(l_impostorBench);
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (l_splitViewBench > 0)
+	{
+		glfwSwapInterval(0);
+		int l_result = benchSplitView(l_splitViewBench);
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (l_captureBench > 0)
+	{
+		glfwSwapInterval(0);
+		int l_result = captureBench(l_captureBench, l_captureWidth, l_captureHeight);
+		shutdownSoftware();
+		glfwTerminate();
+		return l_result;
+	}
+
+	if (l_swBenchFrames > 0)
+	{
+		benchSoftware(l_swBenchFrames, l_swBenchImages);
+		shutdownSoftware();
+		glfwTerminate();
+		return 0;
+	}
+
+	if (inputLog.mode == inputReplay && inputLog.fast) glfwSwapInterval(0);
+
+	captureBegin(windowWidth, windowHeight);
+	simStart();
+	hotReloadStart(window);
+
 	glfwSetKeyCallback(window, keyboardCB);
-	//glfwSetMouseButtonCallback(window, mouseCB);
+	glfwSetMouseButtonCallback(window, mouseCB);
 
 	while (!glfwWindowShouldClose(window))
 	{
 		//glfwSetKeyCallback(window, key_callback);
-		renderWorld();
+		inputLogBeginFrame(window);
+		if (glfwWindowShouldClose(window)) break;
+		hotReloadBeginFrame();
+		if (sim.enabled) renderSnapshot();
+		else renderWorld();
+		captureFrame();
+		gltEndFrame(sceneStats.propsDrawn);
+		inputLogEndFrame();
 		glfwSwapBuffers(window);
+		simEndFrame();
+		hotReloadEndFrame();
 		glfwPollEvents();
+		simPublishInput();
 	}
-
+	simFinish();
+	hotReloadFinish();
+	terrainReport();
+	shadowReport();
+	captureEnd();
+	gltFinish();
+	inputLogFinish();
+
+	shutdownSoftware();
 	glfwTerminate();
 	return 0;
 }
\ No newline at end of file